@@ -0,0 +1,418 @@
+//stonedb_microbench: isolated, repeated microbenchmarks of engine hot paths,
+//with a saved baseline to compare later runs against
+#include"common.hpp"
+#include"storage.hpp"
+#include"pageformat.hpp"
+#include"wal.hpp"
+#include"lockmgr.hpp"
+#include<algorithm>
+#include<chrono>
+#include<cmath>
+#include<cstdio>
+#include<cstdlib>
+#include<cstring>
+#include<fstream>
+#include<functional>
+#include<iomanip>
+#include<iostream>
+#include<map>
+#include<memory>
+#include<sstream>
+#include<string>
+#include<vector>
+
+//keeps the compiler from discarding a result it can see is unused
+template<typename T>
+static inline void doNotOptimize(const T& value)
+{
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+//Benchmark: setup runs before every repetition, outside the timing; run
+//performs iterations operations
+struct Benchmark
+{
+    std::string name;
+    std::string description;
+    std::function<void()> setup;
+    std::function<void(uint64_t iterations)> run;
+};
+
+//Result: nanoseconds per operation over the repetitions
+struct Result
+{
+    std::string name;
+    uint64_t iterations=0;
+    double median=0;
+    double min=0;
+    double mean=0;
+    double stddev=0;
+};
+
+struct MicroOptions
+{
+    size_t repetitions=15;
+    double minMillis=20;
+    std::string filter;
+    std::string savePath;
+    std::string comparePath;
+    double threshold=10.0;
+    bool list=false;
+};
+
+static double timeBatch(const Benchmark& bench, uint64_t iterations)
+{
+    if(bench.setup) bench.setup();
+    auto start=std::chrono::steady_clock::now();
+    bench.run(iterations);
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+//grows the batch until one takes minMillis, then times repetitions batches
+static Result measure(const Benchmark& bench, const MicroOptions& opts)
+{
+    uint64_t iterations=1;
+    while(true)
+    {
+        double nanos=timeBatch(bench, iterations);
+        if(nanos >= opts.minMillis * 1e6) break;
+        double scale=nanos > 0 ? opts.minMillis * 1e6 / nanos * 1.2 : 10.0;
+        iterations=static_cast<uint64_t>(iterations * std::min(10.0, std::max(2.0, scale)));
+    }
+    std::vector<double> perOp;
+    for(size_t r=0; r<opts.repetitions; r++) perOp.push_back(timeBatch(bench, iterations) / iterations);
+    std::sort(perOp.begin(), perOp.end());
+    Result result;
+    result.name=bench.name;
+    result.iterations=iterations;
+    result.min=perOp.front();
+    size_t n=perOp.size();
+    result.median=n % 2 ? perOp[n / 2] : (perOp[n / 2 - 1] + perOp[n / 2]) / 2;
+    for(double v : perOp) result.mean += v;
+    result.mean /= n;
+    for(double v : perOp) result.stddev += (v - result.mean) * (v - result.mean);
+    result.stddev=n > 1 ? std::sqrt(result.stddev / (n - 1)) : 0;
+    return result;
+}
+
+static std::string tenantKey(int i)
+{
+    return "tenant:12345:user:" + std::to_string(100000 + i);
+}
+
+//MicroSuite: owns the fixtures the benchmarks run against
+class MicroSuite
+{
+private:
+    static constexpr const char* DB_PATH="microbench.sdb";
+    static constexpr const char* WAL_PATH="microbench.wal";
+    static constexpr size_t LOCK_KEYS=1024;
+    static constexpr size_t MISS_FRAMES=64;
+
+    uint8_t recordsPage[stonedb::PAGE_SIZE];
+    uint8_t slottedPage[stonedb::PAGE_SIZE];
+    std::vector<std::string> pageKeys;
+    std::vector<uint64_t> pageHashes;
+    std::vector<std::string> missKeys;
+    std::vector<uint64_t> missHashes;
+    std::vector<std::string> lockKeys;
+    std::unique_ptr<stonedb::WALManager> wal;
+    std::unique_ptr<stonedb::LockManager> lockMgr;
+    std::unique_ptr<stonedb::StorageManager> storage;
+    std::vector<stonedb::PageId> diskPages;
+    std::vector<Benchmark> benchmarks;
+
+    static void removeFiles()
+    {
+        for(std::string suffix : {"", ".bloom", ".pagemap"}) std::remove((std::string(DB_PATH) + suffix).c_str());
+        std::remove(WAL_PATH);
+    }
+
+    //fills both page formats with the same tenant keys until one is full
+    void buildPages()
+    {
+        memset(recordsPage, 0, sizeof(recordsPage));
+        memset(slottedPage, 0, sizeof(slottedPage));
+        for(int i=0; ; i++)
+        {
+            std::string key=tenantKey(i);
+            uint64_t hash=stonedb::hashKey(key);
+            bool modified;
+            if(!stonedb::putInPage(stonedb::PageFormat::RECORDS, recordsPage, key, "value-0123456789", hash, modified) ||
+               !stonedb::putInPage(stonedb::PageFormat::SLOTTED, slottedPage, key, "value-0123456789", hash, modified))
+            {
+                break;
+            }
+            pageKeys.push_back(key);
+            pageHashes.push_back(hash);
+        }
+        for(int i=0; i<256; i++)
+        {
+            missKeys.push_back(tenantKey(900000 + i));
+            missHashes.push_back(stonedb::hashKey(missKeys.back()));
+        }
+    }
+
+    //a data file several times larger than MISS_FRAMES pages, flushed so every
+    //eviction is clean
+    bool buildStorage()
+    {
+        stonedb::StorageOptions opts;
+        opts.cacheFrames=MISS_FRAMES;
+        storage.reset(new stonedb::StorageManager());
+        if(!storage->open(DB_PATH, opts)) return false;
+        std::string value(1000, 'x');
+        for(int i=0; i<4000; i++)
+        {
+            if(!storage->putRecord(tenantKey(i), value)) return false;
+        }
+        if(!storage->flushAll()) return false;
+        for(stonedb::PageId id=1; id<=MISS_FRAMES * 8; id++) diskPages.push_back(id);
+        return true;
+    }
+
+    void pageFind(stonedb::PageFormat format, const uint8_t* page, const std::vector<std::string>& keys,
+                  const std::vector<uint64_t>& hashes, uint64_t iterations)
+    {
+        std::string_view value;
+        size_t n=keys.size();
+        for(uint64_t i=0; i<iterations; i++)
+        {
+            bool found=stonedb::findInPage(format, page, keys[i % n], hashes[i % n], value);
+            doNotOptimize(found);
+        }
+    }
+
+public:
+    bool init()
+    {
+        removeFiles();
+        buildPages();
+        for(size_t i=0; i<LOCK_KEYS; i++) lockKeys.push_back("lock:key:" + std::to_string(i));
+        wal.reset(new stonedb::WALManager());
+        lockMgr.reset(new stonedb::LockManager());
+        if(!wal->open(WAL_PATH) || !buildStorage())
+        {
+            stonedb::logError("failed to set up microbenchmark fixtures");
+            return false;
+        }
+
+        benchmarks.push_back({"page_find_records_hit", "findInPage, records format, key present", nullptr,
+            [this](uint64_t n) { pageFind(stonedb::PageFormat::RECORDS, recordsPage, pageKeys, pageHashes, n); }});
+        benchmarks.push_back({"page_find_records_miss", "findInPage, records format, key absent", nullptr,
+            [this](uint64_t n) { pageFind(stonedb::PageFormat::RECORDS, recordsPage, missKeys, missHashes, n); }});
+        benchmarks.push_back({"page_find_slotted_hit", "findInPage, slotted format, key present", nullptr,
+            [this](uint64_t n) { pageFind(stonedb::PageFormat::SLOTTED, slottedPage, pageKeys, pageHashes, n); }});
+        benchmarks.push_back({"page_find_slotted_miss", "findInPage, slotted format, key absent", nullptr,
+            [this](uint64_t n) { pageFind(stonedb::PageFormat::SLOTTED, slottedPage, missKeys, missHashes, n); }});
+        benchmarks.push_back({"wal_append_put", "logPutRecord, 30-byte key and 100-byte value",
+            [this]() { wal->truncateLog(); },
+            [this](uint64_t n)
+            {
+                std::string key="tenant:12345:user:000000000000";
+                std::string value(100, 'v');
+                for(uint64_t i=0; i<n; i++) wal->logPutRecord(1, key, value);
+            }});
+        benchmarks.push_back({"lock_uncontended", "acquireLock + releaseLock, exclusive, no other holder", nullptr,
+            [this](uint64_t n)
+            {
+                for(uint64_t i=0; i<n; i++)
+                {
+                    const std::string& key=lockKeys[i % LOCK_KEYS];
+                    lockMgr->acquireLock(1, key, stonedb::LockType::EXCLUSIVE);
+                    lockMgr->releaseLock(1, key);
+                }
+            }});
+        benchmarks.push_back({"getpage_hit", "loadPage of a resident page", [this]() { storage->loadPage(1); },
+            [this](uint64_t n)
+            {
+                for(uint64_t i=0; i<n; i++) doNotOptimize(storage->loadPage(1));
+            }});
+        benchmarks.push_back({"getpage_miss", "loadPage cycling over 8x the buffer pool, clean evictions", nullptr,
+            [this](uint64_t n)
+            {
+                size_t count=diskPages.size();
+                for(uint64_t i=0; i<n; i++) doNotOptimize(storage->loadPage(diskPages[i % count]));
+            }});
+        return true;
+    }
+
+    void shutdown()
+    {
+        if(storage) storage->close();
+        if(wal) wal->close();
+        removeFiles();
+    }
+
+    const std::vector<Benchmark>& all() const { return benchmarks; }
+};
+
+//baseline file: one "name median_ns" line per benchmark, '#' starts a comment
+static bool saveBaseline(const std::string& path, const std::vector<Result>& results)
+{
+    std::ofstream out(path, std::ios::trunc);
+    if(!out.is_open())
+    {
+        stonedb::logError("failed to write baseline: " + path);
+        return false;
+    }
+    out << "# stonedb_microbench baseline: name median_ns_per_op" << std::endl;
+    out << std::fixed << std::setprecision(3);
+    for(const auto& result : results) out << result.name << " " << result.median << std::endl;
+    return static_cast<bool>(out);
+}
+
+static bool loadBaseline(const std::string& path, std::map<std::string, double>& baseline)
+{
+    std::ifstream in(path);
+    if(!in.is_open())
+    {
+        stonedb::logError("failed to read baseline: " + path);
+        return false;
+    }
+    std::string line;
+    while(std::getline(in, line))
+    {
+        if(line.empty() || line[0] == '#') continue;
+        std::istringstream fields(line);
+        std::string name;
+        double nanos;
+        if(fields >> name >> nanos) baseline[name]=nanos;
+    }
+    return true;
+}
+
+//true when no benchmark got slower than the threshold allows
+static bool compare(const std::map<std::string, double>& baseline, const std::vector<Result>& results, double threshold)
+{
+    bool ok=true;
+    std::cout << std::endl << "compared with baseline (threshold " << threshold << "%):" << std::endl;
+    std::cout << std::left << std::setw(26) << "benchmark" << std::right << std::setw(14) << "baseline ns"
+              << std::setw(14) << "current ns" << std::setw(10) << "change" << "  status" << std::endl;
+    for(const auto& result : results)
+    {
+        auto it=baseline.find(result.name);
+        std::cout << std::left << std::setw(26) << result.name << std::right << std::fixed << std::setprecision(2);
+        if(it == baseline.end())
+        {
+            std::cout << std::setw(14) << "-" << std::setw(14) << result.median << std::setw(10) << "-" << "  new" << std::endl;
+            continue;
+        }
+        double change=(result.median - it->second) / it->second * 100.0;
+        const char* status="ok";
+        if(change > threshold)
+        {
+            status="REGRESSION";
+            ok=false;
+        }
+        else if(change < -threshold) status="faster";
+        std::cout << std::setw(14) << it->second << std::setw(14) << result.median << std::setw(9)
+                  << std::showpos << change << std::noshowpos << "%  " << status << std::endl;
+    }
+    return ok;
+}
+
+static void printUsage()
+{
+    std::cout << "Usage: stonedb_microbench [OPTIONS]" << std::endl;
+    std::cout << "  --filter TEXT       run only benchmarks whose name contains TEXT" << std::endl;
+    std::cout << "  --list              list the benchmarks and exit" << std::endl;
+    std::cout << "  --repetitions N     timed repetitions per benchmark (default: 15)" << std::endl;
+    std::cout << "  --min-time MS       shortest repetition in milliseconds (default: 20)" << std::endl;
+    std::cout << "  --save PATH         write the medians to a baseline file" << std::endl;
+    std::cout << "  --compare PATH      compare with a baseline file; exit 2 on a regression" << std::endl;
+    std::cout << "  --threshold PCT     slowdown in percent counted as a regression (default: 10)" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+    MicroOptions opts;
+    for(int i=1; i<argc; i++)
+    {
+        std::string arg=argv[i];
+        std::string next=(i+1 < argc) ? argv[i+1] : "";
+        if(arg == "--help" || arg == "-h")
+        {
+            printUsage();
+            return 0;
+        }
+        else if(arg == "--list")
+        {
+            opts.list=true;
+        }
+        else if(arg == "--filter" || arg == "--save" || arg == "--compare")
+        {
+            if(next.empty())
+            {
+                std::cerr << "Error: " << arg << " requires an argument" << std::endl;
+                return 1;
+            }
+            (arg == "--filter" ? opts.filter : arg == "--save" ? opts.savePath : opts.comparePath)=next;
+            i++;
+        }
+        else if(arg == "--repetitions" || arg == "--min-time" || arg == "--threshold")
+        {
+            char* end=nullptr;
+            double v=std::strtod(next.c_str(), &end);
+            if(next.empty() || *end != '\0' || v <= 0)
+            {
+                std::cerr << "Error: " << arg << " requires a positive number" << std::endl;
+                return 1;
+            }
+            if(arg == "--repetitions") opts.repetitions=static_cast<size_t>(v);
+            else if(arg == "--min-time") opts.minMillis=v;
+            else opts.threshold=v;
+            i++;
+        }
+        else
+        {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            std::cerr << "Use --help for usage information" << std::endl;
+            return 1;
+        }
+    }
+    opts.repetitions=std::max<size_t>(opts.repetitions, 1);
+
+    stonedb::setLogLevel(stonedb::LogLevel::ERROR);
+    MicroSuite suite;
+    if(!suite.init())
+    {
+        suite.shutdown();
+        return 1;
+    }
+    if(opts.list)
+    {
+        for(const auto& bench : suite.all()) std::cout << std::left << std::setw(26) << bench.name << bench.description << std::endl;
+        suite.shutdown();
+        return 0;
+    }
+
+    std::vector<Result> results;
+    std::cout << std::left << std::setw(26) << "benchmark" << std::right << std::setw(12) << "median ns"
+              << std::setw(12) << "min ns" << std::setw(12) << "mean ns" << std::setw(10) << "stddev"
+              << std::setw(12) << "iterations" << std::endl;
+    for(const auto& bench : suite.all())
+    {
+        if(!opts.filter.empty() && bench.name.find(opts.filter) == std::string::npos) continue;
+        Result result=measure(bench, opts);
+        results.push_back(result);
+        std::cout << std::left << std::setw(26) << result.name << std::right << std::fixed << std::setprecision(2)
+                  << std::setw(12) << result.median << std::setw(12) << result.min << std::setw(12) << result.mean
+                  << std::setw(9) << (result.mean > 0 ? result.stddev / result.mean * 100.0 : 0) << "%"
+                  << std::setw(12) << result.iterations << std::endl;
+    }
+    suite.shutdown();
+
+    if(!opts.savePath.empty())
+    {
+        if(!saveBaseline(opts.savePath, results)) return 1;
+        std::cout << "baseline saved to " << opts.savePath << std::endl;
+    }
+    if(!opts.comparePath.empty())
+    {
+        std::map<std::string, double> baseline;
+        if(!loadBaseline(opts.comparePath, baseline)) return 1;
+        if(!compare(baseline, results, opts.threshold)) return 2;
+    }
+    return 0;
+}
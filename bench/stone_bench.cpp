@@ -0,0 +1,594 @@
+//stone_bench: YCSB-style workload driver. loads records, warms up, then runs
+//one of the core workloads A-F from several threads straight through
+//TransactionManager and reports throughput and latency percentiles
+#include"common.hpp"
+#include"engine.hpp"
+#include"wal.hpp"
+#include"lockmgr.hpp"
+#include"transaction.hpp"
+#include"statistics.hpp"
+#include<atomic>
+#include<chrono>
+#include<cmath>
+#include<cstdio>
+#include<cstdlib>
+#include<filesystem>
+#include<iomanip>
+#include<iostream>
+#include<memory>
+#include<random>
+#include<sstream>
+#include<string>
+#include<thread>
+#include<vector>
+
+using stonedb::LatencyHistogram;
+using stonedb::HistogramSnapshot;
+
+enum class Distribution
+{
+    UNIFORM,
+    ZIPFIAN,
+    LATEST
+};
+
+enum class OpType
+{
+    READ,
+    UPDATE,
+    INSERT,
+    SCAN,
+    READ_MODIFY_WRITE,
+    COUNT
+};
+static constexpr size_t OP_TYPES=static_cast<size_t>(OpType::COUNT);
+static const char* opNames[OP_TYPES]={"read", "update", "insert", "scan", "rmw"};
+
+//Workload: the operation mix of one YCSB core workload, in percent
+struct Workload
+{
+    char name;
+    int mix[OP_TYPES];
+    Distribution distribution;
+};
+
+static const Workload workloads[]={
+    {'A', {50, 50, 0, 0, 0}, Distribution::ZIPFIAN},    //update heavy
+    {'B', {95, 5, 0, 0, 0}, Distribution::ZIPFIAN},     //read mostly
+    {'C', {100, 0, 0, 0, 0}, Distribution::ZIPFIAN},    //read only
+    {'D', {95, 0, 5, 0, 0}, Distribution::LATEST},      //read latest
+    {'E', {0, 0, 5, 95, 0}, Distribution::ZIPFIAN},     //short ranges
+    {'F', {50, 0, 0, 0, 50}, Distribution::ZIPFIAN},    //read-modify-write
+};
+
+struct BenchOptions
+{
+    char workload='A';
+    bool distributionSet=false;
+    Distribution distribution=Distribution::ZIPFIAN;
+    size_t threads=1;
+    uint64_t records=10000;
+    uint64_t operations=10000;
+    uint64_t warmup=1000;
+    size_t valueSize=100;
+    size_t maxScanLength=100;
+    uint64_t seed=42;
+    stonedb::EngineType engine=stonedb::EngineType::PAGE;
+    std::string dbPath="stone_bench.sdb";
+    std::string format="text";
+    bool keep=false;
+};
+
+//ZipfianGenerator: Gray et al.'s "Quickly generating billion-record synthetic
+//databases" as used by YCSB; item 0 is the most popular. read-only after
+//construction so threads share one
+class ZipfianGenerator
+{
+private:
+    uint64_t items;
+    double theta;
+    double zetan;
+    double alpha;
+    double eta;
+public:
+    static constexpr double ZIPFIAN_CONSTANT=0.99;
+
+    explicit ZipfianGenerator(uint64_t items, double theta=ZIPFIAN_CONSTANT) : items(items), theta(theta), zetan(0)
+    {
+        for(uint64_t i=1; i<=items; i++) zetan += 1.0 / std::pow(static_cast<double>(i), theta);
+        double zeta2=1.0 + 1.0 / std::pow(2.0, theta);
+        alpha=1.0 / (1.0 - theta);
+        eta=(1.0 - std::pow(2.0 / items, 1.0 - theta)) / (1.0 - zeta2 / zetan);
+    }
+    uint64_t itemCount() const { return items; }
+    //u uniform in [0, 1)
+    uint64_t next(double u) const
+    {
+        double uz=u * zetan;
+        if(uz < 1.0) return 0;
+        if(uz < 1.0 + std::pow(0.5, theta)) return 1;
+        uint64_t v=static_cast<uint64_t>(items * std::pow(eta * u - eta + 1.0, alpha));
+        return std::min(v, items - 1);
+    }
+};
+
+static uint64_t fnv64(uint64_t v)
+{
+    uint64_t hash=0xcbf29ce484222325ULL;
+    for(int i=0; i<8; i++)
+    {
+        hash ^= v & 0xff;
+        hash *= 0x100000001b3ULL;
+        v >>= 8;
+    }
+    return hash;
+}
+
+//KeyChooser: picks an existing key index. zipfian is scrambled so the hot
+//keys are spread over the key space; latest favours the newest inserts
+class KeyChooser
+{
+private:
+    Distribution distribution;
+    const ZipfianGenerator& zipf;
+    const std::atomic<uint64_t>& inserted;
+public:
+    KeyChooser(Distribution distribution, const ZipfianGenerator& zipf, const std::atomic<uint64_t>& inserted)
+        : distribution(distribution), zipf(zipf), inserted(inserted) {}
+
+    uint64_t next(std::mt19937_64& rng) const
+    {
+        uint64_t count=inserted.load(std::memory_order_acquire);
+        std::uniform_real_distribution<double> unit(0.0, 1.0);
+        while(true)
+        {
+            if(distribution == Distribution::UNIFORM) return rng() % count;
+            uint64_t z=zipf.next(unit(rng));
+            if(distribution == Distribution::LATEST)
+            {
+                if(z < count) return count - 1 - z;
+                continue;
+            }
+            uint64_t k=fnv64(z) % zipf.itemCount();
+            if(k < count) return k;
+        }
+    }
+};
+
+static std::string makeKey(uint64_t index)
+{
+    char key[32];
+    snprintf(key, sizeof(key), "user%012llu", static_cast<unsigned long long>(index));
+    return key;
+}
+
+//ThreadResult: per-thread histograms, merged after the run
+struct ThreadResult
+{
+    std::unique_ptr<LatencyHistogram[]> histograms;
+    uint64_t failed=0;
+    ThreadResult() : histograms(new LatencyHistogram[OP_TYPES]) {}
+};
+
+class Bench
+{
+private:
+    BenchOptions opts;
+    Workload workload;
+    std::shared_ptr<stonedb::StorageEngine> storage;
+    std::shared_ptr<stonedb::WALManager> wal;
+    std::shared_ptr<stonedb::LockManager> lockMgr;
+    std::unique_ptr<stonedb::TransactionManager> txnMgr;
+    std::unique_ptr<ZipfianGenerator> zipf;
+    //keys [0, inserted) exist; inserts reserve indexes from nextInsert
+    std::atomic<uint64_t> inserted{0};
+    std::atomic<uint64_t> nextInsert{0};
+
+    std::string walPath() const { return opts.dbPath + ".wal"; }
+
+    void removeFiles() const
+    {
+        std::error_code ec;
+        std::filesystem::remove_all(opts.dbPath, ec);
+        for(const char* suffix : {".bloom", ".pagemap", ".wal"}) std::filesystem::remove(opts.dbPath + suffix, ec);
+    }
+
+    //one operation in its own transaction; false if it had to be aborted
+    bool runOne(OpType op, std::mt19937_64& rng, const KeyChooser& chooser, std::string& value)
+    {
+        auto txnId=txnMgr->beginTransaction();
+        if(txnId == stonedb::INVALID_TXN_ID) return false;
+        bool ok=true;
+        std::string read;
+        switch(op)
+        {
+            case OpType::READ:
+                txnMgr->getRecord(txnId, makeKey(chooser.next(rng)), read);
+                break;
+            case OpType::UPDATE:
+                value[rng() % value.size()]='a' + rng() % 26;
+                ok=txnMgr->putRecord(txnId, makeKey(chooser.next(rng)), value);
+                break;
+            case OpType::INSERT:
+            {
+                uint64_t index=nextInsert.fetch_add(1);
+                ok=txnMgr->putRecord(txnId, makeKey(index), value);
+                if(ok) inserted.fetch_add(1, std::memory_order_release);
+                break;
+            }
+            case OpType::SCAN:
+            {
+                //no range API on the engines: a scan reads consecutive keys
+                uint64_t start=chooser.next(rng);
+                uint64_t length=1 + rng() % opts.maxScanLength;
+                uint64_t end=std::min(start + length, inserted.load(std::memory_order_acquire));
+                for(uint64_t k=start; k<end; k++) txnMgr->getRecord(txnId, makeKey(k), read);
+                break;
+            }
+            case OpType::READ_MODIFY_WRITE:
+            {
+                std::string key=makeKey(chooser.next(rng));
+                txnMgr->getRecord(txnId, key, read);
+                value[rng() % value.size()]='a' + rng() % 26;
+                ok=txnMgr->putRecord(txnId, key, value);
+                break;
+            }
+            default:
+                break;
+        }
+        if(!ok)
+        {
+            txnMgr->abortTransaction(txnId);
+            return false;
+        }
+        return txnMgr->commitTransaction(txnId);
+    }
+
+    OpType pickOp(std::mt19937_64& rng) const
+    {
+        int roll=static_cast<int>(rng() % 100);
+        for(size_t i=0; i<OP_TYPES; i++)
+        {
+            roll -= workload.mix[i];
+            if(roll < 0) return static_cast<OpType>(i);
+        }
+        return OpType::READ;
+    }
+
+    //runs total operations over the threads; returns elapsed seconds
+    double runPhase(uint64_t total, bool load, std::vector<ThreadResult>& results)
+    {
+        results.clear();
+        results.resize(opts.threads);
+        KeyChooser chooser(opts.distribution, *zipf, inserted);
+        auto start=std::chrono::steady_clock::now();
+        std::vector<std::thread> threads;
+        for(size_t t=0; t<opts.threads; t++)
+        {
+            threads.emplace_back([this, t, total, load, &chooser, &results]()
+            {
+                std::mt19937_64 rng(opts.seed * 1000003 + t + (load ? 0 : 7919));
+                std::string value(opts.valueSize, 'v');
+                for(auto& c : value) c='a' + rng() % 26;
+                uint64_t count=total / opts.threads + (t < total % opts.threads ? 1 : 0);
+                ThreadResult& result=results[t];
+                for(uint64_t i=0; i<count; i++)
+                {
+                    OpType op=load ? OpType::INSERT : pickOp(rng);
+                    auto begin=std::chrono::steady_clock::now();
+                    bool ok=runOne(op, rng, chooser, value);
+                    auto elapsed=std::chrono::steady_clock::now() - begin;
+                    result.histograms[static_cast<size_t>(op)].record(
+                        std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+                    if(!ok) result.failed++;
+                }
+            });
+        }
+        for(auto& thread : threads) thread.join();
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    struct PhaseReport
+    {
+        std::string phase;
+        double seconds=0;
+        uint64_t failed=0;
+        std::vector<HistogramSnapshot> ops;
+        HistogramSnapshot all;
+    };
+
+    PhaseReport summarize(const std::string& phase, double seconds, const std::vector<ThreadResult>& results) const
+    {
+        PhaseReport report;
+        report.phase=phase;
+        report.seconds=seconds;
+        report.ops.resize(OP_TYPES);
+        for(const auto& result : results)
+        {
+            report.failed += result.failed;
+            for(size_t i=0; i<OP_TYPES; i++)
+            {
+                report.ops[i].merge(result.histograms[i]);
+                report.all.merge(result.histograms[i]);
+            }
+        }
+        return report;
+    }
+
+    static const char* distributionName(Distribution distribution)
+    {
+        if(distribution == Distribution::UNIFORM) return "uniform";
+        if(distribution == Distribution::LATEST) return "latest";
+        return "zipfian";
+    }
+
+    void printText(const std::vector<PhaseReport>& reports) const
+    {
+        std::cout << "workload " << workload.name << ", " << distributionName(opts.distribution) << ", "
+                  << opts.threads << " thread(s), " << opts.records << " records, " << opts.valueSize
+                  << "-byte values" << std::endl;
+        for(const auto& report : reports)
+        {
+            std::cout << report.phase << ": " << report.all.count << " ops in " << std::fixed << std::setprecision(3)
+                      << report.seconds << " s, " << std::setprecision(0) << report.all.count / report.seconds
+                      << " ops/sec, " << report.failed << " aborted" << std::endl;
+            std::cout << "  op         count     mean ns      p50 ns      p99 ns     p999 ns      max ns" << std::endl;
+            for(size_t i=0; i<=OP_TYPES; i++)
+            {
+                const HistogramSnapshot& h=i < OP_TYPES ? report.ops[i] : report.all;
+                if(h.count == 0) continue;
+                std::cout << "  " << std::left << std::setw(8) << (i < OP_TYPES ? opNames[i] : "total") << std::right
+                          << std::setw(8) << h.count << std::setw(12) << h.mean() << std::setw(12) << h.percentile(50)
+                          << std::setw(12) << h.percentile(99) << std::setw(12) << h.percentile(99.9)
+                          << std::setw(12) << h.max << std::endl;
+            }
+        }
+    }
+
+    void printCsv(const std::vector<PhaseReport>& reports) const
+    {
+        std::cout << "workload,distribution,threads,records,value_size,phase,op,count,aborted,seconds,ops_per_sec,"
+                     "mean_ns,p50_ns,p99_ns,p999_ns,max_ns" << std::endl;
+        for(const auto& report : reports)
+        {
+            for(size_t i=0; i<=OP_TYPES; i++)
+            {
+                const HistogramSnapshot& h=i < OP_TYPES ? report.ops[i] : report.all;
+                if(h.count == 0 && i < OP_TYPES) continue;
+                std::cout << workload.name << "," << distributionName(opts.distribution) << "," << opts.threads << ","
+                          << opts.records << "," << opts.valueSize << "," << report.phase << ","
+                          << (i < OP_TYPES ? opNames[i] : "total") << "," << h.count << ","
+                          << (i < OP_TYPES ? 0 : report.failed) << "," << std::fixed << std::setprecision(3)
+                          << report.seconds << "," << std::setprecision(1) << h.count / report.seconds << ","
+                          << h.mean() << "," << h.percentile(50) << "," << h.percentile(99) << ","
+                          << h.percentile(99.9) << "," << h.max << std::endl;
+            }
+        }
+    }
+
+    void printJson(const std::vector<PhaseReport>& reports) const
+    {
+        std::ostringstream out;
+        out << std::fixed << std::setprecision(1);
+        out << "{\"workload\":\"" << workload.name << "\",\"distribution\":\"" << distributionName(opts.distribution)
+            << "\",\"threads\":" << opts.threads << ",\"records\":" << opts.records << ",\"value_size\":"
+            << opts.valueSize << ",\"phases\":[";
+        for(size_t r=0; r<reports.size(); r++)
+        {
+            const PhaseReport& report=reports[r];
+            if(r > 0) out << ",";
+            out << "{\"phase\":\"" << report.phase << "\",\"seconds\":" << std::setprecision(3) << report.seconds
+                << std::setprecision(1) << ",\"ops\":" << report.all.count << ",\"aborted\":" << report.failed
+                << ",\"ops_per_sec\":" << report.all.count / report.seconds << ",\"latency_ns\":{";
+            bool first=true;
+            for(size_t i=0; i<=OP_TYPES; i++)
+            {
+                const HistogramSnapshot& h=i < OP_TYPES ? report.ops[i] : report.all;
+                if(h.count == 0 && i < OP_TYPES) continue;
+                if(!first) out << ",";
+                first=false;
+                out << "\"" << (i < OP_TYPES ? opNames[i] : "total") << "\":{\"count\":" << h.count << ",\"mean\":"
+                    << h.mean() << ",\"p50\":" << h.percentile(50) << ",\"p99\":" << h.percentile(99)
+                    << ",\"p999\":" << h.percentile(99.9) << ",\"max\":" << h.max << "}";
+            }
+            out << "}}";
+        }
+        out << "]}";
+        std::cout << out.str() << std::endl;
+    }
+
+public:
+    explicit Bench(const BenchOptions& options) : opts(options)
+    {
+        for(const auto& w : workloads)
+        {
+            if(w.name == opts.workload) workload=w;
+        }
+        if(!opts.distributionSet) opts.distribution=workload.distribution;
+    }
+
+    bool run()
+    {
+        removeFiles();
+        storage=stonedb::createStorageEngine(opts.engine);
+        wal=std::make_shared<stonedb::WALManager>();
+        lockMgr=std::make_shared<stonedb::LockManager>();
+        if(!storage->open(opts.dbPath) || !wal->open(walPath()))
+        {
+            stonedb::logError("failed to open " + opts.dbPath);
+            return false;
+        }
+        txnMgr.reset(new stonedb::TransactionManager(storage, wal, lockMgr));
+
+        //inserts can at most double the key space beyond what was loaded
+        uint64_t insertBudget=(opts.warmup + opts.operations) * workload.mix[static_cast<size_t>(OpType::INSERT)] / 100;
+        zipf.reset(new ZipfianGenerator(opts.records + insertBudget + 1));
+
+        std::vector<ThreadResult> results;
+        std::vector<PhaseReport> reports;
+        double seconds=runPhase(opts.records, true, results);
+        reports.push_back(summarize("load", seconds, results));
+        if(opts.warmup > 0) runPhase(opts.warmup, false, results);
+        stonedb::Statistics::global().reset();
+        seconds=runPhase(opts.operations, false, results);
+        reports.push_back(summarize("run", seconds, results));
+
+        if(opts.format == "csv") printCsv(reports);
+        else if(opts.format == "json") printJson(reports);
+        else printText(reports);
+
+        txnMgr.reset();
+        storage->close();
+        wal->close();
+        if(!opts.keep) removeFiles();
+        return true;
+    }
+};
+
+static void printUsage()
+{
+    std::cout << "Usage: stone_bench [OPTIONS]" << std::endl;
+    std::cout << "  --workload W        YCSB core workload A-F (default: A)" << std::endl;
+    std::cout << "                      A 50/50 read/update, B 95/5 read/update, C read only," << std::endl;
+    std::cout << "                      D 95/5 read/insert of latest, E 95/5 scan/insert, F 50/50 read/read-modify-write" << std::endl;
+    std::cout << "  --distribution D    uniform, zipfian or latest (default: the workload's)" << std::endl;
+    std::cout << "  --threads N         client threads (default: 1)" << std::endl;
+    std::cout << "  --records N         records loaded before the run (default: 10000)" << std::endl;
+    std::cout << "  --operations N      measured operations, over all threads (default: 10000)" << std::endl;
+    std::cout << "  --warmup N          unmeasured operations before the run (default: 1000)" << std::endl;
+    std::cout << "  --value-size N      value bytes (default: 100)" << std::endl;
+    std::cout << "  --scan-length N     longest scan for workload E (default: 100)" << std::endl;
+    std::cout << "  --engine TYPE       page (default) or lsm" << std::endl;
+    std::cout << "  --db PATH           database path (default: stone_bench.sdb), removed afterwards" << std::endl;
+    std::cout << "  --keep              keep the database files" << std::endl;
+    std::cout << "  --format F          text (default), csv or json" << std::endl;
+    std::cout << "  --seed N            random seed (default: 42)" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+    BenchOptions opts;
+    for(int i=1; i<argc; i++)
+    {
+        std::string arg=argv[i];
+        std::string next=(i+1 < argc) ? argv[i+1] : "";
+        auto number=[&](uint64_t& out, bool positive)
+        {
+            char* end=nullptr;
+            unsigned long long v=std::strtoull(next.c_str(), &end, 10);
+            if(next.empty() || *end != '\0' || (positive && v == 0))
+            {
+                std::cerr << "Error: " << arg << " requires a" << (positive ? " positive" : "") << " number" << std::endl;
+                return false;
+            }
+            out=v;
+            i++;
+            return true;
+        };
+        uint64_t v=0;
+        if(arg == "--help" || arg == "-h")
+        {
+            printUsage();
+            return 0;
+        }
+        else if(arg == "--workload")
+        {
+            if(next.size() != 1 || toupper(next[0]) < 'A' || toupper(next[0]) > 'F')
+            {
+                std::cerr << "Error: --workload must be one of A-F" << std::endl;
+                return 1;
+            }
+            opts.workload=static_cast<char>(toupper(next[0]));
+            i++;
+        }
+        else if(arg == "--distribution")
+        {
+            if(next == "uniform") opts.distribution=Distribution::UNIFORM;
+            else if(next == "zipfian") opts.distribution=Distribution::ZIPFIAN;
+            else if(next == "latest") opts.distribution=Distribution::LATEST;
+            else
+            {
+                std::cerr << "Error: --distribution must be uniform, zipfian or latest" << std::endl;
+                return 1;
+            }
+            opts.distributionSet=true;
+            i++;
+        }
+        else if(arg == "--threads")
+        {
+            if(!number(v, true)) return 1;
+            opts.threads=v;
+        }
+        else if(arg == "--records")
+        {
+            if(!number(opts.records, true)) return 1;
+        }
+        else if(arg == "--operations")
+        {
+            if(!number(opts.operations, true)) return 1;
+        }
+        else if(arg == "--warmup")
+        {
+            if(!number(opts.warmup, false)) return 1;
+        }
+        else if(arg == "--value-size")
+        {
+            if(!number(v, true)) return 1;
+            opts.valueSize=std::min<uint64_t>(v, stonedb::MAX_VALUE_SIZE);
+        }
+        else if(arg == "--scan-length")
+        {
+            if(!number(v, true)) return 1;
+            opts.maxScanLength=v;
+        }
+        else if(arg == "--seed")
+        {
+            if(!number(opts.seed, false)) return 1;
+        }
+        else if(arg == "--engine")
+        {
+            if(next == "page") opts.engine=stonedb::EngineType::PAGE;
+            else if(next == "lsm") opts.engine=stonedb::EngineType::LSM;
+            else
+            {
+                std::cerr << "Error: --engine must be page or lsm" << std::endl;
+                return 1;
+            }
+            i++;
+        }
+        else if(arg == "--db")
+        {
+            if(next.empty())
+            {
+                std::cerr << "Error: --db requires a path argument" << std::endl;
+                return 1;
+            }
+            opts.dbPath=next;
+            i++;
+        }
+        else if(arg == "--keep")
+        {
+            opts.keep=true;
+        }
+        else if(arg == "--format")
+        {
+            if(next != "text" && next != "csv" && next != "json")
+            {
+                std::cerr << "Error: --format must be text, csv or json" << std::endl;
+                return 1;
+            }
+            opts.format=next;
+            i++;
+        }
+        else
+        {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            std::cerr << "Use --help for usage information" << std::endl;
+            return 1;
+        }
+    }
+    //keep stdout to the report
+    stonedb::setLogLevel(stonedb::LogLevel::ERROR);
+    Bench bench(opts);
+    return bench.run() ? 0 : 1;
+}
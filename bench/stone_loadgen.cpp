@@ -0,0 +1,261 @@
+//stone_loadgen: load generator for stone --serve. each connection runs on its
+//own thread and keeps a window of --pipeline requests in flight: it sends the
+//window in one write, then reads the window's responses. latency is measured
+//from the write to each response, so it includes queueing behind the window
+#include"common.hpp"
+#include"protocol.hpp"
+#include"statistics.hpp"
+#include<atomic>
+#include<chrono>
+#include<cstdio>
+#include<cstdlib>
+#include<iomanip>
+#include<iostream>
+#include<random>
+#include<string>
+#include<thread>
+#include<vector>
+
+using stonedb::LatencyHistogram;
+using stonedb::HistogramSnapshot;
+using stonedb::Opcode;
+
+struct LoadOptions
+{
+    std::string socketPath="stonedb.sock";
+    size_t connections=4;
+    size_t pipeline=16;
+    uint64_t requests=100000;
+    uint64_t keys=10000;
+    uint64_t readPercent=50;
+    size_t valueSize=100;
+    bool load=true;
+    uint64_t seed=42;
+};
+
+static std::string makeKey(uint64_t index)
+{
+    char key[32];
+    snprintf(key, sizeof(key), "user%012llu", static_cast<unsigned long long>(index));
+    return key;
+}
+
+//ConnectionResult: one connection's histograms and outcome counts
+struct ConnectionResult
+{
+    LatencyHistogram reads;
+    LatencyHistogram writes;
+    uint64_t notFound=0;
+    uint64_t errors=0;
+    bool failed=false;
+};
+
+//runs total requests split over the connections; returns elapsed seconds
+//load: puts keys [0, total) in order instead of the read/write mix
+static double runPhase(const LoadOptions& opts, uint64_t total, bool load, std::vector<ConnectionResult>& results)
+{
+    results=std::vector<ConnectionResult>(opts.connections);
+    std::atomic<uint64_t> nextKey{0};
+    auto start=std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for(size_t c=0; c<opts.connections; c++)
+    {
+        threads.emplace_back([&opts, &results, &nextKey, c, total, load]()
+        {
+            ConnectionResult& result=results[c];
+            stonedb::StoneClient client;
+            if(!client.connect(opts.socketPath))
+            {
+                result.failed=true;
+                return;
+            }
+            std::mt19937_64 rng(opts.seed * 1000003 + c);
+            std::string value(opts.valueSize, 'v');
+            for(auto& ch : value) ch='a' + rng() % 26;
+            uint64_t count=total / opts.connections + (c < total % opts.connections ? 1 : 0);
+            std::vector<bool> isRead(opts.pipeline);
+            stonedb::Response response;
+            for(uint64_t done=0; done < count; )
+            {
+                size_t window=static_cast<size_t>(std::min<uint64_t>(opts.pipeline, count - done));
+                for(size_t i=0; i<window; i++)
+                {
+                    if(load)
+                    {
+                        isRead[i]=false;
+                        client.send(Opcode::PUT, makeKey(nextKey.fetch_add(1)), value);
+                        continue;
+                    }
+                    isRead[i]=rng() % 100 < opts.readPercent;
+                    std::string key=makeKey(rng() % opts.keys);
+                    if(isRead[i]) client.send(Opcode::GET, key);
+                    else client.send(Opcode::PUT, key, value);
+                }
+                auto sent=std::chrono::steady_clock::now();
+                if(!client.flush())
+                {
+                    result.failed=true;
+                    return;
+                }
+                for(size_t i=0; i<window; i++)
+                {
+                    if(!client.receive(response))
+                    {
+                        result.failed=true;
+                        return;
+                    }
+                    auto nanos=std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - sent).count();
+                    (isRead[i] ? result.reads : result.writes).record(nanos);
+                    if(response.status == stonedb::Status::NOT_FOUND) result.notFound++;
+                    else if(response.status != stonedb::Status::OK) result.errors++;
+                }
+                done += window;
+            }
+        });
+    }
+    for(auto& thread : threads) thread.join();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static bool report(const std::string& phase, double seconds, const std::vector<ConnectionResult>& results)
+{
+    HistogramSnapshot reads;
+    HistogramSnapshot writes;
+    HistogramSnapshot all;
+    uint64_t notFound=0;
+    uint64_t errors=0;
+    for(const auto& result : results)
+    {
+        if(result.failed)
+        {
+            std::cerr << "Error: a connection failed during " << phase << std::endl;
+            return false;
+        }
+        reads.merge(result.reads);
+        writes.merge(result.writes);
+        all.merge(result.reads);
+        all.merge(result.writes);
+        notFound += result.notFound;
+        errors += result.errors;
+    }
+    std::cout << phase << ": " << all.count << " requests in " << std::fixed << std::setprecision(3) << seconds
+              << " s, " << std::setprecision(0) << all.count / seconds << " requests/sec, " << notFound
+              << " not found, " << errors << " errors" << std::endl;
+    std::cout << "  op          count    mean ns     p50 ns     p99 ns    p999 ns     max ns" << std::endl;
+    const char* names[]={"get", "put", "all"};
+    const HistogramSnapshot* histograms[]={&reads, &writes, &all};
+    for(int i=0; i<3; i++)
+    {
+        const HistogramSnapshot& h=*histograms[i];
+        if(h.count == 0) continue;
+        std::cout << "  " << std::left << std::setw(6) << names[i] << std::right << std::setw(11) << h.count
+                  << std::setw(11) << h.mean() << std::setw(11) << h.percentile(50) << std::setw(11)
+                  << h.percentile(99) << std::setw(11) << h.percentile(99.9) << std::setw(11) << h.max << std::endl;
+    }
+    return true;
+}
+
+static void printUsage()
+{
+    std::cout << "Usage: stone_loadgen [OPTIONS]" << std::endl;
+    std::cout << "  --socket PATH       server socket (default: stonedb.sock)" << std::endl;
+    std::cout << "  --connections N     client connections, one thread each (default: 4)" << std::endl;
+    std::cout << "  --pipeline N        requests in flight per connection (default: 16)" << std::endl;
+    std::cout << "  --requests N        measured requests, over all connections (default: 100000)" << std::endl;
+    std::cout << "  --keys N            key space, loaded before the run (default: 10000)" << std::endl;
+    std::cout << "  --read-percent N    share of gets; the rest are puts (default: 50)" << std::endl;
+    std::cout << "  --value-size N      value bytes (default: 100)" << std::endl;
+    std::cout << "  --no-load           skip loading the key space" << std::endl;
+    std::cout << "  --seed N            random seed (default: 42)" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+    LoadOptions opts;
+    for(int i=1; i<argc; i++)
+    {
+        std::string arg=argv[i];
+        std::string next=(i+1 < argc) ? argv[i+1] : "";
+        auto number=[&](uint64_t& out, bool positive)
+        {
+            char* end=nullptr;
+            unsigned long long v=std::strtoull(next.c_str(), &end, 10);
+            if(next.empty() || *end != '\0' || (positive && v == 0))
+            {
+                std::cerr << "Error: " << arg << " requires a" << (positive ? " positive" : "") << " number" << std::endl;
+                return false;
+            }
+            out=v;
+            i++;
+            return true;
+        };
+        uint64_t v=0;
+        if(arg == "--help" || arg == "-h")
+        {
+            printUsage();
+            return 0;
+        }
+        else if(arg == "--socket")
+        {
+            if(next.empty())
+            {
+                std::cerr << "Error: --socket requires a path argument" << std::endl;
+                return 1;
+            }
+            opts.socketPath=next;
+            i++;
+        }
+        else if(arg == "--connections")
+        {
+            if(!number(v, true)) return 1;
+            opts.connections=v;
+        }
+        else if(arg == "--pipeline")
+        {
+            if(!number(v, true)) return 1;
+            opts.pipeline=v;
+        }
+        else if(arg == "--requests")
+        {
+            if(!number(opts.requests, true)) return 1;
+        }
+        else if(arg == "--keys")
+        {
+            if(!number(opts.keys, true)) return 1;
+        }
+        else if(arg == "--read-percent")
+        {
+            if(!number(opts.readPercent, false)) return 1;
+            opts.readPercent=std::min<uint64_t>(opts.readPercent, 100);
+        }
+        else if(arg == "--value-size")
+        {
+            if(!number(v, true)) return 1;
+            opts.valueSize=std::min<uint64_t>(v, stonedb::MAX_VALUE_SIZE);
+        }
+        else if(arg == "--no-load")
+        {
+            opts.load=false;
+        }
+        else if(arg == "--seed")
+        {
+            if(!number(opts.seed, false)) return 1;
+        }
+        else
+        {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            std::cerr << "Use --help for usage information" << std::endl;
+            return 1;
+        }
+    }
+    std::cout << opts.connections << " connection(s), pipeline " << opts.pipeline << ", " << opts.keys << " keys, "
+              << opts.readPercent << "% gets, " << opts.valueSize << "-byte values" << std::endl;
+    std::vector<ConnectionResult> results;
+    if(opts.load)
+    {
+        double seconds=runPhase(opts, opts.keys, true, results);
+        if(!report("load", seconds, results)) return 1;
+    }
+    double seconds=runPhase(opts, opts.requests, false, results);
+    return report("run", seconds, results) ? 0 : 1;
+}
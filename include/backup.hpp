@@ -0,0 +1,67 @@
+#pragma once
+#include"common.hpp"
+#include"engine.hpp"
+#include"wal.hpp"
+#include<vector>
+
+namespace stonedb
+{
+    struct BackupInfo
+    {
+        uint64_t id=0;                 //names the backup for the incremental ones taken on top of it
+        uint64_t parent=0;             //incremental: the id of the backup it builds on
+        bool incremental=false;
+        uint64_t pages=0;
+        uint64_t dataBytes=0;
+        uint64_t walBytes=0;
+        uint64_t preserved=0;          //pages copied ahead of a concurrent write-back
+        Lsn walStart=0;                //log end when the data copy started; a restore replays at least this far
+        Lsn walEnd=0;                  //the restored database replays the log up to here
+        double seconds=0;
+    };
+
+    //binary hot backup: a directory holding
+    //  data      the data file as it was on disk when the backup started
+    //  wal       the log from its last truncation up to the end of the backup
+    //  extents   incremental only: the byte ranges data holds
+    //  BACKUP    manifest, written last; a directory without it is incomplete
+    //transactions keep running throughout. the data image is crash-consistent
+    //and the log covers everything since the last checkpoint, so opening the
+    //restored pair and running recover() yields every transaction that
+    //committed before the log was copied. files are copied in the kernel
+    //(copy_file_range), so a backup runs at disk speed
+    //truncateLog on wal fails while a backup runs
+    bool hotBackup(StorageEngine& engine, WALManager& wal, const std::string& dir, BackupInfo& info);
+
+    //like hotBackup, but data only holds the pages written since the backup
+    //in parentDir (full or incremental) started; the rest of the file is a
+    //hole. the engine has to have tracked those writes, which it does from
+    //one backup to the next while it stays open or is closed cleanly
+    bool incrementalBackup(StorageEngine& engine, WALManager& wal, const std::string& dir,
+                           const std::string& parentDir, BackupInfo& info);
+
+    //true when dir holds a complete hot backup
+    bool isBackupDirectory(const std::string& dir);
+
+    //reads the manifest of the backup in dir
+    bool readBackupInfo(const std::string& dir, BackupInfo& info);
+
+    //replaces the data file and log at dbPath/walPath with a backup chain: a
+    //full backup, then any incremental ones each built on the one before.
+    //neither file may be open. open the database and recover() afterwards;
+    //info describes the last backup of the chain
+    bool restoreBackup(const std::vector<std::string>& dirs, const std::string& dbPath, const std::string& walPath,
+                       BackupInfo& info);
+    bool restoreBackup(const std::string& dir, const std::string& dbPath, const std::string& walPath, BackupInfo& info);
+
+    //point-in-time restore: rebuilds the data file from the backup chain in
+    //dirs, then replays the log from the last backup on, through the
+    //segments in archiveDir (may be empty) and the current log at walPath,
+    //until target. the result replaces dbPath only once the replay is done,
+    //and walPath gets an empty log that starts past every LSN read, so the
+    //abandoned history never chains onto the new one. a target before the
+    //last backup's walStart cannot be reached. reached receives the LSN the
+    //replay stopped at
+    bool restoreToPoint(const std::vector<std::string>& dirs, const std::string& archiveDir, const std::string& dbPath,
+                        const std::string& walPath, const RecoveryTarget& target, Lsn& reached, BackupInfo& info);
+}
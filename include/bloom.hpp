@@ -0,0 +1,44 @@
+#pragma once
+#include"common.hpp"
+#include<vector>
+
+namespace stonedb
+{
+    //BloomFilter: split-block Bloom filter over 64-bit key hashes
+    //each key touches a single 32-byte block (8 words, one bit per word), so a
+    //probe is one cache line and maps onto one AVX2 test instruction
+    //an unsized filter has no information and reports every key as present
+    class BloomFilter
+    {
+    private:
+        struct alignas(32) Block
+        {
+            uint32_t words[8];
+        };
+        std::vector<Block> blocks;
+        size_t insertedCount;
+
+        size_t blockIndex(uint64_t hash) const
+        {
+            return static_cast<size_t>(((hash >> 32) * blocks.size()) >> 32);
+        }
+
+    public:
+        static constexpr size_t BITS_PER_KEY=10;
+
+        BloomFilter();
+        explicit BloomFilter(size_t expectedKeys);
+
+        void reset(size_t expectedKeys);
+        void insert(uint64_t hash);
+        bool mayContain(uint64_t hash) const;
+
+        bool isSized() const { return !blocks.empty(); }
+        size_t count() const { return insertedCount; }
+        size_t capacity() const { return blocks.size() * 256 / BITS_PER_KEY; }
+        size_t byteSize() const { return blocks.size() * sizeof(Block); }
+
+        void serialize(std::vector<uint8_t>& out) const;
+        bool deserialize(const uint8_t* data, size_t size);
+    };
+}
@@ -0,0 +1,80 @@
+#pragma once
+#include"common.hpp"
+#include<vector>
+#include<limits>
+
+namespace stonedb
+{
+    static constexpr PageId NO_PAGE=std::numeric_limits<PageId>::max();
+
+    //FrameArena: one contiguous mapping holding every buffer pool frame
+    //frames are PAGE_SIZE aligned (usable as O_DIRECT buffers); with huge pages
+    //the mapping is 2MB aligned and advised MADV_HUGEPAGE
+    class FrameArena
+    {
+    private:
+        void* mapping;
+        size_t mappingBytes;
+        uint8_t* base;
+        size_t frameCount;
+        bool hugePages;
+
+    public:
+        FrameArena(size_t frames, bool useHugePages);
+        ~FrameArena();
+        FrameArena(const FrameArena&)=delete;
+        FrameArena& operator=(const FrameArena&)=delete;
+
+        bool isValid() const { return base != nullptr; }
+        bool usesHugePages() const { return hugePages; }
+        size_t size() const { return frameCount; }
+        uint8_t* frame(size_t index) { return base + index * PAGE_SIZE; }
+    };
+
+    //BufferPool: fixed frame arena plus a compact array of page descriptors
+    //the page table is open addressing keyed by PageId and eviction is CLOCK,
+    //so after construction a cache miss never touches the heap
+    //handles stay valid for the pool lifetime but the frame behind them is
+    //reused once the page is evicted - callers must hold the storage lock
+    class BufferPool
+    {
+    private:
+        FrameArena arena;
+        std::shared_ptr<std::vector<Page>> descriptors;
+        std::vector<uint8_t> referenced;
+        std::vector<uint32_t> freeFrames;
+        std::vector<uint32_t> table;
+        size_t tableMask;
+        size_t clockHand;
+
+        size_t homeSlot(PageId pageId) const;
+        size_t findSlot(PageId pageId) const;
+        void tableInsert(PageId pageId, uint32_t frameIndex);
+        void tableErase(PageId pageId);
+        std::shared_ptr<Page> handle(size_t frameIndex);
+
+    public:
+        BufferPool(size_t frameCount, bool useHugePages=false);
+
+        bool isValid() const { return arena.isValid(); }
+        bool usesHugePages() const { return arena.usesHugePages(); }
+        size_t capacity() const { return arena.size(); }
+        size_t residentCount() const { return arena.size() - freeFrames.size(); }
+        bool isFull() const { return freeFrames.empty(); }
+
+        std::shared_ptr<Page> find(PageId pageId);
+        std::shared_ptr<Page> install(PageId pageId);
+        std::shared_ptr<Page> pickVictim();
+        void evict(PageId pageId);
+        void clear();
+
+        template<typename Fn>
+        void forEachResident(Fn&& fn)
+        {
+            for(auto& page : *descriptors)
+            {
+                if(page.pageId != NO_PAGE) fn(page);
+            }
+        }
+    };
+}
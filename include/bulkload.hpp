@@ -0,0 +1,50 @@
+#pragma once
+#include"common.hpp"
+#include"engine.hpp"
+#include"transaction.hpp"
+#include"wal.hpp"
+
+namespace stonedb
+{
+    //input formats for bulkLoad
+    //CSV: key,value per line; fields may be double-quoted ("" escapes a quote,
+    //quoted fields may span lines); everything after the first comma is the value
+    //TSV: key<TAB>value per line, split at the first tab, no quoting
+    //BINARY: repeated [u32 keyLen][u32 valueLen][key][value], little endian
+    enum class LoadFormat
+    {
+        CSV,
+        TSV,
+        BINARY
+    };
+
+    //"csv", "tsv" or "binary"
+    bool parseLoadFormat(const std::string& name, LoadFormat& format);
+
+    struct BulkLoadOptions
+    {
+        LoadFormat format=LoadFormat::CSV;
+        size_t memoryBytes=256 << 20;  //sort buffer; input beyond it spills to sorted runs
+        std::string tempPrefix;        //run file prefix; empty: temp directory/stonedb-load-<pid>
+        bool skipHeader=false;         //drop the first CSV/TSV record
+    };
+
+    struct BulkLoadResult
+    {
+        uint64_t inputRecords=0;
+        uint64_t duplicates=0;         //input records superseded by a later one with the same key
+        size_t runs=0;                 //sorted runs spilled to disk; 0 when the input fit in memory
+        bool packed=false;             //false: the engine took the transactional fallback
+        BulkLoadStats stats;
+        double seconds=0;
+    };
+
+    //bulkLoad: loads a whole file in one atomic step
+    //records are sorted by key (externally when they exceed memoryBytes) and
+    //deduplicated, the last occurrence winning. an engine that canBulkLoad
+    //writes them as packed pages behind a single BULK_LOAD log record; any
+    //other engine gets them through one transaction. no other transaction
+    //may run against the engine while a load is in progress
+    bool bulkLoad(const std::string& inputPath, const BulkLoadOptions& options, StorageEngine& engine,
+                  WALManager& wal, TransactionManager& txnMgr, BulkLoadResult& result);
+}
@@ -1,16 +1,20 @@
 #pragma once
 #include<cstdint>
 #include<string>
+#include<string_view>
 #include<vector>
 #include<unordered_map>
 #include<memory>
 #include<fstream>
 #include<iostream>
+#include<algorithm>
+#include"logger.hpp"
 namespace stonedb
 {
     using TransactionId=uint64_t;
     using PageId=uint32_t;
     using SlotId=uint16_t;
+    using Lsn=uint64_t;     //WAL log sequence number: byte position in the log stream
     static constexpr size_t PAGE_SIZE=4096;
     static constexpr size_t MAX_KEY_SIZE=255;
     static constexpr size_t MAX_VALUE_SIZE=1024*1024;
@@ -27,14 +31,34 @@ namespace stonedb
         Record(const std::string& k, const std::string& v):key(k),value(v){}
     };
     
+    //PageBuffer: PAGE_SIZE bytes of page data
+    //either borrows a frame from the buffer pool arena or owns a heap copy
+    //(standalone pages built outside the pool)
+    class PageBuffer
+    {
+    private:
+        std::unique_ptr<uint8_t[]> owned;
+        uint8_t* frame;
+    public:
+        PageBuffer():owned(new uint8_t[PAGE_SIZE]()),frame(owned.get()) {}
+        explicit PageBuffer(uint8_t* borrowed):frame(borrowed) {}
+        uint8_t* data() { return frame; }
+        const uint8_t* data() const { return frame; }
+        size_t size() const { return PAGE_SIZE; }
+        uint8_t& operator[](size_t i) { return frame[i]; }
+        uint8_t operator[](size_t i) const { return frame[i]; }
+        void clear() { std::fill(frame, frame + PAGE_SIZE, 0); }
+    };
+
     //Page structure: represents a single 4KB page in storage
     //isDirty flag indicates if page has been modified and needs flushing
     struct Page
     {
         PageId pageId;
-        std::vector<uint8_t> data;
-        bool isDirty = false;    
-        Page(PageId id):pageId(id),data(PAGE_SIZE, 0) {}
+        PageBuffer data;
+        bool isDirty = false;
+        Page(PageId id):pageId(id) {}
+        Page(PageId id, uint8_t* frame):pageId(id),data(frame) {}
     };
     
     //Lock types for concurrency control
@@ -54,11 +78,14 @@ namespace stonedb
         COMMIT_TXN,
         ABORT_TXN,
         PUT_RECORD,
-        DELETE_RECORD
+        DELETE_RECORD,
+        BULK_LOAD,      //self-committing; value describes pages the engine already wrote
+        PREPARE_TXN     //two-phase commit vote; value names the coordinator that decides
     };
     
     //LogEntry structure: represents a single entry in the WAL
     //Contains transaction ID, operation type, and data changes
+    //timestamp is only persisted for COMMIT_TXN; lsn is filled in on replay
     struct LogEntry
     {
         LogType type;
@@ -66,8 +93,18 @@ namespace stonedb
         std::string key;
         std::string value;
         uint64_t timestamp;    
-        LogEntry(LogType t, TransactionId id) : type(t), txnId(id), timestamp(0) {}
+        Lsn lsn;
+        LogEntry(LogType t, TransactionId id) : type(t), txnId(id), timestamp(0), lsn(0) {}
     };
+    //stable 64-bit key hash; used for anything persisted or partitioned by key
+    uint64_t hashKey(std::string_view key);
+    //CRC-32C (Castagnoli); uses the SSE4.2 crc32 instruction when available
+    uint32_t crc32c(const void* data, size_t size, uint32_t crc=0);
+    //copies length bytes between two files inside the kernel (copy_file_range),
+    //falling back to pread/pwrite where that is unsupported; no logging
+    bool copyFileBytes(int srcFd, uint64_t srcOffset, int dstFd, uint64_t dstOffset, uint64_t length);
+    //INFO and ERROR lines through the logger; per-operation diagnostics use
+    //STONEDB_TRACE/STONEDB_DEBUG so they can be compiled out
     void log(const std::string& msg);
     void logError(const std::string& msg);
 }
\ No newline at end of file
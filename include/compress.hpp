@@ -0,0 +1,18 @@
+#pragma once
+#include"common.hpp"
+
+namespace stonedb
+{
+    //byte-oriented LZ77 codec for page images, LZ4-style sequences:
+    //  [u8 token: literalLen<<4 | (matchLen-4)][literalLen ext][literals]
+    //  [u16 offset][matchLen ext]
+    //a nibble of 15 continues in extension bytes (255 = keep reading); the
+    //last sequence carries literals only. no entropy stage, so decoding is a
+    //memcpy loop and a 4KB page compresses in a few microseconds
+
+    //returns the compressed size, or 0 when it would exceed dstCapacity
+    size_t lzCompress(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstCapacity);
+
+    //false unless src decodes to exactly dstSize bytes
+    bool lzDecompress(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize);
+}
@@ -0,0 +1,159 @@
+#pragma once
+#include"common.hpp"
+#include"kviterator.hpp"
+#include<functional>
+#include<vector>
+
+namespace stonedb
+{
+    class WALManager;
+
+    //how the page store places records; recorded in the file header when the
+    //file is created, an existing file keeps its layout
+    enum class StorageLayout
+    {
+        HEAP,      //records in any page with room, found through the in-memory keyToPage map
+        HASH       //extendible hashing: a key-hash directory addresses one bucket page per key
+    };
+
+    //record encoding inside data pages; recorded in the file header like the
+    //layout, an existing file keeps its format
+    enum class PageFormat
+    {
+        RECORDS,   //[keyLen][valueLen][key][value] tuples in insertion order
+        SLOTTED    //shared key prefix, 1-byte fingerprint per slot, prefix-truncated keys
+    };
+
+    //how page images are kept on disk; recorded in the file header like the
+    //layout, an existing file keeps its setting
+    enum class PageCompression
+    {
+        NONE,      //fixed PAGE_SIZE slots in the data file
+        LZ         //LZ-compressed images in variable-size extents, located through <path>.pagemap
+    };
+
+    //StorageOptions: tuning knobs fixed at open time
+    struct StorageOptions
+    {
+        //page store
+        size_t cacheFrames=1000;       //buffer pool size in pages
+        bool useHugePages=false;       //advise the frame arena for transparent huge pages
+        StorageLayout layout=StorageLayout::HEAP;
+        PageFormat pageFormat=PageFormat::RECORDS;
+        //with LZ half of cacheFrames stays a frame pool and the other half
+        //holds compressed images of evicted pages
+        PageCompression compression=PageCompression::NONE;
+        //threads that split startup page parsing, large flushes and full
+        //scans into page ranges. 0: the process-wide pool, 1: the calling
+        //thread only, N: a pool of N workers for this store
+        size_t workerThreads=0;
+        //LSM store
+        size_t memtableBytes=4*1024*1024;      //memtable size that triggers a flush to L0
+        size_t l0CompactionTrigger=4;          //L0 table count that triggers compaction into L1
+        size_t levelBaseBytes=10*1024*1024;    //L1 size budget, x10 per deeper level
+        size_t tableTargetBytes=2*1024*1024;   //split compaction output at this size
+    };
+
+    //BulkLoadStats: what one StorageEngine::bulkLoad wrote
+    struct BulkLoadStats
+    {
+        uint64_t records=0;
+        uint64_t bytes=0;              //key and value bytes
+        PageId firstPage=0;
+        uint64_t pages=0;
+    };
+
+    //BackupOptions: what one StorageEngine::backupData copies. every backup
+    //names itself with id; an incremental one only copies the pages written
+    //since the backup named base was taken
+    struct BackupOptions
+    {
+        uint64_t id=0;
+        bool incremental=false;
+        uint64_t base=0;
+    };
+
+    //BackupStats: what one StorageEngine::backupData copied
+    struct BackupStats
+    {
+        uint64_t pages=0;              //pages in the image
+        uint64_t bytes=0;              //bytes copied
+        uint64_t preserved=0;          //pages copied early because a write-back was about to replace them
+        //(offset, length) of each byte range the image holds; an incremental
+        //image is sparse and everything else reads as its base backup's
+        std::vector<std::pair<uint64_t, uint64_t>> extents;
+    };
+
+    enum class EngineType
+    {
+        PAGE,
+        LSM
+    };
+
+    //StorageEngine: interface shared by the in-place page store and the LSM store
+    //TransactionManager, WALManager and the CLI only talk to this
+    class StorageEngine
+    {
+    public:
+        virtual ~StorageEngine()=default;
+
+        virtual bool open(const std::string& path, const StorageOptions& opts=StorageOptions())=0;
+        virtual void close()=0;
+        virtual bool isOpen() const=0;
+
+        virtual bool putRecord(const std::string& key, const std::string& value)=0;
+        virtual bool getRecord(const std::string& key, std::string& value)=0;
+        virtual bool deleteRecord(const std::string& key)=0;
+        virtual std::vector<Record> scanRecords()=0;
+        //forEachRecord: visits every live record without collecting them, in
+        //an engine-defined order; the views are valid during the call only.
+        //stops and returns false once fn does. writers are not blocked for
+        //the whole walk, so a record a concurrent write moves may be seen
+        //twice or not at all, unless the engine reads a snapshot (the page
+        //store does); the default walks scanRecords()
+        virtual bool forEachRecord(const std::function<bool(std::string_view key, std::string_view value)>& fn);
+
+        //flushAll: make everything a committed transaction wrote durable
+        //checkpoint: write a self-contained on-disk image so the WAL can be truncated
+        virtual bool flushAll()=0;
+        virtual bool checkpoint()=0;
+
+        //redo committed WAL operations; both engines apply blind puts/deletes,
+        //so replaying a prefix that is already on disk is harmless
+        //redoThreads workers apply disjoint key sets in parallel, 0 picks one per core
+        bool recover(WALManager& wal, size_t redoThreads=0);
+        //applies one committed PUT, DELETE or BULK_LOAD log record; recover()
+        //and point-in-time restore redo through it
+        bool applyLogEntry(const LogEntry& entry);
+
+        //bulk loading: bulkLoad writes input (ascending, unique keys) straight
+        //into new storage and makes it visible with one BULK_LOAD WAL record.
+        //keys already present are replaced. on failure nothing is visible.
+        //no transaction may run meanwhile. engines that cannot say so in
+        //canBulkLoad and the caller falls back to transactional puts
+        virtual bool canBulkLoad() const { return false; }
+        virtual bool bulkLoad(KVIterator&, WALManager&, BulkLoadStats&) { return false; }
+        //redo of a committed BULK_LOAD record, given what bulkLoad logged
+        virtual bool redoBulkLoad(std::string_view)
+        {
+            logError("this storage engine cannot redo a bulk load");
+            return false;
+        }
+        //drops a load that crashed before its BULK_LOAD record committed;
+        //recover() calls it once the log is replayed
+        virtual bool discardPendingLoad() { return true; }
+
+        //hot backup: copies the data file as it was on disk when the call
+        //started to destPath while transactions keep running. that image is
+        //what a crash at that moment would have left, so it is only complete
+        //together with the WAL copied after it (see hotBackup in backup.hpp).
+        //an incremental copy leaves out the pages unchanged since its base
+        virtual bool backupData(const std::string&, const BackupOptions&, BackupStats&)
+        {
+            logError("this storage engine does not support hot backup");
+            return false;
+        }
+    };
+
+    std::shared_ptr<StorageEngine> createStorageEngine(EngineType type);
+}
@@ -0,0 +1,24 @@
+#pragma once
+#include"common.hpp"
+#include"engine.hpp"
+#include"transaction.hpp"
+#include<iosfwd>
+
+namespace stonedb
+{
+    //portable JSON backup document:
+    //  {"stonedb_backup": true, "version": "1.0.0", "records": [{"key": "...", "value": "..."}, ...]}
+    //keys and values are JSON strings; bytes below 0x20, quotes and
+    //backslashes are escaped and everything else is copied through as is
+
+    //streams every record of engine to out in one pass: each string is
+    //escaped in linear time and output goes out in large blocks, so memory
+    //does not grow with the database
+    bool writeJsonBackup(StorageEngine& engine, std::ostream& out, uint64_t& records);
+
+    //parses a backup document in one pass over a fixed-size read buffer and
+    //puts its records through txnMgr, batchSize records per transaction;
+    //memory is bounded by one batch. unknown members are skipped. on an
+    //error the batches committed before it stay; records counts those
+    bool readJsonBackup(std::istream& in, TransactionManager& txnMgr, size_t batchSize, uint64_t& records);
+}
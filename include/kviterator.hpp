@@ -0,0 +1,31 @@
+#pragma once
+#include"common.hpp"
+#include<string_view>
+
+namespace stonedb
+{
+    //outcome of a point lookup in one LSM component; DELETED means a tombstone
+    //shadows any older version, so the search must stop there
+    enum class LookupResult
+    {
+        NOT_FOUND,
+        FOUND,
+        DELETED
+    };
+
+    //KVIterator: ordered cursor over one sorted LSM source (memtable or table)
+    //views returned by key()/value() stay valid until the next call to next()
+    class KVIterator
+    {
+    public:
+        virtual ~KVIterator()=default;
+        virtual bool valid() const=0;
+        virtual void next()=0;
+        virtual std::string_view key() const=0;
+        virtual std::string_view value() const=0;
+        virtual bool isTombstone() const=0;
+        //true once the source could not be read: valid() went false early,
+        //so what was seen is only a prefix of it
+        virtual bool failed() const { return false; }
+    };
+}
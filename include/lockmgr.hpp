@@ -25,7 +25,7 @@ namespace stonedb
         std::unordered_map<TransactionId, std::unordered_set<std::string>> txnLocks;
         std::unordered_map<TransactionId, std::unordered_set<std::string>> txnWaits;
         
-        bool canGrantLock(const std::string& key, LockType requestedType);
+        bool canGrantLock(const std::string& key, LockType requestedType, TransactionId txnId);
         void grantLock(const std::string& key, TransactionId txnId, LockType type);
         void releaseLock(const std::string& key, TransactionId txnId);
         bool hasDeadlock(TransactionId txnId);
@@ -0,0 +1,53 @@
+#pragma once
+#include<atomic>
+#include<cstdint>
+#include<string>
+#include<string_view>
+
+//lowest level whose STONEDB_TRACE/STONEDB_DEBUG call sites are compiled in;
+//0 TRACE, 1 DEBUG. set from CMake (STONEDB_MIN_LOG_LEVEL)
+#ifndef STONEDB_MIN_LOG_LEVEL
+#define STONEDB_MIN_LOG_LEVEL 1
+#endif
+
+namespace stonedb
+{
+    enum class LogLevel : int
+    {
+        TRACE=0,
+        DEBUG=1,
+        INFO=2,
+        ERROR=3
+    };
+
+    //runtime threshold, INFO by default
+    extern std::atomic<int> currentLogLevel;
+    inline bool logEnabled(LogLevel level)
+    {
+        return static_cast<int>(level) >= currentLogLevel.load(std::memory_order_relaxed);
+    }
+    void setLogLevel(LogLevel level);
+    bool parseLogLevel(const std::string& name, LogLevel& level);
+
+    //logger: TRACE/DEBUG/INFO lines go into a per-thread lock-free ring and a
+    //background thread formats and writes them to stdout; a full ring drops the
+    //line and counts it. ERROR lines are written to stderr synchronously so they
+    //survive a crash
+    void logAt(LogLevel level, std::string_view msg);
+    //writes out everything queued so far
+    void flushLog();
+    uint64_t droppedLogMessages();
+}
+
+//disabled levels cost nothing: below STONEDB_MIN_LOG_LEVEL the statement is
+//discarded at compile time, otherwise the message is only built when enabled
+#define STONEDB_LOG_AT(level, msg) \
+    do \
+    { \
+        if constexpr(static_cast<int>(level) >= STONEDB_MIN_LOG_LEVEL) \
+        { \
+            if(::stonedb::logEnabled(level)) ::stonedb::logAt(level, msg); \
+        } \
+    } while(0)
+#define STONEDB_TRACE(msg) STONEDB_LOG_AT(::stonedb::LogLevel::TRACE, msg)
+#define STONEDB_DEBUG(msg) STONEDB_LOG_AT(::stonedb::LogLevel::DEBUG, msg)
@@ -0,0 +1,105 @@
+#pragma once
+#include"common.hpp"
+#include"engine.hpp"
+#include"memtable.hpp"
+#include"sstable.hpp"
+#include<condition_variable>
+#include<mutex>
+#include<thread>
+#include<vector>
+
+namespace stonedb
+{
+    //LSMStorage: log-structured store for write-heavy workloads
+    //writes go to a memtable (durable through the WAL); full memtables are
+    //flushed to sorted table files in L0 and merged down the levels by a
+    //background thread. the database path is a directory:
+    //  <dir>/MANIFEST      live tables per level and the next file number
+    //  <dir>/NNNNNN.sst    table files
+    class LSMStorage : public StorageEngine
+    {
+    private:
+        static constexpr int MAX_LEVELS=7;
+
+        struct TableHandle
+        {
+            TableMeta meta;
+            std::shared_ptr<SSTableReader> reader;
+        };
+        //Version: immutable set of live tables; readers take a snapshot and
+        //the background thread publishes a new one after every flush/compaction
+        //L0 is newest first and may overlap, L1+ are sorted and disjoint
+        struct Version
+        {
+            std::vector<TableHandle> levels[MAX_LEVELS];
+        };
+        struct Compaction
+        {
+            int level;                       //inputs from level and level+1
+            std::vector<TableHandle> inputs[2];
+            bool dropTombstones;
+        };
+
+        std::string dbDir;
+        StorageOptions options;
+        bool dbOpen;
+
+        std::mutex stateMutex;
+        std::condition_variable workCv;      //wakes the background thread
+        std::condition_variable doneCv;      //signals a flush or compaction finished
+        std::shared_ptr<MemTable> mem;
+        std::shared_ptr<MemTable> imm;       //waiting to be flushed to L0
+        std::shared_ptr<const Version> current;
+        uint64_t nextFileNumber;
+        std::string compactPointer[MAX_LEVELS];
+        bool stopping;
+        bool backgroundError;
+        std::thread worker;
+
+        std::string tablePath(uint64_t number) const;
+        std::string manifestPath() const;
+        bool loadManifest(Version& version);
+        bool saveManifest(const Version& version, uint64_t nextNumber);
+        void removeOrphans(const Version& version);
+
+        bool makeRoomForWrite(std::unique_lock<std::mutex>& lock);
+        bool write(std::string_view key, std::string_view value, bool tombstone);
+
+        void backgroundLoop();
+        bool flushImmutable(std::unique_lock<std::mutex>& lock);
+        int compactionLevel(const Version& version) const;
+        bool pickCompaction(const Version& version, Compaction& compaction);
+        bool runCompaction(std::unique_lock<std::mutex>& lock, Compaction& compaction);
+        bool writeTables(KVIterator& input, bool dropTombstones, size_t expectedKeys, uint64_t splitBytes,
+                         std::unique_lock<std::mutex>& lock, std::vector<TableHandle>& outputs);
+        bool installVersion(std::unique_lock<std::mutex>& lock, std::shared_ptr<Version> version,
+                            const std::vector<uint64_t>& obsolete);
+        uint64_t maxBytesForLevel(int level) const;
+
+    public:
+        LSMStorage();
+        ~LSMStorage() override;
+        LSMStorage(const LSMStorage&)=delete;
+        LSMStorage& operator=(const LSMStorage&)=delete;
+
+        bool open(const std::string& path, const StorageOptions& opts=StorageOptions()) override;
+        void close() override;
+        bool isOpen() const override { return dbOpen; }
+
+        bool putRecord(const std::string& key, const std::string& value) override;
+        bool getRecord(const std::string& key, std::string& value) override;
+        bool deleteRecord(const std::string& key) override;
+        std::vector<Record> scanRecords() override;
+        bool forEachRecord(const std::function<bool(std::string_view key, std::string_view value)>& fn) override;
+
+        //commits are durable once the WAL is flushed, nothing to do here
+        bool flushAll() override;
+        //flushes the memtable to L0 so the WAL can be truncated
+        bool checkpoint() override;
+
+        //table count per level, for stats and tests
+        std::vector<size_t> levelTableCounts();
+        //blocks until no flush or compaction is pending
+        void waitForBackgroundWork();
+    };
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include"common.hpp"
+#include"kviterator.hpp"
+#include<atomic>
+#include<mutex>
+#include<vector>
+
+namespace stonedb
+{
+    //MemTable: in-memory write buffer of the LSM store, a concurrent skiplist
+    //writers serialize on writeMutex; readers never lock - nodes are published
+    //with release stores and nothing is unlinked while the table is alive
+    //overwrites swap the node's value pointer, so a key has exactly one node
+    class MemTable
+    {
+    private:
+        friend class MemTableIterator;
+
+        static constexpr int MAX_HEIGHT=12;
+        static constexpr size_t ARENA_BLOCK_SIZE=64*1024;
+
+        struct ValueRecord
+        {
+            uint32_t size;
+            bool tombstone;
+            const char* data;
+        };
+        struct Node
+        {
+            const char* key;
+            uint32_t keySize;
+            int height;
+            std::atomic<const ValueRecord*> value;
+            std::atomic<Node*> next[1];
+
+            std::string_view keyView() const { return std::string_view(key, keySize); }
+        };
+
+        //bump allocator; blocks are freed together with the table
+        std::vector<std::unique_ptr<char[]>> arenaBlocks;
+        char* arenaCursor;
+        size_t arenaRemaining;
+        std::atomic<size_t> memoryBytes;
+
+        Node* head;
+        std::atomic<int> maxHeight;
+        std::atomic<size_t> entryCount;
+        uint32_t rngState;
+        std::mutex writeMutex;
+
+        char* allocate(size_t bytes);
+        Node* newNode(std::string_view key, int height);
+        const ValueRecord* newValue(std::string_view value, bool tombstone);
+        int randomHeight();
+        Node* findGreaterOrEqual(std::string_view key, Node** prev) const;
+        void insert(std::string_view key, std::string_view value, bool tombstone);
+
+    public:
+        MemTable();
+        MemTable(const MemTable&)=delete;
+        MemTable& operator=(const MemTable&)=delete;
+
+        void put(std::string_view key, std::string_view value);
+        void remove(std::string_view key);
+        LookupResult get(std::string_view key, std::string& value) const;
+
+        size_t memoryUsage() const { return memoryBytes.load(std::memory_order_relaxed); }
+        size_t size() const { return entryCount.load(std::memory_order_relaxed); }
+        bool empty() const { return size() == 0; }
+
+        std::unique_ptr<KVIterator> newIterator() const;
+    };
+}
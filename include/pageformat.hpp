@@ -0,0 +1,38 @@
+#pragma once
+#include"common.hpp"
+#include"engine.hpp"
+#include<functional>
+
+namespace stonedb
+{
+    //record operations on one PAGE_SIZE data page, for either PageFormat
+    //an all-zero page is a valid empty page in both formats
+    //
+    //SLOTTED page layout:
+    //  [u16 slotCount][u16 recordStart][u16 garbage][u8 prefixLen][u8 flags]
+    //  [prefix][u8 fingerprint x slotCount][u16 offset x slotCount] ... free ...
+    //  [record bodies, growing down from the page end]
+    //  body: [u16 suffixLen][u16 valueLen][key suffix][value]
+    //every key in the page starts with the prefix; the fingerprint is the top
+    //byte of hashKey, so a lookup is one vector compare over the fingerprints
+    //and normally a single suffix compare
+
+    bool fitsInEmptyPage(PageFormat format, size_t keySize, size_t valueSize);
+
+    //value points into the page and is valid while the page is
+    bool findInPage(PageFormat format, const uint8_t* data, std::string_view key, uint64_t hash,
+                    std::string_view& value);
+
+    //inserts or overwrites key; false when the page has no room, and then an
+    //older version of key is not in the page any more either
+    //modified reports whether the page bytes changed
+    bool putInPage(PageFormat format, uint8_t* data, std::string_view key, std::string_view value,
+                   uint64_t hash, bool& modified);
+
+    bool eraseFromPage(PageFormat format, uint8_t* data, std::string_view key, uint64_t hash);
+
+    //visits live records in page order; returns true when the page also holds
+    //dead space that rewriting it would reclaim
+    bool forEachInPage(PageFormat format, const uint8_t* data,
+                       const std::function<void(std::string_view key, std::string_view value)>& fn);
+}
@@ -0,0 +1,94 @@
+#pragma once
+#include"common.hpp"
+#include<string>
+#include<string_view>
+#include<vector>
+
+namespace stonedb
+{
+    //wire protocol of stone --serve, host byte order (local sockets only)
+    //request:  [u32 bodyLen][u8 opcode][u32 id][u16 keyLen][key][value]
+    //response: [u32 bodyLen][u8 status][u32 id][value]
+    //bodyLen counts everything after itself. a client may send any number of
+    //requests before reading; each connection's requests run in order and
+    //their responses come back in the same order, tagged with the request id
+    enum class Opcode : uint8_t
+    {
+        PING=0,
+        GET=1,
+        PUT=2,
+        DEL=3,
+        STATS=4      //response value is Statistics::toJson()
+    };
+
+    enum class Status : uint8_t
+    {
+        OK=0,
+        NOT_FOUND=1,
+        ERROR=2,
+        BAD_REQUEST=3
+    };
+
+    struct Request
+    {
+        Opcode op=Opcode::PING;
+        uint32_t id=0;
+        std::string key;
+        std::string value;
+    };
+
+    struct Response
+    {
+        Status status=Status::OK;
+        uint32_t id=0;
+        std::string value;
+    };
+
+    static constexpr size_t REQUEST_HEADER_SIZE=11;
+    static constexpr size_t RESPONSE_HEADER_SIZE=9;
+    //largest body either side accepts; a stats reply is far below this
+    static constexpr size_t MAX_BODY_SIZE=REQUEST_HEADER_SIZE + MAX_KEY_SIZE + MAX_VALUE_SIZE;
+
+    enum class DecodeResult
+    {
+        OK,
+        NEED_MORE,   //the frame is not complete yet
+        BAD          //malformed; the connection cannot continue
+    };
+
+    void encodeRequest(std::string& out, Opcode op, uint32_t id, std::string_view key, std::string_view value);
+    //consumed is set to the frame size on OK
+    DecodeResult decodeRequest(const uint8_t* data, size_t size, size_t& consumed, Request& request);
+    void encodeResponse(std::string& out, Status status, uint32_t id, std::string_view value);
+    DecodeResult decodeResponse(const uint8_t* data, size_t size, size_t& consumed, Response& response);
+
+    //StoneClient: blocking client for a stone --serve socket. send() only
+    //queues; flush() writes everything queued, so a caller pipelines by
+    //sending several requests before flushing and receiving
+    class StoneClient
+    {
+    private:
+        int fd;
+        uint32_t nextId;
+        std::string out;
+        std::vector<uint8_t> in;
+        size_t inBegin;
+    public:
+        StoneClient();
+        ~StoneClient();
+        StoneClient(const StoneClient&)=delete;
+        StoneClient& operator=(const StoneClient&)=delete;
+
+        bool connect(const std::string& socketPath);
+        void close();
+        bool isConnected() const { return fd >= 0; }
+
+        //returns the request id
+        uint32_t send(Opcode op, std::string_view key=std::string_view(), std::string_view value=std::string_view());
+        bool flush();
+        //blocks for the next response; false when the connection is gone
+        bool receive(Response& response);
+        //send, flush and receive one request
+        bool call(Opcode op, std::string_view key, std::string_view value, Response& response);
+    };
+}
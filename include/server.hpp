@@ -0,0 +1,98 @@
+#pragma once
+#include"common.hpp"
+#include"protocol.hpp"
+#include"transaction.hpp"
+#include<atomic>
+#include<condition_variable>
+#include<deque>
+#include<mutex>
+#include<thread>
+
+namespace stonedb
+{
+    struct ServerOptions
+    {
+        size_t workers=0;          //0: one per hardware thread
+        size_t maxBatch=256;       //requests a worker takes from one connection at a time
+        size_t maxPending=4096;    //decoded requests per connection before reads pause
+        size_t maxOutput=4 << 20;  //unsent response bytes per connection before reads pause
+    };
+
+    //Server: serves the protocol.hpp wire format on a Unix stream socket
+    //one event-loop thread owns every socket: it accepts, reads and decodes
+    //requests, and writes responses, all nonblocking through level-triggered
+    //epoll. decoded requests queue per connection; a connection with work
+    //and no batch in flight hands up to maxBatch requests to the worker pool
+    //as one task, so a connection's requests run in order while different
+    //connections run in parallel. each request is its own autocommit
+    //transaction on the shared TransactionManager. a worker encodes its
+    //batch's responses and wakes the loop through an eventfd
+    //a connection that stops reading is throttled: the loop stops reading
+    //from it once maxPending requests or maxOutput bytes are waiting
+    class Server
+    {
+    private:
+        struct Connection
+        {
+            int fd;
+            std::vector<uint8_t> in;
+            size_t inBegin=0;
+            std::deque<Request> pending;
+            //owned by the worker while busy
+            std::vector<Request> batch;
+            std::string responses;
+            std::string out;
+            size_t outSent=0;
+            bool busy=false;
+            bool eof=false;        //peer finished sending; answer what is queued, then close
+            bool dead=false;       //socket failed or protocol error; drop queued work
+            uint32_t events=0;     //current epoll interest
+            explicit Connection(int f) : fd(f) {}
+        };
+
+        TransactionManager& txnMgr;
+        ServerOptions options;
+        std::string socketPath;
+        int listenFd;
+        int epollFd;
+        int wakeFd;
+        std::atomic<bool> stopRequested;
+        std::thread loopThread;
+        std::unordered_map<int, std::unique_ptr<Connection>> connections;
+
+        std::vector<std::thread> workers;
+        std::mutex workMutex;
+        std::condition_variable workCv;
+        std::deque<Connection*> work;
+        bool stopWorkers;
+        std::mutex doneMutex;
+        std::vector<Connection*> done;
+
+        void eventLoop();
+        void acceptConnections();
+        void readConnection(Connection& conn);
+        void dispatch(Connection& conn);
+        void writeConnection(Connection& conn);
+        //re-arms epoll for conn, or closes it when finished; false if closed
+        bool updateConnection(Connection& conn);
+        void closeConnection(Connection& conn);
+        void collectCompleted();
+        void workerLoop();
+        void execute(const Request& request, std::string& out);
+
+    public:
+        Server(TransactionManager& txnMgr, const ServerOptions& options=ServerOptions());
+        ~Server();
+        Server(const Server&)=delete;
+        Server& operator=(const Server&)=delete;
+
+        //binds socketPath (replacing a stale socket file) and starts the threads
+        bool start(const std::string& socketPath);
+        //async-signal-safe; wait() returns once the loop has seen it
+        void requestStop();
+        //blocks until requestStop, then closes connections and joins threads
+        void wait();
+        //requestStop then wait
+        void stop();
+    };
+}
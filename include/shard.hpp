@@ -0,0 +1,94 @@
+#pragma once
+#include"common.hpp"
+#include"engine.hpp"
+#include"wal.hpp"
+#include<functional>
+#include<memory>
+#include<shared_mutex>
+#include<vector>
+
+namespace stonedb
+{
+    struct ShardOptions
+    {
+        size_t shards=0;               //0: the count the directory was created with, else one per CPU
+        bool pinThreads=true;          //bind shard i's thread to the i-th CPU the process may run on
+        EngineType engine=EngineType::PAGE;
+        StorageOptions storage;
+    };
+
+    //ShardWrite: one put or delete of a ShardedEngine::commit batch
+    struct ShardWrite
+    {
+        std::string key;
+        std::string value;
+        bool isDelete=false;
+    };
+
+    //ShardedEngine: thread-per-core façade over independent engines. keys
+    //are hash-partitioned over N shards, each a storage engine with its own
+    //WAL, owned by one worker thread that nothing else touches: callers
+    //post requests to the shard's inbox and wait for the reply, so shards
+    //share no locks and their logs sync in parallel. the directory holds
+    //  SHARDS            shard count and engine type, fixed at creation
+    //  shard-NNN.sdb     shard NNN's data (a directory for LSM)
+    //  shard-NNN.wal     its log
+    //a write batch touching one shard is a local transaction. one spanning
+    //several commits with two-phase commit: every shard involved logs its
+    //records and a PREPARE vote, then the lowest one (the coordinator) logs
+    //COMMIT, which is the decision, and the rest follow. writes are applied
+    //to storage only once decided, and keys held by a prepared transaction
+    //reject other writes until then. open() settles transactions a crash
+    //left prepared by asking their coordinator's log: no COMMIT there means
+    //abort
+    class ShardedEngine
+    {
+    private:
+        struct Shard;
+        std::vector<std::unique_ptr<Shard>> shards;
+        bool engineOpen;
+        //cross-shard commits hold it shared until every shard has the
+        //decision, checkpoint exclusive, so no coordinator log is truncated
+        //while a participant still waits on it
+        std::shared_mutex decisionMutex;
+
+        size_t shardOf(std::string_view key) const;
+        bool call(Shard& shard, const std::function<bool()>& fn);
+        bool callEach(const std::vector<size_t>& targets, const std::function<bool(Shard&)>& fn);
+        bool callAll(const std::function<bool(Shard&)>& fn);
+        static void workerLoop(Shard& shard);
+        bool writeLocal(Shard& shard, const std::vector<ShardWrite>& writes);
+        bool prepare(Shard& shard, TransactionId txnId, size_t coordinator, const std::vector<ShardWrite>& writes);
+        bool finish(Shard& shard, TransactionId txnId, bool commit);
+        bool deliver(Shard& shard, TransactionId txnId, bool commit);
+        bool apply(Shard& shard, const std::vector<ShardWrite>& writes);
+        bool resolveInDoubt();
+        void stopWorkers();
+
+    public:
+        ShardedEngine();
+        ~ShardedEngine();
+
+        //creates or opens the shards in dir, settles in-doubt transactions,
+        //recovers every shard from its log in parallel and truncates the logs
+        bool open(const std::string& dir, const ShardOptions& options=ShardOptions());
+        void close();
+        bool isOpen() const { return engineOpen; }
+        size_t shardCount() const { return shards.size(); }
+
+        //single-key operations, each an autocommit transaction on its shard
+        bool putRecord(const std::string& key, const std::string& value);
+        bool getRecord(const std::string& key, std::string& value);
+        bool deleteRecord(const std::string& key);
+        //commits writes atomically across shards; deletes of missing keys
+        //are not an error. false if the batch was not committed
+        bool commit(const std::vector<ShardWrite>& writes);
+
+        //visits every shard in turn, each through its engine's forEachRecord
+        bool forEachRecord(const std::function<bool(std::string_view key, std::string_view value)>& fn);
+        //checkpoints every shard and truncates its log; first retries any
+        //decision a participant failed to log, and refuses while one is
+        //still prepared
+        bool checkpoint();
+    };
+}
@@ -0,0 +1,90 @@
+#pragma once
+#include"common.hpp"
+#include"kviterator.hpp"
+#include"bloom.hpp"
+#include<string>
+#include<vector>
+
+namespace stonedb
+{
+    //TableMeta: what the LSM manifest records about one sorted table file
+    struct TableMeta
+    {
+        uint64_t number=0;
+        uint64_t fileSize=0;
+        uint64_t entryCount=0;
+        std::string smallest;
+        std::string largest;
+    };
+
+    //table file layout:
+    //  [data block]...[data block][filter][index][footer]
+    //  data block: entries [u16 keyLen][u32 valueLen][u8 flags][key][value], then u32 checksum
+    //  index: per block [u16 lastKeyLen][lastKey][u64 offset][u32 size]
+    //  footer: u64 filterOffset, filterSize, indexOffset, indexSize, entryCount, magic
+    static constexpr size_t TABLE_BLOCK_SIZE=4096;
+
+    //SSTableWriter: streams keys in ascending order into a new table file
+    class SSTableWriter
+    {
+    private:
+        std::string path;
+        int fd;
+        uint64_t offset;
+        std::string block;
+        std::string index;
+        std::string lastKey;
+        BloomFilter filter;
+        TableMeta meta;
+        bool failed;
+
+        bool writeBytes(const void* data, size_t size);
+        bool flushBlock();
+
+    public:
+        SSTableWriter(const std::string& path, uint64_t number, size_t expectedKeys);
+        ~SSTableWriter();
+        SSTableWriter(const SSTableWriter&)=delete;
+        SSTableWriter& operator=(const SSTableWriter&)=delete;
+
+        bool isOpen() const { return fd >= 0; }
+        bool add(std::string_view key, std::string_view value, bool tombstone);
+        bool finish(TableMeta& result);
+        void abandon();
+        uint64_t estimatedSize() const { return offset + block.size(); }
+        uint64_t entryCount() const { return meta.entryCount; }
+    };
+
+    //SSTableReader: immutable table opened for point lookups and iteration
+    //filter and index stay in memory; data blocks are read with pread, so one
+    //reader can be shared by any number of threads
+    class SSTableReader
+    {
+    private:
+        struct IndexEntry
+        {
+            std::string lastKey;
+            uint64_t offset;
+            uint32_t size;
+        };
+        int fd;
+        std::string path;
+        std::vector<IndexEntry> index;
+        BloomFilter filter;
+        uint64_t entryCount;
+
+        friend class SSTableIterator;
+        bool readBlock(size_t blockIndex, std::string& block) const;
+
+    public:
+        SSTableReader();
+        ~SSTableReader();
+        SSTableReader(const SSTableReader&)=delete;
+        SSTableReader& operator=(const SSTableReader&)=delete;
+
+        bool open(const std::string& tablePath);
+        LookupResult get(std::string_view key, uint64_t hash, std::string& value) const;
+        std::unique_ptr<KVIterator> newIterator() const;
+        uint64_t entries() const { return entryCount; }
+    };
+}
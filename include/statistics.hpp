@@ -1,47 +1,211 @@
 #pragma once
 #include<cstdint>
 #include<atomic>
+#include<chrono>
 #include<mutex>
+#include<string>
+#include<vector>
 
 namespace stonedb
 {
+    //operations timed by the engine
+    enum class LatencyOp
+    {
+        GET,
+        PUT,
+        DELETE,
+        COMMIT,
+        WAL_SYNC,
+        PAGE_READ,
+        PAGE_WRITE,
+        LOCK_WAIT,
+        COUNT
+    };
+    const char* latencyOpName(LatencyOp op);
+
+    //LatencyHistogram: HDR-style log-linear buckets over nanoseconds. below 16
+    //every value has its own bucket, above it each power of two is split into
+    //16 linear sub-buckets, so a value is known to within 1/16. covers up to
+    //2^41 ns (about 36 minutes); anything larger lands in the last bucket
+    class LatencyHistogram
+    {
+    public:
+        static constexpr int SUB_BITS=4;
+        static constexpr size_t SUB_BUCKETS=size_t(1) << SUB_BITS;
+        static constexpr int MAX_EXPONENT=41;
+        static constexpr size_t BUCKETS=SUB_BUCKETS + (MAX_EXPONENT - SUB_BITS) * SUB_BUCKETS;
+
+        static size_t bucketFor(uint64_t nanos);
+        //largest value that maps to the bucket
+        static uint64_t bucketUpperBound(size_t index);
+
+        std::atomic<uint64_t> counts[BUCKETS];
+        std::atomic<uint64_t> sum;
+        std::atomic<uint64_t> max;
+
+        LatencyHistogram() { reset(); }
+        void record(uint64_t nanos);
+        void reset();
+    };
+
+    //HistogramSnapshot: a histogram merged over all shards
+    struct HistogramSnapshot
+    {
+        std::vector<uint64_t> counts;
+        uint64_t count=0;
+        uint64_t sum=0;
+        uint64_t max=0;
+
+        HistogramSnapshot() : counts(LatencyHistogram::BUCKETS, 0) {}
+        void merge(const LatencyHistogram& histogram);
+        //q in [0, 100]; the upper bound of the bucket holding that rank
+        uint64_t percentile(double q) const;
+        double mean() const { return count ? static_cast<double>(sum) / count : 0.0; }
+    };
+
+    //files whose I/O is accounted
+    enum class IoFile
+    {
+        DATA,        //the page store's data file
+        WAL,
+        METADATA,    //page map and bloom filter side files
+        COUNT
+    };
+    const char* ioFileName(IoFile file);
+
+    //IoSnapshot: one file's I/O merged over all shards. a write or read is one
+    //call into the file (syscall or stream); flushes push a stream's buffer to
+    //the kernel, syncs force it to the device
+    struct IoSnapshot
+    {
+        uint64_t reads=0;
+        uint64_t bytesRead=0;
+        uint64_t writes=0;
+        uint64_t bytesWritten=0;
+        uint64_t flushes=0;
+        uint64_t syncs=0;
+        HistogramSnapshot syncLatency;
+    };
+
     //Statistics tracking class (GitHub Issue #9)
+    //counters and latency histograms are sharded: each thread updates a
+    //cache-line-aligned shard, shared once many threads have come and gone,
+    //with relaxed atomics; readers sum the shards.
+    //the engine records into Statistics::global()
     class Statistics
     {
     private:
-        std::atomic<uint64_t> transactionCount;
-        std::atomic<uint64_t> putOperations;
-        std::atomic<uint64_t> getOperations;
-        std::atomic<uint64_t> deleteOperations;
-        std::atomic<uint64_t> cacheHits;
-        std::atomic<uint64_t> cacheMisses;
-        std::atomic<uint64_t> lockWaits;
-        std::atomic<uint64_t> deadlocksDetected;
-        
+        enum Counter
+        {
+            TRANSACTIONS,
+            PUT_OPERATIONS,
+            GET_OPERATIONS,
+            DELETE_OPERATIONS,
+            CACHE_HITS,
+            CACHE_MISSES,
+            LOCK_WAITS,
+            DEADLOCKS,
+            LOGICAL_BYTES,
+            COUNTER_COUNT
+        };
+        enum IoCounter
+        {
+            READS,
+            BYTES_READ,
+            WRITES,
+            BYTES_WRITTEN,
+            FLUSHES,
+            SYNCS,
+            IO_COUNTER_COUNT
+        };
+        struct Shard;
+        static constexpr size_t MAX_SHARDS=64;
+        //allocated by the first thread that lands on each slot
+        std::atomic<Shard*> shards[MAX_SHARDS];
+
+        Shard& localShard();
+        void addIo(IoFile file, IoCounter counter, uint64_t amount);
+        void add(Counter counter, uint64_t amount=1);
+        uint64_t total(Counter counter) const;
+
     public:
         Statistics();
-        
-        void incrementTransactions() { transactionCount++; }
-        void incrementPutOps() { putOperations++; }
-        void incrementGetOps() { getOperations++; }
-        void incrementDeleteOps() { deleteOperations++; }
-        void incrementCacheHits() { cacheHits++; }
-        void incrementCacheMisses() { cacheMisses++; }
-        void incrementLockWaits() { lockWaits++; }
-        void incrementDeadlocks() { deadlocksDetected++; }
-        
-        uint64_t getTransactionCount() const { return transactionCount.load(); }
-        uint64_t getPutOps() const { return putOperations.load(); }
-        uint64_t getGetOps() const { return getOperations.load(); }
-        uint64_t getDeleteOps() const { return deleteOperations.load(); }
-        uint64_t getCacheHits() const { return cacheHits.load(); }
-        uint64_t getCacheMisses() const { return cacheMisses.load(); }
-        uint64_t getLockWaits() const { return lockWaits.load(); }
-        uint64_t getDeadlocks() const { return deadlocksDetected.load(); }
-        
+        ~Statistics();
+        Statistics(const Statistics&)=delete;
+        Statistics& operator=(const Statistics&)=delete;
+
+        static Statistics& global();
+
+        void incrementTransactions() { add(TRANSACTIONS); }
+        void incrementPutOps() { add(PUT_OPERATIONS); }
+        void incrementGetOps() { add(GET_OPERATIONS); }
+        void incrementDeleteOps() { add(DELETE_OPERATIONS); }
+        void incrementCacheHits() { add(CACHE_HITS); }
+        void incrementCacheMisses() { add(CACHE_MISSES); }
+        void incrementLockWaits() { add(LOCK_WAITS); }
+        void incrementDeadlocks() { add(DEADLOCKS); }
+
+        uint64_t getTransactionCount() const { return total(TRANSACTIONS); }
+        uint64_t getPutOps() const { return total(PUT_OPERATIONS); }
+        uint64_t getGetOps() const { return total(GET_OPERATIONS); }
+        uint64_t getDeleteOps() const { return total(DELETE_OPERATIONS); }
+        uint64_t getCacheHits() const { return total(CACHE_HITS); }
+        uint64_t getCacheMisses() const { return total(CACHE_MISSES); }
+        uint64_t getLockWaits() const { return total(LOCK_WAITS); }
+        uint64_t getDeadlocks() const { return total(DEADLOCKS); }
+
+        void recordLatency(LatencyOp op, uint64_t nanos);
+        HistogramSnapshot latency(LatencyOp op) const;
+
+        void recordRead(IoFile file, uint64_t bytes);
+        void recordWrite(IoFile file, uint64_t bytes);
+        void recordFlush(IoFile file);
+        void recordSync(IoFile file, uint64_t nanos);
+        //key and value bytes a client asked to write, the base of write amplification
+        void recordLogicalWrite(uint64_t bytes) { add(LOGICAL_BYTES, bytes); }
+        uint64_t getLogicalBytes() const { return total(LOGICAL_BYTES); }
+        IoSnapshot io(IoFile file) const;
+        //bytes written to every file per logical byte, 0 before any client write
+        double writeAmplification() const;
+
         double getCacheHitRatio() const;
         void printStatistics() const;
+        //counters, per-operation count/mean/p50/p99/p999/max in nanoseconds and per-file I/O
+        std::string toJson() const;
         void reset();
     };
-}
 
+    //ScopedLatency: records the lifetime of the scope into Statistics::global()
+    class ScopedLatency
+    {
+    private:
+        LatencyOp op;
+        std::chrono::steady_clock::time_point start;
+    public:
+        explicit ScopedLatency(LatencyOp op) : op(op), start(std::chrono::steady_clock::now()) {}
+        ~ScopedLatency()
+        {
+            auto elapsed=std::chrono::steady_clock::now() - start;
+            Statistics::global().recordLatency(op, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+        }
+        ScopedLatency(const ScopedLatency&)=delete;
+        ScopedLatency& operator=(const ScopedLatency&)=delete;
+    };
+
+    //ScopedSync: times an fsync/fdatasync of file into Statistics::global()
+    class ScopedSync
+    {
+    private:
+        IoFile file;
+        std::chrono::steady_clock::time_point start;
+    public:
+        explicit ScopedSync(IoFile file) : file(file), start(std::chrono::steady_clock::now()) {}
+        ~ScopedSync()
+        {
+            auto elapsed=std::chrono::steady_clock::now() - start;
+            Statistics::global().recordSync(file, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+        }
+        ScopedSync(const ScopedSync&)=delete;
+        ScopedSync& operator=(const ScopedSync&)=delete;
+    };
+}
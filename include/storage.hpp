@@ -1,6 +1,11 @@
 #pragma once
 #include"common.hpp"
+#include"engine.hpp"
+#include"bufferpool.hpp"
+#include"bloom.hpp"
+#include"threadpool.hpp"
 #include<fstream>
+#include<list>
 #include<unordered_map>
 #include<unordered_set>
 #include<mutex>
@@ -8,12 +13,46 @@
 
 namespace stonedb
 {
-    class StorageManager
+    //PageCacheStats: where page fetches were served from since open
+    struct PageCacheStats
+    {
+        uint64_t frameHits=0;        //page was resident in the buffer pool
+        uint64_t compressedHits=0;   //decompressed from the compressed cache tier
+        uint64_t diskReads=0;        //read from the data file
+        uint64_t bytesRead=0;        //data file bytes read
+    };
+
+    //PageSnapshot: point-in-time read view of a StorageManager, see
+    //createSnapshot. holds the pages the store had when it was taken and the
+    //old image of each one changed since; the rest are read from the pool
+    class PageSnapshot
+    {
+    private:
+        friend class StorageManager;
+        std::vector<PageId> pages;     //sorted
+        std::unordered_map<PageId, std::shared_ptr<const PageBuffer>> images;     //guarded by the store's cacheMutex
+    public:
+        size_t pageCount() const { return pages.size(); }
+    };
+
+    //ScanOptions: how StorageManager::parallelScan delivers records
+    struct ScanOptions
+    {
+        //false: fn runs on the scan's threads as pages are parsed, in no
+        //order. true: every range sorts its records by key and the calling
+        //thread merges the ranges into one key-ordered stream, holding the
+        //scan's pages in memory until it ends
+        bool ordered=false;
+    };
+
+    //StorageManager: in-place page store, records live in 4KB pages
+    class StorageManager : public StorageEngine
     {
     private:
         std::string dbPath;
         std::fstream dbFile;
-        std::unordered_map<PageId, std::shared_ptr<Page>> pageCache;
+        StorageOptions options;
+        std::unique_ptr<BufferPool> bufferPool;
         std::mutex cacheMutex;
         PageId nextPageId;
         bool dbOpen;
@@ -23,37 +62,208 @@ namespace stonedb
         std::vector<PageId> freePages;
         std::unordered_set<PageId> allocatedPages;
         
+        //every live key is in keyFilter, so a negative probe means the key is
+        //absent and neither keyToPage nor any page has to be consulted
+        //deletes cannot clear bits; the filter is rebuilt once they pile up
+        BloomFilter keyFilter;
+        size_t filterDeletes;
+        void rebuildKeyFilter();
+        void noteKeyInserted(uint64_t hash);
+        void noteKeyDeleted();
+        bool loadKeyFilter();
+        bool saveKeyFilter();
+        
+        //extendible hash layout (options.layout == StorageLayout::HASH)
+        //page 0 holds the directory page list, the directory itself lives in
+        //memory and is written back on flush; bucket pages use the normal
+        //page format, so a GET reads exactly one page
+        struct BucketRef
+        {
+            PageId bucket;
+            uint32_t localDepth;
+        };
+        std::vector<BucketRef> directory;
+        std::vector<PageId> directoryPages;
+        uint32_t globalDepth;
+        uint64_t hashKeyCount;
+        //page 0 (depth, key count, page list) and the directory pages are
+        //written back separately: a key count change only rewrites page 0
+        bool hashMetaDirty;
+        std::unordered_set<size_t> dirtyDirectoryPages;
+        void markDirectory(size_t first, size_t end);
+        bool initHashLayout();
+        bool loadHashLayout();
+        bool saveHashLayout();
+        bool growDirectory();
+        bool splitBucket(size_t dirIndex);
+        bool compactBucket(PageId bucket);
+        bool writeBucket(PageId bucket, const std::vector<Record>& records);
+        bool hashPutRecord(const std::string& key, const std::string& value);
+        bool hashGetRecord(const std::string& key, std::string& value);
+        bool hashDeleteRecord(const std::string& key);
+        size_t liveKeyCount() const;
+        
+        //compressed page store (options.compression == PageCompression::LZ)
+        //page images live in extents of whole EXTENT_UNIT blocks after the file
+        //header, <path>.pagemap maps every PageId to its extent. a page that
+        //outgrows its extent moves; the old extent becomes reusable only once
+        //the map no longer points at it on disk
+        struct PageMapEntry
+        {
+            uint64_t offset;
+            uint32_t storedSize;     //0: never written, reads as zeros
+            uint16_t extentUnits;
+            uint16_t flags;
+        };
+        std::vector<PageMapEntry> pageMap;
+        std::vector<std::vector<uint64_t>> freeExtents;     //offsets by extent size in units
+        std::vector<std::pair<uint64_t, uint16_t>> pendingFreeExtents;
+        uint64_t dataEnd;
+        bool pageMapDirty;
+        bool loadPageMap();
+        bool savePageMap();
+        void rebuildFreeExtents();
+        bool writePageImage(PageId pageId, const uint8_t* image, size_t size, uint16_t flags);
+        //second cache tier: compressed page images in LRU order, filled on
+        //read and write; an image stays valid while its page is resident and
+        //clean, so evicting a clean page costs no compression
+        std::list<std::pair<PageId, std::string>> compressedLru;
+        std::unordered_map<PageId, std::list<std::pair<PageId, std::string>>::iterator> compressedIndex;
+        size_t compressedBytes;
+        size_t compressedLimit;
+        void cacheCompressed(PageId pageId, const uint8_t* image, size_t size);
+        bool loadCompressed(PageId pageId, uint8_t* data);
+        void dropCompressed(PageId pageId);
+        PageCacheStats cacheCounters;
+        
+        //bulk load (heap layout, uncompressed): pages are appended past
+        //nextPageId with raw writes, then published once their BULK_LOAD
+        //record commits. until then the file header holds the load's first
+        //page, and open() keeps [pendingLoadStart, pendingLoadEnd) out of the
+        //scan so recovery can publish or drop them
+        PageId pendingLoadStart;
+        PageId pendingLoadEnd;
+        bool setPendingLoad(int fd, PageId start);
+        bool publishLoad(int fd, PageId first, PageId end, std::vector<std::pair<std::string, PageId>>& keys);
+        bool flushAllUnlocked();
+        
+        //hot backup in progress: pages below pages still hold the image the
+        //backup started from until copied says otherwise; a write-back to
+        //such a page copies the old image out first
+        struct BackupCopy
+        {
+            int srcFd;
+            int dstFd;
+            PageId pages;
+            std::vector<bool> copied;
+            uint64_t preserved=0;
+            bool failed=false;
+        };
+        std::unique_ptr<BackupCopy> activeBackup;
+        void copyForBackup(PageId first, PageId end);
+        
+        //incremental backup: changedPages marks the pages written since the
+        //backup changeBase started; pages past its end count as written.
+        //changeBase 0 means nothing is known and only a full backup can
+        //follow. <path>.changes keeps the map across a clean close and is
+        //stale, like the bloom filter, once the data file changes after it
+        std::vector<bool> changedPages;
+        uint64_t changeBase;
+        void noteWritten(PageId first, PageId end);
+        bool loadChangeMap();
+        bool saveChangeMap();
+        
+        //snapshots: a page an open snapshot still reads as it was gets its
+        //current image copied into that snapshot before the first change,
+        //once, and shared by every snapshot that needs it. writers pay one
+        //page copy per snapshot per page and never wait for a reader
+        std::vector<std::shared_ptr<PageSnapshot>> snapshots;
+        PageBuffer snapshotScratch;
+        bool snapshotNeeds(PageId pageId) const;
+        void preservePage(PageId pageId, const uint8_t* image);
+        bool eraseRecord(Page& page, const std::string& key, uint64_t hash);
+        bool copySnapshotPage(const PageSnapshot& snapshot, PageId pageId, uint8_t* data);
+        bool readSnapshotPage(const PageSnapshot& snapshot, PageId pageId, int fd, uint8_t* data);
+        
+        //page-range work: open() parsing every page, flushes of many dirty
+        //pages and full scans run as tasks of PAGE_TASK_PAGES pages on pool,
+        //null when options.workerThreads is 1 and the caller does it all
+        ThreadPool* pool;
+        std::unique_ptr<ThreadPool> ownPool;
+        void runRanges(size_t count, const std::function<void(size_t begin, size_t end)>& fn);
+        bool readPages(const std::vector<PageId>& pages, const std::function<void(size_t index, const uint8_t* data)>& fn);
+        bool writePages(std::vector<Page*>& dirty);
+        
         //fix bug #17: page cache size limit to prevent unbounded growth
-        static constexpr size_t MAX_CACHE_SIZE=1000;
-        void evictLRUPage();
+        //now enforced by the fixed-size buffer pool (options.cacheFrames)
+        bool evictPage();
         
         static constexpr size_t HEADER_SIZE=64;
-        static constexpr size_t RECORD_HEADER_SIZE=8;
         
-        bool writePageToDisk(PageId pageId, const std::vector<uint8_t>& data);
-        bool readPageFromDisk(PageId pageId, std::vector<uint8_t>& data);
+        bool writePageToDisk(PageId pageId, const uint8_t* data);
+        bool readPageFromDisk(PageId pageId, uint8_t* data);
         PageId allocateNewPage();
         void deallocatePage(PageId pageId);
-        bool findFreeSpaceInPage(PageId pageId, const std::string& key, const std::string& value, size_t requiredSize);
+        bool findFreeSpaceInPage(PageId pageId, const std::string& key, const std::string& value, uint64_t hash);
+        //caller holds cacheMutex: the frame can be reused once it is released
         std::shared_ptr<Page> getPageUnlocked(PageId pageId);
         
     public:
         StorageManager();
-        ~StorageManager();
+        ~StorageManager() override;
         
-        bool open(const std::string& path);
-        void close();
-        bool isOpen() const { return dbOpen; }
+        bool open(const std::string& path, const StorageOptions& opts=StorageOptions()) override;
+        void close() override;
+        bool isOpen() const override { return dbOpen; }
         
-        std::shared_ptr<Page> getPage(PageId pageId);
+        //brings a page into the buffer pool; frames never leave cacheMutex,
+        //since eviction reuses them
+        bool loadPage(PageId pageId);
         bool flushPage(PageId pageId);
-        bool flushAll();
+        bool flushAll() override;
+        bool checkpoint() override;
         
-        bool putRecord(const std::string& key, const std::string& value);
-        bool getRecord(const std::string& key, std::string& value);
-        bool deleteRecord(const std::string& key);
+        bool putRecord(const std::string& key, const std::string& value) override;
+        bool getRecord(const std::string& key, std::string& value) override;
+        bool deleteRecord(const std::string& key) override;
         
         // simple scan for now
-        std::vector<Record> scanRecords();
+        std::vector<Record> scanRecords() override;
+        bool forEachRecord(const std::function<bool(std::string_view key, std::string_view value)>& fn) override;
+        
+        //createSnapshot: a point-in-time view of every record, read with the
+        //forEachRecord overload below while writers carry on; pages are only
+        //copied as writers change them. releaseSnapshot drops the copies,
+        //and close() releases whatever is still open
+        std::shared_ptr<const PageSnapshot> createSnapshot();
+        void releaseSnapshot(const std::shared_ptr<const PageSnapshot>& snapshot);
+        bool forEachRecord(const PageSnapshot& snapshot,
+                           const std::function<bool(std::string_view key, std::string_view value)>& fn);
+        //pages copied for the open snapshots, for tests
+        size_t snapshotImages();
+        
+        //parallelScan: every record of a snapshot taken for the call, as
+        //views into page copies, so nothing per record is copied. ranges of
+        //pages run on the store's pool and read pages that are not resident
+        //from the file without holding the store's lock. fn gets the index
+        //of the thread calling it, below scanSinks(), so per-thread sinks
+        //need no locking; it is called concurrently unless scan.ordered.
+        //false from fn stops the scan, which then returns false
+        bool parallelScan(const std::function<bool(size_t sink, std::string_view key, std::string_view value)>& fn,
+                          const ScanOptions& scan=ScanOptions());
+        size_t scanSinks() const { return pool ? pool->workerCount() + 1 : 1; }
+        
+        bool canBulkLoad() const override;
+        bool bulkLoad(KVIterator& input, WALManager& wal, BulkLoadStats& stats) override;
+        bool redoBulkLoad(std::string_view descriptor) override;
+        bool discardPendingLoad() override;
+        bool backupData(const std::string& destPath, const BackupOptions& backup, BackupStats& stats) override;
+        
+        StorageLayout layout() const { return options.layout; }
+        PageFormat pageFormat() const { return options.pageFormat; }
+        PageCompression compression() const { return options.compression; }
+        //pages read from the data file since open, for benchmarks
+        uint64_t pageReads() const { return cacheCounters.diskReads; }
+        PageCacheStats cacheStats() const { return cacheCounters; }
     };
 }
@@ -0,0 +1,90 @@
+#pragma once
+#include"common.hpp"
+#include<atomic>
+#include<condition_variable>
+#include<deque>
+#include<functional>
+#include<memory>
+#include<mutex>
+#include<thread>
+#include<vector>
+
+namespace stonedb
+{
+    //ThreadPool: work-stealing pool for engine work split into tasks
+    //every worker owns a deque: it pushes and pops its own tasks at the
+    //back, so a task's subtasks run hot in its cache, and when it runs dry
+    //it steals the oldest task from the front of another worker's deque.
+    //tasks submitted from outside the pool are dealt round-robin. idle
+    //workers sleep until something is queued
+    //tasks must not throw
+    class ThreadPool
+    {
+    private:
+        struct WorkQueue
+        {
+            std::mutex mutex;
+            std::deque<std::function<void()>> tasks;
+        };
+        std::vector<std::unique_ptr<WorkQueue>> queues;
+        std::vector<std::thread> workers;
+        std::atomic<size_t> queued;
+        std::atomic<size_t> nextQueue;
+        std::mutex sleepMutex;
+        std::condition_variable sleepCv;
+        bool stopping;
+
+        bool takeTask(size_t home, std::function<void()>& task);
+        void workerLoop(size_t index);
+
+    public:
+        //workers 0: one per hardware thread
+        explicit ThreadPool(size_t workers=0);
+        //runs what is still queued, then joins the workers
+        ~ThreadPool();
+        ThreadPool(const ThreadPool&)=delete;
+        ThreadPool& operator=(const ThreadPool&)=delete;
+
+        size_t workerCount() const { return workers.size(); }
+        //the calling thread's worker index in this pool, workerCount() for
+        //a thread that is not one of its workers
+        size_t currentWorker() const;
+        void submit(std::function<void()> task);
+        //splits [0, count) into ranges of at most grain items, runs
+        //fn(begin, end) for each on the pool and returns once all are done;
+        //the calling thread runs ranges too while it waits
+        void parallelFor(size_t count, size_t grain, const std::function<void(size_t begin, size_t end)>& fn);
+
+        //process-wide pool, one worker per hardware thread, started on first use
+        static ThreadPool& shared();
+    };
+
+    //TaskGroup: tasks on a pool that can be waited for together. each task
+    //waits in the group's own queue and the pool gets a stub that runs
+    //whichever is next; wait() runs the group's queued tasks on the calling
+    //thread and never anyone else's, so a caller may wait while holding a
+    //lock that unrelated pool tasks take, and groups nest
+    class TaskGroup
+    {
+    private:
+        struct State
+        {
+            std::mutex mutex;
+            std::condition_variable doneCv;
+            std::deque<std::function<void()>> tasks;
+            size_t pending=0;      //queued or running
+        };
+        ThreadPool& pool;
+        std::shared_ptr<State> state;
+        static bool runNext(State& state);
+
+    public:
+        explicit TaskGroup(ThreadPool& p) : pool(p), state(std::make_shared<State>()) {}
+        ~TaskGroup() { wait(); }
+        TaskGroup(const TaskGroup&)=delete;
+        TaskGroup& operator=(const TaskGroup&)=delete;
+
+        void run(std::function<void()> task);
+        void wait();
+    };
+}
@@ -1,6 +1,6 @@
 #pragma once
 #include"common.hpp"
-#include"storage.hpp"
+#include"engine.hpp"
 #include"wal.hpp"
 #include"lockmgr.hpp"
 #include<memory>
@@ -10,6 +10,7 @@ namespace stonedb
     enum class TransactionState
     {
         ACTIVE,
+        COMMITTING,     //commit record being made durable, txnMutex not held
         COMMITTED,
         ABORTED
     };
@@ -24,7 +25,7 @@ namespace stonedb
     class TransactionManager
     {
     private:
-        std::shared_ptr<StorageManager> storage;
+        std::shared_ptr<StorageEngine> storage;
         std::shared_ptr<WALManager> wal;
         std::shared_ptr<LockManager> lockMgr;
         std::unordered_map<TransactionId, Transaction> activeTxns;
@@ -34,7 +35,7 @@ namespace stonedb
         void releaseLocks(TransactionId txnId);
         
     public:
-        TransactionManager(std::shared_ptr<StorageManager> storage,
+        TransactionManager(std::shared_ptr<StorageEngine> storage,
                           std::shared_ptr<WALManager> wal,
                           std::shared_ptr<LockManager> lockMgr);
         TransactionId beginTransaction();
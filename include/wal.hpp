@@ -4,26 +4,101 @@
 #include<vector>
 #include<unordered_set>
 #include<memory>
+#include<atomic>
+#include<thread>
+#include<mutex>
+#include<condition_variable>
+#include<functional>
 
 namespace stonedb
 {
-    class StorageManager;
+    class StorageEngine;
+
+    //RecoveryTarget: where a point-in-time replay stops. only transactions
+    //whose COMMIT record lies below lsn and carries a timestamp (ms since
+    //the epoch) no later than timestamp are applied
+    struct RecoveryTarget
+    {
+        Lsn lsn=UINT64_MAX;
+        uint64_t timestamp=UINT64_MAX;
+    };
+
+    //LogSegment: one log file of a chain, whose first record has LSN base
+    struct LogSegment
+    {
+        std::string path;
+        Lsn base;
+    };
     
+    //WALManager: write-ahead log of transaction records
+    //file: [32-byte header: magic, version, base LSN] then framed records
+    //  [u32 crc32c][u32 payloadLen][payload]
+    //  payload: varint type, varint txnId, then per type
+    //    COMMIT_TXN: varint timestamp
+    //    PUT_RECORD: varint keyLen, key, varint valueLen, value
+    //    DELETE_RECORD: varint keyLen, key
+    //    BULK_LOAD: varint valueLen, value (engine-defined load descriptor)
+    //    PREPARE_TXN: varint valueLen, value (coordinator reference)
+    //the crc covers payloadLen and payload; replay stops at the first record
+    //that fails it and open() cuts a torn tail off. a record's LSN is the
+    //base LSN plus its offset after the header, so LSNs keep growing across
+    //truncations
+    //appends serialize straight into a preallocated ring log buffer without
+    //heap allocation. loggers run concurrently: each reserves its byte range
+    //(and so its LSN) with a fetch_add on the tail, copies its record in
+    //parallel with the others, then publishes in LSN order. a writer thread
+    //hands each contiguous published region to the file in one write and
+    //syncs when flush() asks for it; concurrent commits share those syncs
+    //open/close/replayLog/truncateLog must not race with loggers
+    //archive mode: truncateLog keeps the log it closes as a segment named by
+    //its base LSN in the archive directory, so the history since any backup
+    //can be replayed up to a chosen point (see restoreToPoint in backup.hpp)
     class WALManager
     {
     private:
         std::string walPath;
-        std::fstream walFile;
+        std::string archiveDir;
+        //truncateLog refuses while backups > 0; both guarded by truncateMutex
+        std::mutex truncateMutex;
+        int backups;
+        int walFd;
         bool walOpen;
-        std::unordered_set<TransactionId> committedTxns;
-        std::unordered_set<TransactionId> activeTxns;
+        Lsn baseLsn;
+        std::unique_ptr<uint8_t[]> logBuffer;
+
+        //ring offsets, all LSNs: reserved >= published >= written >= durable
+        alignas(64) std::atomic<Lsn> reservedLsn;
+        alignas(64) std::atomic<Lsn> publishedLsn;
+        alignas(64) std::atomic<Lsn> writtenLsn;
+        std::atomic<Lsn> durableLsn;
+        std::atomic<int> spaceWaiters;
+        std::atomic<bool> writeFailed;
+
+        //writer thread; the flags below are guarded by writerMutex
+        std::thread writer;
+        std::mutex writerMutex;
+        std::condition_variable writerCv;
+        std::condition_variable doneCv;
+        bool stopWriter;
+        bool writeRequested;
+        Lsn syncTarget;
         
         static constexpr size_t WAL_HEADER_SIZE=32;
+        static constexpr size_t LOG_BUFFER_SIZE=4 << 20;
         
-        bool writeLogEntry(const LogEntry& entry);
-        bool readLogEntry(LogEntry& entry);
-        void serializeEntry(const LogEntry& entry, std::vector<uint8_t>& data);
-        bool deserializeEntry(const std::vector<uint8_t>& data, LogEntry& entry);
+        bool createLog(Lsn base);
+        bool archiveLog();
+        static bool replaySegments(const std::vector<LogSegment>& segments, const RecoveryTarget& target,
+                                   const std::function<bool(const LogEntry&)>& apply, size_t redoThreads, Lsn& end);
+        void resetOffsets(Lsn end);
+        bool appendRecord(LogType type, TransactionId txnId, uint64_t timestamp, std::string_view key, std::string_view value);
+        void copyToRing(Lsn at, const void* data, size_t size);
+        bool waitForSpace(Lsn end);
+        void requestWrite();
+        void startWriter();
+        void stopWriterThread();
+        void writerLoop();
+        bool writeRing(Lsn from, Lsn to);
         
     public:
         WALManager();
@@ -39,11 +114,67 @@ namespace stonedb
         bool logBeginTxn(TransactionId txnId);
         bool logCommitTxn(TransactionId txnId);
         bool logAbortTxn(TransactionId txnId);
-        bool logPutRecord(TransactionId txnId, const std::string& key, const std::string& value);
-        bool logDeleteRecord(TransactionId txnId, const std::string& key);
+        bool logPutRecord(TransactionId txnId, std::string_view key, std::string_view value);
+        bool logDeleteRecord(TransactionId txnId, std::string_view key);
+        //appends a BULK_LOAD record and flushes; the record commits on its own,
+        //so once this returns the load survives a crash
+        bool logBulkLoad(std::string_view descriptor);
+        //appends a PREPARE record and flushes: the transaction's records are
+        //durable and it waits for coordinator's decision, which a COMMIT or
+        //ABORT record logged later carries. replay treats a transaction
+        //that never got one as uncommitted
+        bool logPrepareTxn(TransactionId txnId, std::string_view coordinator);
+        //two-phase commit recovery, before replay: inDoubt receives the
+        //PREPARE record of every transaction still waiting for its decision,
+        //committed the ids of the prepared ones that did commit. memory is
+        //bounded by the prepared transactions, not the log size
+        bool preparedTransactions(std::vector<LogEntry>& inDoubt, std::unordered_set<TransactionId>& committed);
+        //streams committed PUT/DELETE records to apply in log order: a first
+        //pass finds the transactions that did not commit, a second one applies
+        //the rest. memory is bounded by the in-flight and aborted transactions,
+        //not the log size. false if the log is closed or apply returns false
+        //with redoThreads > 1 records are partitioned by key hash over that many
+        //workers calling apply concurrently; order is kept per key only. a
+        //BULK_LOAD record is a barrier: everything before it is applied first
+        //and it is applied alone, on the calling thread
+        bool replayLog(const std::function<bool(const LogEntry&)>& apply, size_t redoThreads=1);
+        //collects the committed records; for tests and small logs
         std::vector<LogEntry> replayLog();
+        //LSN the next record will get; everything below it has been appended
+        Lsn endLsn() const { return reservedLsn.load(); }
+        //waits until every record published so far is written and synced
         bool flush();
-        bool checkpoint(std::shared_ptr<StorageManager> storage);
+        bool checkpoint(std::shared_ptr<StorageEngine> storage);
+        //starts a new, empty log at the current end. in archive mode the
+        //closed log is kept first; if that fails nothing is truncated
         bool truncateLog();
+        //beginBackup holds truncateLog off until the matching endBackup, so
+        //a log copied meanwhile still starts at or before the LSN returned
+        Lsn beginBackup();
+        void endBackup();
+        //turns on archive mode; dir is created if needed
+        bool setArchiveDir(const std::string& dir);
+        const std::string& archiveDirectory() const { return archiveDir; }
+        //copies the log, up to everything appended before the call, to
+        //destPath for a hot backup; end receives the LSN the copy stops at.
+        //loggers may keep appending meanwhile
+        bool copyLog(const std::string& destPath, Lsn& end);
+
+        //writes an empty log at path whose first record will get LSN base,
+        //replacing any file there in one rename
+        static bool createLogFile(const std::string& path, Lsn base);
+        //reads the header of the log at path: base is its first LSN and end
+        //the LSN just past its last byte
+        static bool readLogBounds(const std::string& path, Lsn& base, Lsn& end);
+        //archive segment name for a log whose first LSN is base
+        static std::string segmentName(Lsn base);
+        //point-in-time replay over several log files, e.g. a backup's copy,
+        //archived segments and the live log, given in any order: starting at
+        //the one whose base is start, each next file must begin where the
+        //previous one ends, and of files with the same base the longest is
+        //read. the committed transactions that reach target are streamed to
+        //apply like replayLog does; end receives the LSN replay stopped at
+        static bool replayChain(const std::vector<std::string>& paths, Lsn start, const RecoveryTarget& target,
+                                const std::function<bool(const LogEntry&)>& apply, Lsn& end);
     };
 }
@@ -0,0 +1,345 @@
+#include"backup.hpp"
+#include"storage.hpp"
+#include<chrono>
+#include<cstring>
+#include<ctime>
+#include<filesystem>
+#include<fstream>
+#include<fcntl.h>
+#include<sys/stat.h>
+#include<unistd.h>
+
+namespace stonedb
+{
+    namespace
+    {
+        const char* BACKUP_MAGIC="stonedb-hot-backup 1";
+
+        std::string backupFile(const std::string& dir, const char* name)
+        {
+            return (std::filesystem::path(dir) / name).string();
+        }
+
+        //sidecars describe the data file they were written for
+        void removeSidecars(const std::string& dbPath)
+        {
+            for(const char* suffix : {".bloom", ".pagemap", ".changes"}) std::remove((dbPath + suffix).c_str());
+        }
+
+        //copies src over dest through a temporary file and a rename, so dest
+        //is either the old file or the complete new one
+        bool replaceFile(const std::string& src, const std::string& dest, uint64_t& bytes)
+        {
+            std::string tmpPath=dest + ".restore.tmp";
+            int srcFd=::open(src.c_str(), O_RDONLY | O_CLOEXEC);
+            int dstFd=::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            struct stat st;
+            bool ok=srcFd >= 0 && dstFd >= 0 && fstat(srcFd, &st) == 0;
+            if(ok)
+            {
+                bytes=static_cast<uint64_t>(st.st_size);
+                ok=copyFileBytes(srcFd, 0, dstFd, 0, bytes) && fdatasync(dstFd) == 0;
+            }
+            if(srcFd >= 0) ::close(srcFd);
+            if(dstFd >= 0) ::close(dstFd);
+            if(ok) ok=std::rename(tmpPath.c_str(), dest.c_str()) == 0;
+            if(!ok)
+            {
+                logError("failed to restore " + dest + " from " + src + ": " + std::string(strerror(errno)));
+                std::remove(tmpPath.c_str());
+            }
+            return ok;
+        }
+
+        //keeps the log from being truncated for the lifetime of a backup
+        struct BackupHold
+        {
+            WALManager& wal;
+            Lsn start;
+            explicit BackupHold(WALManager& log) : wal(log), start(log.beginBackup()) {}
+            ~BackupHold() { wal.endBackup(); }
+        };
+
+        bool runBackup(StorageEngine& engine, WALManager& wal, const std::string& dir, const BackupInfo* parent,
+                       BackupInfo& info)
+        {
+            auto start=std::chrono::steady_clock::now();
+            info=BackupInfo();
+            std::error_code ec;
+            std::filesystem::create_directories(dir, ec);
+            if(ec)
+            {
+                logError("cannot create backup directory " + dir + ": " + ec.message());
+                return false;
+            }
+            if(std::filesystem::exists(backupFile(dir, "BACKUP")))
+            {
+                logError("backup directory " + dir + " already holds a backup");
+                return false;
+            }
+            BackupOptions options;
+            options.id=std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+            if(parent)
+            {
+                options.id=std::max<uint64_t>(options.id, parent->id + 1);
+                options.incremental=true;
+                options.base=parent->id;
+            }
+            info.id=options.id;
+            info.incremental=options.incremental;
+            info.parent=options.base;
+            //data first: the log copied afterwards must reach past every change
+            //the data image is missing
+            BackupHold hold(wal);
+            info.walStart=hold.start;
+            BackupStats stats;
+            if(!engine.backupData(backupFile(dir, "data"), options, stats)) return false;
+            if(!wal.copyLog(backupFile(dir, "wal"), info.walEnd)) return false;
+            info.pages=stats.pages;
+            info.dataBytes=stats.bytes;
+            info.preserved=stats.preserved;
+            info.walBytes=std::filesystem::file_size(backupFile(dir, "wal"), ec);
+
+            if(info.incremental)
+            {
+                std::ofstream out(backupFile(dir, "extents"), std::ios::trunc);
+                for(const auto& extent : stats.extents) out << extent.first << " " << extent.second << "\n";
+                out.close();
+                if(!out)
+                {
+                    logError("failed to write backup extents in " + dir);
+                    return false;
+                }
+            }
+            std::string manifestPath=backupFile(dir, "BACKUP");
+            {
+                std::ofstream out(manifestPath + ".tmp", std::ios::trunc);
+                out << BACKUP_MAGIC << "\n";
+                out << "created " << std::time(nullptr) << "\n";
+                out << "id " << info.id << "\n";
+                if(info.incremental) out << "parent " << info.parent << "\n";
+                out << "pages " << info.pages << "\n";
+                out << "wal_start_lsn " << info.walStart << "\n";
+                out << "wal_end_lsn " << info.walEnd << "\n";
+                out.close();
+                if(!out || std::rename((manifestPath + ".tmp").c_str(), manifestPath.c_str()) != 0)
+                {
+                    logError("failed to write backup manifest " + manifestPath);
+                    return false;
+                }
+            }
+            info.seconds=std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            log(std::string(info.incremental ? "incremental" : "hot") + " backup to " + dir + ": " +
+                std::to_string(info.dataBytes) + " data bytes, log up to lsn " + std::to_string(info.walEnd));
+            return true;
+        }
+
+        //reads the manifests of a chain and checks each backup builds on the
+        //one before it
+        bool readChain(const std::vector<std::string>& dirs, std::vector<BackupInfo>& chain)
+        {
+            chain.resize(dirs.size());
+            for(size_t i=0; i<dirs.size(); i++)
+            {
+                if(!readBackupInfo(dirs[i], chain[i])) return false;
+                if(i == 0 && chain[i].incremental)
+                {
+                    logError(dirs[i] + " is an incremental backup; a restore starts from a full one");
+                    return false;
+                }
+                if(i > 0 && (!chain[i].incremental || chain[i].parent != chain[i - 1].id))
+                {
+                    logError(dirs[i] + " does not build on " + dirs[i - 1]);
+                    return false;
+                }
+            }
+            if(dirs.empty()) logError("no backup to restore");
+            return !dirs.empty();
+        }
+
+        //writes the data file of a chain to dbPath: the full image, then the
+        //extents of each incremental one on top, sized like the last image
+        bool assembleData(const std::vector<std::string>& dirs, const std::string& dbPath, uint64_t& bytes)
+        {
+            if(!replaceFile(backupFile(dirs[0], "data"), dbPath, bytes)) return false;
+            int dstFd=::open(dbPath.c_str(), O_WRONLY | O_CLOEXEC);
+            bool ok=dstFd >= 0;
+            for(size_t i=1; ok && i<dirs.size(); i++)
+            {
+                std::string dataPath=backupFile(dirs[i], "data");
+                std::ifstream extents(backupFile(dirs[i], "extents"));
+                int srcFd=::open(dataPath.c_str(), O_RDONLY | O_CLOEXEC);
+                struct stat st;
+                ok=extents.is_open() && srcFd >= 0 && fstat(srcFd, &st) == 0;
+                uint64_t offset, length;
+                while(ok && extents >> offset >> length)
+                {
+                    ok=copyFileBytes(srcFd, offset, dstFd, offset, length);
+                    bytes += length;
+                }
+                if(ok) ok=ftruncate(dstFd, st.st_size) == 0;
+                if(srcFd >= 0) ::close(srcFd);
+                if(!ok) logError("failed to apply incremental backup " + dirs[i] + ": " + std::string(strerror(errno)));
+            }
+            if(ok && fdatasync(dstFd) != 0) ok=false;
+            if(dstFd >= 0) ::close(dstFd);
+            return ok;
+        }
+    }
+
+    bool hotBackup(StorageEngine& engine, WALManager& wal, const std::string& dir, BackupInfo& info)
+    {
+        return runBackup(engine, wal, dir, nullptr, info);
+    }
+
+    bool incrementalBackup(StorageEngine& engine, WALManager& wal, const std::string& dir,
+                           const std::string& parentDir, BackupInfo& info)
+    {
+        BackupInfo parent;
+        if(!readBackupInfo(parentDir, parent)) return false;
+        return runBackup(engine, wal, dir, &parent, info);
+    }
+
+    bool isBackupDirectory(const std::string& dir)
+    {
+        std::ifstream in(backupFile(dir, "BACKUP"));
+        std::string magic;
+        return std::getline(in, magic) && magic == BACKUP_MAGIC;
+    }
+
+    bool readBackupInfo(const std::string& dir, BackupInfo& info)
+    {
+        info=BackupInfo();
+        std::ifstream in(backupFile(dir, "BACKUP"));
+        std::string line;
+        if(!std::getline(in, line) || line != BACKUP_MAGIC)
+        {
+            logError(dir + " is not a complete hot backup");
+            return false;
+        }
+        std::string field;
+        while(in >> field)
+        {
+            if(field == "id") in >> info.id;
+            else if(field == "parent")
+            {
+                in >> info.parent;
+                info.incremental=true;
+            }
+            else if(field == "pages") in >> info.pages;
+            else if(field == "wal_start_lsn") in >> info.walStart;
+            else if(field == "wal_end_lsn") in >> info.walEnd;
+            else in >> line;
+        }
+        return true;
+    }
+
+    bool restoreBackup(const std::vector<std::string>& dirs, const std::string& dbPath, const std::string& walPath,
+                       BackupInfo& info)
+    {
+        auto start=std::chrono::steady_clock::now();
+        std::vector<BackupInfo> chain;
+        if(!readChain(dirs, chain)) return false;
+        info=chain.back();
+        //each file is swapped in whole; a restore cut short leaves a
+        //mismatched pair and has to be run again
+        if(!replaceFile(backupFile(dirs.back(), "wal"), walPath, info.walBytes)) return false;
+        if(!assembleData(dirs, dbPath, info.dataBytes)) return false;
+        removeSidecars(dbPath);
+        info.seconds=std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        log("restored " + dbPath + " from " + std::to_string(dirs.size()) + " backup(s) ending with " + dirs.back());
+        return true;
+    }
+
+    bool restoreBackup(const std::string& dir, const std::string& dbPath, const std::string& walPath, BackupInfo& info)
+    {
+        return restoreBackup(std::vector<std::string>{dir}, dbPath, walPath, info);
+    }
+
+    bool restoreToPoint(const std::vector<std::string>& dirs, const std::string& archiveDir, const std::string& dbPath,
+                        const std::string& walPath, const RecoveryTarget& target, Lsn& reached, BackupInfo& info)
+    {
+        auto start=std::chrono::steady_clock::now();
+        std::vector<BackupInfo> chain;
+        if(!readChain(dirs, chain)) return false;
+        info=chain.back();
+
+        //every log that may continue the backup's copy; past the newest one
+        //is where the restored log starts
+        std::vector<std::string> logs{backupFile(dirs.back(), "wal")};
+        if(!archiveDir.empty())
+        {
+            std::error_code ec;
+            for(const auto& file : std::filesystem::directory_iterator(archiveDir, ec))
+            {
+                if(file.path().extension() == ".wal") logs.push_back(file.path().string());
+            }
+        }
+        if(std::filesystem::exists(walPath)) logs.push_back(walPath);
+        Lsn walBase=0;
+        Lsn historyEnd=0;
+        for(size_t i=0; i<logs.size(); i++)
+        {
+            Lsn base, end;
+            if(!WALManager::readLogBounds(logs[i], base, end)) continue;
+            if(i == 0) walBase=base;
+            historyEnd=std::max(historyEnd, end);
+        }
+
+        //rebuild and replay next to the database, which stays untouched until then
+        std::string workPath=dbPath + ".pitr";
+        removeSidecars(workPath);
+        if(!assembleData(dirs, workPath, info.dataBytes)) return false;
+        bool ok;
+        {
+            StorageManager storage;
+            ok=storage.open(workPath);
+            ok=ok && WALManager::replayChain(logs, walBase, target, [&](const LogEntry& entry)
+            {
+                return storage.applyLogEntry(entry);
+            }, reached);
+            ok=ok && storage.discardPendingLoad() && storage.checkpoint();
+            storage.close();
+        }
+        if(ok && reached < info.walStart)
+        {
+            logError("the recovery target lies before backup " + dirs.back() + " was taken (lsn " +
+                     std::to_string(info.walStart) + ")");
+            ok=false;
+        }
+        //the live log holds history past the archive; keep it with the rest
+        if(ok && !archiveDir.empty() && std::filesystem::exists(walPath))
+        {
+            Lsn base, end;
+            std::error_code ec;
+            if(WALManager::readLogBounds(walPath, base, end) && end > base)
+            {
+                std::filesystem::copy_file(walPath, (std::filesystem::path(archiveDir) / WALManager::segmentName(base)),
+                                           std::filesystem::copy_options::overwrite_existing, ec);
+            }
+            if(ec)
+            {
+                logError("failed to archive " + walPath + ": " + ec.message());
+                ok=false;
+            }
+        }
+        //a restore cut short between these two renames has to be run again
+        if(ok && std::rename(workPath.c_str(), dbPath.c_str()) != 0)
+        {
+            logError("failed to move the restored database to " + dbPath + ": " + std::string(strerror(errno)));
+            ok=false;
+        }
+        ok=ok && WALManager::createLogFile(walPath, historyEnd + 1);
+        removeSidecars(workPath);
+        if(!ok)
+        {
+            std::remove(workPath.c_str());
+            return false;
+        }
+        removeSidecars(dbPath);
+        info.seconds=std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        log("restored " + dbPath + " to lsn " + std::to_string(reached));
+        return true;
+    }
+}
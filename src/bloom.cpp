@@ -0,0 +1,117 @@
+#include"bloom.hpp"
+#include<cstring>
+#if defined(__x86_64__) || defined(__i386__)
+#include<immintrin.h>
+#define STONEDB_BLOOM_X86 1
+#endif
+
+namespace stonedb
+{
+    //odd multipliers from the split-block filter design (Putze et al, Parquet)
+    alignas(32) static const uint32_t SALT[8]={
+        0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+        0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U
+    };
+    static constexpr uint32_t BLOOM_MAGIC=0x4d4c4253;   //"SBLM"
+    static constexpr uint32_t BLOOM_VERSION=1;
+    static constexpr size_t BLOOM_HEADER_SIZE=24;
+
+    static bool probeScalar(const uint32_t* words, uint32_t key)
+    {
+        for(int i=0; i<8; i++)
+        {
+            uint32_t mask=1U << ((key * SALT[i]) >> 27);
+            if((words[i] & mask) == 0) return false;
+        }
+        return true;
+    }
+
+#ifdef STONEDB_BLOOM_X86
+    __attribute__((target("avx2")))
+    static bool probeAvx2(const uint32_t* words, uint32_t key)
+    {
+        __m256i salt=_mm256_load_si256(reinterpret_cast<const __m256i*>(SALT));
+        __m256i shifts=_mm256_srli_epi32(_mm256_mullo_epi32(_mm256_set1_epi32(static_cast<int>(key)), salt), 27);
+        __m256i mask=_mm256_sllv_epi32(_mm256_set1_epi32(1), shifts);
+        __m256i block=_mm256_load_si256(reinterpret_cast<const __m256i*>(words));
+        //testc is set when every mask bit is also set in the block
+        return _mm256_testc_si256(block, mask) != 0;
+    }
+#endif
+
+    using ProbeFn=bool(*)(const uint32_t*, uint32_t);
+    static ProbeFn selectProbe()
+    {
+#ifdef STONEDB_BLOOM_X86
+        __builtin_cpu_init();
+        if(__builtin_cpu_supports("avx2")) return probeAvx2;
+#endif
+        return probeScalar;
+    }
+    static const ProbeFn probeBlock=selectProbe();
+
+    BloomFilter::BloomFilter() : insertedCount(0) {}
+
+    BloomFilter::BloomFilter(size_t expectedKeys) : insertedCount(0)
+    {
+        reset(expectedKeys);
+    }
+
+    void BloomFilter::reset(size_t expectedKeys)
+    {
+        size_t bits=std::max<size_t>(expectedKeys, 1) * BITS_PER_KEY;
+        size_t blockCount=(bits + 255) / 256;
+        blocks.assign(blockCount, Block{});
+        insertedCount=0;
+    }
+
+    void BloomFilter::insert(uint64_t hash)
+    {
+        if(blocks.empty()) return;
+        uint32_t* words=blocks[blockIndex(hash)].words;
+        uint32_t key=static_cast<uint32_t>(hash);
+        for(int i=0; i<8; i++)
+        {
+            words[i] |= 1U << ((key * SALT[i]) >> 27);
+        }
+        insertedCount++;
+    }
+
+    bool BloomFilter::mayContain(uint64_t hash) const
+    {
+        if(blocks.empty()) return true;
+        return probeBlock(blocks[blockIndex(hash)].words, static_cast<uint32_t>(hash));
+    }
+
+    void BloomFilter::serialize(std::vector<uint8_t>& out) const
+    {
+        size_t start=out.size();
+        out.resize(start + BLOOM_HEADER_SIZE + byteSize());
+        uint8_t* p=out.data() + start;
+        uint64_t blockCount=blocks.size();
+        uint64_t inserted=insertedCount;
+        memcpy(p, &BLOOM_MAGIC, 4);
+        memcpy(p + 4, &BLOOM_VERSION, 4);
+        memcpy(p + 8, &blockCount, 8);
+        memcpy(p + 16, &inserted, 8);
+        if(!blocks.empty()) memcpy(p + BLOOM_HEADER_SIZE, blocks.data(), byteSize());
+    }
+
+    bool BloomFilter::deserialize(const uint8_t* data, size_t size)
+    {
+        if(size < BLOOM_HEADER_SIZE) return false;
+        uint32_t magic, version;
+        uint64_t blockCount, inserted;
+        memcpy(&magic, data, 4);
+        memcpy(&version, data + 4, 4);
+        memcpy(&blockCount, data + 8, 8);
+        memcpy(&inserted, data + 16, 8);
+        if(magic != BLOOM_MAGIC || version != BLOOM_VERSION) return false;
+        if(blockCount > (size - BLOOM_HEADER_SIZE) / sizeof(Block)) return false;
+        if(blockCount * sizeof(Block) != size - BLOOM_HEADER_SIZE) return false;
+        blocks.assign(blockCount, Block{});
+        if(blockCount > 0) memcpy(blocks.data(), data + BLOOM_HEADER_SIZE, blockCount * sizeof(Block));
+        insertedCount=inserted;
+        return true;
+    }
+}
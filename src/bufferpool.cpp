@@ -0,0 +1,182 @@
+#include"bufferpool.hpp"
+#include<sys/mman.h>
+#include<cstring>
+
+namespace stonedb
+{
+    static constexpr size_t HUGE_PAGE_SIZE=2*1024*1024;
+
+    FrameArena::FrameArena(size_t frames, bool useHugePages)
+        : mapping(nullptr), mappingBytes(0), base(nullptr), frameCount(frames), hugePages(false)
+    {
+        size_t bytes=frames * PAGE_SIZE;
+        if(bytes == 0) return;
+        size_t alignment=useHugePages ? HUGE_PAGE_SIZE : PAGE_SIZE;
+        //over-map by one alignment unit so the arena can start on a boundary
+        mappingBytes=((bytes + alignment - 1) / alignment) * alignment + alignment;
+        mapping=mmap(nullptr, mappingBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(mapping == MAP_FAILED)
+        {
+            mapping=nullptr;
+            logError("failed to map buffer pool arena of " + std::to_string(bytes) + " bytes");
+            return;
+        }
+        uintptr_t start=reinterpret_cast<uintptr_t>(mapping);
+        uintptr_t aligned=(start + alignment - 1) & ~(static_cast<uintptr_t>(alignment) - 1);
+        base=reinterpret_cast<uint8_t*>(aligned);
+#ifdef MADV_HUGEPAGE
+        if(useHugePages)
+        {
+            size_t hugeBytes=((bytes + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE) * HUGE_PAGE_SIZE;
+            hugePages=madvise(base, hugeBytes, MADV_HUGEPAGE) == 0;
+            if(!hugePages) log("huge pages unavailable, using regular pages for buffer pool");
+        }
+#endif
+    }
+
+    FrameArena::~FrameArena()
+    {
+        if(mapping) munmap(mapping, mappingBytes);
+    }
+
+    BufferPool::BufferPool(size_t frameCount, bool useHugePages)
+        : arena(frameCount, useHugePages), descriptors(std::make_shared<std::vector<Page>>()),
+          tableMask(0), clockHand(0)
+    {
+        if(!arena.isValid()) return;
+        descriptors->reserve(frameCount);
+        freeFrames.reserve(frameCount);
+        for(size_t i=0; i<frameCount; i++)
+        {
+            descriptors->emplace_back(NO_PAGE, arena.frame(i));
+        }
+        //pop order hands out low frames first so the arena is touched sequentially
+        for(size_t i=frameCount; i>0; i--)
+        {
+            freeFrames.push_back(static_cast<uint32_t>(i - 1));
+        }
+        referenced.assign(frameCount, 0);
+
+        //keep the load factor at or below 1/2 for short linear probes
+        size_t tableSize=1;
+        while(tableSize < frameCount * 2) tableSize <<= 1;
+        table.assign(tableSize, 0);
+        tableMask=tableSize - 1;
+    }
+
+    size_t BufferPool::homeSlot(PageId pageId) const
+    {
+        return static_cast<size_t>((static_cast<uint64_t>(pageId) * 0x9E3779B97F4A7C15ULL) >> 32) & tableMask;
+    }
+
+    size_t BufferPool::findSlot(PageId pageId) const
+    {
+        size_t slot=homeSlot(pageId);
+        while(table[slot] != 0)
+        {
+            if((*descriptors)[table[slot] - 1].pageId == pageId) return slot;
+            slot=(slot + 1) & tableMask;
+        }
+        return slot;
+    }
+
+    void BufferPool::tableInsert(PageId pageId, uint32_t frameIndex)
+    {
+        table[findSlot(pageId)]=frameIndex + 1;
+    }
+
+    void BufferPool::tableErase(PageId pageId)
+    {
+        size_t hole=findSlot(pageId);
+        if(table[hole] == 0) return;
+        table[hole]=0;
+        //backward-shift deletion keeps probe chains intact without tombstones
+        size_t slot=hole;
+        while(true)
+        {
+            slot=(slot + 1) & tableMask;
+            if(table[slot] == 0) break;
+            size_t home=homeSlot((*descriptors)[table[slot] - 1].pageId);
+            bool stays=(slot > hole) ? (home > hole && home <= slot) : (home > hole || home <= slot);
+            if(stays) continue;
+            table[hole]=table[slot];
+            table[slot]=0;
+            hole=slot;
+        }
+    }
+
+    std::shared_ptr<Page> BufferPool::handle(size_t frameIndex)
+    {
+        //aliasing constructor: shares the descriptor array's control block, no allocation
+        return std::shared_ptr<Page>(descriptors, &(*descriptors)[frameIndex]);
+    }
+
+    std::shared_ptr<Page> BufferPool::find(PageId pageId)
+    {
+        if(table.empty()) return nullptr;
+        size_t slot=findSlot(pageId);
+        if(table[slot] == 0) return nullptr;
+        size_t frameIndex=table[slot] - 1;
+        referenced[frameIndex]=1;
+        return handle(frameIndex);
+    }
+
+    std::shared_ptr<Page> BufferPool::install(PageId pageId)
+    {
+        if(freeFrames.empty()) return nullptr;
+        uint32_t frameIndex=freeFrames.back();
+        freeFrames.pop_back();
+        Page& page=(*descriptors)[frameIndex];
+        page.pageId=pageId;
+        page.isDirty=false;
+        referenced[frameIndex]=1;
+        tableInsert(pageId, frameIndex);
+        return handle(frameIndex);
+    }
+
+    std::shared_ptr<Page> BufferPool::pickVictim()
+    {
+        size_t frames=descriptors->size();
+        if(frames == 0) return nullptr;
+        size_t dirtyCandidate=frames;
+        //CLOCK sweep: clear reference bits on the first pass, prefer clean pages
+        for(size_t step=0; step < 2 * frames; step++)
+        {
+            size_t frameIndex=clockHand;
+            clockHand=(clockHand + 1) % frames;
+            const Page& page=(*descriptors)[frameIndex];
+            if(page.pageId == NO_PAGE) continue;
+            if(referenced[frameIndex])
+            {
+                referenced[frameIndex]=0;
+                continue;
+            }
+            if(!page.isDirty) return handle(frameIndex);
+            if(dirtyCandidate == frames) dirtyCandidate=frameIndex;
+        }
+        if(dirtyCandidate != frames) return handle(dirtyCandidate);
+        return nullptr;
+    }
+
+    void BufferPool::evict(PageId pageId)
+    {
+        if(table.empty()) return;
+        size_t slot=findSlot(pageId);
+        if(table[slot] == 0) return;
+        uint32_t frameIndex=table[slot] - 1;
+        tableErase(pageId);
+        Page& page=(*descriptors)[frameIndex];
+        page.pageId=NO_PAGE;
+        page.isDirty=false;
+        referenced[frameIndex]=0;
+        freeFrames.push_back(frameIndex);
+    }
+
+    void BufferPool::clear()
+    {
+        for(size_t i=0; i<descriptors->size(); i++)
+        {
+            if((*descriptors)[i].pageId != NO_PAGE) evict((*descriptors)[i].pageId);
+        }
+    }
+}
@@ -0,0 +1,464 @@
+#include"bulkload.hpp"
+#include"kviterator.hpp"
+#include<algorithm>
+#include<chrono>
+#include<cstring>
+#include<filesystem>
+#include<fstream>
+#include<queue>
+#include<unistd.h>
+
+namespace stonedb
+{
+    bool parseLoadFormat(const std::string& name, LoadFormat& format)
+    {
+        if(name == "csv") format=LoadFormat::CSV;
+        else if(name == "tsv") format=LoadFormat::TSV;
+        else if(name == "binary") format=LoadFormat::BINARY;
+        else return false;
+        return true;
+    }
+
+    namespace
+    {
+        //RecordReader: pulls one key/value pair at a time out of the input file
+        class RecordReader
+        {
+        private:
+            std::ifstream in;
+            LoadFormat format;
+            std::string line;
+            uint64_t lineNumber=0;
+            bool failed=false;
+
+            bool fail(const std::string& message)
+            {
+                logError("load input line " + std::to_string(lineNumber) + ": " + message);
+                failed=true;
+                return false;
+            }
+
+            bool readLine()
+            {
+                if(!std::getline(in, line)) return false;
+                lineNumber++;
+                if(!line.empty() && line.back() == '\r') line.pop_back();
+                return true;
+            }
+
+            //one CSV field starting at pos; a quoted field may continue on the
+            //following lines. leaves pos on the delimiter or at the end of line
+            bool csvField(size_t& pos, std::string& out, bool rest)
+            {
+                out.clear();
+                if(pos >= line.size() || line[pos] != '"')
+                {
+                    size_t end=rest ? line.size() : line.find(',', pos);
+                    if(end == std::string::npos) end=line.size();
+                    out.assign(line, pos, end - pos);
+                    pos=end;
+                    return true;
+                }
+                pos++;
+                while(true)
+                {
+                    size_t quote=line.find('"', pos);
+                    if(quote == std::string::npos)
+                    {
+                        out.append(line, pos, std::string::npos);
+                        out.push_back('\n');
+                        if(!readLine()) return fail("unterminated quoted field");
+                        pos=0;
+                        continue;
+                    }
+                    out.append(line, pos, quote - pos);
+                    if(quote + 1 < line.size() && line[quote + 1] == '"')
+                    {
+                        out.push_back('"');
+                        pos=quote + 2;
+                        continue;
+                    }
+                    pos=quote + 1;
+                    if(pos < line.size() && line[pos] != ',') return fail("text after a closing quote");
+                    return true;
+                }
+            }
+
+            bool readBinary(std::string& key, std::string& value)
+            {
+                uint32_t lengths[2];
+                in.read(reinterpret_cast<char*>(lengths), sizeof(lengths));
+                if(in.gcount() == 0 && in.eof()) return false;
+                lineNumber++;
+                if(in.gcount() != static_cast<std::streamsize>(sizeof(lengths))) return fail("truncated record");
+                if(lengths[0] > MAX_KEY_SIZE || lengths[1] > MAX_VALUE_SIZE) return fail("record too large");
+                key.resize(lengths[0]);
+                value.resize(lengths[1]);
+                in.read(key.data(), lengths[0]);
+                in.read(value.data(), lengths[1]);
+                if(!in) return fail("truncated record");
+                return true;
+            }
+
+        public:
+            RecordReader(const std::string& path, LoadFormat f)
+                : in(path, f == LoadFormat::BINARY ? std::ios::binary : std::ios::in), format(f) {}
+
+            bool isOpen() const { return in.is_open(); }
+            bool hasFailed() const { return failed; }
+
+            //false at the end of input or on a malformed record (hasFailed)
+            bool next(std::string& key, std::string& value)
+            {
+                if(failed) return false;
+                if(format == LoadFormat::BINARY) return readBinary(key, value);
+                do
+                {
+                    if(!readLine()) return false;
+                } while(line.empty());
+                if(format == LoadFormat::TSV)
+                {
+                    size_t tab=line.find('\t');
+                    if(tab == std::string::npos) return fail("no tab separator");
+                    key.assign(line, 0, tab);
+                    value.assign(line, tab + 1, std::string::npos);
+                    return true;
+                }
+                size_t pos=0;
+                if(!csvField(pos, key, false)) return false;
+                if(pos >= line.size()) return fail("no comma separator");
+                pos++;
+                return csvField(pos, value, true);
+            }
+        };
+
+        //SortEntry: one buffered record; key and value sit back to back in the arena
+        struct SortEntry
+        {
+            size_t offset;
+            uint32_t keyLen;
+            uint32_t valueLen;
+        };
+
+        //SortBuffer: the in-memory part of the external sort
+        class SortBuffer
+        {
+        private:
+            std::string arena;
+            std::vector<SortEntry> entries;
+
+        public:
+            void add(const std::string& key, const std::string& value)
+            {
+                entries.push_back({arena.size(), static_cast<uint32_t>(key.size()), static_cast<uint32_t>(value.size())});
+                arena += key;
+                arena += value;
+            }
+
+            size_t bytes() const { return arena.size() + entries.size() * sizeof(SortEntry); }
+            bool empty() const { return entries.empty(); }
+            size_t size() const { return entries.size(); }
+
+            std::string_view key(size_t i) const
+            {
+                return std::string_view(arena.data() + entries[i].offset, entries[i].keyLen);
+            }
+
+            std::string_view value(size_t i) const
+            {
+                return std::string_view(arena.data() + entries[i].offset + entries[i].keyLen, entries[i].valueLen);
+            }
+
+            //sorts by key and keeps only the last occurrence of each key;
+            //returns the number of records dropped
+            uint64_t sortUnique()
+            {
+                std::stable_sort(entries.begin(), entries.end(), [this](const SortEntry& a, const SortEntry& b)
+                {
+                    return std::string_view(arena.data() + a.offset, a.keyLen) < std::string_view(arena.data() + b.offset, b.keyLen);
+                });
+                size_t out=0;
+                for(size_t i=0; i<entries.size(); i++)
+                {
+                    if(i + 1 < entries.size() && key(i) == key(i + 1)) continue;
+                    entries[out++]=entries[i];
+                }
+                uint64_t dropped=entries.size() - out;
+                entries.resize(out);
+                return dropped;
+            }
+
+            void clear()
+            {
+                arena.clear();
+                entries.clear();
+            }
+        };
+
+        //MemoryIterator: walks a sorted SortBuffer
+        class MemoryIterator : public KVIterator
+        {
+        private:
+            const SortBuffer& buffer;
+            size_t index=0;
+
+        public:
+            explicit MemoryIterator(const SortBuffer& b) : buffer(b) {}
+            bool valid() const override { return index < buffer.size(); }
+            void next() override { index++; }
+            std::string_view key() const override { return buffer.key(index); }
+            std::string_view value() const override { return buffer.value(index); }
+            bool isTombstone() const override { return false; }
+        };
+
+        //RunReader: reads back a spilled run, which uses the BINARY input format
+        class RunReader
+        {
+        private:
+            std::ifstream in;
+
+        public:
+            std::string key;
+            std::string value;
+            bool valid=false;
+            bool failed=false;
+
+            explicit RunReader(const std::string& path) : in(path, std::ios::binary)
+            {
+                failed=!in.is_open();
+            }
+
+            void advance()
+            {
+                uint32_t lengths[2];
+                in.read(reinterpret_cast<char*>(lengths), sizeof(lengths));
+                valid=in.gcount() == static_cast<std::streamsize>(sizeof(lengths));
+                if(!valid)
+                {
+                    //a clean end of run stops exactly between records
+                    failed=in.gcount() != 0 || in.bad();
+                    return;
+                }
+                key.resize(lengths[0]);
+                value.resize(lengths[1]);
+                in.read(key.data(), lengths[0]);
+                in.read(value.data(), lengths[1]);
+                if(!in)
+                {
+                    valid=false;
+                    failed=true;
+                }
+            }
+        };
+
+        //MergeIterator: k-way merge of sorted runs; when runs share a key the
+        //latest run holds the latest input record, so it wins
+        class MergeIterator : public KVIterator
+        {
+        private:
+            std::vector<std::unique_ptr<RunReader>> runs;
+            //(run index) ordered by key ascending, then run index descending
+            struct Greater
+            {
+                const std::vector<std::unique_ptr<RunReader>>* runs;
+                bool operator()(size_t a, size_t b) const
+                {
+                    int cmp=(*runs)[a]->key.compare((*runs)[b]->key);
+                    if(cmp != 0) return cmp > 0;
+                    return a < b;
+                }
+            };
+            std::priority_queue<size_t, std::vector<size_t>, Greater> heap;
+            size_t current=0;
+            bool hasCurrent=false;
+
+            void pop()
+            {
+                hasCurrent=false;
+                if(heap.empty()) return;
+                current=heap.top();
+                heap.pop();
+                hasCurrent=true;
+                //older copies of the same key in earlier runs are superseded
+                while(!heap.empty() && runs[heap.top()]->key == runs[current]->key)
+                {
+                    size_t older=heap.top();
+                    heap.pop();
+                    duplicates++;
+                    refill(older);
+                }
+            }
+
+            void refill(size_t index)
+            {
+                runs[index]->advance();
+                if(runs[index]->valid) heap.push(index);
+            }
+
+        public:
+            uint64_t duplicates=0;
+
+            explicit MergeIterator(const std::vector<std::string>& paths) : heap(Greater{&runs})
+            {
+                for(const auto& path : paths) runs.push_back(std::make_unique<RunReader>(path));
+                for(size_t i=0; i<runs.size(); i++) refill(i);
+                pop();
+            }
+
+            bool failed() const override
+            {
+                for(const auto& run : runs) if(run->failed) return true;
+                return false;
+            }
+
+            bool valid() const override { return hasCurrent; }
+
+            void next() override
+            {
+                if(!hasCurrent) return;
+                refill(current);
+                pop();
+            }
+
+            std::string_view key() const override { return runs[current]->key; }
+            std::string_view value() const override { return runs[current]->value; }
+            bool isTombstone() const override { return false; }
+        };
+
+        bool writeRun(const SortBuffer& buffer, const std::string& path)
+        {
+            std::ofstream out(path, std::ios::binary | std::ios::trunc);
+            for(size_t i=0; i<buffer.size(); i++)
+            {
+                std::string_view key=buffer.key(i);
+                std::string_view value=buffer.value(i);
+                uint32_t lengths[2]={static_cast<uint32_t>(key.size()), static_cast<uint32_t>(value.size())};
+                out.write(reinterpret_cast<const char*>(lengths), sizeof(lengths));
+                out.write(key.data(), key.size());
+                out.write(value.data(), value.size());
+            }
+            out.close();
+            if(!out)
+            {
+                logError("failed to write sort run " + path);
+                return false;
+            }
+            return true;
+        }
+
+        //engines without a packed path take the records as one transaction
+        bool loadTransactional(KVIterator& input, TransactionManager& txnMgr, BulkLoadStats& stats)
+        {
+            TransactionId txnId=txnMgr.beginTransaction();
+            for(; input.valid(); input.next())
+            {
+                if(!txnMgr.putRecord(txnId, std::string(input.key()), std::string(input.value())))
+                {
+                    logError("bulk load failed at key " + std::string(input.key()));
+                    txnMgr.abortTransaction(txnId);
+                    return false;
+                }
+                stats.records++;
+                stats.bytes += input.key().size() + input.value().size();
+            }
+            if(input.failed())
+            {
+                logError("bulk load input ended early");
+                txnMgr.abortTransaction(txnId);
+                return false;
+            }
+            return txnMgr.commitTransaction(txnId);
+        }
+    }
+
+    bool bulkLoad(const std::string& inputPath, const BulkLoadOptions& options, StorageEngine& engine,
+                  WALManager& wal, TransactionManager& txnMgr, BulkLoadResult& result)
+    {
+        auto start=std::chrono::steady_clock::now();
+        result=BulkLoadResult();
+        RecordReader reader(inputPath, options.format);
+        if(!reader.isOpen())
+        {
+            logError("cannot open load input " + inputPath);
+            return false;
+        }
+        std::string prefix=options.tempPrefix;
+        if(prefix.empty())
+        {
+            prefix=(std::filesystem::temp_directory_path() / ("stonedb-load-" + std::to_string(getpid()))).string();
+        }
+
+        //phase 1: sorted runs of at most memoryBytes each
+        SortBuffer buffer;
+        std::vector<std::string> runPaths;
+        std::string key;
+        std::string value;
+        bool ok=true;
+        bool first=true;
+        while(reader.next(key, value))
+        {
+            if(first && options.skipHeader && options.format != LoadFormat::BINARY)
+            {
+                first=false;
+                continue;
+            }
+            first=false;
+            result.inputRecords++;
+            buffer.add(key, value);
+            if(buffer.bytes() >= options.memoryBytes)
+            {
+                result.duplicates += buffer.sortUnique();
+                runPaths.push_back(prefix + "." + std::to_string(runPaths.size()) + ".run");
+                ok=writeRun(buffer, runPaths.back());
+                buffer.clear();
+                if(!ok) break;
+            }
+        }
+        if(reader.hasFailed()) ok=false;
+        if(ok)
+        {
+            result.duplicates += buffer.sortUnique();
+            if(!runPaths.empty() && !buffer.empty())
+            {
+                runPaths.push_back(prefix + "." + std::to_string(runPaths.size()) + ".run");
+                ok=writeRun(buffer, runPaths.back());
+                buffer.clear();
+            }
+        }
+
+        //phase 2: one ordered stream into the engine
+        if(ok)
+        {
+            std::unique_ptr<KVIterator> input;
+            MergeIterator* merge=nullptr;
+            if(runPaths.empty())
+            {
+                input=std::make_unique<MemoryIterator>(buffer);
+            }
+            else
+            {
+                auto iterator=std::make_unique<MergeIterator>(runPaths);
+                merge=iterator.get();
+                input=std::move(iterator);
+            }
+            result.runs=runPaths.size();
+            result.packed=engine.canBulkLoad();
+            if(result.packed) ok=engine.bulkLoad(*input, wal, result.stats);
+            else ok=loadTransactional(*input, txnMgr, result.stats);
+            if(merge) result.duplicates += merge->duplicates;
+            //the engine has discarded what it read of a short stream
+            if(input->failed())
+            {
+                logError("failed to read back a sort run");
+                ok=false;
+            }
+        }
+        for(const auto& path : runPaths) std::remove(path.c_str());
+        result.seconds=std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if(ok)
+        {
+            log("loaded " + std::to_string(result.stats.records) + " records from " + inputPath);
+        }
+        return ok;
+    }
+}
@@ -2,16 +2,70 @@
 #include<chrono>
 #include<ctime>
 #include<iomanip>
+#include<cstring>
+#include<cerrno>
+#include<unistd.h>
 namespace stonedb
 {
-    void log(const std::string& msg)
+    static inline uint64_t mix64(uint64_t h)
     {
-        auto now = std::chrono::system_clock::now();
-        auto time_t = std::chrono::system_clock::to_time_t(now);
-        std::cout << "[" << std::put_time(std::localtime(&time_t), "%H:%M:%S") << "] " << msg << std::endl;
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        return h;
     }
-    void logError(const std::string& msg)
+    uint64_t hashKey(std::string_view key)
     {
-    std::cerr << "ERROR: " << msg << std::endl;
-}
+        const uint64_t prime=0x9E3779B97F4A7C15ULL;
+        uint64_t h=key.size() * prime;
+        const char* p=key.data();
+        size_t remaining=key.size();
+        while(remaining >= 8)
+        {
+            uint64_t chunk;
+            memcpy(&chunk, p, 8);
+            h=(h ^ mix64(chunk)) * prime;
+            h=(h << 27) | (h >> 37);
+            p += 8;
+            remaining -= 8;
+        }
+        uint64_t tail=0;
+        if(remaining > 0) memcpy(&tail, p, remaining);
+        h ^= mix64(tail ^ (static_cast<uint64_t>(remaining) << 56));
+        return mix64(h);
+    }
+
+    bool copyFileBytes(int srcFd, uint64_t srcOffset, int dstFd, uint64_t dstOffset, uint64_t length)
+    {
+        loff_t in=static_cast<loff_t>(srcOffset);
+        loff_t out=static_cast<loff_t>(dstOffset);
+        while(length > 0)
+        {
+            ssize_t n=copy_file_range(srcFd, &in, dstFd, &out, length, 0);
+            if(n < 0 && errno == EINTR) continue;
+            if(n < 0 && (errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP)) break;
+            if(n <= 0) return false;
+            length -= static_cast<uint64_t>(n);
+        }
+        char buffer[1 << 16];
+        while(length > 0)
+        {
+            ssize_t n=pread(srcFd, buffer, std::min<uint64_t>(length, sizeof(buffer)), in);
+            if(n < 0 && errno == EINTR) continue;
+            if(n <= 0) return false;
+            for(ssize_t done=0; done<n; )
+            {
+                ssize_t w=pwrite(dstFd, buffer + done, n - done, out + done);
+                if(w < 0 && errno == EINTR) continue;
+                if(w <= 0) return false;
+                done += w;
+            }
+            in += n;
+            out += n;
+            length -= static_cast<uint64_t>(n);
+        }
+        return true;
+    }
 }
@@ -0,0 +1,148 @@
+#include"compress.hpp"
+#include<cstring>
+
+namespace stonedb
+{
+    static constexpr size_t MIN_MATCH=4;
+    //matches never cover the tail, so the decoder ends on a literal run
+    static constexpr size_t LAST_LITERALS=5;
+    static constexpr size_t MAX_OFFSET=65535;
+    static constexpr int HASH_BITS=12;
+
+    static uint32_t load32(const uint8_t* p)
+    {
+        uint32_t v;
+        memcpy(&v, p, 4);
+        return v;
+    }
+
+    static uint32_t hashSequence(uint32_t v)
+    {
+        return (v * 2654435761U) >> (32 - HASH_BITS);
+    }
+
+    //writes a length that did not fit its nibble
+    static bool putLength(uint8_t*& op, uint8_t* end, size_t length)
+    {
+        while(length >= 255)
+        {
+            if(op >= end) return false;
+            *op++=255;
+            length -= 255;
+        }
+        if(op >= end) return false;
+        *op++=static_cast<uint8_t>(length);
+        return true;
+    }
+
+    static bool getLength(const uint8_t*& ip, const uint8_t* end, size_t& length)
+    {
+        uint8_t b;
+        do
+        {
+            if(ip >= end) return false;
+            b=*ip++;
+            length += b;
+        } while(b == 255);
+        return true;
+    }
+
+    static bool emitSequence(uint8_t*& op, uint8_t* end, const uint8_t* literals, size_t literalLen,
+                             size_t offset, size_t matchLen)
+    {
+        if(op >= end) return false;
+        uint8_t* token=op++;
+        size_t litNibble=literalLen < 15 ? literalLen : 15;
+        size_t matchNibble=0;
+        if(matchLen) matchNibble=matchLen - MIN_MATCH < 15 ? matchLen - MIN_MATCH : 15;
+        *token=static_cast<uint8_t>(litNibble << 4 | matchNibble);
+        if(litNibble == 15 && !putLength(op, end, literalLen - 15)) return false;
+        if(static_cast<size_t>(end - op) < literalLen) return false;
+        memcpy(op, literals, literalLen);
+        op += literalLen;
+        if(!matchLen) return true;
+        if(end - op < 2) return false;
+        uint16_t off=static_cast<uint16_t>(offset);
+        memcpy(op, &off, 2);
+        op += 2;
+        return matchNibble < 15 || putLength(op, end, matchLen - MIN_MATCH - 15);
+    }
+
+    size_t lzCompress(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstCapacity)
+    {
+        uint32_t table[1 << HASH_BITS]={0};
+        uint8_t* op=dst;
+        uint8_t* end=dst + dstCapacity;
+        size_t anchor=0;
+        size_t pos=0;
+        if(srcSize >= MIN_MATCH + LAST_LITERALS)
+        {
+            size_t matchLimit=srcSize - LAST_LITERALS;
+            while(pos + MIN_MATCH <= matchLimit)
+            {
+                uint32_t sequence=load32(src + pos);
+                uint32_t h=hashSequence(sequence);
+                size_t candidate=table[h];
+                table[h]=static_cast<uint32_t>(pos);
+                if(candidate >= pos || pos - candidate > MAX_OFFSET || load32(src + candidate) != sequence)
+                {
+                    pos++;
+                    continue;
+                }
+                size_t matchLen=MIN_MATCH;
+                while(pos + matchLen < matchLimit && src[candidate + matchLen] == src[pos + matchLen])
+                {
+                    matchLen++;
+                }
+                if(!emitSequence(op, end, src + anchor, pos - anchor, pos - candidate, matchLen)) return 0;
+                pos += matchLen;
+                anchor=pos;
+            }
+        }
+        if(!emitSequence(op, end, src + anchor, srcSize - anchor, 0, 0)) return 0;
+        return static_cast<size_t>(op - dst);
+    }
+
+    bool lzDecompress(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize)
+    {
+        const uint8_t* ip=src;
+        const uint8_t* ipEnd=src + srcSize;
+        uint8_t* op=dst;
+        uint8_t* opEnd=dst + dstSize;
+        while(ip < ipEnd)
+        {
+            uint8_t token=*ip++;
+            size_t literalLen=token >> 4;
+            if(literalLen == 15 && !getLength(ip, ipEnd, literalLen)) return false;
+            if(static_cast<size_t>(ipEnd - ip) < literalLen || static_cast<size_t>(opEnd - op) < literalLen)
+            {
+                return false;
+            }
+            memcpy(op, ip, literalLen);
+            ip += literalLen;
+            op += literalLen;
+            if(ip == ipEnd) break;
+
+            if(ipEnd - ip < 2) return false;
+            uint16_t offset;
+            memcpy(&offset, ip, 2);
+            ip += 2;
+            size_t matchLen=token & 15;
+            if(matchLen == 15 && !getLength(ip, ipEnd, matchLen)) return false;
+            matchLen += MIN_MATCH;
+            if(offset == 0 || offset > static_cast<size_t>(op - dst) || static_cast<size_t>(opEnd - op) < matchLen) return false;
+            //an overlapping match repeats the last offset bytes, copy it bytewise
+            const uint8_t* from=op - offset;
+            if(offset >= matchLen)
+            {
+                memcpy(op, from, matchLen);
+            }
+            else
+            {
+                for(size_t i=0; i<matchLen; i++) op[i]=from[i];
+            }
+            op += matchLen;
+        }
+        return op == opEnd;
+    }
+}
@@ -0,0 +1,75 @@
+#include"common.hpp"
+#include<cstring>
+#if defined(__x86_64__)
+#include<nmmintrin.h>
+#define STONEDB_CRC_X86 1
+#endif
+
+namespace stonedb
+{
+    //Castagnoli polynomial, reflected
+    static constexpr uint32_t CRC32C_POLY=0x82f63b78U;
+
+    struct Crc32cTable
+    {
+        uint32_t entries[256];
+        Crc32cTable()
+        {
+            for(uint32_t i=0; i<256; i++)
+            {
+                uint32_t crc=i;
+                for(int bit=0; bit<8; bit++) crc=(crc >> 1) ^ ((crc & 1) ? CRC32C_POLY : 0);
+                entries[i]=crc;
+            }
+        }
+    };
+
+    static uint32_t crcSoftware(const uint8_t* p, size_t size, uint32_t crc)
+    {
+        static const Crc32cTable table;
+        for(size_t i=0; i<size; i++)
+        {
+            crc=table.entries[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+        }
+        return crc;
+    }
+
+#ifdef STONEDB_CRC_X86
+    __attribute__((target("sse4.2")))
+    static uint32_t crcSse42(const uint8_t* p, size_t size, uint32_t crc)
+    {
+        uint64_t wide=crc;
+        while(size >= 8)
+        {
+            uint64_t chunk;
+            memcpy(&chunk, p, 8);
+            wide=_mm_crc32_u64(wide, chunk);
+            p += 8;
+            size -= 8;
+        }
+        crc=static_cast<uint32_t>(wide);
+        while(size > 0)
+        {
+            crc=_mm_crc32_u8(crc, *p++);
+            size--;
+        }
+        return crc;
+    }
+#endif
+
+    using CrcFn=uint32_t(*)(const uint8_t*, size_t, uint32_t);
+    static CrcFn selectCrc()
+    {
+#ifdef STONEDB_CRC_X86
+        __builtin_cpu_init();
+        if(__builtin_cpu_supports("sse4.2")) return crcSse42;
+#endif
+        return crcSoftware;
+    }
+    static const CrcFn crcUpdate=selectCrc();
+
+    uint32_t crc32c(const void* data, size_t size, uint32_t crc)
+    {
+        return ~crcUpdate(static_cast<const uint8_t*>(data), size, ~crc);
+    }
+}
@@ -0,0 +1,63 @@
+#include"engine.hpp"
+#include"storage.hpp"
+#include"lsm.hpp"
+#include"wal.hpp"
+#include<atomic>
+#include<thread>
+
+namespace stonedb
+{
+    bool StorageEngine::recover(WALManager& wal, size_t redoThreads)
+    {
+        if(redoThreads == 0) redoThreads=std::max(1U, std::thread::hardware_concurrency());
+        std::atomic<size_t> applied{0};
+        bool replayed=wal.replayLog([&](const LogEntry& entry)
+        {
+            if(!applyLogEntry(entry)) return false;
+            applied++;
+            return true;
+        }, redoThreads);
+        if(!replayed || !discardPendingLoad()) return false;
+        log("recovery applied " + std::to_string(applied.load()) + " operations on " +
+            std::to_string(redoThreads) + " thread(s)");
+        return true;
+    }
+
+    bool StorageEngine::applyLogEntry(const LogEntry& entry)
+    {
+        if(entry.type == LogType::PUT_RECORD)
+        {
+            if(!putRecord(entry.key, entry.value))
+            {
+                logError("failed to redo put of key " + entry.key);
+                return false;
+            }
+        }
+        else if(entry.type == LogType::BULK_LOAD)
+        {
+            //replay runs it alone, after everything logged before it
+            return redoBulkLoad(entry.value);
+        }
+        else
+        {
+            //the delete may already be on disk, a missing key is fine
+            deleteRecord(entry.key);
+        }
+        return true;
+    }
+
+    bool StorageEngine::forEachRecord(const std::function<bool(std::string_view, std::string_view)>& fn)
+    {
+        for(const auto& record : scanRecords())
+        {
+            if(!fn(record.key, record.value)) return false;
+        }
+        return true;
+    }
+
+    std::shared_ptr<StorageEngine> createStorageEngine(EngineType type)
+    {
+        if(type == EngineType::LSM) return std::make_shared<LSMStorage>();
+        return std::make_shared<StorageManager>();
+    }
+}
@@ -0,0 +1,358 @@
+#include"jsonbackup.hpp"
+#include<cctype>
+#include<istream>
+#include<ostream>
+#include<vector>
+
+namespace stonedb
+{
+    namespace
+    {
+        const size_t OUTPUT_BLOCK=1 << 16;
+        const size_t INPUT_BLOCK=1 << 16;
+        const int MAX_SKIP_DEPTH=64;
+
+        //appends s as a JSON string; bytes that need no escape are copied in runs
+        void appendEscaped(std::string& out, std::string_view s)
+        {
+            static const char* hex="0123456789abcdef";
+            out.push_back('"');
+            size_t run=0;
+            for(size_t i=0; i<s.size(); i++)
+            {
+                unsigned char c=static_cast<unsigned char>(s[i]);
+                if(c >= 0x20 && c != '"' && c != '\\') continue;
+                out.append(s.data() + run, i - run);
+                run=i + 1;
+                switch(c)
+                {
+                    case '"': out += "\\\""; break;
+                    case '\\': out += "\\\\"; break;
+                    case '\b': out += "\\b"; break;
+                    case '\f': out += "\\f"; break;
+                    case '\n': out += "\\n"; break;
+                    case '\r': out += "\\r"; break;
+                    case '\t': out += "\\t"; break;
+                    default:
+                        out += "\\u00";
+                        out.push_back(hex[c >> 4]);
+                        out.push_back(hex[c & 15]);
+                }
+            }
+            out.append(s.data() + run, s.size() - run);
+            out.push_back('"');
+        }
+
+        void appendUtf8(std::string& out, uint32_t cp)
+        {
+            if(cp < 0x80)
+            {
+                out.push_back(static_cast<char>(cp));
+            }
+            else if(cp < 0x800)
+            {
+                out.push_back(static_cast<char>(0xc0 | (cp >> 6)));
+                out.push_back(static_cast<char>(0x80 | (cp & 0x3f)));
+            }
+            else if(cp < 0x10000)
+            {
+                out.push_back(static_cast<char>(0xe0 | (cp >> 12)));
+                out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3f)));
+                out.push_back(static_cast<char>(0x80 | (cp & 0x3f)));
+            }
+            else
+            {
+                out.push_back(static_cast<char>(0xf0 | (cp >> 18)));
+                out.push_back(static_cast<char>(0x80 | ((cp >> 12) & 0x3f)));
+                out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3f)));
+                out.push_back(static_cast<char>(0x80 | (cp & 0x3f)));
+            }
+        }
+
+        //JsonReader: pull tokenizer over a fixed-size window of the stream;
+        //only the string being decoded is ever held in full
+        class JsonReader
+        {
+        private:
+            std::istream& in;
+            std::vector<char> buffer;
+            size_t pos=0;
+            size_t end=0;
+            uint64_t line=1;
+
+            bool refill()
+            {
+                if(pos < end) return true;
+                in.read(buffer.data(), buffer.size());
+                end=static_cast<size_t>(in.gcount());
+                pos=0;
+                return end > 0;
+            }
+
+        public:
+            explicit JsonReader(std::istream& s) : in(s), buffer(INPUT_BLOCK) {}
+
+            bool fail(const std::string& message)
+            {
+                logError("json backup line " + std::to_string(line) + ": " + message);
+                return false;
+            }
+
+            //next byte without consuming it, -1 at the end of input
+            int peek()
+            {
+                if(!refill()) return -1;
+                return static_cast<unsigned char>(buffer[pos]);
+            }
+
+            int get()
+            {
+                int c=peek();
+                if(c >= 0) pos++;
+                if(c == '\n') line++;
+                return c;
+            }
+
+            void skipSpace()
+            {
+                for(int c=peek(); c == ' ' || c == '\t' || c == '\n' || c == '\r'; c=peek()) get();
+            }
+
+            bool expect(char want)
+            {
+                skipSpace();
+                if(get() == want) return true;
+                return fail(std::string("expected '") + want + "'");
+            }
+
+            //true and consumes c if it is the next token
+            bool accept(char c)
+            {
+                skipSpace();
+                if(peek() != c) return false;
+                get();
+                return true;
+            }
+
+            bool hex4(uint32_t& value)
+            {
+                value=0;
+                for(int i=0; i<4; i++)
+                {
+                    int c=get();
+                    int digit=(c >= '0' && c <= '9') ? c - '0' : (c >= 'a' && c <= 'f') ? c - 'a' + 10 :
+                              (c >= 'A' && c <= 'F') ? c - 'A' + 10 : -1;
+                    if(digit < 0) return fail("bad \\u escape");
+                    value=(value << 4) | static_cast<uint32_t>(digit);
+                }
+                return true;
+            }
+
+            bool readString(std::string& out)
+            {
+                out.clear();
+                if(!expect('"')) return false;
+                while(true)
+                {
+                    if(!refill()) return fail("unterminated string");
+                    //copy the run up to the next quote, backslash or newline in one go
+                    size_t run=pos;
+                    while(run < end && buffer[run] != '"' && buffer[run] != '\\' && buffer[run] != '\n') run++;
+                    out.append(buffer.data() + pos, run - pos);
+                    pos=run;
+                    if(pos == end) continue;
+                    int c=get();
+                    if(c == '"') return true;
+                    if(c == '\n')
+                    {
+                        out.push_back('\n');
+                        continue;
+                    }
+                    c=get();
+                    switch(c)
+                    {
+                        case '"': out.push_back('"'); break;
+                        case '\\': out.push_back('\\'); break;
+                        case '/': out.push_back('/'); break;
+                        case 'b': out.push_back('\b'); break;
+                        case 'f': out.push_back('\f'); break;
+                        case 'n': out.push_back('\n'); break;
+                        case 'r': out.push_back('\r'); break;
+                        case 't': out.push_back('\t'); break;
+                        case 'u':
+                        {
+                            uint32_t cp;
+                            if(!hex4(cp)) return false;
+                            if(cp >= 0xd800 && cp < 0xdc00 && peek() == '\\')
+                            {
+                                get();
+                                uint32_t low;
+                                if(get() != 'u' || !hex4(low) || low < 0xdc00 || low >= 0xe000) return fail("bad surrogate pair");
+                                cp=0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+                            }
+                            appendUtf8(out, cp);
+                            break;
+                        }
+                        default:
+                            return fail("bad escape in string");
+                    }
+                }
+            }
+
+            //skips any value: strings, numbers, literals, objects and arrays
+            bool skipValue(int depth=0)
+            {
+                if(depth > MAX_SKIP_DEPTH) return fail("nesting too deep");
+                skipSpace();
+                int c=peek();
+                std::string scratch;
+                if(c == '"') return readString(scratch);
+                if(c == '{' || c == '[')
+                {
+                    char close=(c == '{') ? '}' : ']';
+                    get();
+                    if(accept(close)) return true;
+                    do
+                    {
+                        if(c == '{' && (!readString(scratch) || !expect(':'))) return false;
+                        if(!skipValue(depth + 1)) return false;
+                    } while(accept(','));
+                    return expect(close);
+                }
+                size_t length=0;
+                for(c=peek(); c >= 0 && (isalnum(c) || c == '-' || c == '+' || c == '.'); c=peek())
+                {
+                    get();
+                    length++;
+                }
+                return length > 0 || fail("expected a value");
+            }
+        };
+    }
+
+    bool writeJsonBackup(StorageEngine& engine, std::ostream& out, uint64_t& records)
+    {
+        records=0;
+        std::string block;
+        block.reserve(OUTPUT_BLOCK * 2);
+        block += "{\n  \"stonedb_backup\": true,\n  \"version\": \"1.0.0\",\n  \"records\": [";
+        bool ok=engine.forEachRecord([&](std::string_view key, std::string_view value)
+        {
+            block += records == 0 ? "\n    {\"key\": " : ",\n    {\"key\": ";
+            appendEscaped(block, key);
+            block += ", \"value\": ";
+            appendEscaped(block, value);
+            block.push_back('}');
+            records++;
+            if(block.size() >= OUTPUT_BLOCK)
+            {
+                out.write(block.data(), block.size());
+                block.clear();
+            }
+            return out.good();
+        });
+        block += records == 0 ? "]\n}\n" : "\n  ]\n}\n";
+        out.write(block.data(), block.size());
+        out.flush();
+        if(!out.good())
+        {
+            logError("failed to write json backup");
+            return false;
+        }
+        return ok;
+    }
+
+    bool readJsonBackup(std::istream& in, TransactionManager& txnMgr, size_t batchSize, uint64_t& records)
+    {
+        records=0;
+        if(batchSize == 0) batchSize=1;
+        JsonReader reader(in);
+        bool sawRecords=false;
+        std::string name;
+        std::string key;
+        std::string value;
+        //a batch is parsed in full before its transaction starts, so a parse
+        //error never leaves half a batch applied
+        std::vector<std::pair<std::string, std::string>> batch;
+        batch.reserve(batchSize);
+
+        auto commitBatch=[&]()
+        {
+            if(batch.empty()) return true;
+            TransactionId txnId=txnMgr.beginTransaction();
+            for(const auto& record : batch)
+            {
+                if(!txnMgr.putRecord(txnId, record.first, record.second))
+                {
+                    txnMgr.abortTransaction(txnId);
+                    return reader.fail("failed to restore key " + record.first);
+                }
+            }
+            if(!txnMgr.commitTransaction(txnId)) return reader.fail("failed to commit a restore batch");
+            records += batch.size();
+            batch.clear();
+            return true;
+        };
+        auto putRecord=[&]()
+        {
+            batch.emplace_back(std::move(key), std::move(value));
+            return batch.size() < batchSize || commitBatch();
+        };
+        //"records": [{"key": ..., "value": ...}, ...]
+        auto readRecords=[&]()
+        {
+            sawRecords=true;
+            if(!reader.expect('[')) return false;
+            if(reader.accept(']')) return true;
+            do
+            {
+                if(!reader.expect('{')) return false;
+                bool hasKey=false;
+                bool hasValue=false;
+                if(!reader.accept('}'))
+                {
+                    do
+                    {
+                        if(!reader.readString(name) || !reader.expect(':')) return false;
+                        if(name == "key")
+                        {
+                            if(!reader.readString(key)) return false;
+                            hasKey=true;
+                        }
+                        else if(name == "value")
+                        {
+                            if(!reader.readString(value)) return false;
+                            hasValue=true;
+                        }
+                        else if(!reader.skipValue())
+                        {
+                            return false;
+                        }
+                    } while(reader.accept(','));
+                    if(!reader.expect('}')) return false;
+                }
+                if(!hasKey || !hasValue) return reader.fail("record without key or value");
+                if(!putRecord()) return false;
+            } while(reader.accept(','));
+            return reader.expect(']');
+        };
+
+        bool ok=reader.expect('{');
+        if(ok && !reader.accept('}'))
+        {
+            do
+            {
+                ok=reader.readString(name) && reader.expect(':');
+                if(ok) ok=(name == "records") ? readRecords() : reader.skipValue();
+            } while(ok && reader.accept(','));
+            ok=ok && reader.expect('}');
+        }
+        if(ok)
+        {
+            reader.skipSpace();
+            if(reader.peek() >= 0) ok=reader.fail("trailing data after the document");
+            else if(!sawRecords) ok=reader.fail("no \"records\" array");
+        }
+        return ok && commitBatch();
+    }
+}
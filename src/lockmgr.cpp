@@ -1,4 +1,5 @@
 #include"lockmgr.hpp"
+#include"statistics.hpp"
 #include<algorithm>
 #include<functional>
 
@@ -12,7 +13,8 @@ namespace stonedb
     {
     }
     
-    bool LockManager::canGrantLock(const std::string& key, LockType requestedType)
+    //the requester's own granted locks never block it, so a shared holder can upgrade
+    bool LockManager::canGrantLock(const std::string& key, LockType requestedType, TransactionId txnId)
     {
         auto it=lockTable.find(key);
         if(it == lockTable.end()) return true;
@@ -21,7 +23,7 @@ namespace stonedb
         
         for(const auto& req : requests)
         {
-            if(req.granted)
+            if(req.granted && req.txnId != txnId)
             {    
                 if(requestedType == LockType::SHARED && req.type == LockType::SHARED)
                 {
@@ -100,24 +102,37 @@ namespace stonedb
         }
         
 
-        if(hasDeadlock(txnId))
+        lockTable[key].emplace_back(txnId, type);
+        txnWaits[txnId].insert(key);
+        //checked with this request's wait in place so the cycle it closes is seen
+        if(!canGrantLock(key, type, txnId) && hasDeadlock(txnId))
         {
             logError("deadlock detected for txn " + std::to_string(txnId));
+            Statistics::global().incrementDeadlocks();
+            auto& requests=lockTable[key];
+            requests.erase(std::remove_if(requests.begin(), requests.end(),
+                [txnId](const LockRequest& req) { return req.txnId == txnId && !req.granted; }), requests.end());
+            if(requests.empty()) lockTable.erase(key);
+            txnWaits[txnId].erase(key);
             return false;
         }
-        lockTable[key].emplace_back(txnId, type);
-        txnWaits[txnId].insert(key);
-        while(!canGrantLock(key, type))
+        if(!canGrantLock(key, type, txnId))
         {
-            lockCondition.wait(lock);
-            if(txnWaits[txnId].find(key) == txnWaits[txnId].end())
+            //only requests that actually block are counted and timed
+            Statistics::global().incrementLockWaits();
+            ScopedLatency timer(LatencyOp::LOCK_WAIT);
+            while(!canGrantLock(key, type, txnId))
             {
-                return false;
+                lockCondition.wait(lock);
+                if(txnWaits[txnId].find(key) == txnWaits[txnId].end())
+                {
+                    return false;
+                }
             }
         }
         grantLock(key, txnId, type);
         lockCondition.notify_all();
-        log("txn " + std::to_string(txnId) + " acquired " + 
+        STONEDB_TRACE("txn " + std::to_string(txnId) + " acquired " + 
             (type == LockType::SHARED ? "shared" : "exclusive") + " lock on " + key);
         return true;
     }
@@ -127,7 +142,7 @@ namespace stonedb
         releaseLock(key, txnId);
         lockCondition.notify_all();
         
-        log("txn " + std::to_string(txnId) + " released lock on " + key);
+        STONEDB_TRACE("txn " + std::to_string(txnId) + " released lock on " + key);
         return true;
     }
     bool LockManager::releaseAllLocks(TransactionId txnId)
@@ -146,7 +161,7 @@ namespace stonedb
         }
         txnWaits.erase(txnId);
         lockCondition.notify_all();
-        log("txn " + std::to_string(txnId) + " released all locks");
+        STONEDB_TRACE("txn " + std::to_string(txnId) + " released all locks");
         return true;
     }
     bool LockManager::hasDeadlock(TransactionId txnId)
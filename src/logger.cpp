@@ -0,0 +1,265 @@
+#include"common.hpp"
+#include"logger.hpp"
+#include<chrono>
+#include<condition_variable>
+#include<cstdio>
+#include<cstdlib>
+#include<cstring>
+#include<ctime>
+#include<mutex>
+#include<thread>
+
+namespace stonedb
+{
+    std::atomic<int> currentLogLevel{static_cast<int>(LogLevel::INFO)};
+
+    static constexpr size_t LOG_TEXT_SIZE=240;
+    static constexpr size_t LOG_RING_SLOTS=2048;
+    static constexpr auto DRAIN_INTERVAL=std::chrono::milliseconds(10);
+
+    //LogRecord: one queued line; longer messages are cut at LOG_TEXT_SIZE
+    struct LogRecord
+    {
+        int64_t nanos;
+        LogLevel level;
+        uint32_t length;
+        char text[LOG_TEXT_SIZE];
+    };
+
+    //LogRing: single-producer single-consumer ring owned by one logging thread
+    struct LogRing
+    {
+        LogRecord slots[LOG_RING_SLOTS];
+        alignas(64) std::atomic<uint64_t> head{0};
+        alignas(64) std::atomic<uint64_t> tail{0};
+        std::atomic<bool> orphaned{false};
+    };
+
+    //Logger: registry of rings and the thread draining them. never destroyed;
+    //an atexit hook stops the drainer, after which lines are written inline
+    struct Logger
+    {
+        std::mutex registryMutex;
+        std::vector<std::shared_ptr<LogRing>> rings;
+        std::mutex drainMutex;
+        //reused by every drain pass so a quiet drainer never allocates
+        std::vector<std::shared_ptr<LogRing>> draining;
+        std::vector<LogRecord> batch;
+        std::string out;
+        std::mutex wakeMutex;
+        std::condition_variable wake;
+        bool stopping=false;
+        std::thread drainer;
+        std::atomic<bool> shutdown{false};
+        std::atomic<uint64_t> dropped{0};
+        uint64_t reportedDrops=0;
+        time_t cachedSecond=-1;
+        char cachedStamp[16]={0};
+    };
+
+    static Logger& logger();
+
+    static void stopLogger()
+    {
+        Logger& l=logger();
+        {
+            std::lock_guard<std::mutex> lock(l.wakeMutex);
+            l.stopping=true;
+        }
+        l.wake.notify_one();
+        if(l.drainer.joinable()) l.drainer.join();
+        l.shutdown=true;
+        flushLog();
+    }
+
+    static void drainLoop()
+    {
+        Logger& l=logger();
+        std::unique_lock<std::mutex> lock(l.wakeMutex);
+        while(!l.stopping)
+        {
+            l.wake.wait_for(lock, DRAIN_INTERVAL);
+            lock.unlock();
+            flushLog();
+            lock.lock();
+        }
+    }
+
+    static Logger& logger()
+    {
+        static Logger* instance=[]
+        {
+            Logger* l=new Logger();
+            l->drainer=std::thread(drainLoop);
+            std::atexit(stopLogger);
+            return l;
+        }();
+        return *instance;
+    }
+
+    //set once the thread's ring is gone, for lines logged during thread exit
+    static thread_local bool localRingGone=false;
+
+    //the calling thread's ring, registered on first use; marked orphaned when
+    //the thread exits so the drainer can drop it once empty
+    struct LocalRing
+    {
+        std::shared_ptr<LogRing> ring;
+        LocalRing() : ring(std::make_shared<LogRing>())
+        {
+            Logger& l=logger();
+            std::lock_guard<std::mutex> lock(l.registryMutex);
+            l.rings.push_back(ring);
+        }
+        ~LocalRing()
+        {
+            ring->orphaned=true;
+            localRingGone=true;
+        }
+    };
+
+    static void appendLine(Logger& l, const LogRecord& record)
+    {
+        time_t second=static_cast<time_t>(record.nanos / 1000000000);
+        if(second != l.cachedSecond)
+        {
+            struct tm local;
+            localtime_r(&second, &local);
+            strftime(l.cachedStamp, sizeof(l.cachedStamp), "[%H:%M:%S] ", &local);
+            l.cachedSecond=second;
+        }
+        l.out += l.cachedStamp;
+        if(record.level == LogLevel::TRACE) l.out += "TRACE ";
+        else if(record.level == LogLevel::DEBUG) l.out += "DEBUG ";
+        l.out.append(record.text, record.length);
+        l.out += '\n';
+    }
+
+    static int64_t nowNanos()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    static void fillRecord(LogRecord& record, LogLevel level, std::string_view msg)
+    {
+        record.nanos=nowNanos();
+        record.level=level;
+        record.length=static_cast<uint32_t>(std::min(msg.size(), LOG_TEXT_SIZE));
+        memcpy(record.text, msg.data(), record.length);
+    }
+
+    void logAt(LogLevel level, std::string_view msg)
+    {
+        if(!logEnabled(level)) return;
+        if(level == LogLevel::ERROR)
+        {
+            std::string line="ERROR: ";
+            line.append(msg.data(), msg.size());
+            line += '\n';
+            fwrite(line.data(), 1, line.size(), stderr);
+            return;
+        }
+        Logger& l=logger();
+        if(l.shutdown.load() || localRingGone)
+        {
+            std::lock_guard<std::mutex> lock(l.drainMutex);
+            LogRecord record;
+            fillRecord(record, level, msg);
+            l.out.clear();
+            appendLine(l, record);
+            fwrite(l.out.data(), 1, l.out.size(), stdout);
+            return;
+        }
+        static thread_local LocalRing local;
+        LogRing& ring=*local.ring;
+        uint64_t head=ring.head.load(std::memory_order_relaxed);
+        uint64_t used=head - ring.tail.load(std::memory_order_acquire);
+        if(used >= LOG_RING_SLOTS)
+        {
+            l.dropped++;
+            return;
+        }
+        fillRecord(ring.slots[head % LOG_RING_SLOTS], level, msg);
+        ring.head.store(head + 1, std::memory_order_release);
+        //past half full, wake the drainer early instead of waiting for its tick
+        if(used + 1 == LOG_RING_SLOTS / 2) l.wake.notify_one();
+    }
+
+    void flushLog()
+    {
+        Logger& l=logger();
+        std::lock_guard<std::mutex> lock(l.drainMutex);
+        {
+            std::lock_guard<std::mutex> registry(l.registryMutex);
+            //a ring whose thread exited is dropped once it has nothing left
+            for(size_t i=0; i<l.rings.size();)
+            {
+                LogRing& ring=*l.rings[i];
+                if(ring.orphaned.load() && ring.tail.load() == ring.head.load(std::memory_order_acquire))
+                {
+                    l.rings[i]=l.rings.back();
+                    l.rings.pop_back();
+                    continue;
+                }
+                i++;
+            }
+            l.draining.assign(l.rings.begin(), l.rings.end());
+        }
+        l.batch.clear();
+        for(auto& ring : l.draining)
+        {
+            uint64_t tail=ring->tail.load(std::memory_order_relaxed);
+            uint64_t head=ring->head.load(std::memory_order_acquire);
+            for(; tail<head; tail++) l.batch.push_back(ring->slots[tail % LOG_RING_SLOTS]);
+            ring->tail.store(tail, std::memory_order_release);
+        }
+        //lines from different threads come out in time order
+        std::stable_sort(l.batch.begin(), l.batch.end(),
+                         [](const LogRecord& a, const LogRecord& b) { return a.nanos < b.nanos; });
+        l.out.clear();
+        for(const auto& record : l.batch) appendLine(l, record);
+        uint64_t dropped=l.dropped.load();
+        if(dropped != l.reportedDrops)
+        {
+            LogRecord note;
+            fillRecord(note, LogLevel::INFO, "logger dropped " + std::to_string(dropped - l.reportedDrops) + " lines");
+            appendLine(l, note);
+            l.reportedDrops=dropped;
+        }
+        if(!l.out.empty())
+        {
+            fwrite(l.out.data(), 1, l.out.size(), stdout);
+            fflush(stdout);
+        }
+    }
+
+    uint64_t droppedLogMessages()
+    {
+        return logger().dropped.load();
+    }
+
+    void setLogLevel(LogLevel level)
+    {
+        currentLogLevel=static_cast<int>(level);
+    }
+
+    bool parseLogLevel(const std::string& name, LogLevel& level)
+    {
+        if(name == "trace") level=LogLevel::TRACE;
+        else if(name == "debug") level=LogLevel::DEBUG;
+        else if(name == "info") level=LogLevel::INFO;
+        else if(name == "error") level=LogLevel::ERROR;
+        else return false;
+        return true;
+    }
+
+    void log(const std::string& msg)
+    {
+        logAt(LogLevel::INFO, msg);
+    }
+    void logError(const std::string& msg)
+    {
+        logAt(LogLevel::ERROR, msg);
+    }
+}
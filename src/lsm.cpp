@@ -0,0 +1,723 @@
+#include"lsm.hpp"
+#include<fcntl.h>
+#include<unistd.h>
+#include<dirent.h>
+#include<sys/stat.h>
+#include<cstdio>
+#include<cstring>
+#include<fstream>
+#include<sstream>
+#include<unordered_set>
+
+namespace stonedb
+{
+    static const char* MANIFEST_MAGIC="STONEDB-MANIFEST";
+    static constexpr int MANIFEST_VERSION=1;
+
+    static std::string toHex(const std::string& bytes)
+    {
+        static const char digits[]="0123456789abcdef";
+        std::string out="x";
+        out.reserve(1 + bytes.size()*2);
+        for(unsigned char c : bytes)
+        {
+            out.push_back(digits[c >> 4]);
+            out.push_back(digits[c & 15]);
+        }
+        return out;
+    }
+
+    static bool fromHex(const std::string& text, std::string& bytes)
+    {
+        if(text.empty() || text[0] != 'x' || text.size() % 2 != 1) return false;
+        auto nibble=[](char c) -> int
+        {
+            if(c >= '0' && c <= '9') return c - '0';
+            if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+            return -1;
+        };
+        bytes.clear();
+        for(size_t i=1; i<text.size(); i+=2)
+        {
+            int hi=nibble(text[i]), lo=nibble(text[i+1]);
+            if(hi < 0 || lo < 0) return false;
+            bytes.push_back(static_cast<char>((hi << 4) | lo));
+        }
+        return true;
+    }
+
+    static bool overlaps(const TableMeta& meta, const std::string& smallest, const std::string& largest)
+    {
+        return !(meta.largest < smallest || meta.smallest > largest);
+    }
+
+    //MergingIterator: k-way merge of sources ordered newest first; when several
+    //sources hold a key only the newest version is returned
+    class MergingIterator : public KVIterator
+    {
+    private:
+        std::vector<std::unique_ptr<KVIterator>> children;
+        int currentChild;
+
+        void findSmallest()
+        {
+            //strict < keeps the lowest (newest) index on ties
+            currentChild=-1;
+            for(size_t i=0; i<children.size(); i++)
+            {
+                if(!children[i]->valid()) continue;
+                if(currentChild < 0 || children[i]->key() < children[currentChild]->key())
+                {
+                    currentChild=static_cast<int>(i);
+                }
+            }
+        }
+
+    public:
+        explicit MergingIterator(std::vector<std::unique_ptr<KVIterator>> sources)
+            : children(std::move(sources)), currentChild(-1)
+        {
+            findSmallest();
+        }
+        bool valid() const override { return currentChild >= 0; }
+        void next() override
+        {
+            std::string key(children[currentChild]->key());
+            for(auto& child : children)
+            {
+                if(child->valid() && child->key() == key) child->next();
+            }
+            findSmallest();
+        }
+        std::string_view key() const override { return children[currentChild]->key(); }
+        std::string_view value() const override { return children[currentChild]->value(); }
+        bool isTombstone() const override { return children[currentChild]->isTombstone(); }
+    };
+
+    LSMStorage::LSMStorage()
+        : dbOpen(false), nextFileNumber(1), stopping(false), backgroundError(false) {}
+
+    LSMStorage::~LSMStorage()
+    {
+        close();
+    }
+
+    std::string LSMStorage::tablePath(uint64_t number) const
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "/%06llu.sst", static_cast<unsigned long long>(number));
+        return dbDir + name;
+    }
+
+    std::string LSMStorage::manifestPath() const
+    {
+        return dbDir + "/MANIFEST";
+    }
+
+    uint64_t LSMStorage::maxBytesForLevel(int level) const
+    {
+        uint64_t bytes=options.levelBaseBytes;
+        for(int i=1; i<level; i++) bytes *= 10;
+        return bytes;
+    }
+
+    bool LSMStorage::open(const std::string& path, const StorageOptions& opts)
+    {
+        if(dbOpen) close();
+        dbDir=path;
+        options=opts;
+        if(options.memtableBytes == 0) options.memtableBytes=1;
+        if(options.l0CompactionTrigger == 0) options.l0CompactionTrigger=1;
+
+        struct stat st;
+        if(stat(path.c_str(), &st) == 0)
+        {
+            if(!S_ISDIR(st.st_mode))
+            {
+                logError("not an LSM database directory: " + path);
+                return false;
+            }
+        }
+        else if(mkdir(path.c_str(), 0755) != 0)
+        {
+            logError("failed to create LSM database directory: " + path);
+            return false;
+        }
+
+        auto version=std::make_shared<Version>();
+        nextFileNumber=1;
+        if(!loadManifest(*version)) return false;
+        removeOrphans(*version);
+
+        current=version;
+        mem=std::make_shared<MemTable>();
+        imm.reset();
+        for(auto& pointer : compactPointer) pointer.clear();
+        stopping=false;
+        backgroundError=false;
+        dbOpen=true;
+        worker=std::thread(&LSMStorage::backgroundLoop, this);
+        log("opened lsm db: " + path);
+        return true;
+    }
+
+    void LSMStorage::close()
+    {
+        if(!dbOpen) return;
+        //the WAL may be truncated after close, so the memtable must reach L0
+        if(!checkpoint())
+        {
+            logError("failed to flush memtable on close");
+        }
+        {
+            std::lock_guard<std::mutex> lock(stateMutex);
+            stopping=true;
+        }
+        workCv.notify_all();
+        worker.join();
+
+        std::lock_guard<std::mutex> lock(stateMutex);
+        mem.reset();
+        imm.reset();
+        current.reset();
+        dbOpen=false;
+        log("closed lsm db");
+    }
+
+    bool LSMStorage::loadManifest(Version& version)
+    {
+        std::ifstream in(manifestPath());
+        if(!in.is_open()) return true;   //fresh database
+
+        std::string magic;
+        int formatVersion=0;
+        in >> magic >> formatVersion;
+        if(magic != MANIFEST_MAGIC || formatVersion != MANIFEST_VERSION)
+        {
+            logError("unrecognized manifest in " + dbDir);
+            return false;
+        }
+        std::string line;
+        while(std::getline(in, line))
+        {
+            if(line.empty()) continue;
+            std::istringstream fields(line);
+            std::string tag;
+            fields >> tag;
+            if(tag == "next")
+            {
+                fields >> nextFileNumber;
+            }
+            else if(tag == "table")
+            {
+                int level=-1;
+                TableMeta meta;
+                std::string smallestHex, largestHex;
+                fields >> level >> meta.number >> meta.fileSize >> meta.entryCount >> smallestHex >> largestHex;
+                if(fields.fail() || level < 0 || level >= MAX_LEVELS ||
+                   !fromHex(smallestHex, meta.smallest) || !fromHex(largestHex, meta.largest))
+                {
+                    logError("corrupt manifest entry: " + line);
+                    return false;
+                }
+                auto reader=std::make_shared<SSTableReader>();
+                if(!reader->open(tablePath(meta.number))) return false;
+                version.levels[level].push_back(TableHandle{meta, reader});
+                nextFileNumber=std::max(nextFileNumber, meta.number + 1);
+            }
+            else
+            {
+                logError("corrupt manifest entry: " + line);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool LSMStorage::saveManifest(const Version& version, uint64_t nextNumber)
+    {
+        std::ostringstream out;
+        out << MANIFEST_MAGIC << " " << MANIFEST_VERSION << "\n";
+        out << "next " << nextNumber << "\n";
+        for(int level=0; level<MAX_LEVELS; level++)
+        {
+            for(const auto& table : version.levels[level])
+            {
+                const TableMeta& meta=table.meta;
+                out << "table " << level << " " << meta.number << " " << meta.fileSize << " "
+                    << meta.entryCount << " " << toHex(meta.smallest) << " " << toHex(meta.largest) << "\n";
+            }
+        }
+        std::string text=out.str();
+
+        //write-then-rename so a crash leaves either the old or the new manifest
+        std::string tmpPath=manifestPath() + ".tmp";
+        int fd=::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if(fd < 0)
+        {
+            logError("failed to write manifest: " + tmpPath);
+            return false;
+        }
+        bool ok=::write(fd, text.data(), text.size()) == static_cast<ssize_t>(text.size()) && fsync(fd) == 0;
+        ::close(fd);
+        if(!ok || rename(tmpPath.c_str(), manifestPath().c_str()) != 0)
+        {
+            logError("failed to install manifest in " + dbDir);
+            unlink(tmpPath.c_str());
+            return false;
+        }
+        int dirFd=::open(dbDir.c_str(), O_RDONLY);
+        if(dirFd >= 0)
+        {
+            fsync(dirFd);
+            ::close(dirFd);
+        }
+        return true;
+    }
+
+    void LSMStorage::removeOrphans(const Version& version)
+    {
+        //tables written by a flush or compaction that never reached the manifest
+        std::unordered_set<uint64_t> live;
+        for(const auto& level : version.levels)
+        {
+            for(const auto& table : level) live.insert(table.meta.number);
+        }
+        DIR* dir=opendir(dbDir.c_str());
+        if(!dir) return;
+        while(struct dirent* entry=readdir(dir))
+        {
+            std::string name=entry->d_name;
+            if(name.size() <= 4 || name.compare(name.size() - 4, 4, ".sst") != 0) continue;
+            uint64_t number=std::strtoull(name.c_str(), nullptr, 10);
+            if(!live.count(number)) unlink((dbDir + "/" + name).c_str());
+        }
+        closedir(dir);
+        unlink((manifestPath() + ".tmp").c_str());
+    }
+
+    bool LSMStorage::makeRoomForWrite(std::unique_lock<std::mutex>& lock)
+    {
+        while(true)
+        {
+            if(backgroundError) return false;
+            if(mem->empty() || mem->memoryUsage() < options.memtableBytes) return true;
+            //stall while the previous memtable is still being flushed, or when
+            //L0 has grown far past the compaction trigger
+            if(imm || current->levels[0].size() >= options.l0CompactionTrigger * 3)
+            {
+                doneCv.wait(lock);
+                continue;
+            }
+            imm=mem;
+            mem=std::make_shared<MemTable>();
+            workCv.notify_one();
+        }
+    }
+
+    bool LSMStorage::write(std::string_view key, std::string_view value, bool tombstone)
+    {
+        std::unique_lock<std::mutex> lock(stateMutex);
+        if(!dbOpen || !makeRoomForWrite(lock)) return false;
+        if(tombstone)
+        {
+            mem->remove(key);
+        }
+        else
+        {
+            mem->put(key, value);
+        }
+        return true;
+    }
+
+    bool LSMStorage::putRecord(const std::string& key, const std::string& value)
+    {
+        if(key.empty() || key.size() > MAX_KEY_SIZE || value.size() > MAX_VALUE_SIZE)
+        {
+            return false;
+        }
+        return write(key, value, false);
+    }
+
+    bool LSMStorage::getRecord(const std::string& key, std::string& value)
+    {
+        std::shared_ptr<MemTable> active, flushing;
+        std::shared_ptr<const Version> version;
+        {
+            std::lock_guard<std::mutex> lock(stateMutex);
+            if(!dbOpen) return false;
+            active=mem;
+            flushing=imm;
+            version=current;
+        }
+
+        //newest source first; a tombstone ends the search
+        LookupResult result=active->get(key, value);
+        if(result == LookupResult::NOT_FOUND && flushing) result=flushing->get(key, value);
+        if(result != LookupResult::NOT_FOUND) return result == LookupResult::FOUND;
+
+        uint64_t hash=hashKey(key);
+        for(const auto& table : version->levels[0])
+        {
+            if(key < table.meta.smallest || key > table.meta.largest) continue;
+            result=table.reader->get(key, hash, value);
+            if(result != LookupResult::NOT_FOUND) return result == LookupResult::FOUND;
+        }
+        for(int level=1; level<MAX_LEVELS; level++)
+        {
+            const auto& tables=version->levels[level];
+            auto it=std::lower_bound(tables.begin(), tables.end(), key,
+                [](const TableHandle& table, const std::string& k) { return table.meta.largest < k; });
+            if(it == tables.end() || key < it->meta.smallest) continue;
+            result=it->reader->get(key, hash, value);
+            if(result != LookupResult::NOT_FOUND) return result == LookupResult::FOUND;
+        }
+        return false;
+    }
+
+    bool LSMStorage::deleteRecord(const std::string& key)
+    {
+        //same contract as the page store: deleting a missing key fails
+        std::string existing;
+        if(!getRecord(key, existing)) return false;
+        return write(key, std::string_view(), true);
+    }
+
+    std::vector<Record> LSMStorage::scanRecords()
+    {
+        std::vector<Record> records;
+        forEachRecord([&](std::string_view key, std::string_view value)
+        {
+            records.emplace_back(std::string(key), std::string(value));
+            return true;
+        });
+        return records;
+    }
+
+    //pins the memtables and the current table version for the walk, so
+    //flushes and compactions cannot pull tables out from under it
+    bool LSMStorage::forEachRecord(const std::function<bool(std::string_view, std::string_view)>& fn)
+    {
+        std::shared_ptr<MemTable> active, flushing;
+        std::shared_ptr<const Version> version;
+        {
+            std::lock_guard<std::mutex> lock(stateMutex);
+            if(!dbOpen) return false;
+            active=mem;
+            flushing=imm;
+            version=current;
+        }
+
+        std::vector<std::unique_ptr<KVIterator>> sources;
+        sources.push_back(active->newIterator());
+        if(flushing) sources.push_back(flushing->newIterator());
+        for(const auto& level : version->levels)
+        {
+            for(const auto& table : level) sources.push_back(table.reader->newIterator());
+        }
+        MergingIterator merged(std::move(sources));
+        for(; merged.valid(); merged.next())
+        {
+            if(merged.isTombstone()) continue;
+            if(!fn(merged.key(), merged.value())) return false;
+        }
+        return true;
+    }
+
+    bool LSMStorage::flushAll()
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        return dbOpen && !backgroundError;
+    }
+
+    bool LSMStorage::checkpoint()
+    {
+        std::unique_lock<std::mutex> lock(stateMutex);
+        if(!dbOpen) return false;
+        while(imm && !backgroundError) doneCv.wait(lock);
+        if(!backgroundError && !mem->empty())
+        {
+            imm=mem;
+            mem=std::make_shared<MemTable>();
+            workCv.notify_one();
+            while(imm && !backgroundError) doneCv.wait(lock);
+        }
+        return !backgroundError;
+    }
+
+    std::vector<size_t> LSMStorage::levelTableCounts()
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        std::vector<size_t> counts;
+        if(!current) return counts;
+        for(const auto& level : current->levels) counts.push_back(level.size());
+        return counts;
+    }
+
+    void LSMStorage::waitForBackgroundWork()
+    {
+        std::unique_lock<std::mutex> lock(stateMutex);
+        while(dbOpen && !backgroundError && (imm || compactionLevel(*current) >= 0))
+        {
+            doneCv.wait(lock);
+        }
+    }
+
+    void LSMStorage::backgroundLoop()
+    {
+        std::unique_lock<std::mutex> lock(stateMutex);
+        while(true)
+        {
+            if(backgroundError)
+            {
+                //keep the store readable, but stop accepting writes
+                doneCv.notify_all();
+                workCv.wait(lock, [this] { return stopping; });
+                return;
+            }
+            if(imm)
+            {
+                if(!flushImmutable(lock))
+                {
+                    logError("memtable flush failed, lsm store is now read-only");
+                    backgroundError=true;
+                }
+                continue;
+            }
+            if(stopping) return;
+            Compaction compaction;
+            if(pickCompaction(*current, compaction))
+            {
+                if(!runCompaction(lock, compaction))
+                {
+                    logError("compaction failed, lsm store is now read-only");
+                    backgroundError=true;
+                }
+                continue;
+            }
+            doneCv.notify_all();
+            workCv.wait(lock);
+        }
+    }
+
+    bool LSMStorage::flushImmutable(std::unique_lock<std::mutex>& lock)
+    {
+        std::shared_ptr<MemTable> table=imm;
+        std::shared_ptr<const Version> base=current;
+        lock.unlock();
+
+        //a flush always produces a single L0 table, whatever its size
+        std::vector<TableHandle> outputs;
+        auto input=table->newIterator();
+        bool ok=writeTables(*input, false, table->size(), UINT64_MAX, lock, outputs);
+        lock.lock();
+        if(!ok) return false;
+
+        auto version=std::make_shared<Version>(*base);
+        version->levels[0].insert(version->levels[0].begin(), outputs.begin(), outputs.end());
+        if(!installVersion(lock, version, std::vector<uint64_t>())) return false;
+        imm.reset();
+        doneCv.notify_all();
+        return true;
+    }
+
+    int LSMStorage::compactionLevel(const Version& version) const
+    {
+        if(version.levels[0].size() >= options.l0CompactionTrigger) return 0;
+        for(int level=1; level<MAX_LEVELS-1; level++)
+        {
+            uint64_t bytes=0;
+            for(const auto& table : version.levels[level]) bytes += table.meta.fileSize;
+            if(bytes > maxBytesForLevel(level)) return level;
+        }
+        return -1;
+    }
+
+    bool LSMStorage::pickCompaction(const Version& version, Compaction& compaction)
+    {
+        int level=compactionLevel(version);
+        if(level < 0) return false;
+        compaction.level=level;
+        compaction.inputs[0].clear();
+        compaction.inputs[1].clear();
+
+        const auto& tables=version.levels[level];
+        if(level == 0)
+        {
+            //L0 tables overlap each other, so they all go at once
+            compaction.inputs[0]=tables;
+        }
+        else
+        {
+            //round-robin through the key space so every range gets its turn
+            auto it=std::find_if(tables.begin(), tables.end(),
+                [&](const TableHandle& table) { return table.meta.smallest > compactPointer[level]; });
+            if(it == tables.end()) it=tables.begin();
+            compaction.inputs[0].push_back(*it);
+            compactPointer[level]=it->meta.largest;
+        }
+
+        std::string smallest=compaction.inputs[0].front().meta.smallest;
+        std::string largest=compaction.inputs[0].front().meta.largest;
+        for(const auto& table : compaction.inputs[0])
+        {
+            smallest=std::min(smallest, table.meta.smallest);
+            largest=std::max(largest, table.meta.largest);
+        }
+        for(const auto& table : version.levels[level+1])
+        {
+            if(overlaps(table.meta, smallest, largest)) compaction.inputs[1].push_back(table);
+        }
+        for(const auto& table : compaction.inputs[1])
+        {
+            smallest=std::min(smallest, table.meta.smallest);
+            largest=std::max(largest, table.meta.largest);
+        }
+
+        //tombstones can go once nothing older below the output level can resurface
+        compaction.dropTombstones=true;
+        for(int deeper=level+2; deeper<MAX_LEVELS && compaction.dropTombstones; deeper++)
+        {
+            for(const auto& table : version.levels[deeper])
+            {
+                if(overlaps(table.meta, smallest, largest))
+                {
+                    compaction.dropTombstones=false;
+                    break;
+                }
+            }
+        }
+        return true;
+    }
+
+    bool LSMStorage::runCompaction(std::unique_lock<std::mutex>& lock, Compaction& compaction)
+    {
+        std::shared_ptr<const Version> base=current;
+        int outputLevel=compaction.level + 1;
+        std::vector<TableHandle> outputs;
+
+        if(compaction.level > 0 && compaction.inputs[0].size() == 1 && compaction.inputs[1].empty())
+        {
+            //nothing to merge with, just move the table down a level
+            outputs=compaction.inputs[0];
+        }
+        else
+        {
+            lock.unlock();
+            std::vector<std::unique_ptr<KVIterator>> sources;
+            uint64_t inputKeys=0, inputBytes=0;
+            //sources newest first: L0 is already newest first, level n beats level n+1
+            for(const auto& inputs : compaction.inputs)
+            {
+                for(const auto& table : inputs)
+                {
+                    sources.push_back(table.reader->newIterator());
+                    inputKeys += table.meta.entryCount;
+                    inputBytes += table.meta.fileSize;
+                }
+            }
+            size_t expectedKeys=inputKeys;
+            if(inputBytes > options.tableTargetBytes)
+            {
+                expectedKeys=inputKeys * options.tableTargetBytes / inputBytes + 1;
+            }
+            MergingIterator merged(std::move(sources));
+            bool ok=writeTables(merged, compaction.dropTombstones, expectedKeys, options.tableTargetBytes, lock, outputs);
+            lock.lock();
+            if(!ok) return false;
+        }
+
+        std::unordered_set<uint64_t> inputNumbers;
+        for(const auto& inputs : compaction.inputs)
+        {
+            for(const auto& table : inputs) inputNumbers.insert(table.meta.number);
+        }
+        auto version=std::make_shared<Version>(*base);
+        for(int level : {compaction.level, outputLevel})
+        {
+            auto& tables=version->levels[level];
+            tables.erase(std::remove_if(tables.begin(), tables.end(),
+                [&](const TableHandle& table) { return inputNumbers.count(table.meta.number) > 0; }), tables.end());
+        }
+        auto& target=version->levels[outputLevel];
+        target.insert(target.end(), outputs.begin(), outputs.end());
+        std::sort(target.begin(), target.end(),
+            [](const TableHandle& a, const TableHandle& b) { return a.meta.smallest < b.meta.smallest; });
+
+        //a moved table keeps its file
+        std::vector<uint64_t> obsolete;
+        for(uint64_t number : inputNumbers)
+        {
+            bool kept=std::any_of(outputs.begin(), outputs.end(),
+                [&](const TableHandle& table) { return table.meta.number == number; });
+            if(!kept) obsolete.push_back(number);
+        }
+        return installVersion(lock, version, obsolete);
+    }
+
+    bool LSMStorage::writeTables(KVIterator& input, bool dropTombstones, size_t expectedKeys, uint64_t splitBytes,
+                                 std::unique_lock<std::mutex>& lock, std::vector<TableHandle>& outputs)
+    {
+        std::unique_ptr<SSTableWriter> writer;
+        auto finishTable=[&]() -> bool
+        {
+            TableMeta meta;
+            bool finished=writer->finish(meta);
+            writer.reset();
+            if(!finished) return false;
+            auto reader=std::make_shared<SSTableReader>();
+            if(!reader->open(tablePath(meta.number)))
+            {
+                unlink(tablePath(meta.number).c_str());
+                return false;
+            }
+            outputs.push_back(TableHandle{meta, reader});
+            return true;
+        };
+        auto fail=[&]() -> bool
+        {
+            writer.reset();
+            for(const auto& table : outputs) unlink(tablePath(table.meta.number).c_str());
+            outputs.clear();
+            return false;
+        };
+
+        for(; input.valid(); input.next())
+        {
+            if(dropTombstones && input.isTombstone()) continue;
+            if(!writer)
+            {
+                lock.lock();
+                uint64_t number=nextFileNumber++;
+                lock.unlock();
+                writer=std::make_unique<SSTableWriter>(tablePath(number), number, expectedKeys);
+                if(!writer->isOpen()) return fail();
+            }
+            if(!writer->add(input.key(), input.value(), input.isTombstone()))
+            {
+                logError("failed to write table in " + dbDir);
+                return fail();
+            }
+            if(writer->estimatedSize() >= splitBytes && !finishTable()) return fail();
+        }
+        if(writer && !finishTable()) return fail();
+        return true;
+    }
+
+    bool LSMStorage::installVersion(std::unique_lock<std::mutex>& lock, std::shared_ptr<Version> version,
+                                    const std::vector<uint64_t>& obsolete)
+    {
+        //only the background thread installs versions, so current stays the
+        //base of this one while the manifest is written
+        uint64_t nextNumber=nextFileNumber;
+        lock.unlock();
+        bool saved=saveManifest(*version, nextNumber);
+        lock.lock();
+        if(!saved) return false;
+        current=version;
+        doneCv.notify_all();
+        //readers still holding the old version keep their open descriptors
+        for(uint64_t number : obsolete) unlink(tablePath(number).c_str());
+        return true;
+    }
+}
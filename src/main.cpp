@@ -1,15 +1,23 @@
 #include"common.hpp"
+#include"engine.hpp"
 #include"storage.hpp"
 #include"wal.hpp"
 #include"lockmgr.hpp"
 #include"transaction.hpp"
 #include"statistics.hpp"
+#include"server.hpp"
+#include"bulkload.hpp"
+#include"backup.hpp"
+#include"jsonbackup.hpp"
 #include<iostream>
 #include<string>
 #include<sstream>
 #include<fstream>
 #include<iomanip>
 #include<cstdio>
+#include<cstdlib>
+#include<csignal>
+#include<filesystem>
 
 void printHelp()
 {
@@ -18,7 +26,22 @@ void printHelp()
     std::cout << "Options:" << std::endl;
     std::cout << "  -d, --db PATH      Database file path (default: stonedb.sdb)" << std::endl;
     std::cout << "  -b, --batch        Batch mode (non-interactive)" << std::endl;
-    std::cout << "  -q, --quiet       Suppress log messages" << std::endl;
+    std::cout << "  -q, --quiet       Suppress log messages (same as --log-level error)" << std::endl;
+    std::cout << "  --log-level LEVEL  trace, debug, info (default) or error" << std::endl;
+    std::cout << "  --cache-pages N    Buffer pool size in 4KB pages (default: 1000)" << std::endl;
+    std::cout << "  --io-threads N     Threads for page store startup, flushes and scans (default: one per CPU)" << std::endl;
+    std::cout << "  --huge-pages       Back the buffer pool with transparent huge pages" << std::endl;
+    std::cout << "  --engine TYPE      Storage engine: page (default) or lsm" << std::endl;
+    std::cout << "  --layout TYPE      Page store layout for new files: heap (default) or hash" << std::endl;
+    std::cout << "  --page-format FMT  Data page format for new files: records (default) or slotted" << std::endl;
+    std::cout << "  --compression TYPE Page compression for new files: none (default) or lz" << std::endl;
+    std::cout << "  --serve SOCKET     Serve the binary protocol on a Unix socket instead of reading commands" << std::endl;
+    std::cout << "  --workers N        Worker threads for --serve (default: one per CPU)" << std::endl;
+    std::cout << "  --restore DIR      Replace the database with a hot backup before opening it; repeat it to" << std::endl;
+    std::cout << "                     add incremental backups in the order they were taken" << std::endl;
+    std::cout << "  --wal-archive DIR  Keep every truncated WAL segment in DIR (archive mode)" << std::endl;
+    std::cout << "  --until-lsn N      With --restore, replay the archived log only up to LSN N" << std::endl;
+    std::cout << "  --until-time T     With --restore, replay transactions committed up to Unix time T" << std::endl;
     std::cout << "  -h, --help         Show this help message" << std::endl;
     std::cout << std::endl;
     std::cout << "Commands:" << std::endl;
@@ -27,17 +50,41 @@ void printHelp()
     std::cout << "  del <key>          - Delete key" << std::endl;
     std::cout << "  scan               - Show all records" << std::endl;
     std::cout << "  backup <path>      - Backup database to JSON file" << std::endl;
+    std::cout << "  backup <dir> binary - Hot backup of the data file and WAL (restore with --restore)" << std::endl;
+    std::cout << "  backup <dir> incremental <parent>" << std::endl;
+    std::cout << "                     - Hot backup of the pages changed since the backup in <parent>" << std::endl;
     std::cout << "  restore <path>     - Restore database from JSON file" << std::endl;
+    std::cout << "  load <path> [csv|tsv|binary] [header]" << std::endl;
+    std::cout << "                     - Bulk load a file (format defaults to the .csv/.tsv extension)" << std::endl;
     std::cout << "  stats              - Show database statistics" << std::endl;
+    std::cout << "  stats json         - Statistics and latency percentiles as JSON" << std::endl;
     std::cout << "  help               - Show this help" << std::endl;
     std::cout << "  quit               - Exit database" << std::endl;
 }
 
+//records per transaction when restoring a JSON backup
+static const size_t RESTORE_BATCH_RECORDS=1000;
+
+//SIGINT/SIGTERM stop the server; requestStop only writes an eventfd
+static stonedb::Server* activeServer=nullptr;
+static void handleStopSignal(int)
+{
+    if(activeServer) activeServer->requestStop();
+}
+
 int main(int argc, char* argv[])
 {
     std::string dbPath="stonedb.sdb";
     bool batchMode=false;
     bool quietMode=false;
+    stonedb::StorageOptions storageOptions;
+    stonedb::EngineType engineType=stonedb::EngineType::PAGE;
+    std::string servePath;
+    stonedb::ServerOptions serverOptions;
+    std::vector<std::string> restorePaths;
+    std::string archivePath;
+    stonedb::RecoveryTarget recoveryTarget;
+    bool pointInTime=false;
     
     //parse command line arguments
     for(int i=1; i<argc; i++)
@@ -55,6 +102,17 @@ int main(int argc, char* argv[])
         else if(arg == "--quiet" || arg == "-q")
         {
             quietMode=true;
+            stonedb::setLogLevel(stonedb::LogLevel::ERROR);
+        }
+        else if(arg == "--log-level")
+        {
+            stonedb::LogLevel level;
+            if(i+1 >= argc || !stonedb::parseLogLevel(argv[++i], level))
+            {
+                std::cerr << "Error: --log-level requires trace, debug, info or error" << std::endl;
+                return 1;
+            }
+            stonedb::setLogLevel(level);
         }
         else if(arg == "--db" || arg == "-d")
         {
@@ -68,6 +126,156 @@ int main(int argc, char* argv[])
                 return 1;
             }
         }
+        else if(arg == "--cache-pages")
+        {
+            storageOptions.cacheFrames=(i+1 < argc) ? std::strtoul(argv[++i], nullptr, 10) : 0;
+            if(storageOptions.cacheFrames == 0)
+            {
+                std::cerr << "Error: --cache-pages requires a positive page count" << std::endl;
+                return 1;
+            }
+        }
+        else if(arg == "--io-threads")
+        {
+            storageOptions.workerThreads=(i+1 < argc) ? std::strtoul(argv[++i], nullptr, 10) : 0;
+            if(storageOptions.workerThreads == 0)
+            {
+                std::cerr << "Error: --io-threads requires a positive thread count" << std::endl;
+                return 1;
+            }
+        }
+        else if(arg == "--huge-pages")
+        {
+            storageOptions.useHugePages=true;
+        }
+        else if(arg == "--engine")
+        {
+            std::string engine=(i+1 < argc) ? argv[++i] : "";
+            if(engine == "page")
+            {
+                engineType=stonedb::EngineType::PAGE;
+            }
+            else if(engine == "lsm")
+            {
+                engineType=stonedb::EngineType::LSM;
+            }
+            else
+            {
+                std::cerr << "Error: --engine must be page or lsm" << std::endl;
+                return 1;
+            }
+        }
+        else if(arg == "--layout")
+        {
+            std::string layout=(i+1 < argc) ? argv[++i] : "";
+            if(layout == "heap")
+            {
+                storageOptions.layout=stonedb::StorageLayout::HEAP;
+            }
+            else if(layout == "hash")
+            {
+                storageOptions.layout=stonedb::StorageLayout::HASH;
+            }
+            else
+            {
+                std::cerr << "Error: --layout must be heap or hash" << std::endl;
+                return 1;
+            }
+        }
+        else if(arg == "--page-format")
+        {
+            std::string format=(i+1 < argc) ? argv[++i] : "";
+            if(format == "records")
+            {
+                storageOptions.pageFormat=stonedb::PageFormat::RECORDS;
+            }
+            else if(format == "slotted")
+            {
+                storageOptions.pageFormat=stonedb::PageFormat::SLOTTED;
+            }
+            else
+            {
+                std::cerr << "Error: --page-format must be records or slotted" << std::endl;
+                return 1;
+            }
+        }
+        else if(arg == "--compression")
+        {
+            std::string compression=(i+1 < argc) ? argv[++i] : "";
+            if(compression == "none")
+            {
+                storageOptions.compression=stonedb::PageCompression::NONE;
+            }
+            else if(compression == "lz")
+            {
+                storageOptions.compression=stonedb::PageCompression::LZ;
+            }
+            else
+            {
+                std::cerr << "Error: --compression must be none or lz" << std::endl;
+                return 1;
+            }
+        }
+        else if(arg == "--serve")
+        {
+            if(i+1 < argc)
+            {
+                servePath=argv[++i];
+            }
+            else
+            {
+                std::cerr << "Error: --serve requires a socket path" << std::endl;
+                return 1;
+            }
+        }
+        else if(arg == "--workers")
+        {
+            serverOptions.workers=(i+1 < argc) ? std::strtoul(argv[++i], nullptr, 10) : 0;
+            if(serverOptions.workers == 0)
+            {
+                std::cerr << "Error: --workers requires a positive thread count" << std::endl;
+                return 1;
+            }
+        }
+        else if(arg == "--restore")
+        {
+            if(i+1 < argc)
+            {
+                restorePaths.push_back(argv[++i]);
+            }
+            else
+            {
+                std::cerr << "Error: --restore requires a backup directory" << std::endl;
+                return 1;
+            }
+        }
+        else if(arg == "--wal-archive")
+        {
+            if(i+1 < argc)
+            {
+                archivePath=argv[++i];
+            }
+            else
+            {
+                std::cerr << "Error: --wal-archive requires a directory" << std::endl;
+                return 1;
+            }
+        }
+        else if(arg == "--until-lsn" || arg == "--until-time")
+        {
+            char* end=nullptr;
+            const char* value=(i+1 < argc) ? argv[++i] : "";
+            uint64_t n=std::strtoull(value, &end, 10);
+            if(*value == '\0' || *end != '\0')
+            {
+                std::cerr << "Error: " << arg << " requires a number" << std::endl;
+                return 1;
+            }
+            //commit timestamps are in milliseconds; take all of second T
+            if(arg == "--until-lsn") recoveryTarget.lsn=n;
+            else recoveryTarget.timestamp=n * 1000 + 999;
+            pointInTime=true;
+        }
         else if(arg[0] == '-')
         {
             std::cerr << "Error: Unknown option " << arg << std::endl;
@@ -91,12 +299,47 @@ int main(int argc, char* argv[])
         stonedb::log("StoneDB-engine starting");
     }
     
-    auto storage=std::make_shared<stonedb::StorageManager>();
+    if(pointInTime && restorePaths.empty())
+    {
+        std::cerr << "Error: --until-lsn and --until-time need --restore" << std::endl;
+        return 1;
+    }
+    if(pointInTime)
+    {
+        stonedb::BackupInfo restored;
+        stonedb::Lsn reached=0;
+        if(!stonedb::restoreToPoint(restorePaths, archivePath, dbPath, walPath, recoveryTarget, reached, restored))
+        {
+            std::cerr << "Failed to restore " << dbPath << " to the requested point" << std::endl;
+            return 1;
+        }
+        if(!quietMode)
+        {
+            std::cout << "Restored " << dbPath << " from " << restorePaths.back() << " and replayed the log to lsn "
+                      << reached << std::endl;
+        }
+    }
+    else if(!restorePaths.empty())
+    {
+        stonedb::BackupInfo restored;
+        if(!stonedb::restoreBackup(restorePaths, dbPath, walPath, restored))
+        {
+            std::cerr << "Failed to restore " << dbPath << " from " << restorePaths.back() << std::endl;
+            return 1;
+        }
+        if(!quietMode)
+        {
+            std::cout << "Restored " << restored.dataBytes << " data bytes and " << restored.walBytes
+                      << " log bytes from " << restorePaths.back() << std::endl;
+        }
+    }
+    
+    auto storage=stonedb::createStorageEngine(engineType);
     auto wal=std::make_shared<stonedb::WALManager>();
     auto lockMgr=std::make_shared<stonedb::LockManager>();
-    stonedb::Statistics stats;
+    stonedb::Statistics& stats=stonedb::Statistics::global();
     
-    if(!storage->open(dbPath))
+    if(!storage->open(dbPath, storageOptions))
     {
         std::cerr << "Failed to open database: " << dbPath << std::endl;
         return 1;
@@ -106,8 +349,39 @@ int main(int argc, char* argv[])
         std::cerr << "Failed to open WAL: " << walPath << std::endl;
         return 1;
     }
+    if(!archivePath.empty() && !wal->setArchiveDir(archivePath))
+    {
+        std::cerr << "Failed to use WAL archive: " << archivePath << std::endl;
+        return 1;
+    }
+    //redo committed work the engine may not hold yet (the LSM memtable lives
+    //only in the WAL), then checkpoint so the log starts empty
+    if(!storage->recover(*wal) || !wal->checkpoint(storage) || !wal->truncateLog())
+    {
+        std::cerr << "Failed to recover database from WAL: " << walPath << std::endl;
+        return 1;
+    }
     stonedb::TransactionManager txnMgr(storage, wal, lockMgr);
     
+    if(!servePath.empty())
+    {
+        stonedb::Server server(txnMgr, serverOptions);
+        if(!server.start(servePath))
+        {
+            std::cerr << "Failed to serve on " << servePath << std::endl;
+            return 1;
+        }
+        activeServer=&server;
+        std::signal(SIGINT, handleStopSignal);
+        std::signal(SIGTERM, handleStopSignal);
+        server.wait();
+        activeServer=nullptr;
+        stonedb::log("server stopped");
+        storage->close();
+        wal->close();
+        return 0;
+    }
+    
     if(!batchMode)
     {
         std::cout << "StoneDB-engine v1.0.0" << std::endl;
@@ -127,6 +401,8 @@ int main(int argc, char* argv[])
         }
         else
         {
+            //keep queued log lines from landing after the prompt
+            stonedb::flushLog();
             std::cout << "stonedb> ";
             if(!std::getline(std::cin, line))
             {
@@ -142,6 +418,52 @@ int main(int argc, char* argv[])
         {
             break;
         }
+        else if(cmd == "load")
+        {
+            std::string inputPath;
+            if(!(iss >> inputPath))
+            {
+                std::cout << "Usage: load <path> [csv|tsv|binary] [header]" << std::endl;
+                continue;
+            }
+            stonedb::BulkLoadOptions loadOptions;
+            bool formatGiven=false;
+            bool valid=true;
+            std::string word;
+            while(iss >> word)
+            {
+                if(word == "header") loadOptions.skipHeader=true;
+                else if(stonedb::parseLoadFormat(word, loadOptions.format)) formatGiven=true;
+                else valid=false;
+            }
+            if(!formatGiven)
+            {
+                std::string extension=std::filesystem::path(inputPath).extension().string();
+                if(extension == ".csv") loadOptions.format=stonedb::LoadFormat::CSV;
+                else if(extension == ".tsv") loadOptions.format=stonedb::LoadFormat::TSV;
+                else valid=false;
+            }
+            if(!valid)
+            {
+                std::cout << "Usage: load <path> [csv|tsv|binary] [header]" << std::endl;
+                continue;
+            }
+            stonedb::BulkLoadResult loaded;
+            if(stonedb::bulkLoad(inputPath, loadOptions, *storage, *wal, txnMgr, loaded))
+            {
+                std::cout << "Loaded " << loaded.stats.records << " records (" << loaded.duplicates
+                          << " duplicates dropped) in " << std::fixed << std::setprecision(3) << loaded.seconds
+                          << " s" << std::defaultfloat;
+                if(loaded.packed) std::cout << ", " << loaded.stats.pages << " pages";
+                else std::cout << ", transactional fallback";
+                if(loaded.runs > 0) std::cout << ", " << loaded.runs << " sort runs";
+                std::cout << std::endl;
+            }
+            else
+            {
+                std::cout << "ERROR: Load failed" << std::endl;
+            }
+        }
         else if(cmd.empty())
         {
             continue;
@@ -152,6 +474,12 @@ int main(int argc, char* argv[])
         }
         else if(cmd == "stats")
         {
+            std::string format;
+            if(iss >> format && format == "json")
+            {
+                std::cout << stats.toJson() << std::endl;
+                continue;
+            }
             std::cout << "=== Database Statistics ===" << std::endl;
             std::cout << "Transactions: " << stats.getTransactionCount() << std::endl;
             std::cout << "PUT operations: " << stats.getPutOps() << std::endl;
@@ -162,6 +490,35 @@ int main(int argc, char* argv[])
             std::cout << "Cache hit ratio: " << std::fixed << std::setprecision(2) << stats.getCacheHitRatio() << "%" << std::endl;
             std::cout << "Lock waits: " << stats.getLockWaits() << std::endl;
             std::cout << "Deadlocks detected: " << stats.getDeadlocks() << std::endl;
+            std::cout << "Latency (ns)      count        p50        p99       p999        max" << std::endl;
+            for(size_t i=0; i<static_cast<size_t>(stonedb::LatencyOp::COUNT); i++)
+            {
+                auto op=static_cast<stonedb::LatencyOp>(i);
+                stonedb::HistogramSnapshot h=stats.latency(op);
+                std::cout << "  " << std::left << std::setw(12) << stonedb::latencyOpName(op) << std::right
+                          << std::setw(9) << h.count << std::setw(11) << h.percentile(50)
+                          << std::setw(11) << h.percentile(99) << std::setw(11) << h.percentile(99.9)
+                          << std::setw(11) << h.max << std::endl;
+            }
+            std::cout << "I/O               reads   bytes read     writes  bytes written   flushes    syncs  sync p99 ns" << std::endl;
+            for(size_t i=0; i<static_cast<size_t>(stonedb::IoFile::COUNT); i++)
+            {
+                auto file=static_cast<stonedb::IoFile>(i);
+                stonedb::IoSnapshot io=stats.io(file);
+                std::cout << "  " << std::left << std::setw(12) << stonedb::ioFileName(file) << std::right
+                          << std::setw(9) << io.reads << std::setw(13) << io.bytesRead
+                          << std::setw(11) << io.writes << std::setw(15) << io.bytesWritten
+                          << std::setw(10) << io.flushes << std::setw(9) << io.syncs
+                          << std::setw(13) << io.syncLatency.percentile(99) << std::endl;
+            }
+            std::cout << "Write amplification: " << std::fixed << std::setprecision(2) << stats.writeAmplification()
+                      << " (" << stats.getLogicalBytes() << " logical bytes)" << std::endl;
+            if(auto pages=std::dynamic_pointer_cast<stonedb::StorageManager>(storage))
+            {
+                stonedb::PageCacheStats cache=pages->cacheStats();
+                std::cout << "Page cache hits: " << cache.frameHits << " (+" << cache.compressedHits << " compressed)" << std::endl;
+                std::cout << "Page reads from disk: " << cache.diskReads << " (" << cache.bytesRead << " bytes)" << std::endl;
+            }
         } else if(cmd == "put")
         {
             std::string key;
@@ -183,8 +540,6 @@ int main(int argc, char* argv[])
                     continue;
                 }
                 auto txnId=txnMgr.beginTransaction();
-                stats.incrementTransactions();
-                stats.incrementPutOps();
                 if(txnMgr.putRecord(txnId, key, value))
                 {
                     if(txnMgr.commitTransaction(txnId))
@@ -214,7 +569,6 @@ int main(int argc, char* argv[])
             if(iss >> key)
             {
                 auto txnId=txnMgr.beginTransaction();
-                stats.incrementGetOps();
                 std::string value;
                 if(txnMgr.getRecord(txnId, key, value))
                 {
@@ -237,7 +591,6 @@ int main(int argc, char* argv[])
             if(iss >> key)
             {
                 auto txnId=txnMgr.beginTransaction();
-                stats.incrementDeleteOps();
                 if(txnMgr.deleteRecord(txnId, key))
                 {
                     if(txnMgr.commitTransaction(txnId))
@@ -280,97 +633,44 @@ int main(int argc, char* argv[])
         else if(cmd == "backup")
         {
             std::string backupPath;
-            if(iss >> backupPath)
+            std::string mode;
+            if(iss >> backupPath && iss >> mode)
             {
-                auto records=storage->scanRecords();
-                std::ofstream outFile(backupPath);
+                stonedb::BackupInfo info;
+                std::string parentPath;
+                if(mode != "binary" && !(mode == "incremental" && iss >> parentPath))
+                {
+                    std::cout << "Usage: backup <path> | backup <dir> binary | backup <dir> incremental <parent>" << std::endl;
+                }
+                else if(mode == "binary" ? stonedb::hotBackup(*storage, *wal, backupPath, info) :
+                                           stonedb::incrementalBackup(*storage, *wal, backupPath, parentPath, info))
+                {
+                    std::cout << "Hot backup saved to " << backupPath << " (" << info.pages << " pages, "
+                              << info.dataBytes << " data bytes, " << info.walBytes << " log bytes, "
+                              << std::fixed << std::setprecision(3) << info.seconds << " s)" << std::defaultfloat << std::endl;
+                }
+                else
+                {
+                    std::cout << "ERROR: Hot backup failed" << std::endl;
+                }
+            }
+            else if(!backupPath.empty())
+            {
+                std::ofstream outFile(backupPath, std::ios::binary | std::ios::trunc);
                 if(!outFile.is_open())
                 {
                     std::cout << "ERROR: Cannot open backup file: " << backupPath << std::endl;
                     continue;
                 }
-                
-                outFile << "{\n";
-                outFile << "  \"stonedb_backup\": true,\n";
-                outFile << "  \"version\": \"1.0.0\",\n";
-                outFile << "  \"records\": [\n";
-                
-                for(size_t i=0; i<records.size(); i++)
+                uint64_t records=0;
+                if(stonedb::writeJsonBackup(*storage, outFile, records))
                 {
-                    outFile << "    {\n";
-                    outFile << "      \"key\": \"" << records[i].key << "\",\n";
-                    std::string escapedValue=records[i].value;
-                    size_t pos=0;
-                    while((pos=escapedValue.find("\\", pos)) != std::string::npos)
-                    {
-                        escapedValue.replace(pos, 1, "\\\\");
-                        pos += 2;
-                    }
-                    pos=0;
-                    while((pos=escapedValue.find("\"", pos)) != std::string::npos)
-                    {
-                        escapedValue.replace(pos, 1, "\\\"");
-                        pos += 2;
-                    }
-                    pos=0;
-                    while((pos=escapedValue.find("\b", pos)) != std::string::npos)
-                    {
-                        escapedValue.replace(pos, 1, "\\b");
-                        pos += 2;
-                    }
-                    pos=0;
-                    while((pos=escapedValue.find("\f", pos)) != std::string::npos)
-                    {
-                        escapedValue.replace(pos, 1, "\\f");
-                        pos += 2;
-                    }
-                    pos=0;
-                    while((pos=escapedValue.find("\n", pos)) != std::string::npos)
-                    {
-                        escapedValue.replace(pos, 1, "\\n");
-                        pos += 2;
-                    }
-                    pos=0;
-                    while((pos=escapedValue.find("\r", pos)) != std::string::npos)
-                    {
-                        escapedValue.replace(pos, 1, "\\r");
-                        pos += 2;
-                    }
-                    pos=0;
-                    while((pos=escapedValue.find("\t", pos)) != std::string::npos)
-                    {
-                        escapedValue.replace(pos, 1, "\\t");
-                        pos += 2;
-                    }
-                    pos=0;
-                    while(pos < escapedValue.size())
-                    {
-                        unsigned char c=escapedValue[pos];
-                        if(c < 0x20 && c != '\b' && c != '\t' && c != '\n' && c != '\f' && c != '\r')
-                        {
-                            char hex[7];
-                            snprintf(hex, sizeof(hex), "\\u%04x", c);
-                            escapedValue.replace(pos, 1, hex);
-                            pos += 6;
-                        }
-                        else
-                        {
-                            pos++;
-                        }
-                    }
-                    outFile << "      \"value\": \"" << escapedValue << "\"\n";
-                    outFile << "    }";
-                    if(i < records.size()-1)
-                    {
-                        outFile << ",";
-                    }
-                    outFile << "\n";
+                    std::cout << "Backup saved to " << backupPath << " (" << records << " records)" << std::endl;
+                }
+                else
+                {
+                    std::cout << "ERROR: Backup to " << backupPath << " failed" << std::endl;
                 }
-                
-                outFile << "  ]\n";
-                outFile << "}\n";
-                outFile.close();
-                std::cout << "Backup saved to " << backupPath << " (" << records.size() << " records)" << std::endl;
             }
             else
             {
@@ -380,121 +680,27 @@ int main(int argc, char* argv[])
         else if(cmd == "restore")
         {
             std::string backupPath;
-            if(iss >> backupPath)
+            if(iss >> backupPath && stonedb::isBackupDirectory(backupPath))
+            {
+                std::cout << "ERROR: " << backupPath << " is a hot backup; restore it with: stone --db "
+                          << dbPath << " --restore " << backupPath << std::endl;
+            }
+            else if(!backupPath.empty())
             {
-                std::ifstream inFile(backupPath);
+                std::ifstream inFile(backupPath, std::ios::binary);
                 if(!inFile.is_open())
                 {
                     std::cout << "ERROR: Cannot open backup file: " << backupPath << std::endl;
                     continue;
                 }
-                
-                std::string line;
-                std::string json;
-                while(std::getline(inFile, line))
-                {
-                    json += line + "\n";
-                }
-                inFile.close();
-                
-                size_t recordsStart=json.find("\"records\":");
-                if(recordsStart == std::string::npos)
-                {
-                    std::cout << "ERROR: Invalid backup format" << std::endl;
-                    continue;
-                }
-                
-                size_t pos=recordsStart;
-                int restoreCount=0;
-                auto txnId=txnMgr.beginTransaction();
-                
-                while((pos=json.find("\"key\":", pos)) != std::string::npos)
-                {
-                    pos += 7;
-                    while(pos < json.size() && (json[pos] == ' ' || json[pos] == '\"'))
-                        pos++;
-                    size_t keyStart=pos;
-                    while(pos < json.size() && json[pos] != '\"')
-                        pos++;
-                    std::string key=json.substr(keyStart, pos-keyStart);
-                    
-                    pos=json.find("\"value\":", pos);
-                    if(pos == std::string::npos) break;
-                    pos += 8;
-                    while(pos < json.size() && (json[pos] == ' ' || json[pos] == '\"'))
-                        pos++;
-
-                    std::string value;
-                    while(pos < json.size())
-                    {
-                        if(json[pos] == '\\' && pos+1 < json.size())
-                        {
-                            if(json[pos+1] == '\"')
-                            {
-                                value += '"';
-                                pos += 2;
-                            }
-                            else if(json[pos+1] == '\\')
-                            {
-                                value += '\\';
-                                pos += 2;
-                            }
-                            else if(json[pos+1] == 'n')
-                            {
-                                value += '\n';
-                                pos += 2;
-                            }
-                            else if(json[pos+1] == 't')
-                            {
-                                value += '\t';
-                                pos += 2;
-                            }
-                            else if(json[pos+1] == 'r')
-                            {
-                                value += '\r';
-                                pos += 2;
-                            }
-                            else
-                            {
-                                value += json[pos];
-                                pos++;
-                            }
-                        }
-                        else if(json[pos] == '"')
-                        {
-                            pos++;
-                            while(pos < json.size() && (json[pos] == ' ' || json[pos] == '\t' || json[pos] == '\n' || json[pos] == '\r'))
-                                pos++;
-                            if(pos < json.size() && (json[pos] == ',' || json[pos] == '}' || json[pos] == ']'))
-                            {
-                                break;
-                            }
-                            value += '"';
-                        }
-                        else if(json[pos] == ',' || json[pos] == '}' || json[pos] == ']')
-                        {
-                            break;
-                        }
-                        else
-                        {
-                            value += json[pos];
-                            pos++;
-                        }
-                    }
-                    
-                    if(txnMgr.putRecord(txnId, key, value))
-                    {
-                        restoreCount++;
-                    }
-                }
-                if(txnMgr.commitTransaction(txnId))
+                uint64_t restoreCount=0;
+                if(stonedb::readJsonBackup(inFile, txnMgr, RESTORE_BATCH_RECORDS, restoreCount))
                 {
                     std::cout << "Restore completed: " << restoreCount << " records restored" << std::endl;
                 }
                 else
                 {
-                    std::cout << "ERROR: Restore failed during commit" << std::endl;
-                    txnMgr.abortTransaction(txnId);
+                    std::cout << "ERROR: Restore failed after " << restoreCount << " records" << std::endl;
                 }
             }
             else
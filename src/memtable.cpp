@@ -0,0 +1,179 @@
+#include"memtable.hpp"
+#include<cstddef>
+#include<cstring>
+#include<new>
+
+namespace stonedb
+{
+    MemTable::MemTable()
+        : arenaCursor(nullptr), arenaRemaining(0), memoryBytes(0), head(nullptr),
+          maxHeight(1), entryCount(0), rngState(0xdeadbeef)
+    {
+        head=newNode(std::string_view(), MAX_HEIGHT);
+    }
+
+    char* MemTable::allocate(size_t bytes)
+    {
+        //keep every allocation pointer aligned for the atomics inside nodes
+        bytes=(bytes + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1);
+        if(bytes > arenaRemaining)
+        {
+            size_t blockSize=std::max(bytes, ARENA_BLOCK_SIZE);
+            arenaBlocks.emplace_back(new char[blockSize]);
+            arenaCursor=arenaBlocks.back().get();
+            arenaRemaining=blockSize;
+        }
+        memoryBytes.fetch_add(bytes, std::memory_order_relaxed);
+        char* result=arenaCursor;
+        arenaCursor += bytes;
+        arenaRemaining -= bytes;
+        return result;
+    }
+
+    MemTable::Node* MemTable::newNode(std::string_view key, int height)
+    {
+        size_t nodeBytes=sizeof(Node) + sizeof(std::atomic<Node*>) * (height - 1);
+        char* memory=allocate(nodeBytes + key.size());
+        char* keyCopy=memory + nodeBytes;
+        if(!key.empty()) memcpy(keyCopy, key.data(), key.size());
+        Node* node=new (memory) Node;
+        node->key=keyCopy;
+        node->keySize=static_cast<uint32_t>(key.size());
+        node->height=height;
+        node->value.store(nullptr, std::memory_order_relaxed);
+        for(int i=0; i<height; i++)
+        {
+            new (&node->next[i]) std::atomic<Node*>(nullptr);
+        }
+        return node;
+    }
+
+    const MemTable::ValueRecord* MemTable::newValue(std::string_view value, bool tombstone)
+    {
+        char* memory=allocate(sizeof(ValueRecord) + value.size());
+        char* data=memory + sizeof(ValueRecord);
+        if(!value.empty()) memcpy(data, value.data(), value.size());
+        ValueRecord* record=new (memory) ValueRecord;
+        record->size=static_cast<uint32_t>(value.size());
+        record->tombstone=tombstone;
+        record->data=data;
+        return record;
+    }
+
+    int MemTable::randomHeight()
+    {
+        //branching factor 4, xorshift is plenty for level choice
+        int height=1;
+        while(height < MAX_HEIGHT)
+        {
+            rngState ^= rngState << 13;
+            rngState ^= rngState >> 17;
+            rngState ^= rngState << 5;
+            if((rngState & 3) != 0) break;
+            height++;
+        }
+        return height;
+    }
+
+    MemTable::Node* MemTable::findGreaterOrEqual(std::string_view key, Node** prev) const
+    {
+        Node* x=head;
+        int level=maxHeight.load(std::memory_order_acquire) - 1;
+        while(true)
+        {
+            Node* next=x->next[level].load(std::memory_order_acquire);
+            if(next && next->keyView() < key)
+            {
+                x=next;
+                continue;
+            }
+            if(prev) prev[level]=x;
+            if(level == 0) return next;
+            level--;
+        }
+    }
+
+    void MemTable::insert(std::string_view key, std::string_view value, bool tombstone)
+    {
+        std::lock_guard<std::mutex> lock(writeMutex);
+        Node* prev[MAX_HEIGHT];
+        Node* existing=findGreaterOrEqual(key, prev);
+        const ValueRecord* record=newValue(value, tombstone);
+        if(existing && existing->keyView() == key)
+        {
+            existing->value.store(record, std::memory_order_release);
+            return;
+        }
+
+        int height=randomHeight();
+        int currentMax=maxHeight.load(std::memory_order_relaxed);
+        if(height > currentMax)
+        {
+            for(int i=currentMax; i<height; i++) prev[i]=head;
+            //readers seeing the new height before the links just drop a level
+            maxHeight.store(height, std::memory_order_release);
+        }
+        Node* node=newNode(key, height);
+        node->value.store(record, std::memory_order_relaxed);
+        for(int i=0; i<height; i++)
+        {
+            node->next[i].store(prev[i]->next[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+            prev[i]->next[i].store(node, std::memory_order_release);
+        }
+        entryCount.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void MemTable::put(std::string_view key, std::string_view value)
+    {
+        insert(key, value, false);
+    }
+
+    void MemTable::remove(std::string_view key)
+    {
+        insert(key, std::string_view(), true);
+    }
+
+    LookupResult MemTable::get(std::string_view key, std::string& value) const
+    {
+        Node* node=findGreaterOrEqual(key, nullptr);
+        if(!node || node->keyView() != key) return LookupResult::NOT_FOUND;
+        const ValueRecord* record=node->value.load(std::memory_order_acquire);
+        if(record->tombstone) return LookupResult::DELETED;
+        value.assign(record->data, record->size);
+        return LookupResult::FOUND;
+    }
+
+    //walks level 0 of the skiplist; the table must outlive the iterator
+    class MemTableIterator : public KVIterator
+    {
+    private:
+        const MemTable::Node* node;
+        const MemTable::ValueRecord* record;
+
+        void load()
+        {
+            record=node ? node->value.load(std::memory_order_acquire) : nullptr;
+        }
+
+    public:
+        explicit MemTableIterator(const MemTable::Node* head)
+            : node(head->next[0].load(std::memory_order_acquire)), record(nullptr)
+        {
+            load();
+        }
+        bool valid() const override { return node != nullptr; }
+        void next() override
+        {
+            node=node->next[0].load(std::memory_order_acquire);
+            load();
+        }
+        std::string_view key() const override { return node->keyView(); }
+        std::string_view value() const override { return std::string_view(record->data, record->size); }
+        bool isTombstone() const override { return record->tombstone; }
+    };
+
+    std::unique_ptr<KVIterator> MemTable::newIterator() const
+    {
+        return std::make_unique<MemTableIterator>(head);
+    }
+}
@@ -0,0 +1,605 @@
+#include"pageformat.hpp"
+#include<cstring>
+#if defined(__SSE2__)
+#include<emmintrin.h>
+#define STONEDB_PAGE_SSE2 1
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include<immintrin.h>
+#define STONEDB_PAGE_X86 1
+#endif
+
+namespace stonedb
+{
+    //---- RECORDS format ----
+
+    static constexpr size_t RECORD_HEADER_SIZE=8;
+
+    //a deleted record keeps keyLen=0 and valueLen covering its old key and
+    //value bytes, so walkers skip exactly the 4+valueLen bytes it occupied
+    static void markRecordDeleted(uint8_t* record, uint16_t keyLen, uint16_t valueLen)
+    {
+        uint16_t zero=0;
+        uint16_t span=keyLen + valueLen;
+        memcpy(record, &zero, 2);
+        memcpy(record + 2, &span, 2);
+    }
+
+    //bytes left over when a record shrinks or reuses a larger slot must stay
+    //walkable: a filler is a deleted record, which needs at least one byte of
+    //body since keyLen=0,valueLen=0 marks the end of the page
+    static constexpr size_t MIN_FILLER_SIZE=5;
+    static bool canLeaveGap(size_t gap)
+    {
+        return gap == 0 || gap >= MIN_FILLER_SIZE;
+    }
+    static void writeFiller(uint8_t* at, size_t gap)
+    {
+        if(gap == 0) return;
+        uint16_t zero=0;
+        uint16_t body=gap - 4;
+        memcpy(at, &zero, 2);
+        memcpy(at + 2, &body, 2);
+    }
+
+    //advances offset to the next live record; deleted records are skipped and
+    //sawGap is set. pages written before tombstones kept their key length can
+    //hold tombstones of the wrong size, so an implausible one falls back to
+    //searching forward for something that parses as a record
+    static bool nextLiveRecord(const uint8_t* data, size_t& offset, uint16_t& keyLen, uint16_t& valueLen,
+                               bool& sawGap)
+    {
+        while(offset < PAGE_SIZE - RECORD_HEADER_SIZE)
+        {
+            memcpy(&keyLen, data + offset, 2);
+            memcpy(&valueLen, data + offset + 2, 2);
+            if(keyLen == 0)
+            {
+                if(valueLen > 0 && offset + 4 + valueLen < PAGE_SIZE)
+                {
+                    sawGap=true;
+                    offset += 4 + valueLen;
+                    continue;
+                }
+                size_t searchOffset=offset + 4;
+                bool foundNext=false;
+                while(searchOffset < PAGE_SIZE - RECORD_HEADER_SIZE)
+                {
+                    uint16_t testKeyLen, testValueLen;
+                    memcpy(&testKeyLen, data + searchOffset, 2);
+                    memcpy(&testValueLen, data + searchOffset + 2, 2);
+                    if(testKeyLen > 0 && testKeyLen <= MAX_KEY_SIZE &&
+                       testValueLen > 0 && searchOffset + 4 + testKeyLen + testValueLen <= PAGE_SIZE)
+                    {
+                        offset=searchOffset;
+                        foundNext=true;
+                        break;
+                    }
+                    if(testKeyLen == 0 && testValueLen > 0 && searchOffset + 4 + testValueLen < PAGE_SIZE)
+                    {
+                        searchOffset += 4 + testValueLen;
+                        continue;
+                    }
+                    searchOffset += 4;
+                }
+                if(!foundNext) return false;
+                sawGap=true;
+                continue;
+            }
+            if(keyLen > MAX_KEY_SIZE || offset + 4 + keyLen + valueLen > PAGE_SIZE)
+            {
+                return false;
+            }
+            return true;
+        }
+        return false;
+    }
+
+    static bool findRecord(const uint8_t* data, std::string_view key, size_t& offset,
+                           uint16_t& keyLen, uint16_t& valueLen)
+    {
+        offset=0;
+        bool sawGap=false;
+        while(nextLiveRecord(data, offset, keyLen, valueLen, sawGap))
+        {
+            if(keyLen == key.size() && memcmp(data + offset + 4, key.data(), keyLen) == 0) return true;
+            offset += 4 + keyLen + valueLen;
+        }
+        return false;
+    }
+
+    static bool putRecords(uint8_t* data, std::string_view key, std::string_view value, bool& modified)
+    {
+        size_t requiredSize=4 + key.size() + value.size();
+
+        //check if record exists in this page
+        size_t offset=0;
+        while(offset < PAGE_SIZE - RECORD_HEADER_SIZE)
+        {
+            uint16_t keyLen, valueLen;
+            memcpy(&keyLen, data + offset, 2);
+            memcpy(&valueLen, data + offset + 2, 2);
+            if(keyLen == 0)
+            {
+                if(valueLen > 0 && offset + 4 + valueLen < PAGE_SIZE)
+                {
+                    offset += 4 + valueLen;
+                    continue;
+                }
+                break;
+            }
+            if(offset + 4 + keyLen + valueLen > PAGE_SIZE)
+            {
+                break;
+            }
+            if(keyLen == key.size() && memcmp(data + offset + 4, key.data(), keyLen) == 0)
+            {
+                if(valueLen >= value.size() && canLeaveGap(valueLen - value.size()))
+                {
+                    uint16_t newValueLen=value.size();
+                    memcpy(data + offset + 2, &newValueLen, 2);
+                    memcpy(data + offset + 4 + keyLen, value.data(), value.size());
+                    writeFiller(data + offset + 4 + keyLen + newValueLen, valueLen - value.size());
+                    modified=true;
+                    return true;
+                }
+                markRecordDeleted(data + offset, keyLen, valueLen);
+                modified=true;
+                break;
+            }
+            offset += 4 + keyLen + valueLen;
+        }
+
+        offset=0;
+        while(offset < PAGE_SIZE - RECORD_HEADER_SIZE)
+        {
+            uint16_t keyLen, valueLen;
+            memcpy(&keyLen, data + offset, 2);
+            memcpy(&valueLen, data + offset + 2, 2);
+            if(keyLen == 0)
+            {
+                size_t slotSize=valueLen;
+                size_t slotTotalSize=4 + slotSize;
+                if(slotTotalSize >= requiredSize && canLeaveGap(slotTotalSize - requiredSize) &&
+                   offset + slotTotalSize <= PAGE_SIZE)
+                {
+                    //reuse this deleted slot
+                    keyLen=key.size();
+                    valueLen=value.size();
+                    memcpy(data + offset, &keyLen, 2);
+                    memcpy(data + offset + 2, &valueLen, 2);
+                    memcpy(data + offset + 4, key.data(), keyLen);
+                    memcpy(data + offset + 4 + keyLen, value.data(), valueLen);
+                    writeFiller(data + offset + requiredSize, slotTotalSize - requiredSize);
+                    modified=true;
+                    return true;
+                }
+                if(slotSize > 0 && offset + 4 + slotSize < PAGE_SIZE)
+                {
+                    offset += 4 + slotSize;
+                    continue;
+                }
+                size_t searchOffset=offset + 4;
+                bool foundNext=false;
+                while(searchOffset < PAGE_SIZE - 4)
+                {
+                    uint16_t testKeyLen;
+                    memcpy(&testKeyLen, data + searchOffset, 2);
+                    if(testKeyLen > 0 && testKeyLen <= MAX_KEY_SIZE)
+                    {
+                        offset=searchOffset;
+                        foundNext=true;
+                        break;
+                    }
+                    searchOffset += 4;
+                    if(searchOffset > offset + 100) break;
+                }
+                if(!foundNext) break;
+                continue;
+            }
+            if(offset + 4 + keyLen + valueLen > PAGE_SIZE)
+            {
+                break;
+            }
+            offset += 4 + keyLen + valueLen;
+        }
+        if(offset < PAGE_SIZE - RECORD_HEADER_SIZE && offset + requiredSize <= PAGE_SIZE)
+        {
+            uint16_t nextKeyLen, nextValueLen;
+            memcpy(&nextKeyLen, data + offset, 2);
+            memcpy(&nextValueLen, data + offset + 2, 2);
+            if(nextKeyLen == 0 && nextValueLen == 0)
+            {
+                uint16_t keyLen=key.size();
+                uint16_t valueLen=value.size();
+                memcpy(data + offset, &keyLen, 2);
+                memcpy(data + offset + 2, &valueLen, 2);
+                memcpy(data + offset + 4, key.data(), keyLen);
+                memcpy(data + offset + 4 + keyLen, value.data(), valueLen);
+                modified=true;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    //---- SLOTTED format ----
+
+    struct SlottedHeader
+    {
+        uint16_t slotCount;
+        uint16_t recordStart;
+        uint16_t garbage;
+        uint8_t prefixLen;
+        uint8_t flags;
+    };
+    static_assert(sizeof(SlottedHeader) == 8, "slotted header is stored as-is");
+    static constexpr size_t SLOTTED_HEADER_SIZE=8;
+    static constexpr uint8_t SLOTTED_INITIALIZED=1;
+    static constexpr size_t SLOT_BYTES=3;            //fingerprint + u16 offset
+    static constexpr size_t BODY_HEADER_SIZE=4;
+    //smallest slot is 3 array bytes plus a 4-byte body
+    static constexpr size_t MAX_SLOTS=PAGE_SIZE / (SLOT_BYTES + BODY_HEADER_SIZE) + 1;
+
+    static uint8_t fingerprint(uint64_t hash)
+    {
+        return static_cast<uint8_t>(hash >> 56);
+    }
+
+    static SlottedHeader loadHeader(const uint8_t* data)
+    {
+        SlottedHeader h;
+        memcpy(&h, data, sizeof(h));
+        if(!(h.flags & SLOTTED_INITIALIZED))
+        {
+            h=SlottedHeader{0, static_cast<uint16_t>(PAGE_SIZE), 0, 0, SLOTTED_INITIALIZED};
+        }
+        return h;
+    }
+
+    static void storeHeader(uint8_t* data, const SlottedHeader& h)
+    {
+        memcpy(data, &h, sizeof(h));
+    }
+
+    static const uint8_t* fingerprints(const uint8_t* data, const SlottedHeader& h)
+    {
+        return data + SLOTTED_HEADER_SIZE + h.prefixLen;
+    }
+
+    static uint16_t slotOffset(const uint8_t* data, const SlottedHeader& h, size_t slot)
+    {
+        uint16_t offset;
+        memcpy(&offset, fingerprints(data, h) + h.slotCount + slot * 2, 2);
+        return offset;
+    }
+
+    static void readBody(const uint8_t* data, uint16_t offset, uint16_t& suffixLen, uint16_t& valueLen)
+    {
+        memcpy(&suffixLen, data + offset, 2);
+        memcpy(&valueLen, data + offset + 2, 2);
+    }
+
+    //mask of the fingerprints equal to fp among the 32 starting at p; callers
+    //mask off bits past slotCount. the fingerprint array sits in the first
+    //third of the page, so the 32-byte load never leaves it
+    using MatchFn=uint32_t(*)(const uint8_t*, uint8_t);
+
+#ifndef STONEDB_PAGE_SSE2
+    static uint32_t matchScalar(const uint8_t* p, uint8_t fp)
+    {
+        uint32_t mask=0;
+        for(int i=0; i<32; i++)
+        {
+            if(p[i] == fp) mask |= 1U << i;
+        }
+        return mask;
+    }
+#else
+    static uint32_t matchSse2(const uint8_t* p, uint8_t fp)
+    {
+        __m128i needle=_mm_set1_epi8(static_cast<char>(fp));
+        __m128i lo=_mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        __m128i hi=_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 16));
+        uint32_t loMask=static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(lo, needle)));
+        uint32_t hiMask=static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(hi, needle)));
+        return loMask | (hiMask << 16);
+    }
+#endif
+
+#ifdef STONEDB_PAGE_X86
+    __attribute__((target("avx2")))
+    static uint32_t matchAvx2(const uint8_t* p, uint8_t fp)
+    {
+        __m256i block=_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        __m256i eq=_mm256_cmpeq_epi8(block, _mm256_set1_epi8(static_cast<char>(fp)));
+        return static_cast<uint32_t>(_mm256_movemask_epi8(eq));
+    }
+#endif
+
+    static MatchFn selectMatch()
+    {
+#ifdef STONEDB_PAGE_X86
+        __builtin_cpu_init();
+        if(__builtin_cpu_supports("avx2")) return matchAvx2;
+#endif
+#ifdef STONEDB_PAGE_SSE2
+        return matchSse2;
+#else
+        return matchScalar;
+#endif
+    }
+    static const MatchFn matchFingerprints=selectMatch();
+
+    //slot index holding key, or -1
+    static int findSlot(const uint8_t* data, const SlottedHeader& h, std::string_view key, uint64_t hash)
+    {
+        if(key.size() < h.prefixLen || memcmp(key.data(), data + SLOTTED_HEADER_SIZE, h.prefixLen) != 0)
+        {
+            return -1;
+        }
+        std::string_view suffix=key.substr(h.prefixLen);
+        const uint8_t* fps=fingerprints(data, h);
+        uint8_t fp=fingerprint(hash);
+        for(size_t base=0; base<h.slotCount; base+=32)
+        {
+            uint32_t mask=matchFingerprints(fps + base, fp);
+            size_t remaining=h.slotCount - base;
+            if(remaining < 32) mask &= (1U << remaining) - 1;
+            while(mask)
+            {
+                size_t slot=base + __builtin_ctz(mask);
+                mask &= mask - 1;
+                uint16_t offset=slotOffset(data, h, slot);
+                uint16_t suffixLen, valueLen;
+                readBody(data, offset, suffixLen, valueLen);
+                if(suffixLen == suffix.size() &&
+                   memcmp(data + offset + BODY_HEADER_SIZE, suffix.data(), suffixLen) == 0)
+                {
+                    return static_cast<int>(slot);
+                }
+            }
+        }
+        return -1;
+    }
+
+    //page bytes needed to hold the live slots with a prefix of prefixLen
+    static size_t encodedSize(const uint8_t* data, const SlottedHeader& h, size_t prefixLen)
+    {
+        size_t bytes=SLOTTED_HEADER_SIZE + prefixLen + h.slotCount * SLOT_BYTES;
+        for(size_t i=0; i<h.slotCount; i++)
+        {
+            uint16_t suffixLen, valueLen;
+            readBody(data, slotOffset(data, h, i), suffixLen, valueLen);
+            bytes += BODY_HEADER_SIZE + (h.prefixLen - prefixLen) + suffixLen + valueLen;
+        }
+        return bytes;
+    }
+
+    //re-encodes the page with a prefix of prefixLen <= the current one,
+    //dropping dead space; the caller has checked encodedSize fits
+    static void rebuildSlotted(uint8_t* data, size_t prefixLen)
+    {
+        uint8_t copy[PAGE_SIZE];
+        memcpy(copy, data, PAGE_SIZE);
+        SlottedHeader old=loadHeader(copy);
+        size_t moved=old.prefixLen - prefixLen;
+
+        memset(data, 0, PAGE_SIZE);
+        memcpy(data + SLOTTED_HEADER_SIZE, copy + SLOTTED_HEADER_SIZE, prefixLen);
+        SlottedHeader h{old.slotCount, static_cast<uint16_t>(PAGE_SIZE), 0,
+                        static_cast<uint8_t>(prefixLen), SLOTTED_INITIALIZED};
+        uint8_t* fps=data + SLOTTED_HEADER_SIZE + prefixLen;
+        uint8_t* offsets=fps + h.slotCount;
+        const uint8_t* oldFps=fingerprints(copy, old);
+        size_t recordStart=PAGE_SIZE;
+        for(size_t i=0; i<old.slotCount; i++)
+        {
+            uint16_t oldOffset=slotOffset(copy, old, i);
+            uint16_t suffixLen, valueLen;
+            readBody(copy, oldOffset, suffixLen, valueLen);
+            uint16_t newSuffixLen=suffixLen + moved;
+            recordStart -= BODY_HEADER_SIZE + newSuffixLen + valueLen;
+            uint8_t* body=data + recordStart;
+            memcpy(body, &newSuffixLen, 2);
+            memcpy(body + 2, &valueLen, 2);
+            memcpy(body + BODY_HEADER_SIZE, copy + SLOTTED_HEADER_SIZE + prefixLen, moved);
+            memcpy(body + BODY_HEADER_SIZE + moved, copy + oldOffset + BODY_HEADER_SIZE, suffixLen + valueLen);
+            fps[i]=oldFps[i];
+            uint16_t offset=static_cast<uint16_t>(recordStart);
+            memcpy(offsets + i * 2, &offset, 2);
+        }
+        h.recordStart=static_cast<uint16_t>(recordStart);
+        storeHeader(data, h);
+    }
+
+    static void removeSlot(uint8_t* data, SlottedHeader& h, size_t slot)
+    {
+        uint16_t suffixLen, valueLen;
+        readBody(data, slotOffset(data, h, slot), suffixLen, valueLen);
+        uint8_t* fps=data + SLOTTED_HEADER_SIZE + h.prefixLen;
+        size_t n=h.slotCount;
+        uint16_t offsets[MAX_SLOTS];
+        memcpy(offsets, fps + n, n * 2);
+        memmove(fps + slot, fps + slot + 1, n - 1 - slot);
+        memmove(offsets + slot, offsets + slot + 1, (n - 1 - slot) * 2);
+        memcpy(fps + n - 1, offsets, (n - 1) * 2);
+        h.slotCount--;
+        h.garbage += BODY_HEADER_SIZE + suffixLen + valueLen;
+        storeHeader(data, h);
+    }
+
+    //caller has checked the slot and body fit below recordStart
+    static void appendSlot(uint8_t* data, SlottedHeader& h, uint8_t fp, std::string_view suffix, std::string_view value)
+    {
+        uint8_t* fps=data + SLOTTED_HEADER_SIZE + h.prefixLen;
+        size_t n=h.slotCount;
+        memmove(fps + n + 1, fps + n, n * 2);
+        fps[n]=fp;
+        h.recordStart -= BODY_HEADER_SIZE + suffix.size() + value.size();
+        uint8_t* body=data + h.recordStart;
+        uint16_t suffixLen=suffix.size();
+        uint16_t valueLen=value.size();
+        memcpy(body, &suffixLen, 2);
+        memcpy(body + 2, &valueLen, 2);
+        memcpy(body + BODY_HEADER_SIZE, suffix.data(), suffix.size());
+        memcpy(body + BODY_HEADER_SIZE + suffix.size(), value.data(), value.size());
+        memcpy(fps + n + 1 + n * 2, &h.recordStart, 2);
+        h.slotCount++;
+        storeHeader(data, h);
+    }
+
+    static bool putSlotted(uint8_t* data, std::string_view key, std::string_view value, uint64_t hash, bool& modified)
+    {
+        SlottedHeader h=loadHeader(data);
+        int slot=findSlot(data, h, key, hash);
+        if(slot >= 0)
+        {
+            uint16_t offset=slotOffset(data, h, slot);
+            uint16_t suffixLen, valueLen;
+            readBody(data, offset, suffixLen, valueLen);
+            if(value.size() <= valueLen)
+            {
+                uint16_t newValueLen=value.size();
+                memcpy(data + offset + 2, &newValueLen, 2);
+                memcpy(data + offset + BODY_HEADER_SIZE + suffixLen, value.data(), value.size());
+                h.garbage += valueLen - newValueLen;
+                storeHeader(data, h);
+                modified=true;
+                return true;
+            }
+            removeSlot(data, h, slot);
+            modified=true;
+        }
+
+        if(h.slotCount == 0)
+        {
+            //an empty page takes the whole first key as its prefix; later keys
+            //shrink it to the common prefix
+            size_t prefixLen=std::min<size_t>(key.size(), 255);
+            if(SLOTTED_HEADER_SIZE + prefixLen + SLOT_BYTES + BODY_HEADER_SIZE + key.size() - prefixLen + value.size() > PAGE_SIZE)
+            {
+                return false;
+            }
+            memset(data, 0, PAGE_SIZE);
+            h=SlottedHeader{0, static_cast<uint16_t>(PAGE_SIZE), 0, static_cast<uint8_t>(prefixLen), SLOTTED_INITIALIZED};
+            memcpy(data + SLOTTED_HEADER_SIZE, key.data(), prefixLen);
+            appendSlot(data, h, fingerprint(hash), key.substr(prefixLen), value);
+            modified=true;
+            return true;
+        }
+
+        size_t common=0;
+        const uint8_t* prefix=data + SLOTTED_HEADER_SIZE;
+        while(common < h.prefixLen && common < key.size() && prefix[common] == static_cast<uint8_t>(key[common]))
+        {
+            common++;
+        }
+        size_t newBytes=SLOT_BYTES + BODY_HEADER_SIZE + key.size() - common + value.size();
+        if(common < h.prefixLen)
+        {
+            if(encodedSize(data, h, common) + newBytes > PAGE_SIZE) return false;
+            rebuildSlotted(data, common);
+            modified=true;
+            h=loadHeader(data);
+        }
+        size_t arraysEnd=SLOTTED_HEADER_SIZE + h.prefixLen + h.slotCount * SLOT_BYTES;
+        if(arraysEnd + newBytes > h.recordStart)
+        {
+            if(arraysEnd + newBytes > static_cast<size_t>(h.recordStart) + h.garbage) return false;
+            rebuildSlotted(data, h.prefixLen);
+            h=loadHeader(data);
+        }
+        appendSlot(data, h, fingerprint(hash), key.substr(h.prefixLen), value);
+        modified=true;
+        return true;
+    }
+
+    //---- format dispatch ----
+
+    bool fitsInEmptyPage(PageFormat format, size_t keySize, size_t valueSize)
+    {
+        if(format == PageFormat::SLOTTED)
+        {
+            return SLOTTED_HEADER_SIZE + SLOT_BYTES + BODY_HEADER_SIZE + keySize + valueSize <= PAGE_SIZE;
+        }
+        return 4 + keySize + valueSize <= PAGE_SIZE - RECORD_HEADER_SIZE;
+    }
+
+    bool findInPage(PageFormat format, const uint8_t* data, std::string_view key, uint64_t hash,
+                    std::string_view& value)
+    {
+        if(format == PageFormat::SLOTTED)
+        {
+            SlottedHeader h=loadHeader(data);
+            int slot=findSlot(data, h, key, hash);
+            if(slot < 0) return false;
+            uint16_t offset=slotOffset(data, h, slot);
+            uint16_t suffixLen, valueLen;
+            readBody(data, offset, suffixLen, valueLen);
+            value=std::string_view(reinterpret_cast<const char*>(data + offset + BODY_HEADER_SIZE + suffixLen), valueLen);
+            return true;
+        }
+        size_t offset;
+        uint16_t keyLen, valueLen;
+        if(!findRecord(data, key, offset, keyLen, valueLen)) return false;
+        value=std::string_view(reinterpret_cast<const char*>(data + offset + 4 + keyLen), valueLen);
+        return true;
+    }
+
+    bool putInPage(PageFormat format, uint8_t* data, std::string_view key, std::string_view value,
+                   uint64_t hash, bool& modified)
+    {
+        modified=false;
+        if(format == PageFormat::SLOTTED) return putSlotted(data, key, value, hash, modified);
+        return putRecords(data, key, value, modified);
+    }
+
+    bool eraseFromPage(PageFormat format, uint8_t* data, std::string_view key, uint64_t hash)
+    {
+        if(format == PageFormat::SLOTTED)
+        {
+            SlottedHeader h=loadHeader(data);
+            int slot=findSlot(data, h, key, hash);
+            if(slot < 0) return false;
+            removeSlot(data, h, slot);
+            return true;
+        }
+        size_t offset;
+        uint16_t keyLen, valueLen;
+        if(!findRecord(data, key, offset, keyLen, valueLen)) return false;
+        markRecordDeleted(data + offset, keyLen, valueLen);
+        return true;
+    }
+
+    bool forEachInPage(PageFormat format, const uint8_t* data,
+                       const std::function<void(std::string_view key, std::string_view value)>& fn)
+    {
+        if(format == PageFormat::SLOTTED)
+        {
+            SlottedHeader h=loadHeader(data);
+            std::string key(reinterpret_cast<const char*>(data + SLOTTED_HEADER_SIZE), h.prefixLen);
+            for(size_t i=0; i<h.slotCount; i++)
+            {
+                uint16_t offset=slotOffset(data, h, i);
+                uint16_t suffixLen, valueLen;
+                readBody(data, offset, suffixLen, valueLen);
+                const char* body=reinterpret_cast<const char*>(data + offset + BODY_HEADER_SIZE);
+                key.resize(h.prefixLen);
+                key.append(body, suffixLen);
+                fn(key, std::string_view(body + suffixLen, valueLen));
+            }
+            return h.garbage > 0;
+        }
+        size_t offset=0;
+        uint16_t keyLen, valueLen;
+        bool sawGap=false;
+        while(nextLiveRecord(data, offset, keyLen, valueLen, sawGap))
+        {
+            const char* body=reinterpret_cast<const char*>(data + offset + 4);
+            fn(std::string_view(body, keyLen), std::string_view(body + keyLen, valueLen));
+            offset += 4 + keyLen + valueLen;
+        }
+        return sawGap;
+    }
+}
@@ -0,0 +1,175 @@
+#include"protocol.hpp"
+#include<cerrno>
+#include<cstring>
+#include<sys/socket.h>
+#include<sys/un.h>
+#include<unistd.h>
+
+namespace stonedb
+{
+    static void putU32(std::string& out, uint32_t v)
+    {
+        out.append(reinterpret_cast<const char*>(&v), 4);
+    }
+
+    void encodeRequest(std::string& out, Opcode op, uint32_t id, std::string_view key, std::string_view value)
+    {
+        uint16_t keyLen=static_cast<uint16_t>(key.size());
+        putU32(out, static_cast<uint32_t>(REQUEST_HEADER_SIZE - 4 + key.size() + value.size()));
+        out.push_back(static_cast<char>(op));
+        putU32(out, id);
+        out.append(reinterpret_cast<const char*>(&keyLen), 2);
+        out.append(key.data(), key.size());
+        out.append(value.data(), value.size());
+    }
+
+    DecodeResult decodeRequest(const uint8_t* data, size_t size, size_t& consumed, Request& request)
+    {
+        if(size < 4) return DecodeResult::NEED_MORE;
+        uint32_t bodyLen;
+        memcpy(&bodyLen, data, 4);
+        if(bodyLen < REQUEST_HEADER_SIZE - 4 || bodyLen > MAX_BODY_SIZE) return DecodeResult::BAD;
+        if(size < 4 + static_cast<size_t>(bodyLen)) return DecodeResult::NEED_MORE;
+        uint8_t op=data[4];
+        uint16_t keyLen;
+        memcpy(&request.id, data + 5, 4);
+        memcpy(&keyLen, data + 9, 2);
+        if(op > static_cast<uint8_t>(Opcode::STATS) || keyLen > MAX_KEY_SIZE ||
+           REQUEST_HEADER_SIZE - 4 + keyLen > bodyLen)
+        {
+            return DecodeResult::BAD;
+        }
+        size_t valueLen=bodyLen - (REQUEST_HEADER_SIZE - 4) - keyLen;
+        if(valueLen > MAX_VALUE_SIZE) return DecodeResult::BAD;
+        request.op=static_cast<Opcode>(op);
+        request.key.assign(reinterpret_cast<const char*>(data + REQUEST_HEADER_SIZE), keyLen);
+        request.value.assign(reinterpret_cast<const char*>(data + REQUEST_HEADER_SIZE + keyLen), valueLen);
+        consumed=4 + bodyLen;
+        return DecodeResult::OK;
+    }
+
+    void encodeResponse(std::string& out, Status status, uint32_t id, std::string_view value)
+    {
+        putU32(out, static_cast<uint32_t>(RESPONSE_HEADER_SIZE - 4 + value.size()));
+        out.push_back(static_cast<char>(status));
+        putU32(out, id);
+        out.append(value.data(), value.size());
+    }
+
+    DecodeResult decodeResponse(const uint8_t* data, size_t size, size_t& consumed, Response& response)
+    {
+        if(size < 4) return DecodeResult::NEED_MORE;
+        uint32_t bodyLen;
+        memcpy(&bodyLen, data, 4);
+        if(bodyLen < RESPONSE_HEADER_SIZE - 4 || bodyLen > MAX_BODY_SIZE) return DecodeResult::BAD;
+        if(size < 4 + static_cast<size_t>(bodyLen)) return DecodeResult::NEED_MORE;
+        if(data[4] > static_cast<uint8_t>(Status::BAD_REQUEST)) return DecodeResult::BAD;
+        response.status=static_cast<Status>(data[4]);
+        memcpy(&response.id, data + 5, 4);
+        response.value.assign(reinterpret_cast<const char*>(data + RESPONSE_HEADER_SIZE), bodyLen - (RESPONSE_HEADER_SIZE - 4));
+        consumed=4 + bodyLen;
+        return DecodeResult::OK;
+    }
+
+    StoneClient::StoneClient() : fd(-1), nextId(1), inBegin(0)
+    {
+    }
+
+    StoneClient::~StoneClient()
+    {
+        close();
+    }
+
+    bool StoneClient::connect(const std::string& socketPath)
+    {
+        close();
+        sockaddr_un addr;
+        if(socketPath.size() >= sizeof(addr.sun_path))
+        {
+            logError("socket path too long: " + socketPath);
+            return false;
+        }
+        fd=::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if(fd < 0) return false;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family=AF_UNIX;
+        memcpy(addr.sun_path, socketPath.c_str(), socketPath.size());
+        if(::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0)
+        {
+            logError("failed to connect to " + socketPath + ": " + strerror(errno));
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void StoneClient::close()
+    {
+        if(fd >= 0) ::close(fd);
+        fd=-1;
+        out.clear();
+        in.clear();
+        inBegin=0;
+    }
+
+    uint32_t StoneClient::send(Opcode op, std::string_view key, std::string_view value)
+    {
+        uint32_t id=nextId++;
+        encodeRequest(out, op, id, key, value);
+        return id;
+    }
+
+    bool StoneClient::flush()
+    {
+        size_t written=0;
+        while(written < out.size())
+        {
+            ssize_t n=::send(fd, out.data() + written, out.size() - written, MSG_NOSIGNAL);
+            if(n < 0)
+            {
+                if(errno == EINTR) continue;
+                return false;
+            }
+            written += static_cast<size_t>(n);
+        }
+        out.clear();
+        return true;
+    }
+
+    bool StoneClient::receive(Response& response)
+    {
+        while(true)
+        {
+            size_t consumed=0;
+            DecodeResult result=decodeResponse(in.data() + inBegin, in.size() - inBegin, consumed, response);
+            if(result == DecodeResult::OK)
+            {
+                inBegin += consumed;
+                if(inBegin == in.size())
+                {
+                    in.clear();
+                    inBegin=0;
+                }
+                return true;
+            }
+            if(result == DecodeResult::BAD || fd < 0) return false;
+            if(inBegin > 0)
+            {
+                in.erase(in.begin(), in.begin() + inBegin);
+                inBegin=0;
+            }
+            size_t have=in.size();
+            in.resize(have + 64 * 1024);
+            ssize_t n=::recv(fd, in.data() + have, 64 * 1024, 0);
+            in.resize(have + (n > 0 ? n : 0));
+            if(n == 0) return false;
+            if(n < 0 && errno != EINTR) return false;
+        }
+    }
+
+    bool StoneClient::call(Opcode op, std::string_view key, std::string_view value, Response& response)
+    {
+        send(op, key, value);
+        return flush() && receive(response);
+    }
+}
@@ -0,0 +1,414 @@
+#include"server.hpp"
+#include"statistics.hpp"
+#include<cerrno>
+#include<cstring>
+#include<fcntl.h>
+#include<sys/epoll.h>
+#include<sys/eventfd.h>
+#include<sys/socket.h>
+#include<sys/un.h>
+#include<unistd.h>
+
+namespace stonedb
+{
+    static constexpr size_t READ_CHUNK=64 * 1024;
+
+    Server::Server(TransactionManager& txnMgr, const ServerOptions& options)
+        : txnMgr(txnMgr), options(options), listenFd(-1), epollFd(-1), wakeFd(-1),
+          stopRequested(false), stopWorkers(false)
+    {
+        if(this->options.workers == 0) this->options.workers=std::max(1U, std::thread::hardware_concurrency());
+        if(this->options.maxBatch == 0) this->options.maxBatch=1;
+    }
+
+    Server::~Server()
+    {
+        stop();
+    }
+
+    bool Server::start(const std::string& path)
+    {
+        sockaddr_un addr;
+        if(path.size() >= sizeof(addr.sun_path))
+        {
+            logError("socket path too long: " + path);
+            return false;
+        }
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family=AF_UNIX;
+        memcpy(addr.sun_path, path.c_str(), path.size());
+
+        //a socket file nobody answers on is left over from a crash; a live one is not ours to take
+        int fd=::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if(fd >= 0 && ::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0)
+        {
+            ::close(fd);
+            logError("another server is listening on " + path);
+            return false;
+        }
+        if(fd >= 0) ::close(fd);
+        ::unlink(path.c_str());
+
+        listenFd=::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if(listenFd < 0 || ::bind(listenFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+           ::listen(listenFd, SOMAXCONN) != 0)
+        {
+            logError("failed to listen on " + path + ": " + strerror(errno));
+            if(listenFd >= 0) ::close(listenFd);
+            listenFd=-1;
+            return false;
+        }
+        socketPath=path;
+        epollFd=::epoll_create1(EPOLL_CLOEXEC);
+        wakeFd=::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if(epollFd < 0 || wakeFd < 0)
+        {
+            logError(std::string("failed to create event loop: ") + strerror(errno));
+            stop();
+            return false;
+        }
+        epoll_event ev{};
+        ev.events=EPOLLIN;
+        ev.data.fd=listenFd;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &ev);
+        ev.data.fd=wakeFd;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &ev);
+
+        stopRequested.store(false);
+        stopWorkers=false;
+        for(size_t i=0; i<options.workers; i++) workers.emplace_back(&Server::workerLoop, this);
+        loopThread=std::thread(&Server::eventLoop, this);
+        log("serving on " + path + " with " + std::to_string(options.workers) + " workers");
+        return true;
+    }
+
+    void Server::requestStop()
+    {
+        stopRequested.store(true);
+        if(wakeFd >= 0)
+        {
+            uint64_t one=1;
+            ssize_t ignored=::write(wakeFd, &one, sizeof(one));
+            (void)ignored;
+        }
+    }
+
+    void Server::wait()
+    {
+        if(loopThread.joinable()) loopThread.join();
+        {
+            std::lock_guard<std::mutex> lock(workMutex);
+            stopWorkers=true;
+        }
+        workCv.notify_all();
+        for(auto& worker : workers) worker.join();
+        workers.clear();
+        //workers are gone, so no connection is busy any more
+        for(auto& entry : connections) ::close(entry.first);
+        connections.clear();
+        work.clear();
+        done.clear();
+        if(listenFd >= 0)
+        {
+            ::close(listenFd);
+            ::unlink(socketPath.c_str());
+        }
+        if(epollFd >= 0) ::close(epollFd);
+        if(wakeFd >= 0) ::close(wakeFd);
+        listenFd=epollFd=wakeFd=-1;
+    }
+
+    void Server::stop()
+    {
+        requestStop();
+        wait();
+    }
+
+    void Server::eventLoop()
+    {
+        epoll_event events[128];
+        while(!stopRequested.load())
+        {
+            int n=epoll_wait(epollFd, events, 128, -1);
+            if(n < 0)
+            {
+                if(errno == EINTR) continue;
+                logError(std::string("epoll_wait failed: ") + strerror(errno));
+                break;
+            }
+            for(int i=0; i<n; i++)
+            {
+                int fd=events[i].data.fd;
+                if(fd == listenFd)
+                {
+                    acceptConnections();
+                    continue;
+                }
+                if(fd == wakeFd)
+                {
+                    uint64_t count;
+                    ssize_t ignored=::read(wakeFd, &count, sizeof(count));
+                    (void)ignored;
+                    collectCompleted();
+                    continue;
+                }
+                auto it=connections.find(fd);
+                if(it == connections.end()) continue;
+                Connection& conn=*it->second;
+                //a full hangup means the peer can no longer take responses either
+                if(events[i].events & (EPOLLHUP | EPOLLERR)) conn.dead=true;
+                if(!conn.dead && (events[i].events & EPOLLIN)) readConnection(conn);
+                if(!conn.dead && (events[i].events & EPOLLOUT)) writeConnection(conn);
+                dispatch(conn);
+                updateConnection(conn);
+            }
+        }
+    }
+
+    void Server::acceptConnections()
+    {
+        while(true)
+        {
+            int fd=::accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if(fd < 0)
+            {
+                if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                {
+                    logError(std::string("accept failed: ") + strerror(errno));
+                }
+                return;
+            }
+            auto conn=std::make_unique<Connection>(fd);
+            conn->events=EPOLLIN;
+            epoll_event ev{};
+            ev.events=conn->events;
+            ev.data.fd=fd;
+            if(epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev) != 0)
+            {
+                ::close(fd);
+                continue;
+            }
+            STONEDB_DEBUG("server: connection " + std::to_string(fd) + " accepted");
+            connections.emplace(fd, std::move(conn));
+        }
+    }
+
+    void Server::readConnection(Connection& conn)
+    {
+        //one chunk per wakeup keeps a fast sender from starving the other connections
+        if(conn.inBegin > 0 && conn.inBegin == conn.in.size())
+        {
+            conn.in.clear();
+            conn.inBegin=0;
+        }
+        else if(conn.inBegin > READ_CHUNK)
+        {
+            conn.in.erase(conn.in.begin(), conn.in.begin() + conn.inBegin);
+            conn.inBegin=0;
+        }
+        size_t have=conn.in.size();
+        conn.in.resize(have + READ_CHUNK);
+        ssize_t n=::recv(conn.fd, conn.in.data() + have, READ_CHUNK, 0);
+        conn.in.resize(have + (n > 0 ? n : 0));
+        if(n == 0)
+        {
+            conn.eof=true;
+        }
+        else if(n < 0)
+        {
+            if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) conn.dead=true;
+            return;
+        }
+
+        while(true)
+        {
+            Request request;
+            size_t consumed=0;
+            DecodeResult result=decodeRequest(conn.in.data() + conn.inBegin, conn.in.size() - conn.inBegin, consumed, request);
+            if(result == DecodeResult::NEED_MORE) break;
+            if(result == DecodeResult::BAD)
+            {
+                //framing is lost, so nothing after this point can be trusted
+                logError("server: malformed request on connection " + std::to_string(conn.fd));
+                conn.dead=true;
+                return;
+            }
+            conn.inBegin += consumed;
+            conn.pending.push_back(std::move(request));
+        }
+        if(conn.eof && conn.inBegin != conn.in.size())
+        {
+            logError("server: connection " + std::to_string(conn.fd) + " closed mid-request");
+        }
+    }
+
+    void Server::dispatch(Connection& conn)
+    {
+        if(conn.busy || conn.dead || conn.pending.empty()) return;
+        conn.batch.clear();
+        while(!conn.pending.empty() && conn.batch.size() < options.maxBatch)
+        {
+            conn.batch.push_back(std::move(conn.pending.front()));
+            conn.pending.pop_front();
+        }
+        conn.busy=true;
+        {
+            std::lock_guard<std::mutex> lock(workMutex);
+            work.push_back(&conn);
+        }
+        workCv.notify_one();
+    }
+
+    void Server::writeConnection(Connection& conn)
+    {
+        while(conn.outSent < conn.out.size())
+        {
+            ssize_t n=::send(conn.fd, conn.out.data() + conn.outSent, conn.out.size() - conn.outSent, MSG_NOSIGNAL);
+            if(n < 0)
+            {
+                if(errno == EINTR) continue;
+                if(errno != EAGAIN && errno != EWOULDBLOCK) conn.dead=true;
+                return;
+            }
+            conn.outSent += static_cast<size_t>(n);
+        }
+        conn.out.clear();
+        conn.outSent=0;
+    }
+
+    bool Server::updateConnection(Connection& conn)
+    {
+        bool finished=conn.eof && conn.pending.empty() && conn.out.empty();
+        if(conn.dead || finished)
+        {
+            if(!conn.busy)
+            {
+                closeConnection(conn);
+                return false;
+            }
+            //the worker still holds it; stop watching until the batch comes back
+            if(conn.events != 0)
+            {
+                epoll_ctl(epollFd, EPOLL_CTL_DEL, conn.fd, nullptr);
+                conn.events=0;
+            }
+            return true;
+        }
+        uint32_t events=0;
+        if(!conn.eof && conn.pending.size() < options.maxPending && conn.out.size() < options.maxOutput) events |= EPOLLIN;
+        if(!conn.out.empty()) events |= EPOLLOUT;
+        if(events != conn.events)
+        {
+            epoll_event ev{};
+            ev.events=events;
+            ev.data.fd=conn.fd;
+            int op=conn.events == 0 ? EPOLL_CTL_ADD : (events == 0 ? EPOLL_CTL_DEL : EPOLL_CTL_MOD);
+            epoll_ctl(epollFd, op, conn.fd, &ev);
+            conn.events=events;
+        }
+        return true;
+    }
+
+    void Server::closeConnection(Connection& conn)
+    {
+        STONEDB_DEBUG("server: connection " + std::to_string(conn.fd) + " closed");
+        int fd=conn.fd;
+        if(conn.events != 0) epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+        connections.erase(fd);
+        ::close(fd);
+    }
+
+    void Server::collectCompleted()
+    {
+        std::vector<Connection*> completed;
+        {
+            std::lock_guard<std::mutex> lock(doneMutex);
+            completed.swap(done);
+        }
+        for(Connection* conn : completed)
+        {
+            conn->busy=false;
+            if(!conn->dead)
+            {
+                conn->out.append(conn->responses);
+                writeConnection(*conn);
+            }
+            conn->responses.clear();
+            dispatch(*conn);
+            updateConnection(*conn);
+        }
+    }
+
+    void Server::workerLoop()
+    {
+        while(true)
+        {
+            Connection* conn;
+            {
+                std::unique_lock<std::mutex> lock(workMutex);
+                workCv.wait(lock, [this]() { return stopWorkers || !work.empty(); });
+                if(stopWorkers) return;
+                conn=work.front();
+                work.pop_front();
+            }
+            for(const Request& request : conn->batch) execute(request, conn->responses);
+            conn->batch.clear();
+            {
+                std::lock_guard<std::mutex> lock(doneMutex);
+                done.push_back(conn);
+            }
+            uint64_t one=1;
+            ssize_t ignored=::write(wakeFd, &one, sizeof(one));
+            (void)ignored;
+        }
+    }
+
+    void Server::execute(const Request& request, std::string& out)
+    {
+        switch(request.op)
+        {
+            case Opcode::PING:
+                encodeResponse(out, Status::OK, request.id, std::string_view());
+                return;
+            case Opcode::STATS:
+                encodeResponse(out, Status::OK, request.id, Statistics::global().toJson());
+                return;
+            case Opcode::GET:
+            {
+                std::string value;
+                auto txnId=txnMgr.beginTransaction();
+                bool found=txnMgr.getRecord(txnId, request.key, value);
+                if(!txnMgr.commitTransaction(txnId))
+                {
+                    encodeResponse(out, Status::ERROR, request.id, std::string_view());
+                    return;
+                }
+                encodeResponse(out, found ? Status::OK : Status::NOT_FOUND, request.id, value);
+                return;
+            }
+            case Opcode::PUT:
+            case Opcode::DEL:
+            {
+                if(request.key.empty())
+                {
+                    encodeResponse(out, Status::BAD_REQUEST, request.id, std::string_view());
+                    return;
+                }
+                auto txnId=txnMgr.beginTransaction();
+                bool ok=request.op == Opcode::PUT ? txnMgr.putRecord(txnId, request.key, request.value)
+                                                  : txnMgr.deleteRecord(txnId, request.key);
+                if(ok)
+                {
+                    ok=txnMgr.commitTransaction(txnId);
+                }
+                else
+                {
+                    txnMgr.abortTransaction(txnId);
+                }
+                encodeResponse(out, ok ? Status::OK : Status::ERROR, request.id, std::string_view());
+                return;
+            }
+        }
+        encodeResponse(out, Status::BAD_REQUEST, request.id, std::string_view());
+    }
+}
@@ -0,0 +1,562 @@
+#include"shard.hpp"
+#include<algorithm>
+#include<atomic>
+#include<condition_variable>
+#include<cstdio>
+#include<filesystem>
+#include<fstream>
+#include<future>
+#include<mutex>
+#include<thread>
+#include<unordered_set>
+#include<pthread.h>
+#include<sched.h>
+
+namespace stonedb
+{
+    namespace
+    {
+        const char* SHARDS_MAGIC="stonedb-shards 1";
+
+        std::string shardFile(const std::string& dir, size_t index, const char* suffix)
+        {
+            char name[32];
+            snprintf(name, sizeof(name), "shard-%03zu%s", index, suffix);
+            return (std::filesystem::path(dir) / name).string();
+        }
+
+        //exists is false for a directory that has no shards yet
+        bool readManifest(const std::string& dir, bool& exists, size_t& count, EngineType& engine)
+        {
+            std::string path=(std::filesystem::path(dir) / "SHARDS").string();
+            exists=std::filesystem::exists(path);
+            if(!exists) return true;
+            std::ifstream in(path);
+            std::string line, field, type;
+            if(!std::getline(in, line) || line != SHARDS_MAGIC)
+            {
+                logError(path + " is not a shard manifest");
+                return false;
+            }
+            count=0;
+            while(in >> field)
+            {
+                if(field == "shards") in >> count;
+                else if(field == "engine") in >> type;
+                else in >> line;
+            }
+            if(count == 0 || (type != "page" && type != "lsm"))
+            {
+                logError("corrupt shard manifest " + path);
+                return false;
+            }
+            engine=type == "lsm" ? EngineType::LSM : EngineType::PAGE;
+            return true;
+        }
+
+        bool writeManifest(const std::string& dir, size_t count, EngineType engine)
+        {
+            std::string path=(std::filesystem::path(dir) / "SHARDS").string();
+            std::ofstream out(path + ".tmp", std::ios::trunc);
+            out << SHARDS_MAGIC << "\n";
+            out << "shards " << count << "\n";
+            out << "engine " << (engine == EngineType::LSM ? "lsm" : "page") << "\n";
+            out.close();
+            if(!out || std::rename((path + ".tmp").c_str(), path.c_str()) != 0)
+            {
+                logError("failed to write shard manifest " + path);
+                return false;
+            }
+            return true;
+        }
+
+        //the CPUs this process may run on, in order
+        std::vector<int> allowedCpus()
+        {
+            std::vector<int> cpus;
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            if(sched_getaffinity(0, sizeof(set), &set) == 0)
+            {
+                for(int cpu=0; cpu<CPU_SETSIZE; cpu++)
+                {
+                    if(CPU_ISSET(cpu, &set)) cpus.push_back(cpu);
+                }
+            }
+            return cpus;
+        }
+    }
+
+    struct ShardedEngine::Shard
+    {
+        size_t index=0;
+        std::shared_ptr<StorageEngine> storage;
+        std::shared_ptr<WALManager> wal;
+
+        std::thread thread;
+        std::mutex inboxMutex;
+        std::condition_variable inboxCv;
+        std::vector<std::function<void()>> inbox;
+        bool stopping=false;
+
+        //shard i hands out i+1, then every shardCount-th id, so a
+        //transaction id names one transaction across all logs
+        std::atomic<TransactionId> nextTxnId{0};
+        TransactionId txnStride=1;
+
+        //worker thread only: prepared transactions waiting for their
+        //decision and the keys they hold
+        std::unordered_map<TransactionId, std::vector<ShardWrite>> prepared;
+        std::unordered_set<std::string> heldKeys;
+        //decisions finish() could not log here yet; checkpoint() retries
+        //them before it truncates anything
+        std::unordered_map<TransactionId, bool> undelivered;
+    };
+
+    ShardedEngine::ShardedEngine() : engineOpen(false) {}
+
+    ShardedEngine::~ShardedEngine()
+    {
+        close();
+    }
+
+    //the high half of the hash picks the shard: the low bits also pick hash
+    //layout buckets and bloom probes inside it, and must stay spread out
+    size_t ShardedEngine::shardOf(std::string_view key) const
+    {
+        return static_cast<size_t>(((hashKey(key) >> 32) * shards.size()) >> 32);
+    }
+
+    //runs fn on the shard's thread and waits for its result
+    bool ShardedEngine::call(Shard& shard, const std::function<bool()>& fn)
+    {
+        std::promise<bool> reply;
+        auto result=reply.get_future();
+        {
+            std::lock_guard<std::mutex> lock(shard.inboxMutex);
+            shard.inbox.push_back([&] { reply.set_value(fn()); });
+        }
+        shard.inboxCv.notify_one();
+        return result.get();
+    }
+
+    //runs fn on every target shard's thread at once; true if all succeeded
+    bool ShardedEngine::callEach(const std::vector<size_t>& targets, const std::function<bool(Shard&)>& fn)
+    {
+        std::vector<std::promise<bool>> replies(targets.size());
+        std::vector<std::future<bool>> results;
+        for(auto& reply : replies) results.push_back(reply.get_future());
+        for(size_t i=0; i<targets.size(); i++)
+        {
+            Shard& shard=*shards[targets[i]];
+            {
+                std::lock_guard<std::mutex> lock(shard.inboxMutex);
+                shard.inbox.push_back([&, i] { replies[i].set_value(fn(*shards[targets[i]])); });
+            }
+            shard.inboxCv.notify_one();
+        }
+        bool ok=true;
+        for(auto& result : results)
+        {
+            if(!result.get()) ok=false;
+        }
+        return ok;
+    }
+
+    bool ShardedEngine::callAll(const std::function<bool(Shard&)>& fn)
+    {
+        std::vector<size_t> targets(shards.size());
+        for(size_t i=0; i<targets.size(); i++) targets[i]=i;
+        return callEach(targets, fn);
+    }
+
+    //takes the whole inbox at once, so callers queue without waiting on a
+    //running request
+    void ShardedEngine::workerLoop(Shard& shard)
+    {
+        std::vector<std::function<void()>> batch;
+        while(true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(shard.inboxMutex);
+                shard.inboxCv.wait(lock, [&] { return !shard.inbox.empty() || shard.stopping; });
+                if(shard.inbox.empty()) return;
+                batch.swap(shard.inbox);
+            }
+            for(auto& task : batch) task();
+            batch.clear();
+        }
+    }
+
+    void ShardedEngine::stopWorkers()
+    {
+        for(auto& shard : shards)
+        {
+            if(!shard->thread.joinable()) continue;
+            {
+                std::lock_guard<std::mutex> lock(shard->inboxMutex);
+                shard->stopping=true;
+            }
+            shard->inboxCv.notify_one();
+            shard->thread.join();
+        }
+    }
+
+    bool ShardedEngine::open(const std::string& dir, const ShardOptions& options)
+    {
+        if(engineOpen)
+        {
+            logError("sharded engine is already open");
+            return false;
+        }
+        std::error_code ec;
+        std::filesystem::create_directories(dir, ec);
+        if(ec)
+        {
+            logError("failed to create shard directory " + dir + ": " + ec.message());
+            return false;
+        }
+        bool exists;
+        size_t count=0;
+        EngineType engine=options.engine;
+        if(!readManifest(dir, exists, count, engine)) return false;
+        std::vector<int> cpus=allowedCpus();
+        if(exists)
+        {
+            //keys are placed by shard count, so it can never change
+            if(options.shards != 0 && options.shards != count)
+            {
+                logError(dir + " holds " + std::to_string(count) + " shards, not " + std::to_string(options.shards));
+                return false;
+            }
+            if(engine != options.engine)
+            {
+                logError(dir + " was created with a different storage engine");
+                return false;
+            }
+        }
+        else
+        {
+            count=options.shards != 0 ? options.shards : std::max<size_t>(1, cpus.size());
+            if(!writeManifest(dir, count, engine)) return false;
+        }
+
+        shards.clear();
+        for(size_t i=0; i<count; i++)
+        {
+            auto shard=std::make_unique<Shard>();
+            shard->index=i;
+            shard->storage=createStorageEngine(engine);
+            shard->wal=std::make_shared<WALManager>();
+            shard->nextTxnId=i + 1;
+            shard->txnStride=count;
+            shard->thread=std::thread(workerLoop, std::ref(*shard));
+            if(options.pinThreads && !cpus.empty())
+            {
+                cpu_set_t set;
+                CPU_ZERO(&set);
+                CPU_SET(cpus[i % cpus.size()], &set);
+                if(pthread_setaffinity_np(shard->thread.native_handle(), sizeof(set), &set) != 0)
+                {
+                    log("could not pin shard " + std::to_string(i) + " to cpu " + std::to_string(cpus[i % cpus.size()]));
+                }
+            }
+            shards.push_back(std::move(shard));
+        }
+
+        //each shard opens on its own thread, so its memory is first touched
+        //where it will be used
+        bool ok=callAll([&](Shard& shard)
+        {
+            return shard.storage->open(shardFile(dir, shard.index, engine == EngineType::LSM ? "" : ".sdb"),
+                                       options.storage) &&
+                   shard.wal->open(shardFile(dir, shard.index, ".wal"));
+        });
+        //every decision has to be in its participants' logs before any
+        //coordinator log is truncated
+        ok=ok && resolveInDoubt();
+        ok=ok && callAll([](Shard& shard)
+        {
+            return shard.storage->recover(*shard.wal, 1) && shard.wal->checkpoint(shard.storage) &&
+                   shard.wal->truncateLog();
+        });
+        if(!ok)
+        {
+            logError("failed to open sharded engine in " + dir);
+            callAll([](Shard& shard)
+            {
+                if(shard.storage->isOpen()) shard.storage->close();
+                if(shard.wal->isOpen()) shard.wal->close();
+                return true;
+            });
+            stopWorkers();
+            shards.clear();
+            return false;
+        }
+        engineOpen=true;
+        log("opened " + std::to_string(count) + " shards in " + dir);
+        return true;
+    }
+
+    void ShardedEngine::close()
+    {
+        if(!engineOpen) return;
+        std::unique_lock<std::shared_mutex> hold(decisionMutex);
+        callAll([](Shard& shard)
+        {
+            shard.storage->close();
+            shard.wal->close();
+            return true;
+        });
+        stopWorkers();
+        shards.clear();
+        engineOpen=false;
+    }
+
+    //a transaction a crash left prepared commits if its coordinator logged
+    //COMMIT and aborts otherwise; the outcome goes into the participant's
+    //log, so replay sees a decided transaction
+    bool ShardedEngine::resolveInDoubt()
+    {
+        std::vector<std::vector<LogEntry>> inDoubt(shards.size());
+        std::vector<std::unordered_set<TransactionId>> committed(shards.size());
+        if(!callAll([&](Shard& shard)
+        {
+            return shard.wal->preparedTransactions(inDoubt[shard.index], committed[shard.index]);
+        }))
+        {
+            return false;
+        }
+        std::atomic<size_t> resolved{0};
+        bool ok=callAll([&](Shard& shard)
+        {
+            for(const auto& entry : inDoubt[shard.index])
+            {
+                size_t coordinator;
+                try
+                {
+                    coordinator=std::stoull(entry.value);
+                }
+                catch(const std::exception&)
+                {
+                    coordinator=shards.size();
+                }
+                if(coordinator >= shards.size())
+                {
+                    logError("prepared transaction " + std::to_string(entry.txnId) + " names unknown coordinator " +
+                             entry.value);
+                    return false;
+                }
+                bool commit=committed[coordinator].count(entry.txnId) != 0;
+                if(!(commit ? shard.wal->logCommitTxn(entry.txnId) : shard.wal->logAbortTxn(entry.txnId))) return false;
+                resolved++;
+            }
+            return true;
+        });
+        if(resolved.load() != 0)
+        {
+            log("resolved " + std::to_string(resolved.load()) + " in-doubt transaction(s)");
+        }
+        return ok;
+    }
+
+    //worker thread; applies decided writes to the shard's storage
+    bool ShardedEngine::apply(Shard& shard, const std::vector<ShardWrite>& writes)
+    {
+        for(const auto& write : writes)
+        {
+            if(write.isDelete)
+            {
+                //a delete of a missing key is fine
+                shard.storage->deleteRecord(write.key);
+            }
+            else if(!shard.storage->putRecord(write.key, write.value))
+            {
+                logError("shard " + std::to_string(shard.index) + " failed to apply committed put of " + write.key);
+                return false;
+            }
+        }
+        return shard.storage->flushAll();
+    }
+
+    //worker thread; a transaction that only touches this shard
+    bool ShardedEngine::writeLocal(Shard& shard, const std::vector<ShardWrite>& writes)
+    {
+        for(const auto& write : writes)
+        {
+            if(shard.heldKeys.count(write.key)) return false;
+        }
+        TransactionId txnId=shard.nextTxnId.fetch_add(shard.txnStride);
+        bool logged=shard.wal->logBeginTxn(txnId);
+        for(size_t i=0; logged && i<writes.size(); i++)
+        {
+            logged=writes[i].isDelete ? shard.wal->logDeleteRecord(txnId, writes[i].key)
+                                      : shard.wal->logPutRecord(txnId, writes[i].key, writes[i].value);
+        }
+        if(!logged || !shard.wal->logCommitTxn(txnId))
+        {
+            shard.wal->logAbortTxn(txnId);
+            return false;
+        }
+        return apply(shard, writes);
+    }
+
+    //worker thread; phase one: log the writes and a durable PREPARE vote,
+    //then hold the keys until the decision
+    bool ShardedEngine::prepare(Shard& shard, TransactionId txnId, size_t coordinator,
+                                const std::vector<ShardWrite>& writes)
+    {
+        for(const auto& write : writes)
+        {
+            if(shard.heldKeys.count(write.key)) return false;
+        }
+        bool logged=shard.wal->logBeginTxn(txnId);
+        for(size_t i=0; logged && i<writes.size(); i++)
+        {
+            logged=writes[i].isDelete ? shard.wal->logDeleteRecord(txnId, writes[i].key)
+                                      : shard.wal->logPutRecord(txnId, writes[i].key, writes[i].value);
+        }
+        if(!logged || !shard.wal->logPrepareTxn(txnId, std::to_string(coordinator)))
+        {
+            shard.wal->logAbortTxn(txnId);
+            return false;
+        }
+        for(const auto& write : writes) shard.heldKeys.insert(write.key);
+        shard.prepared.emplace(txnId, writes);
+        return true;
+    }
+
+    //worker thread; phase two. a COMMIT that cannot be logged leaves the
+    //transaction prepared for the abort that follows
+    bool ShardedEngine::finish(Shard& shard, TransactionId txnId, bool commit)
+    {
+        auto it=shard.prepared.find(txnId);
+        if(it == shard.prepared.end()) return false;
+        if(commit && !shard.wal->logCommitTxn(txnId)) return false;
+        if(!commit && !shard.wal->logAbortTxn(txnId)) return false;
+        for(const auto& write : it->second) shard.heldKeys.erase(write.key);
+        bool ok=!commit || apply(shard, it->second);
+        shard.prepared.erase(it);
+        shard.undelivered.erase(txnId);
+        return ok;
+    }
+
+    //worker thread; finish() that remembers a decision it could not log
+    bool ShardedEngine::deliver(Shard& shard, TransactionId txnId, bool commit)
+    {
+        if(finish(shard, txnId, commit)) return true;
+        if(shard.prepared.count(txnId)) shard.undelivered[txnId]=commit;
+        return false;
+    }
+
+    bool ShardedEngine::putRecord(const std::string& key, const std::string& value)
+    {
+        if(key.size() > MAX_KEY_SIZE || value.size() > MAX_VALUE_SIZE) return false;
+        std::vector<ShardWrite> writes{{key, value, false}};
+        return commit(writes);
+    }
+
+    bool ShardedEngine::getRecord(const std::string& key, std::string& value)
+    {
+        if(!engineOpen) return false;
+        Shard& shard=*shards[shardOf(key)];
+        return call(shard, [&] { return shard.storage->getRecord(key, value); });
+    }
+
+    bool ShardedEngine::deleteRecord(const std::string& key)
+    {
+        if(!engineOpen) return false;
+        Shard& shard=*shards[shardOf(key)];
+        std::vector<ShardWrite> writes{{key, std::string(), true}};
+        return call(shard, [&]
+        {
+            std::string value;
+            return shard.storage->getRecord(key, value) && writeLocal(shard, writes);
+        });
+    }
+
+    bool ShardedEngine::commit(const std::vector<ShardWrite>& writes)
+    {
+        if(!engineOpen) return false;
+        std::vector<std::vector<ShardWrite>> byShard(shards.size());
+        std::vector<size_t> participants;
+        for(const auto& write : writes)
+        {
+            if(write.key.size() > MAX_KEY_SIZE || write.value.size() > MAX_VALUE_SIZE) return false;
+            size_t index=shardOf(write.key);
+            if(byShard[index].empty()) participants.push_back(index);
+            byShard[index].push_back(write);
+        }
+        if(participants.empty()) return true;
+        if(participants.size() == 1)
+        {
+            Shard& shard=*shards[participants[0]];
+            return call(shard, [&] { return writeLocal(shard, byShard[shard.index]); });
+        }
+
+        std::shared_lock<std::shared_mutex> hold(decisionMutex);
+        std::sort(participants.begin(), participants.end());
+        size_t coordinator=participants[0];
+        TransactionId txnId=shards[coordinator]->nextTxnId.fetch_add(shards[coordinator]->txnStride);
+        std::vector<char> voted(shards.size(), 0);
+        bool yes=callEach(participants, [&](Shard& shard)
+        {
+            voted[shard.index]=prepare(shard, txnId, coordinator, byShard[shard.index]);
+            return voted[shard.index] != 0;
+        });
+        //the coordinator's COMMIT record is the decision
+        if(yes && call(*shards[coordinator], [&] { return finish(*shards[coordinator], txnId, true); }))
+        {
+            std::vector<size_t> rest(participants.begin() + 1, participants.end());
+            if(!callEach(rest, [&](Shard& shard) { return deliver(shard, txnId, true); }))
+            {
+                //committed all the same; checkpoint() or open() finishes it
+                logError("transaction " + std::to_string(txnId) + " committed, but a participant did not finish");
+            }
+            return true;
+        }
+        std::vector<size_t> undo;
+        for(size_t index : participants)
+        {
+            if(voted[index]) undo.push_back(index);
+        }
+        callEach(undo, [&](Shard& shard) { return deliver(shard, txnId, false); });
+        return false;
+    }
+
+    //reads from the calling thread through each engine's own locking, so
+    //a long walk does not hold up the shard threads
+    bool ShardedEngine::forEachRecord(const std::function<bool(std::string_view, std::string_view)>& fn)
+    {
+        if(!engineOpen) return false;
+        for(auto& shard : shards)
+        {
+            if(!shard->storage->forEachRecord(fn)) return false;
+        }
+        return true;
+    }
+
+    bool ShardedEngine::checkpoint()
+    {
+        if(!engineOpen) return false;
+        std::unique_lock<std::shared_mutex> hold(decisionMutex);
+        //no commit is in flight, so anything still prepared missed its
+        //decision. truncating the coordinator's log would turn a commit
+        //into an abort on open(), so every shard must be settled first
+        bool settled=callAll([this](Shard& shard)
+        {
+            auto pending=shard.undelivered;
+            for(const auto& entry : pending) finish(shard, entry.first, entry.second);
+            return shard.prepared.empty();
+        });
+        if(!settled)
+        {
+            logError("checkpoint skipped: a shard holds prepared transactions");
+            return false;
+        }
+        return callAll([](Shard& shard)
+        {
+            return shard.wal->checkpoint(shard.storage) && shard.wal->truncateLog();
+        });
+    }
+}
@@ -0,0 +1,349 @@
+#include"sstable.hpp"
+#include<fcntl.h>
+#include<unistd.h>
+#include<sys/stat.h>
+#include<cstring>
+
+namespace stonedb
+{
+    static constexpr uint64_t TABLE_MAGIC=0x3130544c42534453ULL;   //"SDSBLT01"
+    static constexpr size_t FOOTER_SIZE=6 * sizeof(uint64_t);
+    static constexpr size_t ENTRY_HEADER_SIZE=7;
+    static constexpr uint8_t ENTRY_TOMBSTONE=1;
+
+    static uint32_t blockChecksum(const char* data, size_t size)
+    {
+        return static_cast<uint32_t>(hashKey(std::string_view(data, size)));
+    }
+
+    static bool preadAll(int fd, void* buffer, size_t size, uint64_t offset)
+    {
+        char* out=static_cast<char*>(buffer);
+        while(size > 0)
+        {
+            ssize_t n=pread(fd, out, size, static_cast<off_t>(offset));
+            if(n <= 0) return false;
+            out += n;
+            size -= n;
+            offset += n;
+        }
+        return true;
+    }
+
+    //parses one entry at offset; false when the block is exhausted or malformed
+    static bool parseEntry(const std::string& block, size_t offset, std::string_view& key,
+                           std::string_view& value, bool& tombstone, size_t& nextOffset)
+    {
+        if(offset + ENTRY_HEADER_SIZE > block.size()) return false;
+        uint16_t keyLen;
+        uint32_t valueLen;
+        memcpy(&keyLen, block.data() + offset, 2);
+        memcpy(&valueLen, block.data() + offset + 2, 4);
+        uint8_t flags=static_cast<uint8_t>(block[offset + 6]);
+        size_t bodyStart=offset + ENTRY_HEADER_SIZE;
+        if(bodyStart + keyLen + valueLen > block.size()) return false;
+        key=std::string_view(block.data() + bodyStart, keyLen);
+        value=std::string_view(block.data() + bodyStart + keyLen, valueLen);
+        tombstone=(flags & ENTRY_TOMBSTONE) != 0;
+        nextOffset=bodyStart + keyLen + valueLen;
+        return true;
+    }
+
+    SSTableWriter::SSTableWriter(const std::string& tablePath, uint64_t number, size_t expectedKeys)
+        : path(tablePath), fd(-1), offset(0), filter(expectedKeys), failed(false)
+    {
+        meta.number=number;
+        fd=::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if(fd < 0)
+        {
+            logError("failed to create table file: " + path);
+        }
+    }
+
+    SSTableWriter::~SSTableWriter()
+    {
+        if(fd >= 0) abandon();
+    }
+
+    bool SSTableWriter::writeBytes(const void* data, size_t size)
+    {
+        const char* in=static_cast<const char*>(data);
+        while(size > 0)
+        {
+            ssize_t n=::write(fd, in, size);
+            if(n <= 0)
+            {
+                failed=true;
+                return false;
+            }
+            in += n;
+            size -= n;
+            offset += n;
+        }
+        return true;
+    }
+
+    bool SSTableWriter::flushBlock()
+    {
+        if(block.empty()) return true;
+        uint64_t blockOffset=offset;
+        uint32_t blockSize=static_cast<uint32_t>(block.size());
+        uint32_t checksum=blockChecksum(block.data(), block.size());
+        if(!writeBytes(block.data(), block.size()) || !writeBytes(&checksum, sizeof(checksum)))
+        {
+            return false;
+        }
+        uint16_t keyLen=static_cast<uint16_t>(lastKey.size());
+        index.append(reinterpret_cast<const char*>(&keyLen), 2);
+        index.append(lastKey);
+        index.append(reinterpret_cast<const char*>(&blockOffset), 8);
+        index.append(reinterpret_cast<const char*>(&blockSize), 4);
+        block.clear();
+        return true;
+    }
+
+    bool SSTableWriter::add(std::string_view key, std::string_view value, bool tombstone)
+    {
+        if(fd < 0 || failed) return false;
+        size_t entrySize=ENTRY_HEADER_SIZE + key.size() + value.size();
+        if(!block.empty() && block.size() + entrySize > TABLE_BLOCK_SIZE)
+        {
+            if(!flushBlock()) return false;
+        }
+        uint16_t keyLen=static_cast<uint16_t>(key.size());
+        uint32_t valueLen=static_cast<uint32_t>(value.size());
+        uint8_t flags=tombstone ? ENTRY_TOMBSTONE : 0;
+        block.append(reinterpret_cast<const char*>(&keyLen), 2);
+        block.append(reinterpret_cast<const char*>(&valueLen), 4);
+        block.push_back(static_cast<char>(flags));
+        block.append(key.data(), key.size());
+        block.append(value.data(), value.size());
+
+        if(meta.entryCount == 0) meta.smallest.assign(key.data(), key.size());
+        lastKey.assign(key.data(), key.size());
+        filter.insert(hashKey(key));
+        meta.entryCount++;
+        return true;
+    }
+
+    bool SSTableWriter::finish(TableMeta& result)
+    {
+        if(fd < 0 || failed || !flushBlock())
+        {
+            abandon();
+            return false;
+        }
+        std::vector<uint8_t> filterBytes;
+        filter.serialize(filterBytes);
+        uint64_t footer[6];
+        footer[0]=offset;
+        footer[1]=filterBytes.size();
+        if(!writeBytes(filterBytes.data(), filterBytes.size()))
+        {
+            abandon();
+            return false;
+        }
+        footer[2]=offset;
+        footer[3]=index.size();
+        footer[4]=meta.entryCount;
+        footer[5]=TABLE_MAGIC;
+        if(!writeBytes(index.data(), index.size()) || !writeBytes(footer, sizeof(footer)))
+        {
+            abandon();
+            return false;
+        }
+        if(fsync(fd) != 0)
+        {
+            logError("failed to sync table file: " + path);
+            abandon();
+            return false;
+        }
+        ::close(fd);
+        fd=-1;
+        meta.largest=lastKey;
+        meta.fileSize=offset;
+        result=meta;
+        return true;
+    }
+
+    void SSTableWriter::abandon()
+    {
+        if(fd >= 0)
+        {
+            ::close(fd);
+            fd=-1;
+        }
+        ::unlink(path.c_str());
+    }
+
+    SSTableReader::SSTableReader() : fd(-1), entryCount(0) {}
+
+    SSTableReader::~SSTableReader()
+    {
+        if(fd >= 0) ::close(fd);
+    }
+
+    bool SSTableReader::open(const std::string& tablePath)
+    {
+        path=tablePath;
+        fd=::open(path.c_str(), O_RDONLY);
+        if(fd < 0)
+        {
+            logError("failed to open table file: " + path);
+            return false;
+        }
+        struct stat st;
+        if(fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < FOOTER_SIZE)
+        {
+            logError("table file too small: " + path);
+            return false;
+        }
+        uint64_t fileSize=static_cast<uint64_t>(st.st_size);
+        uint64_t footer[6];
+        if(!preadAll(fd, footer, FOOTER_SIZE, fileSize - FOOTER_SIZE) || footer[5] != TABLE_MAGIC)
+        {
+            logError("bad table footer: " + path);
+            return false;
+        }
+        uint64_t filterOffset=footer[0], filterSize=footer[1];
+        uint64_t indexOffset=footer[2], indexSize=footer[3];
+        if(filterOffset + filterSize > fileSize || indexOffset + indexSize > fileSize - FOOTER_SIZE)
+        {
+            logError("table footer out of range: " + path);
+            return false;
+        }
+        entryCount=footer[4];
+
+        std::vector<uint8_t> filterBytes(filterSize);
+        if(!preadAll(fd, filterBytes.data(), filterSize, filterOffset) ||
+           !filter.deserialize(filterBytes.data(), filterBytes.size()))
+        {
+            logError("bad table filter: " + path);
+            return false;
+        }
+
+        std::string indexBytes(indexSize, '\0');
+        if(!preadAll(fd, &indexBytes[0], indexSize, indexOffset))
+        {
+            logError("failed to read table index: " + path);
+            return false;
+        }
+        size_t pos=0;
+        while(pos < indexBytes.size())
+        {
+            if(pos + 2 > indexBytes.size()) return false;
+            uint16_t keyLen;
+            memcpy(&keyLen, indexBytes.data() + pos, 2);
+            pos += 2;
+            if(pos + keyLen + 12 > indexBytes.size()) return false;
+            IndexEntry entry;
+            entry.lastKey.assign(indexBytes.data() + pos, keyLen);
+            pos += keyLen;
+            memcpy(&entry.offset, indexBytes.data() + pos, 8);
+            memcpy(&entry.size, indexBytes.data() + pos + 8, 4);
+            pos += 12;
+            index.push_back(std::move(entry));
+        }
+        return true;
+    }
+
+    bool SSTableReader::readBlock(size_t blockIndex, std::string& block) const
+    {
+        const IndexEntry& entry=index[blockIndex];
+        block.resize(entry.size + sizeof(uint32_t));
+        if(!preadAll(fd, &block[0], block.size(), entry.offset))
+        {
+            logError("failed to read table block in " + path);
+            return false;
+        }
+        uint32_t stored;
+        memcpy(&stored, block.data() + entry.size, sizeof(stored));
+        block.resize(entry.size);
+        if(stored != blockChecksum(block.data(), block.size()))
+        {
+            logError("table block checksum mismatch in " + path);
+            return false;
+        }
+        return true;
+    }
+
+    LookupResult SSTableReader::get(std::string_view key, uint64_t hash, std::string& value) const
+    {
+        if(!filter.mayContain(hash)) return LookupResult::NOT_FOUND;
+        //first block whose last key is >= key
+        auto it=std::lower_bound(index.begin(), index.end(), key,
+            [](const IndexEntry& entry, std::string_view k) { return std::string_view(entry.lastKey) < k; });
+        if(it == index.end()) return LookupResult::NOT_FOUND;
+
+        std::string block;
+        if(!readBlock(static_cast<size_t>(it - index.begin()), block)) return LookupResult::NOT_FOUND;
+        size_t offset=0, nextOffset=0;
+        std::string_view entryKey, entryValue;
+        bool tombstone=false;
+        while(parseEntry(block, offset, entryKey, entryValue, tombstone, nextOffset))
+        {
+            if(entryKey == key)
+            {
+                if(tombstone) return LookupResult::DELETED;
+                value.assign(entryValue.data(), entryValue.size());
+                return LookupResult::FOUND;
+            }
+            if(entryKey > key) break;
+            offset=nextOffset;
+        }
+        return LookupResult::NOT_FOUND;
+    }
+
+    //reads the table block by block; the reader must outlive the iterator
+    class SSTableIterator : public KVIterator
+    {
+    private:
+        const SSTableReader* reader;
+        size_t blockIndex;
+        std::string block;
+        size_t offset;
+        size_t nextOffset;
+        std::string_view currentKey;
+        std::string_view currentValue;
+        bool currentTombstone;
+        bool positioned;
+
+        void settle()
+        {
+            positioned=false;
+            while(true)
+            {
+                if(parseEntry(block, offset, currentKey, currentValue, currentTombstone, nextOffset))
+                {
+                    positioned=true;
+                    return;
+                }
+                blockIndex++;
+                if(blockIndex >= reader->index.size() || !reader->readBlock(blockIndex, block)) return;
+                offset=0;
+            }
+        }
+
+    public:
+        explicit SSTableIterator(const SSTableReader* r)
+            : reader(r), blockIndex(0), offset(0), nextOffset(0), currentTombstone(false), positioned(false)
+        {
+            if(reader->index.empty() || !reader->readBlock(0, block)) return;
+            settle();
+        }
+        bool valid() const override { return positioned; }
+        void next() override
+        {
+            offset=nextOffset;
+            settle();
+        }
+        std::string_view key() const override { return currentKey; }
+        std::string_view value() const override { return currentValue; }
+        bool isTombstone() const override { return currentTombstone; }
+    };
+
+    std::unique_ptr<KVIterator> SSTableReader::newIterator() const
+    {
+        return std::make_unique<SSTableIterator>(this);
+    }
+}
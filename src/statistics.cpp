@@ -1,48 +1,322 @@
 #include"statistics.hpp"
 #include"common.hpp"
+#include<cmath>
+#include<cstdio>
 
 namespace stonedb
 {
-    Statistics::Statistics() 
-        : transactionCount(0), putOperations(0), getOperations(0), 
-          deleteOperations(0), cacheHits(0), cacheMisses(0), 
-          lockWaits(0), deadlocksDetected(0)
+    static constexpr size_t LATENCY_OPS=static_cast<size_t>(LatencyOp::COUNT);
+    static constexpr size_t IO_FILES=static_cast<size_t>(IoFile::COUNT);
+
+    const char* latencyOpName(LatencyOp op)
+    {
+        static const char* names[LATENCY_OPS]={"get", "put", "delete", "commit", "wal_sync", "page_read", "page_write", "lock_wait"};
+        return names[static_cast<size_t>(op)];
+    }
+
+    const char* ioFileName(IoFile file)
+    {
+        static const char* names[IO_FILES]={"data", "wal", "metadata"};
+        return names[static_cast<size_t>(file)];
+    }
+
+    size_t LatencyHistogram::bucketFor(uint64_t nanos)
+    {
+        if(nanos < SUB_BUCKETS) return static_cast<size_t>(nanos);
+        int exponent=63 - __builtin_clzll(nanos);
+        if(exponent >= MAX_EXPONENT) return BUCKETS - 1;
+        size_t sub=(nanos >> (exponent - SUB_BITS)) & (SUB_BUCKETS - 1);
+        return SUB_BUCKETS + static_cast<size_t>(exponent - SUB_BITS) * SUB_BUCKETS + sub;
+    }
+
+    uint64_t LatencyHistogram::bucketUpperBound(size_t index)
     {
+        if(index < SUB_BUCKETS) return index;
+        size_t exponent=(index - SUB_BUCKETS) / SUB_BUCKETS + SUB_BITS;
+        size_t sub=(index - SUB_BUCKETS) % SUB_BUCKETS;
+        uint64_t width=uint64_t(1) << (exponent - SUB_BITS);
+        return (uint64_t(1) << exponent) + (sub + 1) * width - 1;
     }
-    
+
+    void LatencyHistogram::record(uint64_t nanos)
+    {
+        counts[bucketFor(nanos)].fetch_add(1, std::memory_order_relaxed);
+        sum.fetch_add(nanos, std::memory_order_relaxed);
+        //slots outlive their threads and are handed out again, so several
+        //threads may record into this one
+        uint64_t seen=max.load(std::memory_order_relaxed);
+        while(nanos > seen && !max.compare_exchange_weak(seen, nanos, std::memory_order_relaxed)) {}
+    }
+
+    void LatencyHistogram::reset()
+    {
+        for(auto& c : counts) c.store(0, std::memory_order_relaxed);
+        sum=0;
+        max=0;
+    }
+
+    void HistogramSnapshot::merge(const LatencyHistogram& histogram)
+    {
+        for(size_t i=0; i<LatencyHistogram::BUCKETS; i++)
+        {
+            uint64_t c=histogram.counts[i].load(std::memory_order_relaxed);
+            counts[i] += c;
+            count += c;
+        }
+        sum += histogram.sum.load(std::memory_order_relaxed);
+        max=std::max(max, histogram.max.load(std::memory_order_relaxed));
+    }
+
+    uint64_t HistogramSnapshot::percentile(double q) const
+    {
+        if(count == 0) return 0;
+        uint64_t rank=static_cast<uint64_t>(std::ceil(q / 100.0 * count));
+        rank=std::max<uint64_t>(rank, 1);
+        uint64_t seen=0;
+        for(size_t i=0; i<counts.size(); i++)
+        {
+            seen += counts[i];
+            if(seen >= rank) return std::min(LatencyHistogram::bucketUpperBound(i), max);
+        }
+        return max;
+    }
+
+    //Shard: one thread's counters and histograms, on their own cache lines
+    struct alignas(64) Statistics::Shard
+    {
+        std::atomic<uint64_t> counters[COUNTER_COUNT];
+        std::atomic<uint64_t> io[IO_FILES][IO_COUNTER_COUNT];
+        LatencyHistogram histograms[LATENCY_OPS];
+        LatencyHistogram syncLatency[IO_FILES];
+        Shard() { clear(); }
+        void clear()
+        {
+            for(auto& c : counters) c.store(0, std::memory_order_relaxed);
+            for(auto& file : io)
+            {
+                for(auto& c : file) c.store(0, std::memory_order_relaxed);
+            }
+            for(auto& h : histograms) h.reset();
+            for(auto& h : syncLatency) h.reset();
+        }
+    };
+
+    //threads take shard slots round-robin and never give them back: once
+    //MAX_SHARDS threads have ever started, new ones share slots with live ones
+    static std::atomic<size_t> nextShardSlot{0};
+    static thread_local size_t shardSlot=nextShardSlot++;
+
+    Statistics::Statistics()
+    {
+        for(auto& shard : shards) shard.store(nullptr, std::memory_order_relaxed);
+    }
+
+    Statistics::~Statistics()
+    {
+        for(auto& shard : shards) delete shard.load();
+    }
+
+    Statistics& Statistics::global()
+    {
+        //never destroyed, so engine objects may record during static teardown
+        static Statistics* instance=new Statistics();
+        return *instance;
+    }
+
+    Statistics::Shard& Statistics::localShard()
+    {
+        std::atomic<Shard*>& slot=shards[shardSlot % MAX_SHARDS];
+        Shard* shard=slot.load(std::memory_order_acquire);
+        if(shard) return *shard;
+        Shard* fresh=new Shard();
+        if(slot.compare_exchange_strong(shard, fresh, std::memory_order_acq_rel)) return *fresh;
+        delete fresh;
+        return *shard;
+    }
+
+    void Statistics::add(Counter counter, uint64_t amount)
+    {
+        localShard().counters[counter].fetch_add(amount, std::memory_order_relaxed);
+    }
+
+    void Statistics::addIo(IoFile file, IoCounter counter, uint64_t amount)
+    {
+        localShard().io[static_cast<size_t>(file)][counter].fetch_add(amount, std::memory_order_relaxed);
+    }
+
+    uint64_t Statistics::total(Counter counter) const
+    {
+        uint64_t sum=0;
+        for(const auto& slot : shards)
+        {
+            if(Shard* shard=slot.load(std::memory_order_acquire)) sum += shard->counters[counter].load(std::memory_order_relaxed);
+        }
+        return sum;
+    }
+
+    void Statistics::recordLatency(LatencyOp op, uint64_t nanos)
+    {
+        localShard().histograms[static_cast<size_t>(op)].record(nanos);
+    }
+
+    HistogramSnapshot Statistics::latency(LatencyOp op) const
+    {
+        HistogramSnapshot snapshot;
+        for(const auto& slot : shards)
+        {
+            if(Shard* shard=slot.load(std::memory_order_acquire)) snapshot.merge(shard->histograms[static_cast<size_t>(op)]);
+        }
+        return snapshot;
+    }
+
+    void Statistics::recordRead(IoFile file, uint64_t bytes)
+    {
+        addIo(file, READS, 1);
+        addIo(file, BYTES_READ, bytes);
+    }
+
+    void Statistics::recordWrite(IoFile file, uint64_t bytes)
+    {
+        addIo(file, WRITES, 1);
+        addIo(file, BYTES_WRITTEN, bytes);
+    }
+
+    void Statistics::recordFlush(IoFile file)
+    {
+        addIo(file, FLUSHES, 1);
+    }
+
+    void Statistics::recordSync(IoFile file, uint64_t nanos)
+    {
+        Shard& shard=localShard();
+        shard.io[static_cast<size_t>(file)][SYNCS].fetch_add(1, std::memory_order_relaxed);
+        shard.syncLatency[static_cast<size_t>(file)].record(nanos);
+    }
+
+    IoSnapshot Statistics::io(IoFile file) const
+    {
+        IoSnapshot snapshot;
+        size_t f=static_cast<size_t>(file);
+        for(const auto& slot : shards)
+        {
+            Shard* shard=slot.load(std::memory_order_acquire);
+            if(!shard) continue;
+            snapshot.reads += shard->io[f][READS].load(std::memory_order_relaxed);
+            snapshot.bytesRead += shard->io[f][BYTES_READ].load(std::memory_order_relaxed);
+            snapshot.writes += shard->io[f][WRITES].load(std::memory_order_relaxed);
+            snapshot.bytesWritten += shard->io[f][BYTES_WRITTEN].load(std::memory_order_relaxed);
+            snapshot.flushes += shard->io[f][FLUSHES].load(std::memory_order_relaxed);
+            snapshot.syncs += shard->io[f][SYNCS].load(std::memory_order_relaxed);
+            snapshot.syncLatency.merge(shard->syncLatency[f]);
+        }
+        return snapshot;
+    }
+
+    double Statistics::writeAmplification() const
+    {
+        uint64_t logical=getLogicalBytes();
+        if(logical == 0) return 0.0;
+        uint64_t physical=0;
+        for(size_t i=0; i<IO_FILES; i++) physical += io(static_cast<IoFile>(i)).bytesWritten;
+        return static_cast<double>(physical) / static_cast<double>(logical);
+    }
+
     double Statistics::getCacheHitRatio() const
     {
-        uint64_t hits=cacheHits.load();
-        uint64_t misses=cacheMisses.load();
+        uint64_t hits=getCacheHits();
+        uint64_t misses=getCacheMisses();
         uint64_t total=hits + misses;
         if(total == 0) return 0.0;
         return (static_cast<double>(hits) / static_cast<double>(total)) * 100.0;
     }
-    
+
     void Statistics::printStatistics() const
     {
         log("=== Database Statistics ===");
-        log("Transactions: " + std::to_string(transactionCount.load()));
-        log("PUT operations: " + std::to_string(putOperations.load()));
-        log("GET operations: " + std::to_string(getOperations.load()));
-        log("DELETE operations: " + std::to_string(deleteOperations.load()));
-        log("Cache hits: " + std::to_string(cacheHits.load()));
-        log("Cache misses: " + std::to_string(cacheMisses.load()));
+        log("Transactions: " + std::to_string(getTransactionCount()));
+        log("PUT operations: " + std::to_string(getPutOps()));
+        log("GET operations: " + std::to_string(getGetOps()));
+        log("DELETE operations: " + std::to_string(getDeleteOps()));
+        log("Cache hits: " + std::to_string(getCacheHits()));
+        log("Cache misses: " + std::to_string(getCacheMisses()));
         log("Cache hit ratio: " + std::to_string(getCacheHitRatio()) + "%");
-        log("Lock waits: " + std::to_string(lockWaits.load()));
-        log("Deadlocks detected: " + std::to_string(deadlocksDetected.load()));
+        log("Lock waits: " + std::to_string(getLockWaits()));
+        log("Deadlocks detected: " + std::to_string(getDeadlocks()));
+        for(size_t i=0; i<LATENCY_OPS; i++)
+        {
+            HistogramSnapshot h=latency(static_cast<LatencyOp>(i));
+            if(h.count == 0) continue;
+            log(std::string(latencyOpName(static_cast<LatencyOp>(i))) + " latency ns: count " + std::to_string(h.count) +
+                " p50 " + std::to_string(h.percentile(50)) + " p99 " + std::to_string(h.percentile(99)) +
+                " p999 " + std::to_string(h.percentile(99.9)) + " max " + std::to_string(h.max));
+        }
+        for(size_t i=0; i<IO_FILES; i++)
+        {
+            IoSnapshot f=io(static_cast<IoFile>(i));
+            log(std::string(ioFileName(static_cast<IoFile>(i))) + " file: " + std::to_string(f.reads) + " reads (" +
+                std::to_string(f.bytesRead) + " bytes), " + std::to_string(f.writes) + " writes (" +
+                std::to_string(f.bytesWritten) + " bytes), " + std::to_string(f.flushes) + " flushes, " +
+                std::to_string(f.syncs) + " syncs (p99 " + std::to_string(f.syncLatency.percentile(99)) + " ns)");
+        }
+        log("Logical bytes written: " + std::to_string(getLogicalBytes()));
+        log("Write amplification: " + std::to_string(writeAmplification()));
     }
-    
+
+    std::string Statistics::toJson() const
+    {
+        std::string json="{\"counters\":{";
+        json += "\"transactions\":" + std::to_string(getTransactionCount());
+        json += ",\"put_operations\":" + std::to_string(getPutOps());
+        json += ",\"get_operations\":" + std::to_string(getGetOps());
+        json += ",\"delete_operations\":" + std::to_string(getDeleteOps());
+        json += ",\"cache_hits\":" + std::to_string(getCacheHits());
+        json += ",\"cache_misses\":" + std::to_string(getCacheMisses());
+        json += ",\"lock_waits\":" + std::to_string(getLockWaits());
+        json += ",\"deadlocks\":" + std::to_string(getDeadlocks());
+        json += "},\"latency_ns\":{";
+        for(size_t i=0; i<LATENCY_OPS; i++)
+        {
+            HistogramSnapshot h=latency(static_cast<LatencyOp>(i));
+            char mean[32];
+            snprintf(mean, sizeof(mean), "%.1f", h.mean());
+            if(i > 0) json += ",";
+            json += "\"" + std::string(latencyOpName(static_cast<LatencyOp>(i))) + "\":{";
+            json += "\"count\":" + std::to_string(h.count);
+            json += ",\"mean\":" + std::string(mean);
+            json += ",\"p50\":" + std::to_string(h.percentile(50));
+            json += ",\"p99\":" + std::to_string(h.percentile(99));
+            json += ",\"p999\":" + std::to_string(h.percentile(99.9));
+            json += ",\"max\":" + std::to_string(h.max) + "}";
+        }
+        json += "},\"io\":{";
+        for(size_t i=0; i<IO_FILES; i++)
+        {
+            IoSnapshot f=io(static_cast<IoFile>(i));
+            if(i > 0) json += ",";
+            json += "\"" + std::string(ioFileName(static_cast<IoFile>(i))) + "\":{";
+            json += "\"reads\":" + std::to_string(f.reads);
+            json += ",\"bytes_read\":" + std::to_string(f.bytesRead);
+            json += ",\"writes\":" + std::to_string(f.writes);
+            json += ",\"bytes_written\":" + std::to_string(f.bytesWritten);
+            json += ",\"flushes\":" + std::to_string(f.flushes);
+            json += ",\"syncs\":" + std::to_string(f.syncs);
+            json += ",\"sync_p50_ns\":" + std::to_string(f.syncLatency.percentile(50));
+            json += ",\"sync_p99_ns\":" + std::to_string(f.syncLatency.percentile(99));
+            json += ",\"sync_max_ns\":" + std::to_string(f.syncLatency.max) + "}";
+        }
+        char amplification[32];
+        snprintf(amplification, sizeof(amplification), "%.3f", writeAmplification());
+        json += "},\"logical_bytes_written\":" + std::to_string(getLogicalBytes());
+        json += ",\"write_amplification\":" + std::string(amplification) + "}";
+        return json;
+    }
+
     void Statistics::reset()
     {
-        transactionCount=0;
-        putOperations=0;
-        getOperations=0;
-        deleteOperations=0;
-        cacheHits=0;
-        cacheMisses=0;
-        lockWaits=0;
-        deadlocksDetected=0;
+        for(auto& slot : shards)
+        {
+            Shard* shard=slot.load(std::memory_order_acquire);
+            if(shard) shard->clear();
+        }
     }
 }
-
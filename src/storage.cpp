@@ -1,11 +1,81 @@
 #include"storage.hpp"
+#include"pageformat.hpp"
+#include"compress.hpp"
+#include"statistics.hpp"
+#include"wal.hpp"
 #include<filesystem>
 #include<cstring>
 #include<algorithm>
+#include<iterator>
 #include<limits>
+#include<sys/stat.h>
+#include<fcntl.h>
+#include<unistd.h>
 namespace stonedb
 {
-    StorageManager::StorageManager() : nextPageId(1), dbOpen(false)
+    static constexpr size_t MIN_FILTER_KEYS=1024;
+
+    //file header: [u32 magic][u32 layout][u32 pageFormat][u32 compression]
+    //[u32 pendingLoadStart]; files from before the header was used are all
+    //zeros and always heap layout, records format, uncompressed
+    static constexpr uint32_t FILE_MAGIC=0x4c424453;        //"SDBL"
+    //first page of a bulk load whose pages are written but not published, 0 if none
+    static constexpr size_t PENDING_LOAD_OFFSET=16;
+    //pages a bulk load hands to the file per write
+    static constexpr size_t LOAD_WRITE_PAGES=256;
+    //pages a hot backup copies per hold of cacheMutex; writers wait at most this long
+    static constexpr PageId BACKUP_CHUNK_PAGES=256;
+    //pages per pool task when open(), flushes and scans split their work
+    static constexpr size_t PAGE_TASK_PAGES=64;
+    //fewer dirty pages than this are written by the flushing thread alone
+    static constexpr size_t PARALLEL_FLUSH_PAGES=64;
+
+    //page map file: [u64 magic][u64 entryCount][u64 dataEnd][u64 checksum]
+    //then entryCount PageMapEntry records; extents are EXTENT_UNIT multiples
+    static constexpr uint64_t PAGE_MAP_MAGIC=0x3150414d50424453ULL;   //"SDBPMAP1"
+    static constexpr size_t PAGE_MAP_HEADER=32;
+    static constexpr size_t EXTENT_UNIT=256;
+    static constexpr size_t MAX_EXTENT_UNITS=PAGE_SIZE / EXTENT_UNIT;
+    static constexpr uint16_t PAGE_IMAGE_RAW=1;
+
+    //hash layout meta page 0: [u32 magic][u32 globalDepth][u64 keyCount]
+    //[u32 directoryPageCount][u32 reserved][u32 directoryPageIds...]
+    //directory pages: 2^globalDepth entries of [u32 bucket][u32 localDepth]
+    static constexpr uint32_t HASH_META_MAGIC=0x52494448;   //"HDIR"
+    static constexpr size_t HASH_META_HEADER=24;
+    static constexpr size_t DIR_ENTRY_SIZE=8;
+    static constexpr size_t DIR_ENTRIES_PER_PAGE=PAGE_SIZE / DIR_ENTRY_SIZE;
+    //2^18 entries need 512 directory pages, which still fit the page 0 list
+    static constexpr uint32_t MAX_GLOBAL_DEPTH=18;
+
+    //copies out the live records; true if the page also holds dead space
+    static bool collectRecords(PageFormat format, const uint8_t* data, std::vector<Record>& records)
+    {
+        return forEachInPage(format, data, [&](std::string_view key, std::string_view value)
+        {
+            records.emplace_back(std::string(key), std::string(value));
+        });
+    }
+
+    //compresses a page image; pages that would not save a whole extent unit
+    //are stored raw
+    static size_t compressPage(const uint8_t* data, uint8_t* image, uint16_t& flags)
+    {
+        size_t size=lzCompress(data, PAGE_SIZE, image, PAGE_SIZE - EXTENT_UNIT);
+        if(size == 0)
+        {
+            memcpy(image, data, PAGE_SIZE);
+            flags=PAGE_IMAGE_RAW;
+            return PAGE_SIZE;
+        }
+        flags=0;
+        return size;
+    }
+
+    StorageManager::StorageManager()
+        : nextPageId(1), dbOpen(false), filterDeletes(0), globalDepth(0), hashKeyCount(0),
+          hashMetaDirty(false), dataEnd(HEADER_SIZE), pageMapDirty(false), compressedBytes(0), compressedLimit(0),
+          pendingLoadStart(0), pendingLoadEnd(0), changeBase(0), pool(nullptr)
     {
         allocatedPages.insert(0);
     } 
@@ -17,9 +87,11 @@ namespace stonedb
             close();
         }
     }
-    bool StorageManager::open(const std::string& path)
+    bool StorageManager::open(const std::string& path, const StorageOptions& opts)
     {
         dbPath=path;
+        options=opts;
+        if(options.cacheFrames == 0) options.cacheFrames=1;
         dbFile.open(path, std::ios::in | std::ios::out | std::ios::binary);
         
         if(!dbFile.is_open())
@@ -33,13 +105,27 @@ namespace stonedb
             }
             //writing header and initial page
             char header[HEADER_SIZE]={0};
+            uint32_t layout=static_cast<uint32_t>(options.layout);
+            memcpy(header, &FILE_MAGIC, 4);
+            uint32_t format=static_cast<uint32_t>(options.pageFormat);
+            uint32_t compression=static_cast<uint32_t>(options.compression);
+            memcpy(header + 4, &layout, 4);
+            memcpy(header + 8, &format, 4);
+            memcpy(header + 12, &compression, 4);
             dbFile.write(header, HEADER_SIZE);
+            Statistics::global().recordWrite(IoFile::DATA, HEADER_SIZE);
             
             //write initial page to ensure file is large enough
-            char initialPage[PAGE_SIZE]={0};
-            dbFile.write(initialPage, PAGE_SIZE);
+            //compressed files place pages on first write instead
+            if(options.compression == PageCompression::NONE)
+            {
+                char initialPage[PAGE_SIZE]={0};
+                dbFile.write(initialPage, PAGE_SIZE);
+                Statistics::global().recordWrite(IoFile::DATA, PAGE_SIZE);
+            }
             
             dbFile.flush();
+            Statistics::global().recordFlush(IoFile::DATA);
             dbFile.close();
             
             //explicitly close before retry to avoid resource leak
@@ -54,84 +140,192 @@ namespace stonedb
             }
             log("reopened db file for read/write");
         }
+        //an existing file keeps the layout, page format and compression it was created with
+        uint32_t header[5]={0, 0, 0, 0, 0};
+        dbFile.seekg(0);
+        dbFile.read(reinterpret_cast<char*>(header), sizeof(header));
+        Statistics::global().recordRead(IoFile::DATA, dbFile.gcount());
+        dbFile.clear();
+        StorageLayout fileLayout=StorageLayout::HEAP;
+        if(header[0] == FILE_MAGIC && header[1] == static_cast<uint32_t>(StorageLayout::HASH))
+        {
+            fileLayout=StorageLayout::HASH;
+        }
+        if(fileLayout != options.layout)
+        {
+            log(std::string("using the file's ") + (fileLayout == StorageLayout::HASH ? "hash" : "heap") + " layout");
+            options.layout=fileLayout;
+        }
+        PageFormat fileFormat=PageFormat::RECORDS;
+        if(header[0] == FILE_MAGIC && header[2] == static_cast<uint32_t>(PageFormat::SLOTTED))
+        {
+            fileFormat=PageFormat::SLOTTED;
+        }
+        if(fileFormat != options.pageFormat)
+        {
+            log(std::string("using the file's ") + (fileFormat == PageFormat::SLOTTED ? "slotted" : "records") + " page format");
+            options.pageFormat=fileFormat;
+        }
+        PageCompression fileCompression=PageCompression::NONE;
+        if(header[0] == FILE_MAGIC && header[3] == static_cast<uint32_t>(PageCompression::LZ))
+        {
+            fileCompression=PageCompression::LZ;
+        }
+        if(fileCompression != options.compression)
+        {
+            log(std::string("using the file's ") + (fileCompression == PageCompression::LZ ? "lz" : "uncompressed") + " page storage");
+            options.compression=fileCompression;
+        }
+        
+        //compression trades half of the frames for a compressed tier of the
+        //same byte size, which holds several times as many pages
+        size_t frames=options.cacheFrames;
+        compressedLimit=0;
+        if(options.compression == PageCompression::LZ)
+        {
+            frames=options.cacheFrames - options.cacheFrames / 2;
+            compressedLimit=(options.cacheFrames / 2) * PAGE_SIZE;
+        }
+        ownPool.reset();
+        pool=nullptr;
+        if(options.workerThreads == 0)
+        {
+            pool=&ThreadPool::shared();
+        }
+        else if(options.workerThreads > 1)
+        {
+            ownPool=std::make_unique<ThreadPool>(options.workerThreads);
+            pool=ownPool.get();
+        }
+        bufferPool=std::make_unique<BufferPool>(frames, options.useHugePages);
+        if(!bufferPool->isValid())
+        {
+            logError("failed to allocate buffer pool");
+            bufferPool.reset();
+            dbFile.close();
+            return false;
+        }
+        
         dbOpen=true;
         allocatedPages.clear();
         allocatedPages.insert(0);
         keyToPage.clear();
         freePages.clear();
+        directory.clear();
+        directoryPages.clear();
+        hashMetaDirty=false;
+        dirtyDirectoryPages.clear();
+        cacheCounters=PageCacheStats();
+        compressedLru.clear();
+        compressedIndex.clear();
+        compressedBytes=0;
+        pendingLoadStart=0;
+        pendingLoadEnd=0;
         dbFile.seekg(0, std::ios::end);
         std::streampos fileSize=dbFile.tellg();
         std::streamoff fileSizeBytes=static_cast<std::streamoff>(fileSize);
-        if(fileSizeBytes > static_cast<std::streamoff>(HEADER_SIZE))
+        bool compressed=options.compression == PageCompression::LZ;
+        if(compressed && !loadPageMap())
+        {
+            dbFile.close();
+            bufferPool.reset();
+            dbOpen=false;
+            return false;
+        }
+        bool filterLoaded=loadKeyFilter();
+        if(!loadChangeMap())
+        {
+            changedPages.clear();
+            changeBase=0;
+        }
+        PageId storedPages=0;
+        if(compressed)
+        {
+            storedPages=static_cast<PageId>(pageMap.size());
+        }
+        else if(fileSizeBytes > static_cast<std::streamoff>(HEADER_SIZE))
+        {
+            storedPages=static_cast<PageId>((fileSizeBytes - static_cast<std::streamoff>(HEADER_SIZE)) / static_cast<std::streamoff>(PAGE_SIZE));
+        }
+        if(options.layout == StorageLayout::HASH)
+        {
+            //no per-key state to rebuild: only page 0 and the directory are read
+            PageId pageCount=std::max<PageId>(1, storedPages);
+            nextPageId=pageCount;
+            for(PageId pageId=1; pageId<pageCount; pageId++)
+            {
+                allocatedPages.insert(pageId);
+            }
+            uint32_t metaMagic=0;
+            {
+                //the frame is only ours while cacheMutex is held
+                std::lock_guard<std::mutex> lock(cacheMutex);
+                auto meta=getPageUnlocked(0);
+                if(meta) memcpy(&metaMagic, meta->data.data(), 4);
+            }
+            bool ready=(metaMagic == HASH_META_MAGIC) ? loadHashLayout() : initHashLayout();
+            if(!ready)
+            {
+                dbFile.close();
+                bufferPool.reset();
+                dbOpen=false;
+                return false;
+            }
+        }
+        else if(storedPages > 0)
         {
-            PageId maxPageId=static_cast<PageId>((fileSizeBytes - static_cast<std::streamoff>(HEADER_SIZE)) / static_cast<std::streamoff>(PAGE_SIZE));
+            PageId maxPageId=compressed ? storedPages - 1 : storedPages;
             nextPageId=maxPageId + 1;
+            if(header[0] == FILE_MAGIC && header[4] != 0 && !compressed)
+            {
+                //an unpublished bulk load: recovery decides whether its pages exist
+                pendingLoadStart=header[4];
+                pendingLoadEnd=std::max(storedPages, pendingLoadStart);
+                maxPageId=std::min(maxPageId, pendingLoadStart - 1);
+                nextPageId=pendingLoadEnd;
+                log("bulk load of pages " + std::to_string(pendingLoadStart) + "-" + std::to_string(pendingLoadEnd - 1) +
+                    " is pending recovery");
+            }
+            //pages are parsed in parallel ranges; merging the ranges in page
+            //order keeps a key that appears twice on its later page
+            std::vector<PageId> pages;
+            pages.reserve(maxPageId + 1);
             for(PageId pageId=0; pageId<=maxPageId; pageId++)
             {
-                auto page=getPage(pageId);
-                if(page)
+                pages.push_back(pageId);
+                allocatedPages.insert(pageId);
+            }
+            std::vector<std::vector<std::pair<std::string, PageId>>> parts((pages.size() + PAGE_TASK_PAGES - 1) / PAGE_TASK_PAGES);
+            bool read=readPages(pages, [&](size_t index, const uint8_t* data)
+            {
+                auto& part=parts[index / PAGE_TASK_PAGES];
+                forEachInPage(options.pageFormat, data, [&](std::string_view key, std::string_view)
                 {
-                    allocatedPages.insert(pageId);
-                    size_t offset=0;
-                    while(offset < PAGE_SIZE - RECORD_HEADER_SIZE)
-                    {
-                        uint16_t keyLen, valueLen;
-                        memcpy(&keyLen, page->data.data() + offset, 2);
-                        memcpy(&valueLen, page->data.data() + offset + 2, 2);
-                        if(keyLen == 0)
-                        {
-                            if(valueLen > 0 && valueLen < MAX_VALUE_SIZE && offset + 4 + valueLen < PAGE_SIZE)
-                            {
-                                offset += 4 + valueLen;
-                                continue;
-                            }
-                            size_t searchOffset=offset + 4;
-                            bool foundNext=false;
-                            while(searchOffset < PAGE_SIZE - RECORD_HEADER_SIZE)
-                            {
-                                if(searchOffset + 4 > PAGE_SIZE) break;
-                                uint16_t testKeyLen, testValueLen;
-                                memcpy(&testKeyLen, page->data.data() + searchOffset, 2);
-                                memcpy(&testValueLen, page->data.data() + searchOffset + 2, 2);
-                                
-                                if(testKeyLen > 0 && testKeyLen <= MAX_KEY_SIZE && 
-                                   testValueLen > 0 && testValueLen <= MAX_VALUE_SIZE &&
-                                   searchOffset + 4 + testKeyLen + testValueLen <= PAGE_SIZE)
-                                {
-                                    offset=searchOffset;
-                                    foundNext=true;
-                                    break;
-                                }
-                                if(testKeyLen == 0 && testValueLen > 0 && testValueLen < MAX_VALUE_SIZE)
-                                {
-                                    searchOffset += 4 + testValueLen;
-                                    continue;
-                                }
-                                searchOffset += 4;
-                                if(searchOffset > offset + PAGE_SIZE / 2) break;
-                            }
-                            if(!foundNext) break;
-                            continue;
-                        }
-                        if(offset + 4 > PAGE_SIZE || 
-                           offset + 4 + keyLen > PAGE_SIZE ||
-                           offset + 4 + keyLen + valueLen > PAGE_SIZE ||
-                           keyLen > MAX_KEY_SIZE || valueLen > MAX_VALUE_SIZE)
-                        {
-                            break;
-                        }
-                        
-                        std::string key(reinterpret_cast<const char*>(page->data.data() + offset + 4), keyLen);
-                        keyToPage[key]=pageId;
-                        
-                        offset += 4 + keyLen + valueLen;
-                    }
-                }
+                    part.emplace_back(std::string(key), pages[index]);
+                });
+            });
+            if(!read)
+            {
+                dbFile.close();
+                bufferPool.reset();
+                dbOpen=false;
+                return false;
+            }
+            size_t keys=0;
+            for(const auto& part : parts) keys += part.size();
+            keyToPage.reserve(keys);
+            for(auto& part : parts)
+            {
+                for(auto& entry : part) keyToPage[std::move(entry.first)]=entry.second;
             }
         }
         else
         {
-        nextPageId=1;
+            nextPageId=1;
+        }
+        if(!filterLoaded)
+        {
+            rebuildKeyFilter();
         }
         
         log("opened db: " + path);
@@ -142,18 +336,44 @@ namespace stonedb
         if(dbOpen)
         {
             flushAll();
+            {
+                std::lock_guard<std::mutex> lock(cacheMutex);
+                saveKeyFilter();
+                saveChangeMap();
+                snapshots.clear();
+            }
             dbFile.close();
-            pageCache.clear();
+            bufferPool.reset();
+            ownPool.reset();
+            pool=nullptr;
+            compressedLru.clear();
+            compressedIndex.clear();
+            compressedBytes=0;
+            pageMap.clear();
             dbOpen=false;
             log("closed db");
         }
     }
-    bool StorageManager::writePageToDisk(PageId pageId, const std::vector<uint8_t>& data)
+    bool StorageManager::writePageToDisk(PageId pageId, const uint8_t* data)
     {
+        ScopedLatency timer(LatencyOp::PAGE_WRITE);
         if(!dbOpen) {
             logError("database not open");
             return false;
         }
+        noteWritten(pageId, pageId + 1);
+        if(options.compression == PageCompression::LZ)
+        {
+            uint8_t image[PAGE_SIZE];
+            uint16_t flags;
+            size_t size=compressPage(data, image, flags);
+            return writePageImage(pageId, image, size, flags);
+        }
+        if(activeBackup && pageId < activeBackup->pages && !activeBackup->copied[pageId])
+        {
+            copyForBackup(pageId, pageId + 1);
+            activeBackup->preserved++;
+        }
         dbFile.clear();
         std::streampos pos=HEADER_SIZE + (pageId * PAGE_SIZE);
         dbFile.seekp(pos);
@@ -162,13 +382,15 @@ namespace stonedb
             logError("failed to seek to position " + std::to_string(pos));
             return false;
         }
-        dbFile.write(reinterpret_cast<const char*>(data.data()), PAGE_SIZE);
+        dbFile.write(reinterpret_cast<const char*>(data), PAGE_SIZE);
         if(dbFile.fail())
         {
             logError("failed to write page data");
             return false;
         }
+        Statistics::global().recordWrite(IoFile::DATA, PAGE_SIZE);
         dbFile.flush();
+        Statistics::global().recordFlush(IoFile::DATA);
         if(dbFile.fail())
         {
             logError("failed to flush page data");
@@ -176,67 +398,291 @@ namespace stonedb
         }
         return true;
     }
-    bool StorageManager::readPageFromDisk(PageId pageId, std::vector<uint8_t>& data)
+    bool StorageManager::readPageFromDisk(PageId pageId, uint8_t* data)
     {
+        ScopedLatency timer(LatencyOp::PAGE_READ);
         if(!dbOpen) return false;
         dbFile.clear();
+        if(options.compression == PageCompression::LZ)
+        {
+            if(pageId >= pageMap.size() || pageMap[pageId].storedSize == 0) return false;
+            const PageMapEntry& entry=pageMap[pageId];
+            uint8_t image[PAGE_SIZE];
+            dbFile.seekg(static_cast<std::streamoff>(entry.offset));
+            dbFile.read(reinterpret_cast<char*>(image), entry.storedSize);
+            if(dbFile.fail()) return false;
+            Statistics::global().recordRead(IoFile::DATA, entry.storedSize);
+            cacheCounters.diskReads++;
+            cacheCounters.bytesRead += entry.storedSize;
+            if(entry.flags & PAGE_IMAGE_RAW)
+            {
+                memcpy(data, image, PAGE_SIZE);
+                return true;
+            }
+            if(!lzDecompress(image, entry.storedSize, data, PAGE_SIZE))
+            {
+                logError("corrupt compressed page " + std::to_string(pageId));
+                return false;
+            }
+            cacheCompressed(pageId, image, entry.storedSize);
+            return true;
+        }
         std::streampos pos=HEADER_SIZE + (pageId * PAGE_SIZE);
         dbFile.seekg(pos);
         if(dbFile.fail()) return false;
-        data.resize(PAGE_SIZE);
-        dbFile.read(reinterpret_cast<char*>(data.data()), PAGE_SIZE);
+        dbFile.read(reinterpret_cast<char*>(data), PAGE_SIZE);
         if(dbFile.fail()) return false;
+        Statistics::global().recordRead(IoFile::DATA, PAGE_SIZE);
+        cacheCounters.diskReads++;
+        cacheCounters.bytesRead += PAGE_SIZE;
         return true;
     }
-    std::shared_ptr<Page> StorageManager::getPage(PageId pageId)
+
+    //caller holds cacheMutex; places a page image in an extent that fits it
+    bool StorageManager::writePageImage(PageId pageId, const uint8_t* image, size_t size, uint16_t flags)
     {
-        std::lock_guard<std::mutex> lock(cacheMutex);
-        auto it=pageCache.find(pageId);
-        if(it != pageCache.end()) {
-            return it->second;
+        if(pageMap.size() <= pageId) pageMap.resize(pageId + 1, PageMapEntry{0, 0, 0, 0});
+        PageMapEntry& entry=pageMap[pageId];
+        uint16_t units=static_cast<uint16_t>((size + EXTENT_UNIT - 1) / EXTENT_UNIT);
+        if(entry.extentUnits < units)
+        {
+            if(entry.extentUnits > 0) pendingFreeExtents.emplace_back(entry.offset, entry.extentUnits);
+            if(!freeExtents[units].empty())
+            {
+                entry.offset=freeExtents[units].back();
+                freeExtents[units].pop_back();
+            }
+            else
+            {
+                entry.offset=dataEnd;
+                dataEnd += units * EXTENT_UNIT;
+            }
+            entry.extentUnits=units;
         }
-        auto page=std::make_shared<Page>(pageId);
-        if(!readPageFromDisk(pageId, page->data))
+        dbFile.clear();
+        dbFile.seekp(static_cast<std::streamoff>(entry.offset));
+        dbFile.write(reinterpret_cast<const char*>(image), size);
+        dbFile.flush();
+        Statistics::global().recordWrite(IoFile::DATA, size);
+        Statistics::global().recordFlush(IoFile::DATA);
+        if(dbFile.fail())
         {
-            page->data.assign(PAGE_SIZE, 0);
+            logError("failed to write page " + std::to_string(pageId));
+            return false;
         }
-        while(pageCache.size() >= MAX_CACHE_SIZE)
+        entry.storedSize=static_cast<uint32_t>(size);
+        entry.flags=flags;
+        pageMapDirty=true;
+        if(flags & PAGE_IMAGE_RAW)
         {
-            evictLRUPage();
+            dropCompressed(pageId);
         }
-        
-        pageCache[pageId]=page;
-        return page;
+        else
+        {
+            cacheCompressed(pageId, image, size);
+        }
+        return true;
+    }
+
+    //caller holds cacheMutex (or is open())
+    bool StorageManager::loadPageMap()
+    {
+        pageMap.clear();
+        pendingFreeExtents.clear();
+        dataEnd=HEADER_SIZE;
+        pageMapDirty=false;
+        std::ifstream in(dbPath + ".pagemap", std::ios::binary);
+        if(!in.is_open())
+        {
+            dbFile.seekg(0, std::ios::end);
+            if(static_cast<std::streamoff>(dbFile.tellg()) > static_cast<std::streamoff>(HEADER_SIZE))
+            {
+                logError("page map missing for compressed db: " + dbPath);
+                return false;
+            }
+            rebuildFreeExtents();
+            return true;
+        }
+        uint64_t header[4];
+        in.read(reinterpret_cast<char*>(header), sizeof(header));
+        Statistics::global().recordRead(IoFile::METADATA, in.gcount());
+        if(in.gcount() != sizeof(header) || header[0] != PAGE_MAP_MAGIC)
+        {
+            logError("bad page map header: " + dbPath + ".pagemap");
+            return false;
+        }
+        static_assert(sizeof(PageMapEntry) == 16, "page map entries are stored as-is");
+        pageMap.resize(header[1]);
+        size_t bytes=pageMap.size() * sizeof(PageMapEntry);
+        in.read(reinterpret_cast<char*>(pageMap.data()), bytes);
+        Statistics::global().recordRead(IoFile::METADATA, in.gcount());
+        if(static_cast<size_t>(in.gcount()) != bytes ||
+           header[3] != hashKey(std::string_view(reinterpret_cast<const char*>(pageMap.data()), bytes)))
+        {
+            logError("page map checksum mismatch: " + dbPath + ".pagemap");
+            pageMap.clear();
+            return false;
+        }
+        dataEnd=header[2];
+        rebuildFreeExtents();
+        return true;
+    }
+
+    //the gaps between live extents become free extents of at most a page
+    void StorageManager::rebuildFreeExtents()
+    {
+        freeExtents.assign(MAX_EXTENT_UNITS + 1, {});
+        std::vector<std::pair<uint64_t, uint64_t>> live;
+        for(const auto& entry : pageMap)
+        {
+            if(entry.extentUnits > 0) live.emplace_back(entry.offset, entry.offset + entry.extentUnits * EXTENT_UNIT);
+        }
+        live.emplace_back(dataEnd, dataEnd);
+        std::sort(live.begin(), live.end());
+        uint64_t cursor=HEADER_SIZE;
+        for(const auto& extent : live)
+        {
+            while(cursor + EXTENT_UNIT <= extent.first)
+            {
+                size_t units=std::min<uint64_t>(MAX_EXTENT_UNITS, (extent.first - cursor) / EXTENT_UNIT);
+                freeExtents[units].push_back(cursor);
+                cursor += units * EXTENT_UNIT;
+            }
+            cursor=std::max(cursor, extent.second);
+        }
+    }
+
+    //caller holds cacheMutex and has written every page the map points at
+    bool StorageManager::savePageMap()
+    {
+        if(options.compression != PageCompression::LZ || !pageMapDirty) return true;
+        uint64_t header[4]={
+            PAGE_MAP_MAGIC,
+            pageMap.size(),
+            dataEnd,
+            hashKey(std::string_view(reinterpret_cast<const char*>(pageMap.data()), pageMap.size() * sizeof(PageMapEntry)))
+        };
+        //write-then-rename so a crash leaves either the old or the new map
+        std::string mapPath=dbPath + ".pagemap";
+        std::string tmpPath=mapPath + ".tmp";
+        int fd=::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if(fd < 0)
+        {
+            logError("failed to write page map: " + tmpPath);
+            return false;
+        }
+        size_t bytes=pageMap.size() * sizeof(PageMapEntry);
+        bool ok=::write(fd, header, sizeof(header)) == static_cast<ssize_t>(sizeof(header)) &&
+                ::write(fd, pageMap.data(), bytes) == static_cast<ssize_t>(bytes);
+        Statistics::global().recordWrite(IoFile::METADATA, sizeof(header));
+        Statistics::global().recordWrite(IoFile::METADATA, bytes);
+        if(ok)
+        {
+            ScopedSync timer(IoFile::METADATA);
+            ok=fsync(fd) == 0;
+        }
+        ::close(fd);
+        if(!ok || std::rename(tmpPath.c_str(), mapPath.c_str()) != 0)
+        {
+            logError("failed to install page map: " + mapPath);
+            unlink(tmpPath.c_str());
+            return false;
+        }
+        //extents the old map referenced are now safe to reuse
+        for(const auto& extent : pendingFreeExtents)
+        {
+            freeExtents[extent.second].push_back(extent.first);
+        }
+        pendingFreeExtents.clear();
+        pageMapDirty=false;
+        return true;
+    }
+
+    //caller holds cacheMutex; the image must not be raw
+    void StorageManager::cacheCompressed(PageId pageId, const uint8_t* image, size_t size)
+    {
+        dropCompressed(pageId);
+        if(size > compressedLimit) return;
+        compressedLru.emplace_front(pageId, std::string(reinterpret_cast<const char*>(image), size));
+        compressedIndex[pageId]=compressedLru.begin();
+        compressedBytes += size;
+        while(compressedBytes > compressedLimit)
+        {
+            compressedBytes -= compressedLru.back().second.size();
+            compressedIndex.erase(compressedLru.back().first);
+            compressedLru.pop_back();
+        }
+    }
+
+    //caller holds cacheMutex; decompresses a cached image into data
+    bool StorageManager::loadCompressed(PageId pageId, uint8_t* data)
+    {
+        auto it=compressedIndex.find(pageId);
+        if(it == compressedIndex.end()) return false;
+        compressedLru.splice(compressedLru.begin(), compressedLru, it->second);
+        const std::string& image=it->second->second;
+        if(!lzDecompress(reinterpret_cast<const uint8_t*>(image.data()), image.size(), data, PAGE_SIZE))
+        {
+            dropCompressed(pageId);
+            return false;
+        }
+        cacheCounters.compressedHits++;
+        return true;
+    }
+
+    void StorageManager::dropCompressed(PageId pageId)
+    {
+        auto it=compressedIndex.find(pageId);
+        if(it == compressedIndex.end()) return;
+        compressedBytes -= it->second->second.size();
+        compressedLru.erase(it->second);
+        compressedIndex.erase(it);
+    }
+    bool StorageManager::loadPage(PageId pageId)
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        return getPageUnlocked(pageId) != nullptr;
     }
     
     std::shared_ptr<Page> StorageManager::getPageUnlocked(PageId pageId)
     {
-        auto it=pageCache.find(pageId);
-        if(it != pageCache.end())
+        if(!bufferPool) return nullptr;
+        auto page=bufferPool->find(pageId);
+        if(page)
         {
-            return it->second;
+            cacheCounters.frameHits++;
+            Statistics::global().incrementCacheHits();
+            return page;
         }
-        auto page=std::make_shared<Page>(pageId);
-        if(!readPageFromDisk(pageId, page->data))
+        Statistics::global().incrementCacheMisses();
+        if(bufferPool->isFull() && !evictPage())
         {
-            page->data.assign(PAGE_SIZE, 0);
+            return nullptr;
+        }
+        page=bufferPool->install(pageId);
+        if(loadCompressed(pageId, page->data.data()))
+        {
+            return page;
+        }
+        if(!readPageFromDisk(pageId, page->data.data()))
+        {
+            page->data.clear();
         }
-        
-        pageCache[pageId]=page;
         return page;
     }
     bool StorageManager::flushPage(PageId pageId)
     {
         std::lock_guard<std::mutex> lock(cacheMutex);
-        auto it=pageCache.find(pageId);
-        if(it == pageCache.end()) return true;
-        if(it->second->isDirty)
+        if(!bufferPool) return true;
+        auto page=bufferPool->find(pageId);
+        if(!page) return true;
+        if(page->isDirty)
         {
-            if(!writePageToDisk(pageId, it->second->data))
+            if(!writePageToDisk(pageId, page->data.data()))
             {
                 return false;
             }
-            it->second->isDirty=false;
+            page->isDirty=false;
         }
         return true;
     }
@@ -244,191 +690,504 @@ namespace stonedb
     bool StorageManager::flushAll()
     {
         std::lock_guard<std::mutex> lock(cacheMutex);
+        return flushAllUnlocked();
+    }
+
+    //caller holds cacheMutex
+    bool StorageManager::flushAllUnlocked()
+    {
+        if(!bufferPool) return true;
+        if(!saveHashLayout()) return false;
         
-        for(auto& pair : pageCache)
+        std::vector<Page*> dirty;
+        bufferPool->forEachResident([&](Page& page)
         {
-            if(pair.second->isDirty)
+            if(page.isDirty) dirty.push_back(&page);
+        });
+        if(pool && dirty.size() >= PARALLEL_FLUSH_PAGES)
+        {
+            return writePages(dirty) && savePageMap();
+        }
+        for(Page* page : dirty)
+        {
+            STONEDB_TRACE("flushing page " + std::to_string(page->pageId));
+            if(!writePageToDisk(page->pageId, page->data.data()))
             {
-                log("flushing page " + std::to_string(pair.first));
-                if(!writePageToDisk(pair.first, pair.second->data))
-                {
-                    logError("failed to write page " + std::to_string(pair.first) + " to disk");
-                    return false;
-                }
-                pair.second->isDirty=false;
+                logError("failed to write page " + std::to_string(page->pageId) + " to disk");
+                return false;
             }
+            page->isDirty=false;
         }
-        return true;
+        return savePageMap();
     }
-    bool StorageManager::putRecord(const std::string& key, const std::string& value)
+
+    void StorageManager::runRanges(size_t count, const std::function<void(size_t, size_t)>& fn)
     {
-        if(key.size() > MAX_KEY_SIZE || value.size() > MAX_VALUE_SIZE)
+        if(pool)
         {
-            return false;
+            pool->parallelFor(count, PAGE_TASK_PAGES, fn);
+            return;
         }
-        
-        size_t requiredSize=4 + key.size() + value.size();
-        
-        std::lock_guard<std::mutex> lock(cacheMutex);
-        auto it=keyToPage.find(key);
-        if(it != keyToPage.end())
+        for(size_t begin=0; begin<count; begin+=PAGE_TASK_PAGES)
         {
-            PageId pageId=it->second;
-            if(findFreeSpaceInPage(pageId, key, value, requiredSize))
+            fn(begin, std::min(count, begin + PAGE_TASK_PAGES));
+        }
+    }
+
+    //caller holds cacheMutex; the flush of many dirty pages. the backup
+    //copies and the change map are done first in page order, then the pool
+    //compresses (LZ) or writes (raw, through a descriptor of its own) the
+    //pages in parallel ranges. extent placement stays on this thread
+    bool StorageManager::writePages(std::vector<Page*>& dirty)
+    {
+        std::sort(dirty.begin(), dirty.end(), [](const Page* a, const Page* b) { return a->pageId < b->pageId; });
+        if(options.compression == PageCompression::LZ)
+        {
+            std::vector<uint8_t> images(dirty.size() * PAGE_SIZE);
+            std::vector<size_t> sizes(dirty.size());
+            std::vector<uint16_t> flags(dirty.size());
+            runRanges(dirty.size(), [&](size_t begin, size_t end)
             {
-                keyToPage[key]=pageId;
-                return true;
+                for(size_t i=begin; i<end; i++)
+                {
+                    sizes[i]=compressPage(dirty[i]->data.data(), &images[i * PAGE_SIZE], flags[i]);
+                }
+            });
+            for(size_t i=0; i<dirty.size(); i++)
+            {
+                PageId pageId=dirty[i]->pageId;
+                noteWritten(pageId, pageId + 1);
+                if(!writePageImage(pageId, &images[i * PAGE_SIZE], sizes[i], flags[i]))
+                {
+                    logError("failed to write page " + std::to_string(pageId) + " to disk");
+                    return false;
+                }
+                dirty[i]->isDirty=false;
             }
-            keyToPage.erase(key);
+            return true;
         }
-        for(PageId pageId : allocatedPages)
+        for(Page* page : dirty)
         {
-            if(findFreeSpaceInPage(pageId, key, value, requiredSize))
+            noteWritten(page->pageId, page->pageId + 1);
+            if(activeBackup && page->pageId < activeBackup->pages && !activeBackup->copied[page->pageId])
             {
-                keyToPage[key]=pageId;
-                return true;
+                copyForBackup(page->pageId, page->pageId + 1);
+                activeBackup->preserved++;
             }
         }
-        PageId newPageId=allocateNewPage();
-        if(findFreeSpaceInPage(newPageId, key, value, requiredSize))
+        dbFile.flush();
+        int fd=::open(dbPath.c_str(), O_RDWR | O_CLOEXEC);
+        if(fd < 0)
         {
-            keyToPage[key]=newPageId;
-            return true;
+            logError("failed to open " + dbPath + " for writing pages");
+            return false;
         }
-        logError("failed to allocate space for record");
-        return false;
+        std::atomic<bool> failed(false);
+        runRanges(dirty.size(), [&](size_t begin, size_t end)
+        {
+            for(size_t i=begin; i<end && !failed; i++)
+            {
+                ScopedLatency timer(LatencyOp::PAGE_WRITE);
+                off_t offset=static_cast<off_t>(HEADER_SIZE + dirty[i]->pageId * PAGE_SIZE);
+                if(::pwrite(fd, dirty[i]->data.data(), PAGE_SIZE, offset) != static_cast<ssize_t>(PAGE_SIZE))
+                {
+                    logError("failed to write page " + std::to_string(dirty[i]->pageId) + " to disk");
+                    failed=true;
+                    return;
+                }
+                Statistics::global().recordWrite(IoFile::DATA, PAGE_SIZE);
+            }
+        });
+        ::close(fd);
+        if(failed) return false;
+        Statistics::global().recordFlush(IoFile::DATA);
+        for(Page* page : dirty) page->isDirty=false;
+        return true;
     }
-    
-    bool StorageManager::getRecord(const std::string& key, std::string& value)
+
+    //caller holds cacheMutex (or is open()); hands fn every page of pages
+    //with its index there. resident frames are read in place, which nothing
+    //changes while the lock is held; the rest are read from the data file
+    //by the pool without going through the buffer pool or its counters'
+    //lock. each PAGE_TASK_PAGES run of indexes is visited by one thread in
+    //order, so fn can collect into a slot per run
+    bool StorageManager::readPages(const std::vector<PageId>& pages, const std::function<void(size_t, const uint8_t*)>& fn)
     {
-        std::lock_guard<std::mutex> lock(cacheMutex);
-        auto it=keyToPage.find(key);
-        if(it != keyToPage.end())
+        std::vector<const uint8_t*> resident(pages.size(), nullptr);
+        for(size_t i=0; i<pages.size(); i++)
         {
-            PageId pageId=it->second;
-            auto page=getPageUnlocked(pageId);
-            if(page)
+            auto page=bufferPool->find(pages[i]);
+            if(page) resident[i]=page->data.data();
+        }
+        dbFile.flush();
+        int fd=::open(dbPath.c_str(), O_RDONLY | O_CLOEXEC);
+        if(fd < 0)
+        {
+            logError("failed to open " + dbPath + " for reading pages");
+            return false;
+        }
+        bool compressed=options.compression == PageCompression::LZ;
+        std::atomic<uint64_t> reads(0);
+        std::atomic<uint64_t> bytes(0);
+        runRanges(pages.size(), [&](size_t begin, size_t end)
+        {
+            PageBuffer data;
+            uint8_t image[PAGE_SIZE];
+            for(size_t i=begin; i<end; i++)
             {
-        size_t offset=0;
-                while(offset < PAGE_SIZE - RECORD_HEADER_SIZE)
+                if(resident[i])
                 {
-            uint16_t keyLen, valueLen;
-            memcpy(&keyLen, page->data.data() + offset, 2);
-            memcpy(&valueLen, page->data.data() + offset + 2, 2);
-                    if(keyLen == 0)
+                    fn(i, resident[i]);
+                    continue;
+                }
+                ScopedLatency timer(LatencyOp::PAGE_READ);
+                //pages never written read as zeros, like getPageUnlocked
+                data.clear();
+                if(compressed)
+                {
+                    if(pages[i] < pageMap.size() && pageMap[pages[i]].storedSize != 0)
                     {
-                        if(valueLen > 0 && valueLen < MAX_VALUE_SIZE && offset + 4 + valueLen < PAGE_SIZE)
-                        {
-                            offset += 4 + valueLen;
-                            continue;
-                        }
-                        size_t searchOffset=offset + 4;
-                        bool foundNext=false;
-                        while(searchOffset < PAGE_SIZE - RECORD_HEADER_SIZE)
+                        const PageMapEntry& entry=pageMap[pages[i]];
+                        ssize_t got=::pread(fd, image, entry.storedSize, static_cast<off_t>(entry.offset));
+                        if(got == static_cast<ssize_t>(entry.storedSize))
                         {
-                            if(searchOffset + 4 > PAGE_SIZE) break;
-                            uint16_t testKeyLen, testValueLen;
-                            memcpy(&testKeyLen, page->data.data() + searchOffset, 2);
-                            memcpy(&testValueLen, page->data.data() + searchOffset + 2, 2);
-                            
-                            if(testKeyLen > 0 && testKeyLen <= MAX_KEY_SIZE && 
-                               testValueLen > 0 && testValueLen <= MAX_VALUE_SIZE &&
-                               searchOffset + 4 + testKeyLen + testValueLen <= PAGE_SIZE)
+                            reads++;
+                            bytes += entry.storedSize;
+                            Statistics::global().recordRead(IoFile::DATA, entry.storedSize);
+                            if(entry.flags & PAGE_IMAGE_RAW)
                             {
-                                offset=searchOffset;
-                                foundNext=true;
-                                break;
+                                memcpy(data.data(), image, PAGE_SIZE);
                             }
-                            if(testKeyLen == 0 && testValueLen > 0 && testValueLen < MAX_VALUE_SIZE &&
-                               searchOffset + 4 + testValueLen < PAGE_SIZE)
+                            else if(!lzDecompress(image, entry.storedSize, data.data(), PAGE_SIZE))
                             {
-                                searchOffset += 4 + testValueLen;
-                                continue;
+                                logError("corrupt compressed page " + std::to_string(pages[i]));
+                                data.clear();
                             }
-                            searchOffset += 4;
                         }
-                        if(!foundNext) break;
-                        continue;
                     }
-                    if(offset + 4 > PAGE_SIZE || 
-                       offset + 4 + keyLen > PAGE_SIZE ||
-                       offset + 4 + keyLen + valueLen > PAGE_SIZE)
+                }
+                else
+                {
+                    off_t offset=static_cast<off_t>(HEADER_SIZE + pages[i] * PAGE_SIZE);
+                    if(::pread(fd, data.data(), PAGE_SIZE, offset) == static_cast<ssize_t>(PAGE_SIZE))
                     {
-                        break;
+                        reads++;
+                        bytes += PAGE_SIZE;
+                        Statistics::global().recordRead(IoFile::DATA, PAGE_SIZE);
                     }
-            std::string recordKey(reinterpret_cast<const char*>(page->data.data() + offset + 4), keyLen);
-                    if(recordKey == key)
+                    else
                     {
-                value.assign(reinterpret_cast<const char*>(page->data.data() + offset + 4 + keyLen), valueLen);
-                return true;
+                        data.clear();
                     }
-                    
-                    offset += 4 + keyLen + valueLen;
                 }
+                fn(i, data.data());
             }
-        }
-        for(PageId pageId : allocatedPages)
-        {
+        });
+        ::close(fd);
+        cacheCounters.diskReads += reads;
+        cacheCounters.bytesRead += bytes;
+        return true;
+    }
+    bool StorageManager::checkpoint()
+    {
+        if(!flushAll())
+        {
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        return saveKeyFilter();
+    }
+
+    //caller holds cacheMutex
+    void StorageManager::rebuildKeyFilter()
+    {
+        keyFilter.reset(std::max(MIN_FILTER_KEYS, liveKeyCount() * 2));
+        if(options.layout == StorageLayout::HASH)
+        {
+            //each bucket once: one of local depth d is first referenced from slot i < 2^d
+            std::vector<PageId> buckets;
+            for(size_t i=0; i<directory.size(); i++)
+            {
+                if(i < (size_t(1) << directory[i].localDepth)) buckets.push_back(directory[i].bucket);
+            }
+            std::vector<std::vector<uint64_t>> parts((buckets.size() + PAGE_TASK_PAGES - 1) / PAGE_TASK_PAGES);
+            readPages(buckets, [&](size_t index, const uint8_t* data)
+            {
+                auto& part=parts[index / PAGE_TASK_PAGES];
+                forEachInPage(options.pageFormat, data, [&](std::string_view key, std::string_view)
+                {
+                    part.push_back(hashKey(key));
+                });
+            });
+            for(const auto& part : parts)
+            {
+                for(uint64_t hash : part) keyFilter.insert(hash);
+            }
+        }
+        else
+        {
+            for(const auto& pair : keyToPage)
+            {
+                keyFilter.insert(hashKey(pair.first));
+            }
+        }
+        filterDeletes=0;
+    }
+
+    size_t StorageManager::liveKeyCount() const
+    {
+        return options.layout == StorageLayout::HASH ? hashKeyCount : keyToPage.size();
+    }
+
+    //caller holds cacheMutex
+    void StorageManager::noteKeyInserted(uint64_t hash)
+    {
+        //re-puts of a present key would only inflate the count
+        if(keyFilter.mayContain(hash)) return;
+        keyFilter.insert(hash);
+        if(keyFilter.count() > keyFilter.capacity())
+        {
+            rebuildKeyFilter();
+        }
+    }
+
+    //caller holds cacheMutex
+    void StorageManager::noteKeyDeleted()
+    {
+        filterDeletes++;
+        if(filterDeletes > MIN_FILTER_KEYS && filterDeletes > liveKeyCount())
+        {
+            rebuildKeyFilter();
+        }
+    }
+
+    //the persisted filter is tagged with the data file's size and mtime at
+    //save time; any later write to the data file invalidates it and open()
+    //falls back to rebuilding from the page scan
+    bool StorageManager::loadKeyFilter()
+    {
+        struct stat dbStat;
+        if(stat(dbPath.c_str(), &dbStat) != 0) return false;
+        std::ifstream in(dbPath + ".bloom", std::ios::binary);
+        if(!in.is_open()) return false;
+        uint64_t tag[4];
+        in.read(reinterpret_cast<char*>(tag), sizeof(tag));
+        Statistics::global().recordRead(IoFile::METADATA, in.gcount());
+        if(in.gcount() != sizeof(tag)) return false;
+        if(tag[0] != static_cast<uint64_t>(dbStat.st_size) ||
+           tag[1] != static_cast<uint64_t>(dbStat.st_mtim.tv_sec) ||
+           tag[2] != static_cast<uint64_t>(dbStat.st_mtim.tv_nsec))
+        {
+            log("bloom filter is stale, rebuilding");
+            return false;
+        }
+        std::vector<uint8_t> bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        Statistics::global().recordRead(IoFile::METADATA, bytes.size());
+        if(tag[3] != hashKey(std::string_view(reinterpret_cast<const char*>(bytes.data()), bytes.size())))
+        {
+            logError("bloom filter checksum mismatch, rebuilding");
+            return false;
+        }
+        if(!keyFilter.deserialize(bytes.data(), bytes.size()))
+        {
+            logError("bloom filter corrupt, rebuilding");
+            return false;
+        }
+        filterDeletes=0;
+        return true;
+    }
+
+    //caller holds cacheMutex and has flushed the data file
+    bool StorageManager::saveKeyFilter()
+    {
+        struct stat dbStat;
+        if(stat(dbPath.c_str(), &dbStat) != 0) return false;
+        std::vector<uint8_t> bytes;
+        keyFilter.serialize(bytes);
+        uint64_t tag[4]={
+            static_cast<uint64_t>(dbStat.st_size),
+            static_cast<uint64_t>(dbStat.st_mtim.tv_sec),
+            static_cast<uint64_t>(dbStat.st_mtim.tv_nsec),
+            hashKey(std::string_view(reinterpret_cast<const char*>(bytes.data()), bytes.size()))
+        };
+        std::string tmpPath=dbPath + ".bloom.tmp";
+        std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+        if(!out.is_open())
+        {
+            logError("failed to write bloom filter: " + tmpPath);
+            return false;
+        }
+        out.write(reinterpret_cast<const char*>(tag), sizeof(tag));
+        out.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+        out.close();
+        Statistics::global().recordWrite(IoFile::METADATA, sizeof(tag) + bytes.size());
+        if(out.fail() || std::rename(tmpPath.c_str(), (dbPath + ".bloom").c_str()) != 0)
+        {
+            logError("failed to persist bloom filter");
+            return false;
+        }
+        return true;
+    }
+
+    //caller holds cacheMutex
+    void StorageManager::noteWritten(PageId first, PageId end)
+    {
+        for(PageId pageId=first; pageId<end && pageId<changedPages.size(); pageId++) changedPages[pageId]=true;
+    }
+
+    //<path>.changes: [u64 db size][u64 mtime sec][u64 mtime nsec][u64 hash]
+    //then the hashed part: [u64 changeBase][u64 page count][bitmap bytes]
+    bool StorageManager::loadChangeMap()
+    {
+        struct stat dbStat;
+        if(stat(dbPath.c_str(), &dbStat) != 0) return false;
+        std::ifstream in(dbPath + ".changes", std::ios::binary);
+        if(!in.is_open()) return false;
+        uint64_t tag[4];
+        in.read(reinterpret_cast<char*>(tag), sizeof(tag));
+        Statistics::global().recordRead(IoFile::METADATA, in.gcount());
+        if(in.gcount() != sizeof(tag)) return false;
+        if(tag[0] != static_cast<uint64_t>(dbStat.st_size) ||
+           tag[1] != static_cast<uint64_t>(dbStat.st_mtim.tv_sec) ||
+           tag[2] != static_cast<uint64_t>(dbStat.st_mtim.tv_nsec))
+        {
+            log("change map is stale, the next backup must be a full one");
+            return false;
+        }
+        std::string bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        Statistics::global().recordRead(IoFile::METADATA, bytes.size());
+        uint64_t head[2];
+        if(bytes.size() < sizeof(head) || tag[3] != hashKey(bytes))
+        {
+            logError("change map corrupt, the next backup must be a full one");
+            return false;
+        }
+        memcpy(head, bytes.data(), sizeof(head));
+        if(bytes.size() != sizeof(head) + (head[1] + 7) / 8) return false;
+        changeBase=head[0];
+        changedPages.assign(head[1], false);
+        for(uint64_t pageId=0; pageId<head[1]; pageId++)
+        {
+            changedPages[pageId]=(bytes[sizeof(head) + pageId / 8] >> (pageId % 8)) & 1;
+        }
+        return true;
+    }
+
+    //caller holds cacheMutex and has flushed the data file for the last time
+    bool StorageManager::saveChangeMap()
+    {
+        std::string mapPath=dbPath + ".changes";
+        struct stat dbStat;
+        if(changeBase == 0 || stat(dbPath.c_str(), &dbStat) != 0)
+        {
+            std::remove(mapPath.c_str());
+            return changeBase == 0;
+        }
+        uint64_t head[2]={changeBase, changedPages.size()};
+        std::string bytes(sizeof(head) + (changedPages.size() + 7) / 8, '\0');
+        memcpy(&bytes[0], head, sizeof(head));
+        for(size_t pageId=0; pageId<changedPages.size(); pageId++)
+        {
+            if(changedPages[pageId]) bytes[sizeof(head) + pageId / 8] |= static_cast<char>(1 << (pageId % 8));
+        }
+        uint64_t tag[4]={
+            static_cast<uint64_t>(dbStat.st_size),
+            static_cast<uint64_t>(dbStat.st_mtim.tv_sec),
+            static_cast<uint64_t>(dbStat.st_mtim.tv_nsec),
+            hashKey(bytes)
+        };
+        std::string tmpPath=mapPath + ".tmp";
+        std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(tag), sizeof(tag));
+        out.write(bytes.data(), bytes.size());
+        out.close();
+        Statistics::global().recordWrite(IoFile::METADATA, sizeof(tag) + bytes.size());
+        if(out.fail() || std::rename(tmpPath.c_str(), mapPath.c_str()) != 0)
+        {
+            logError("failed to persist change map: " + mapPath);
+            return false;
+        }
+        return true;
+    }
+
+    bool StorageManager::putRecord(const std::string& key, const std::string& value)
+    {
+        if(key.size() > MAX_KEY_SIZE || value.size() > MAX_VALUE_SIZE)
+        {
+            return false;
+        }
+        
+        if(options.layout == StorageLayout::HASH)
+        {
+            return hashPutRecord(key, value);
+        }
+        
+        uint64_t hash=hashKey(key);
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        auto it=keyToPage.find(key);
+        if(it != keyToPage.end())
+        {
+            PageId pageId=it->second;
+            if(findFreeSpaceInPage(pageId, key, value, hash))
+            {
+                keyToPage[key]=pageId;
+                return true;
+            }
+            keyToPage.erase(key);
+        }
+        for(PageId pageId : allocatedPages)
+        {
+            if(findFreeSpaceInPage(pageId, key, value, hash))
+            {
+                keyToPage[key]=pageId;
+                noteKeyInserted(hash);
+                return true;
+            }
+        }
+        PageId newPageId=allocateNewPage();
+        if(findFreeSpaceInPage(newPageId, key, value, hash))
+        {
+            keyToPage[key]=newPageId;
+            noteKeyInserted(hash);
+            return true;
+        }
+        logError("failed to allocate space for record");
+        return false;
+    }
+    
+    bool StorageManager::getRecord(const std::string& key, std::string& value)
+    {
+        if(options.layout == StorageLayout::HASH)
+        {
+            return hashGetRecord(key, value);
+        }
+        uint64_t hash=hashKey(key);
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        if(!keyFilter.mayContain(hash))
+        {
+            return false;
+        }
+        std::string_view found;
+        auto it=keyToPage.find(key);
+        if(it != keyToPage.end())
+        {
+            auto page=getPageUnlocked(it->second);
+            if(page && findInPage(options.pageFormat, page->data.data(), key, hash, found))
+            {
+                value.assign(found.data(), found.size());
+                return true;
+            }
+        }
+        for(PageId pageId : allocatedPages)
+        {
             auto page=getPageUnlocked(pageId);
             if(!page) continue;
-            
-            size_t offset=0;
-            while(offset < PAGE_SIZE - RECORD_HEADER_SIZE)
+            if(findInPage(options.pageFormat, page->data.data(), key, hash, found))
             {
-                uint16_t keyLen, valueLen;
-                memcpy(&keyLen, page->data.data() + offset, 2);
-                memcpy(&valueLen, page->data.data() + offset + 2, 2);
-                if(keyLen == 0)
-                {
-                    if(valueLen > 0 && valueLen < MAX_VALUE_SIZE && offset + 4 + valueLen < PAGE_SIZE)
-                    {
-                        offset += 4 + valueLen;
-                        continue;
-                    }
-                    size_t searchOffset=offset + 4;
-                    bool foundNext=false;
-                    while(searchOffset < PAGE_SIZE - RECORD_HEADER_SIZE)
-                    {
-                        if(searchOffset + 4 > PAGE_SIZE) break;
-                        uint16_t testKeyLen, testValueLen;
-                        memcpy(&testKeyLen, page->data.data() + searchOffset, 2);
-                        memcpy(&testValueLen, page->data.data() + searchOffset + 2, 2);
-                        
-                        if(testKeyLen > 0 && testKeyLen <= MAX_KEY_SIZE && 
-                           testValueLen > 0 && testValueLen <= MAX_VALUE_SIZE &&
-                           searchOffset + 4 + testKeyLen + testValueLen <= PAGE_SIZE)
-                        {
-                            offset=searchOffset;
-                            foundNext=true;
-                            break;
-                        }
-                        if(testKeyLen == 0 && testValueLen > 0 && testValueLen < MAX_VALUE_SIZE &&
-                           searchOffset + 4 + testValueLen < PAGE_SIZE)
-                        {
-                            searchOffset += 4 + testValueLen;
-                            continue;
-                        }
-                        searchOffset += 4;
-                    }
-                    if(!foundNext) break;
-                    continue;
-                }
-                if(offset + 4 > PAGE_SIZE || 
-                   offset + 4 + keyLen > PAGE_SIZE ||
-                   offset + 4 + keyLen + valueLen > PAGE_SIZE)
-                {
-                    break;
-                }
-                std::string recordKey(reinterpret_cast<const char*>(page->data.data() + offset + 4), keyLen);
-                if(recordKey == key)
-                    {
-                        value.assign(reinterpret_cast<const char*>(page->data.data() + offset + 4 + keyLen), valueLen);
-                        //update mapping for future lookups
-                        keyToPage[key]=pageId;
-                        return true;
-                    }
-                
-            offset += 4 + keyLen + valueLen;
+                value.assign(found.data(), found.size());
+                //update mapping for future lookups
+                keyToPage[key]=pageId;
+                return true;
             }
         }
         
@@ -436,150 +1195,44 @@ namespace stonedb
     }
     bool StorageManager::deleteRecord(const std::string& key)
     {
+        if(options.layout == StorageLayout::HASH)
+        {
+            return hashDeleteRecord(key);
+        }
+        uint64_t hash=hashKey(key);
         std::lock_guard<std::mutex> lock(cacheMutex);
+        if(!keyFilter.mayContain(hash))
+        {
+            return false;
+        }
         auto it=keyToPage.find(key);
         if(it != keyToPage.end())
         {
-            PageId pageId=it->second;
-            auto page=getPageUnlocked(pageId);
-            if(page)
+            auto page=getPageUnlocked(it->second);
+            if(page && eraseRecord(*page, key, hash))
             {
-                size_t offset=0;
-                while(offset < PAGE_SIZE - RECORD_HEADER_SIZE)
-                {
-                    uint16_t keyLen, valueLen;
-                    memcpy(&keyLen, page->data.data() + offset, 2);
-                    memcpy(&valueLen, page->data.data() + offset + 2, 2);
-                    
-                    //skip deleted records
-                    if(keyLen == 0)
-                    {
-                        if(valueLen > 0 && valueLen < MAX_VALUE_SIZE && offset + 4 + valueLen < PAGE_SIZE)
-                        {
-                            offset += 4 + valueLen;
-                            continue;
-                        }
-                        size_t searchOffset=offset + 4;
-                        bool foundNext=false;
-                        while(searchOffset < PAGE_SIZE - RECORD_HEADER_SIZE)
-                        {
-                            if(searchOffset + 4 > PAGE_SIZE) break;
-                            uint16_t testKeyLen, testValueLen;
-                            memcpy(&testKeyLen, page->data.data() + searchOffset, 2);
-                            memcpy(&testValueLen, page->data.data() + searchOffset + 2, 2);
-                            
-                            if(testKeyLen > 0 && testKeyLen <= MAX_KEY_SIZE && 
-                               testValueLen > 0 && testValueLen <= MAX_VALUE_SIZE &&
-                               searchOffset + 4 + testKeyLen + testValueLen <= PAGE_SIZE)
-                            {
-                                offset=searchOffset;
-                                foundNext=true;
-                                break;
-                            }
-                            if(testKeyLen == 0 && testValueLen > 0 && testValueLen < MAX_VALUE_SIZE &&
-                               testValueLen < MAX_VALUE_SIZE && searchOffset + 4 + testValueLen < PAGE_SIZE)
-                            {
-                                searchOffset += 4 + testValueLen;
-                                continue;
-                            }
-                            searchOffset += 4;
-                        }
-                        if(!foundNext) break;
-                        continue;
-                    }
-                    if(offset + 4 > PAGE_SIZE || 
-                       offset + 4 + keyLen > PAGE_SIZE ||
-                       offset + 4 + keyLen + valueLen > PAGE_SIZE)
-                    {
-                        break;
-                    }
-                    
-                    std::string recordKey(reinterpret_cast<const char*>(page->data.data() + offset + 4), keyLen);
-                    if(recordKey == key)
-                    {
-                        uint16_t zero=0;
-                        memcpy(page->data.data() + offset, &zero, 2);
-                        page->isDirty=true;
-                        keyToPage.erase(key);
-                        return true;
-                    }
-                    
-                    offset += 4 + keyLen + valueLen;
-                }
+                keyToPage.erase(key);
+                noteKeyDeleted();
+                return true;
             }
         }
         for(PageId pageId : allocatedPages)
         {
             auto page=getPageUnlocked(pageId);
             if(!page) continue;
-            
-            size_t offset=0;
-            while(offset < PAGE_SIZE - RECORD_HEADER_SIZE)
+            if(eraseRecord(*page, key, hash))
             {
-                uint16_t keyLen, valueLen;
-                memcpy(&keyLen, page->data.data() + offset, 2);
-                memcpy(&valueLen, page->data.data() + offset + 2, 2);
-                if(keyLen == 0)
-                {
-                    if(valueLen > 0 && valueLen < MAX_VALUE_SIZE && offset + 4 + valueLen < PAGE_SIZE)
-                    {
-                        offset += 4 + valueLen;
-                        continue;
-                    }
-                    size_t searchOffset=offset + 4;
-                    bool foundNext=false;
-                    while(searchOffset < PAGE_SIZE - RECORD_HEADER_SIZE)
-                    {
-                        if(searchOffset + 4 > PAGE_SIZE) break;
-                        uint16_t testKeyLen, testValueLen;
-                        memcpy(&testKeyLen, page->data.data() + searchOffset, 2);
-                        memcpy(&testValueLen, page->data.data() + searchOffset + 2, 2);
-                        
-                        if(testKeyLen > 0 && testKeyLen <= MAX_KEY_SIZE && 
-                           testValueLen > 0 && testValueLen <= MAX_VALUE_SIZE &&
-                           searchOffset + 4 + testKeyLen + testValueLen <= PAGE_SIZE)
-                        {
-                            offset=searchOffset;
-                            foundNext=true;
-                            break;
-                        }
-                        if(testKeyLen == 0 && testValueLen > 0 && testValueLen < MAX_VALUE_SIZE &&
-                           searchOffset + 4 + testValueLen < PAGE_SIZE)
-                        {
-                            searchOffset += 4 + testValueLen;
-                            continue;
-                        }
-                        searchOffset += 4;
-                    }
-                    if(!foundNext) break;
-                    continue;
-                }
-                if(offset + 4 > PAGE_SIZE || 
-                   offset + 4 + keyLen > PAGE_SIZE ||
-                   offset + 4 + keyLen + valueLen > PAGE_SIZE)
-                {
-                    break;
-                }
-                std::string recordKey(reinterpret_cast<const char*>(page->data.data() + offset + 4), keyLen);
-                if(recordKey == key)
-                {
-                    uint16_t zero=0;
-                    memcpy(page->data.data() + offset, &zero, 2);
-                    page->isDirty=true;
-                    keyToPage.erase(key);
-                    return true;
-                }
-                
-                offset += 4 + keyLen + valueLen;
+                keyToPage.erase(key);
+                noteKeyDeleted();
+                return true;
             }
         }
         
         return false;
     }
+    //caller holds cacheMutex
     PageId StorageManager::allocateNewPage()
     {
-        std::lock_guard<std::mutex> lock(cacheMutex);
-        
         if(!freePages.empty())
         {
             PageId pageId=freePages.back();
@@ -588,7 +1241,8 @@ namespace stonedb
             return pageId;
         }
         PageId newPageId=nextPageId++;
-        const size_t maxPageId=std::numeric_limits<std::streampos>::max() / PAGE_SIZE;
+        //NO_PAGE is reserved for empty buffer pool frames
+        const size_t maxPageId=std::min<size_t>(std::numeric_limits<std::streamoff>::max() / PAGE_SIZE, NO_PAGE - 1);
         if(newPageId > maxPageId)
         {
             logError("page ID overflow: maximum pages exceeded");
@@ -596,6 +1250,13 @@ namespace stonedb
         }
         
         allocatedPages.insert(newPageId);
+        if(options.compression == PageCompression::LZ)
+        {
+            //the page gets an extent when it is first written
+            if(pageMap.size() <= newPageId) pageMap.resize(newPageId + 1, PageMapEntry{0, 0, 0, 0});
+            pageMapDirty=true;
+            return newPageId;
+        }
         size_t pageSizeBytes=static_cast<size_t>(newPageId) * PAGE_SIZE;
         std::streamoff maxFileSize=std::numeric_limits<std::streamoff>::max();
         std::streamoff totalSize=static_cast<std::streamoff>(HEADER_SIZE) + static_cast<std::streamoff>(pageSizeBytes) + static_cast<std::streamoff>(PAGE_SIZE);
@@ -614,238 +1275,1141 @@ namespace stonedb
             dbFile.seekp(targetPos);
             dbFile.write("\0", 1);
             dbFile.flush();
+            Statistics::global().recordWrite(IoFile::DATA, 1);
+            Statistics::global().recordFlush(IoFile::DATA);
         }
         return newPageId;
     }
+    //caller holds cacheMutex
     void StorageManager::deallocatePage(PageId pageId)
     {
-        std::lock_guard<std::mutex> lock(cacheMutex);
         allocatedPages.erase(pageId);
         freePages.push_back(pageId);
-        pageCache.erase(pageId);
+        if(bufferPool) bufferPool->evict(pageId);
+        dropCompressed(pageId);
     }
     
-    void StorageManager::evictLRUPage()
+    //caller holds cacheMutex; writes a dirty victim back before its frame is reused
+    bool StorageManager::evictPage()
     {
-        for(auto it=pageCache.begin(); it != pageCache.end(); ++it)
+        auto victim=bufferPool->pickVictim();
+        if(!victim)
         {
-            if(!it->second->isDirty)
-            {
-                pageCache.erase(it);
-                return;
-            }
+            logError("buffer pool has no evictable page");
+            return false;
         }
-        if(!pageCache.empty())
+        if(options.compression == PageCompression::LZ && !victim->isDirty &&
+           !compressedIndex.count(victim->pageId))
         {
-            pageCache.erase(pageCache.begin());
+            //keep a clean page in the compressed tier if its image was pushed out
+            uint8_t image[PAGE_SIZE];
+            uint16_t flags;
+            size_t size=compressPage(victim->data.data(), image, flags);
+            if(!(flags & PAGE_IMAGE_RAW)) cacheCompressed(victim->pageId, image, size);
+        }
+        if(victim->isDirty)
+        {
+            if(!writePageToDisk(victim->pageId, victim->data.data()))
+            {
+                logError("failed to write back page " + std::to_string(victim->pageId));
+                return false;
+            }
+            victim->isDirty=false;
         }
+        bufferPool->evict(victim->pageId);
+        return true;
     }
     
-    bool StorageManager::findFreeSpaceInPage(PageId pageId, const std::string& key, const std::string& value, size_t requiredSize)
+    //caller holds cacheMutex
+    bool StorageManager::findFreeSpaceInPage(PageId pageId, const std::string& key, const std::string& value, uint64_t hash)
     {
         auto page=getPageUnlocked(pageId);
         if(!page) return false;   
-        
-        //check if record exists in this page
-        size_t offset=0;
-        while(offset < PAGE_SIZE - RECORD_HEADER_SIZE)
+        bool modified=false;
+        if(snapshotNeeds(pageId))
         {
-            uint16_t keyLen, valueLen;
-            memcpy(&keyLen, page->data.data() + offset, 2);
-            memcpy(&valueLen, page->data.data() + offset + 2, 2);
-            if(keyLen == 0)
-            {
-                if(valueLen > 0 && valueLen < MAX_VALUE_SIZE && offset + 4 + valueLen < PAGE_SIZE)
-                {
-                    offset += 4 + valueLen;
-                    continue;
-                }
-                break;
-            }
-            if(offset + 4 > PAGE_SIZE || 
-               offset + 4 + keyLen > PAGE_SIZE ||
-               offset + 4 + keyLen + valueLen > PAGE_SIZE)
+            //a put that finds no room can still rewrite the page, so try it
+            //on a copy and keep the old image only if the bytes changed
+            memcpy(snapshotScratch.data(), page->data.data(), PAGE_SIZE);
+            bool stored=putInPage(options.pageFormat, snapshotScratch.data(), key, value, hash, modified);
+            if(modified)
             {
-                break;
+                preservePage(pageId, page->data.data());
+                memcpy(page->data.data(), snapshotScratch.data(), PAGE_SIZE);
+                page->isDirty=true;
             }
-            
-            std::string recordKey(reinterpret_cast<const char*>(page->data.data() + offset + 4), keyLen);
-            if(recordKey == key)
+            return stored;
+        }
+        bool stored=putInPage(options.pageFormat, page->data.data(), key, value, hash, modified);
+        if(modified) page->isDirty=true;
+        return stored;
+    }
+
+    //caller holds cacheMutex
+    bool StorageManager::eraseRecord(Page& page, const std::string& key, uint64_t hash)
+    {
+        if(snapshotNeeds(page.pageId))
+        {
+            std::string_view found;
+            if(!findInPage(options.pageFormat, page.data.data(), key, hash, found)) return false;
+            preservePage(page.pageId, page.data.data());
+        }
+        if(!eraseFromPage(options.pageFormat, page.data.data(), key, hash)) return false;
+        page.isDirty=true;
+        return true;
+    }
+    //ranges of the snapshot's pages are copied and parsed on the pool, each
+    //into its own slot, and joined in page order
+    std::vector<Record> StorageManager::scanRecords()
+    {
+        std::vector<Record> records;
+        auto snapshot=createSnapshot();
+        if(!snapshot) return records;
+        const std::vector<PageId>& pages=snapshot->pages;
+        std::vector<std::vector<Record>> parts((pages.size() + PAGE_TASK_PAGES - 1) / PAGE_TASK_PAGES);
+        runRanges(pages.size(), [&](size_t begin, size_t end)
+        {
+            PageBuffer copy;
+            auto& part=parts[begin / PAGE_TASK_PAGES];
+            for(size_t i=begin; i<end; i++)
             {
-                if(valueLen >= value.size())
-                {
-                    uint16_t newValueLen=value.size();
-                    memcpy(page->data.data() + offset + 2, &newValueLen, 2);
-                    memcpy(page->data.data() + offset + 4 + keyLen, value.c_str(), value.size());
-                    page->isDirty=true;
-                    return true;
-                }
-                else
-                {
-                uint16_t zero=0;
-                memcpy(page->data.data() + offset, &zero, 2);
-                    page->isDirty=true;
-                    break;
-                }
+                if(copySnapshotPage(*snapshot, pages[i], copy.data())) collectRecords(options.pageFormat, copy.data(), part);
             }
-            
-            offset += 4 + keyLen + valueLen;
+        });
+        releaseSnapshot(snapshot);
+        size_t total=0;
+        for(const auto& part : parts) total += part.size();
+        records.reserve(total);
+        for(auto& part : parts)
+        {
+            std::move(part.begin(), part.end(), std::back_inserter(records));
         }
-        offset=0;
-        
-        while(offset < PAGE_SIZE - RECORD_HEADER_SIZE)
+        return records;
+    }
+    //reads a snapshot taken for the walk, so the result is the store as it
+    //was when the call started, whatever writers do meanwhile
+    bool StorageManager::forEachRecord(const std::function<bool(std::string_view, std::string_view)>& fn)
+    {
+        auto snapshot=createSnapshot();
+        if(!snapshot) return false;
+        bool ok=forEachRecord(*snapshot, fn);
+        releaseSnapshot(snapshot);
+        return ok;
+    }
+
+    //caller holds cacheMutex
+    bool StorageManager::snapshotNeeds(PageId pageId) const
+    {
+        for(const auto& snapshot : snapshots)
         {
-            uint16_t keyLen, valueLen;
-            memcpy(&keyLen, page->data.data() + offset, 2);
-            memcpy(&valueLen, page->data.data() + offset + 2, 2);
-            
-            if(keyLen == 0)
+            if(!snapshot->images.count(pageId) &&
+               std::binary_search(snapshot->pages.begin(), snapshot->pages.end(), pageId))
             {
-                size_t slotSize=valueLen > 0 && valueLen < MAX_VALUE_SIZE ? valueLen : 0;
-                size_t slotTotalSize=4 + slotSize;
-                if(slotTotalSize >= requiredSize)
-                {
-                    //reuse this deleted slot
-                    keyLen=key.size();
-                    valueLen=value.size();
-                    memcpy(page->data.data() + offset, &keyLen, 2);
-                    memcpy(page->data.data() + offset + 2, &valueLen, 2);
-                    memcpy(page->data.data() + offset + 4, key.c_str(), keyLen);
-                    memcpy(page->data.data() + offset + 4 + keyLen, value.c_str(), valueLen);
-                page->isDirty=true;
                 return true;
+            }
+        }
+        return false;
+    }
+
+    //caller holds cacheMutex; image is the page before the change about to be made
+    void StorageManager::preservePage(PageId pageId, const uint8_t* image)
+    {
+        std::shared_ptr<PageBuffer> copy;
+        for(const auto& snapshot : snapshots)
+        {
+            if(snapshot->images.count(pageId) ||
+               !std::binary_search(snapshot->pages.begin(), snapshot->pages.end(), pageId))
+            {
+                continue;
+            }
+            if(!copy)
+            {
+                copy=std::make_shared<PageBuffer>();
+                memcpy(copy->data(), image, PAGE_SIZE);
+            }
+            snapshot->images.emplace(pageId, copy);
+        }
+    }
+
+    //the snapshot lists the pages a scan would visit right now; pages of a
+    //bulk load in flight are not among them until it publishes
+    std::shared_ptr<const PageSnapshot> StorageManager::createSnapshot()
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        if(!dbOpen) return nullptr;
+        auto snapshot=std::make_shared<PageSnapshot>();
+        if(options.layout == StorageLayout::HASH)
+        {
+            for(size_t i=0; i<directory.size(); i++)
+            {
+                //a bucket of local depth d is first referenced from slot i < 2^d
+                if(i < (size_t(1) << directory[i].localDepth)) snapshot->pages.push_back(directory[i].bucket);
+            }
+        }
+        else
+        {
+            snapshot->pages.assign(allocatedPages.begin(), allocatedPages.end());
+        }
+        std::sort(snapshot->pages.begin(), snapshot->pages.end());
+        snapshots.push_back(snapshot);
+        return snapshot;
+    }
+
+    void StorageManager::releaseSnapshot(const std::shared_ptr<const PageSnapshot>& snapshot)
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        for(auto it=snapshots.begin(); it != snapshots.end(); ++it)
+        {
+            if(*it == snapshot)
+            {
+                snapshots.erase(it);
+                return;
+            }
+        }
+    }
+
+    size_t StorageManager::snapshotImages()
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        std::unordered_set<const PageBuffer*> distinct;
+        for(const auto& snapshot : snapshots)
+        {
+            for(const auto& entry : snapshot->images) distinct.insert(entry.second.get());
+        }
+        return distinct.size();
+    }
+
+    //copies pageId as snapshot sees it into data under cacheMutex, zeros if
+    //it cannot be fetched; false once the store is closed
+    bool StorageManager::copySnapshotPage(const PageSnapshot& snapshot, PageId pageId, uint8_t* data)
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        if(!dbOpen) return false;
+        auto image=snapshot.images.find(pageId);
+        if(image != snapshot.images.end())
+        {
+            memcpy(data, image->second->data(), PAGE_SIZE);
+            return true;
+        }
+        auto page=getPageUnlocked(pageId);
+        if(page) memcpy(data, page->data.data(), PAGE_SIZE);
+        else memset(data, 0, PAGE_SIZE);
+        return true;
+    }
+
+    //pages are copied out one at a time under cacheMutex and visited
+    //unlocked, so fn may take its time without stalling writers. a page
+    //changed since the snapshot was taken is read from its preserved image
+    bool StorageManager::forEachRecord(const PageSnapshot& snapshot,
+                                       const std::function<bool(std::string_view, std::string_view)>& fn)
+    {
+        PageBuffer copy;
+        for(PageId pageId : snapshot.pages)
+        {
+            if(!copySnapshotPage(snapshot, pageId, copy.data())) return false;
+            bool keepGoing=true;
+            forEachInPage(options.pageFormat, copy.data(), [&](std::string_view key, std::string_view value)
+            {
+                if(keepGoing) keepGoing=fn(key, value);
+            });
+            if(!keepGoing) return false;
+        }
+        return true;
+    }
+
+    //copies pageId as snapshot sees it into data. a page that is not
+    //resident is read from the file through fd after cacheMutex is dropped;
+    //a writer that changes it meanwhile preserves the old image in the
+    //snapshot first, so the image wins if one showed up by the recheck.
+    //false once the store is closed
+    bool StorageManager::readSnapshotPage(const PageSnapshot& snapshot, PageId pageId, int fd, uint8_t* data)
+    {
+        PageMapEntry entry{0, 0, 0, 0};
+        {
+            std::lock_guard<std::mutex> lock(cacheMutex);
+            if(!dbOpen) return false;
+            auto image=snapshot.images.find(pageId);
+            if(image != snapshot.images.end())
+            {
+                memcpy(data, image->second->data(), PAGE_SIZE);
+                return true;
+            }
+            auto page=bufferPool->find(pageId);
+            if(page)
+            {
+                cacheCounters.frameHits++;
+                memcpy(data, page->data.data(), PAGE_SIZE);
+                return true;
+            }
+            if(options.compression == PageCompression::LZ && pageId < pageMap.size()) entry=pageMap[pageId];
+        }
+        bool read=false;
+        size_t bytes=0;
+        {
+            ScopedLatency timer(LatencyOp::PAGE_READ);
+            if(options.compression == PageCompression::LZ)
+            {
+                uint8_t image[PAGE_SIZE];
+                if(entry.storedSize == 0)
+                {
+                    memset(data, 0, PAGE_SIZE);
+                    read=true;
                 }
-                if(slotSize > 0 && slotSize < MAX_VALUE_SIZE && offset + 4 + slotSize < PAGE_SIZE)
+                else if(::pread(fd, image, entry.storedSize, static_cast<off_t>(entry.offset)) == static_cast<ssize_t>(entry.storedSize))
                 {
-                    size_t newOffset=offset + 4 + slotSize;
-                    if(newOffset <= offset) break; //prevent infinite loop
-                    offset=newOffset;
-                    continue;
+                    bytes=entry.storedSize;
+                    if(entry.flags & PAGE_IMAGE_RAW)
+                    {
+                        memcpy(data, image, PAGE_SIZE);
+                        read=true;
+                    }
+                    else
+                    {
+                        read=lzDecompress(image, entry.storedSize, data, PAGE_SIZE);
+                    }
                 }
-                else
+            }
+            else
+            {
+                ssize_t got=::pread(fd, data, PAGE_SIZE, static_cast<off_t>(HEADER_SIZE + pageId * PAGE_SIZE));
+                if(got == static_cast<ssize_t>(PAGE_SIZE))
+                {
+                    bytes=PAGE_SIZE;
+                    read=true;
+                }
+                else if(got >= 0)
                 {
-                    size_t searchOffset=offset + 4;
-                    bool foundNext=false;
-                    while(searchOffset < PAGE_SIZE - 4)
+                    //past the end of the file: never written, reads as zeros
+                    memset(data, 0, PAGE_SIZE);
+                    read=true;
+                }
+            }
+        }
+        if(bytes > 0) Statistics::global().recordRead(IoFile::DATA, bytes);
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        if(!dbOpen) return false;
+        if(bytes > 0)
+        {
+            cacheCounters.diskReads++;
+            cacheCounters.bytesRead += bytes;
+        }
+        auto image=snapshot.images.find(pageId);
+        if(image != snapshot.images.end())
+        {
+            memcpy(data, image->second->data(), PAGE_SIZE);
+            return true;
+        }
+        if(read) return true;
+        //an extent reused under the read: go through the pool instead
+        auto page=getPageUnlocked(pageId);
+        if(page) memcpy(data, page->data.data(), PAGE_SIZE);
+        else memset(data, 0, PAGE_SIZE);
+        return true;
+    }
+
+    bool StorageManager::parallelScan(const std::function<bool(size_t, std::string_view, std::string_view)>& fn,
+                                      const ScanOptions& scan)
+    {
+        auto snapshot=createSnapshot();
+        if(!snapshot) return false;
+        {
+            std::lock_guard<std::mutex> lock(cacheMutex);
+            dbFile.flush();
+        }
+        int fd=::open(dbPath.c_str(), O_RDONLY | O_CLOEXEC);
+        if(fd < 0)
+        {
+            logError("failed to open " + dbPath + " for scanning");
+            releaseSnapshot(snapshot);
+            return false;
+        }
+        const std::vector<PageId>& pages=snapshot->pages;
+        std::atomic<bool> stopped(false);
+        std::atomic<bool> closed(false);
+        size_t caller=scanSinks() - 1;
+        if(!scan.ordered)
+        {
+            runRanges(pages.size(), [&](size_t begin, size_t end)
+            {
+                size_t sink=pool ? pool->currentWorker() : caller;
+                PageBuffer copy;
+                for(size_t i=begin; i<end && !stopped; i++)
+                {
+                    if(!readSnapshotPage(*snapshot, pages[i], fd, copy.data()))
                     {
-                        uint16_t testKeyLen;
-                        memcpy(&testKeyLen, page->data.data() + searchOffset, 2);
-                        if(testKeyLen > 0 && testKeyLen <= MAX_KEY_SIZE)
-                        {
-                            offset=searchOffset;
-                            foundNext=true;
-                            break;
-                        }
-                        searchOffset += 4;
-                        if(searchOffset > offset + 100) break;
+                        closed=true;
+                        stopped=true;
+                        return;
                     }
-                    if(!foundNext) break;
-                    continue;
+                    forEachInPage(options.pageFormat, copy.data(), [&](std::string_view key, std::string_view value)
+                    {
+                        if(!stopped && !fn(sink, key, value)) stopped=true;
+                    });
                 }
+            });
+        }
+        else
+        {
+            //a run: one range's page copies and its records sorted by key,
+            //page order among equal keys
+            struct Run
+            {
+                std::vector<uint8_t> pages;
+                std::vector<std::pair<std::string_view, std::string_view>> records;
+                size_t next=0;
+            };
+            std::vector<Run> runs((pages.size() + PAGE_TASK_PAGES - 1) / PAGE_TASK_PAGES);
+            runRanges(pages.size(), [&](size_t begin, size_t end)
+            {
+                Run& run=runs[begin / PAGE_TASK_PAGES];
+                run.pages.resize((end - begin) * PAGE_SIZE);
+                for(size_t i=begin; i<end && !closed; i++)
+                {
+                    uint8_t* data=&run.pages[(i - begin) * PAGE_SIZE];
+                    if(!readSnapshotPage(*snapshot, pages[i], fd, data))
+                    {
+                        closed=true;
+                        return;
+                    }
+                    forEachInPage(options.pageFormat, data, [&](std::string_view key, std::string_view value)
+                    {
+                        run.records.emplace_back(key, value);
+                    });
+                }
+                std::stable_sort(run.records.begin(), run.records.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+            });
+            //k-way merge on the calling thread; the earlier run wins ties
+            auto later=[&](size_t a, size_t b)
+            {
+                std::string_view keyA=runs[a].records[runs[a].next].first;
+                std::string_view keyB=runs[b].records[runs[b].next].first;
+                return keyA != keyB ? keyA > keyB : a > b;
+            };
+            std::vector<size_t> heap;
+            for(size_t i=0; i<runs.size() && !closed; i++)
+            {
+                if(!runs[i].records.empty()) heap.push_back(i);
             }
-            
-            //validate bounds
-            if(offset + 4 > PAGE_SIZE || 
-               offset + 4 + keyLen > PAGE_SIZE ||
-               offset + 4 + keyLen + valueLen > PAGE_SIZE)
+            std::make_heap(heap.begin(), heap.end(), later);
+            while(!heap.empty() && !stopped)
+            {
+                std::pop_heap(heap.begin(), heap.end(), later);
+                Run& run=runs[heap.back()];
+                const auto& record=run.records[run.next++];
+                if(!fn(caller, record.first, record.second)) stopped=true;
+                if(run.next < run.records.size()) std::push_heap(heap.begin(), heap.end(), later);
+                else heap.pop_back();
+            }
+        }
+        ::close(fd);
+        releaseSnapshot(snapshot);
+        return !stopped && !closed;
+    }
+
+    //caller holds cacheMutex (or is open())
+    bool StorageManager::initHashLayout()
+    {
+        globalDepth=0;
+        hashKeyCount=0;
+        PageId bucket=allocateNewPage();
+        PageId dirPage=allocateNewPage();
+        if(bucket == 0 || dirPage == 0)
+        {
+            logError("failed to allocate hash directory");
+            return false;
+        }
+        directory.assign(1, BucketRef{bucket, 0});
+        directoryPages.assign(1, dirPage);
+        hashMetaDirty=true;
+        markDirectory(0, directory.size());
+        return saveHashLayout();
+    }
+
+    //caller holds cacheMutex (or is open())
+    bool StorageManager::loadHashLayout()
+    {
+        auto meta=getPageUnlocked(0);
+        if(!meta) return false;
+        const uint8_t* data=meta->data.data();
+        uint32_t depth, pageCount;
+        memcpy(&depth, data + 4, 4);
+        memcpy(&hashKeyCount, data + 8, 8);
+        memcpy(&pageCount, data + 16, 4);
+        size_t entries=size_t(1) << std::min(depth, MAX_GLOBAL_DEPTH);
+        if(depth > MAX_GLOBAL_DEPTH || pageCount * 4 > PAGE_SIZE - HASH_META_HEADER ||
+           pageCount * DIR_ENTRIES_PER_PAGE < entries)
+        {
+            logError("corrupt hash directory meta page");
+            return false;
+        }
+        globalDepth=depth;
+        directoryPages.resize(pageCount);
+        memcpy(directoryPages.data(), data + HASH_META_HEADER, pageCount * 4);
+
+        directory.resize(entries);
+        for(size_t i=0; i<pageCount && i * DIR_ENTRIES_PER_PAGE < entries; i++)
+        {
+            auto page=getPageUnlocked(directoryPages[i]);
+            if(!page) return false;
+            size_t count=std::min(DIR_ENTRIES_PER_PAGE, entries - i * DIR_ENTRIES_PER_PAGE);
+            memcpy(&directory[i * DIR_ENTRIES_PER_PAGE], page->data.data(), count * DIR_ENTRY_SIZE);
+        }
+        for(const auto& ref : directory)
+        {
+            if(ref.bucket == 0 || ref.bucket >= nextPageId || ref.localDepth > globalDepth)
+            {
+                logError("corrupt hash directory entry");
+                return false;
+            }
+        }
+        return true;
+    }
+
+    //caller holds cacheMutex; directory entries [first, end) changed
+    void StorageManager::markDirectory(size_t first, size_t end)
+    {
+        if(first >= end) return;
+        for(size_t i=first / DIR_ENTRIES_PER_PAGE; i<=(end - 1) / DIR_ENTRIES_PER_PAGE; i++)
+        {
+            dirtyDirectoryPages.insert(i);
+        }
+    }
+
+    //caller holds cacheMutex; writes page 0 and the changed directory pages
+    //into the buffer pool, the following flush takes them to disk
+    bool StorageManager::saveHashLayout()
+    {
+        if(options.layout != StorageLayout::HASH) return true;
+        static_assert(sizeof(BucketRef) == DIR_ENTRY_SIZE, "directory entries are stored as-is");
+        for(size_t i : dirtyDirectoryPages)
+        {
+            auto page=getPageUnlocked(directoryPages[i]);
+            if(!page) return false;
+            page->data.clear();
+            size_t first=i * DIR_ENTRIES_PER_PAGE;
+            if(first < directory.size())
+            {
+                size_t count=std::min(DIR_ENTRIES_PER_PAGE, directory.size() - first);
+                memcpy(page->data.data(), &directory[first], count * DIR_ENTRY_SIZE);
+            }
+            page->isDirty=true;
+        }
+        dirtyDirectoryPages.clear();
+        if(!hashMetaDirty) return true;
+        auto meta=getPageUnlocked(0);
+        if(!meta) return false;
+        uint8_t* data=meta->data.data();
+        uint32_t pageCount=static_cast<uint32_t>(directoryPages.size());
+        uint32_t reserved=0;
+        meta->data.clear();
+        memcpy(data, &HASH_META_MAGIC, 4);
+        memcpy(data + 4, &globalDepth, 4);
+        memcpy(data + 8, &hashKeyCount, 8);
+        memcpy(data + 16, &pageCount, 4);
+        memcpy(data + 20, &reserved, 4);
+        memcpy(data + HASH_META_HEADER, directoryPages.data(), pageCount * 4);
+        meta->isDirty=true;
+        hashMetaDirty=false;
+        return true;
+    }
+
+    //caller holds cacheMutex; doubles the directory, each new slot aliasing
+    //the bucket of its lower twin, so no bucket is touched
+    bool StorageManager::growDirectory()
+    {
+        if(globalDepth >= MAX_GLOBAL_DEPTH) return false;
+        size_t size=directory.size();
+        size_t neededPages=(size * 2 + DIR_ENTRIES_PER_PAGE - 1) / DIR_ENTRIES_PER_PAGE;
+        while(directoryPages.size() < neededPages)
+        {
+            PageId pageId=allocateNewPage();
+            if(pageId == 0) return false;
+            directoryPages.push_back(pageId);
+        }
+        directory.resize(size * 2);
+        std::copy(directory.begin(), directory.begin() + size, directory.begin() + size);
+        globalDepth++;
+        hashMetaDirty=true;
+        markDirectory(size, size * 2);
+        return true;
+    }
+
+    //caller holds cacheMutex; rewrites a bucket with just the given records,
+    //which also drops the space of deleted ones
+    bool StorageManager::writeBucket(PageId bucket, const std::vector<Record>& records)
+    {
+        auto page=getPageUnlocked(bucket);
+        if(!page) return false;
+        preservePage(bucket, page->data.data());
+        page->data.clear();
+        page->isDirty=true;
+        bool modified;
+        for(const auto& record : records)
+        {
+            if(!putInPage(options.pageFormat, page->data.data(), record.key, record.value, hashKey(record.key), modified))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    //caller holds cacheMutex; false if the bucket had nothing to reclaim
+    bool StorageManager::compactBucket(PageId bucket)
+    {
+        std::vector<Record> records;
+        bool hasGaps=false;
+        {
+            auto page=getPageUnlocked(bucket);
+            if(!page) return false;
+            hasGaps=collectRecords(options.pageFormat, page->data.data(), records);
+        }
+        return hasGaps && writeBucket(bucket, records);
+    }
+
+    //caller holds cacheMutex; splits one bucket on the next hash bit, only its
+    //records move and only its directory slots change
+    bool StorageManager::splitBucket(size_t dirIndex)
+    {
+        BucketRef ref=directory[dirIndex];
+        if(ref.localDepth == globalDepth && !growDirectory()) return false;
+        PageId newBucket=allocateNewPage();
+        if(newBucket == 0) return false;
+
+        std::vector<Record> records;
+        {
+            auto page=getPageUnlocked(ref.bucket);
+            if(!page) return false;
+            collectRecords(options.pageFormat, page->data.data(), records);
+        }
+        uint64_t bit=uint64_t(1) << ref.localDepth;
+        std::vector<Record> low, high;
+        for(auto& record : records)
+        {
+            ((hashKey(record.key) & bit) ? high : low).push_back(std::move(record));
+        }
+        //one page handle at a time: with a tiny pool the second fetch may evict the first
+        if(!writeBucket(ref.bucket, low) || !writeBucket(newBucket, high)) return false;
+
+        for(size_t i=dirIndex & (bit - 1); i<directory.size(); i+=bit)
+        {
+            directory[i].localDepth=ref.localDepth + 1;
+            if(i & bit) directory[i].bucket=newBucket;
+            dirtyDirectoryPages.insert(i / DIR_ENTRIES_PER_PAGE);
+        }
+        return true;
+    }
+
+    bool StorageManager::hashPutRecord(const std::string& key, const std::string& value)
+    {
+        if(key.empty() || !fitsInEmptyPage(options.pageFormat, key.size(), value.size()))
+        {
+            return false;
+        }
+        uint64_t hash=hashKey(key);
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        if(directory.empty()) return false;
+
+        bool existed=false;
+        std::string previous;
+        if(keyFilter.mayContain(hash))
+        {
+            auto page=getPageUnlocked(directory[hash & (directory.size() - 1)].bucket);
+            std::string_view found;
+            existed=page && findInPage(options.pageFormat, page->data.data(), key, hash, found);
+            if(existed) previous.assign(found.data(), found.size());
+        }
+
+        bool compacted=false;
+        while(true)
+        {
+            size_t dirIndex=hash & (directory.size() - 1);
+            if(findFreeSpaceInPage(directory[dirIndex].bucket, key, value, hash)) break;
+            //reclaim deleted space once before growing the table
+            if(!compacted)
+            {
+                compacted=true;
+                if(compactBucket(directory[dirIndex].bucket)) continue;
+            }
+            if(!splitBucket(dirIndex))
             {
+                logError("hash bucket for key " + key + " cannot be split further");
+                //the failed attempt marked the committed version deleted; it
+                //fit before, so its freed space takes it back
+                if(existed && !findFreeSpaceInPage(directory[hash & (directory.size() - 1)].bucket, key, previous, hash))
+                {
+                    logError("lost the previous value of key " + key);
+                    hashKeyCount--;
+                    hashMetaDirty=true;
+                }
+                return false;
+            }
+        }
+        if(!existed)
+        {
+            hashKeyCount++;
+            hashMetaDirty=true;
+            noteKeyInserted(hash);
+        }
+        return true;
+    }
+
+    bool StorageManager::hashGetRecord(const std::string& key, std::string& value)
+    {
+        uint64_t hash=hashKey(key);
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        if(directory.empty() || !keyFilter.mayContain(hash)) return false;
+        auto page=getPageUnlocked(directory[hash & (directory.size() - 1)].bucket);
+        if(!page) return false;
+        std::string_view found;
+        if(!findInPage(options.pageFormat, page->data.data(), key, hash, found)) return false;
+        value.assign(found.data(), found.size());
+        return true;
+    }
+
+    bool StorageManager::hashDeleteRecord(const std::string& key)
+    {
+        uint64_t hash=hashKey(key);
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        if(directory.empty() || !keyFilter.mayContain(hash)) return false;
+        auto page=getPageUnlocked(directory[hash & (directory.size() - 1)].bucket);
+        if(!page) return false;
+        if(!eraseRecord(*page, key, hash)) return false;
+        hashKeyCount--;
+        hashMetaDirty=true;
+        noteKeyDeleted();
+        return true;
+    }
+
+    bool StorageManager::canBulkLoad() const
+    {
+        return dbOpen && options.layout == StorageLayout::HEAP && options.compression == PageCompression::NONE;
+    }
+
+    //caller holds cacheMutex; sets the header's pending-load word and syncs it
+    bool StorageManager::setPendingLoad(int fd, PageId start)
+    {
+        uint32_t word=start;
+        if(pwrite(fd, &word, sizeof(word), PENDING_LOAD_OFFSET) != static_cast<ssize_t>(sizeof(word)))
+        {
+            logError("failed to write bulk load marker: " + std::string(strerror(errno)));
+            return false;
+        }
+        Statistics::global().recordWrite(IoFile::DATA, sizeof(word));
+        ScopedSync sync(IoFile::DATA);
+        if(fdatasync(fd) != 0)
+        {
+            logError("failed to sync data file: " + std::string(strerror(errno)));
+            return false;
+        }
+        return true;
+    }
+
+    //input arrives sorted, so each page is filled to the brim before the next
+    //one starts and pages go out LOAD_WRITE_PAGES at a time in file order
+    //order of durability: marker, pages, BULK_LOAD record (the commit point),
+    //then the in-memory publish and the marker cleared
+    bool StorageManager::bulkLoad(KVIterator& input, WALManager& wal, BulkLoadStats& stats)
+    {
+        if(!canBulkLoad()) return false;
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        if(pendingLoadStart != 0)
+        {
+            logError("an earlier bulk load is still waiting for recovery");
+            return false;
+        }
+        //the raw writes below must not be overtaken by buffered ones
+        if(!flushAllUnlocked()) return false;
+        dbFile.flush();
+        int fd=::open(dbPath.c_str(), O_RDWR | O_CLOEXEC);
+        if(fd < 0)
+        {
+            logError("failed to open " + dbPath + " for bulk load");
+            return false;
+        }
+        struct stat before;
+        fstat(fd, &before);
+        const PageId first=nextPageId;
+        stats=BulkLoadStats();
+        stats.firstPage=first;
+        std::vector<std::pair<std::string, PageId>> keys;
+        std::vector<uint8_t> batch(LOAD_WRITE_PAGES * PAGE_SIZE, 0);
+        size_t current=0;              //page of batch being filled
+        bool currentUsed=false;
+        PageId batchStart=first;
+        std::string previous;
+        bool ok=setPendingLoad(fd, first);
+        auto writeBatch=[&](size_t pages)
+        {
+            size_t bytes=pages * PAGE_SIZE;
+            off_t offset=static_cast<off_t>(HEADER_SIZE + static_cast<uint64_t>(batchStart) * PAGE_SIZE);
+            size_t written=0;
+            while(written < bytes)
+            {
+                ssize_t n=pwrite(fd, batch.data() + written, bytes - written, offset + written);
+                if(n < 0 && errno == EINTR) continue;
+                if(n <= 0)
+                {
+                    logError("bulk load write failed: " + std::string(strerror(errno)));
+                    return false;
+                }
+                written += static_cast<size_t>(n);
+            }
+            Statistics::global().recordWrite(IoFile::DATA, bytes);
+            noteWritten(batchStart, batchStart + static_cast<PageId>(pages));
+            batchStart += static_cast<PageId>(pages);
+            std::fill(batch.begin(), batch.end(), 0);
+            return true;
+        };
+        for(; ok && input.valid(); input.next())
+        {
+            std::string_view key=input.key();
+            std::string_view value=input.value();
+            if(key.empty() || key.size() > MAX_KEY_SIZE || !fitsInEmptyPage(options.pageFormat, key.size(), value.size()))
+            {
+                logError("bulk load record does not fit in a page: " + std::string(key.substr(0, 64)));
+                ok=false;
                 break;
             }
-            
-            offset += 4 + keyLen + valueLen;
+            if(stats.records > 0 && key <= previous)
+            {
+                logError("bulk load input is not sorted at key " + std::string(key));
+                ok=false;
+                break;
+            }
+            previous.assign(key.data(), key.size());
+            uint64_t hash=hashKey(key);
+            bool modified=false;
+            if(!putInPage(options.pageFormat, batch.data() + current * PAGE_SIZE, key, value, hash, modified))
+            {
+                current++;
+                if(current == LOAD_WRITE_PAGES)
+                {
+                    ok=writeBatch(LOAD_WRITE_PAGES);
+                    current=0;
+                }
+                if(!ok || !putInPage(options.pageFormat, batch.data() + current * PAGE_SIZE, key, value, hash, modified))
+                {
+                    ok=false;
+                    break;
+                }
+            }
+            currentUsed=true;
+            keys.emplace_back(previous, batchStart + static_cast<PageId>(current));
+            stats.records++;
+            stats.bytes += key.size() + value.size();
         }
-        if(offset < PAGE_SIZE - RECORD_HEADER_SIZE && offset + requiredSize <= PAGE_SIZE)
+        if(ok && input.failed())
         {
-            if(offset + 4 <= PAGE_SIZE)
+            //a short stream must not be published as the whole load
+            logError("bulk load input ended early");
+            ok=false;
+        }
+        PageId end=batchStart + static_cast<PageId>(current) + (currentUsed ? 1 : 0);
+        if(ok && end > batchStart) ok=writeBatch(end - batchStart);
+        if(ok)
+        {
+            ScopedSync sync(IoFile::DATA);
+            ok=fdatasync(fd) == 0;
+            if(!ok) logError("failed to sync bulk loaded pages: " + std::string(strerror(errno)));
+        }
+        stats.pages=end - first;
+        if(ok)
+        {
+            uint32_t descriptor[2]={first, end};
+            ok=wal.logBulkLoad(std::string_view(reinterpret_cast<const char*>(descriptor), sizeof(descriptor)));
+        }
+        if(!ok)
+        {
+            //nothing refers to the new pages yet; cut them off again
+            if(ftruncate(fd, before.st_size) != 0) logError("failed to drop bulk loaded pages");
+            setPendingLoad(fd, 0);
+            ::close(fd);
+            return false;
+        }
+        ok=publishLoad(fd, first, end, keys);
+        ::close(fd);
+        if(ok) Statistics::global().recordLogicalWrite(stats.bytes);
+        return ok;
+    }
+
+    //caller holds cacheMutex; makes committed load pages [first, end) live.
+    //older versions of the loaded keys are erased and written back before
+    //the marker is cleared, so after that the file alone is consistent
+    bool StorageManager::publishLoad(int fd, PageId first, PageId end, std::vector<std::pair<std::string, PageId>>& keys)
+    {
+        for(auto& entry : keys)
+        {
+            auto it=keyToPage.find(entry.first);
+            if(it != keyToPage.end())
             {
-                uint16_t nextKeyLen, nextValueLen;
-                memcpy(&nextKeyLen, page->data.data() + offset, 2);
-                memcpy(&nextValueLen, page->data.data() + offset + 2, 2);
-                if(nextKeyLen == 0 && nextValueLen == 0)
+                if(it->second < first || it->second >= end)
                 {
-                    uint16_t keyLen=key.size();
-                    uint16_t valueLen=value.size();
-                    memcpy(page->data.data() + offset, &keyLen, 2);
-                    memcpy(page->data.data() + offset + 2, &valueLen, 2);
-                    memcpy(page->data.data() + offset + 4, key.c_str(), keyLen);
-                    memcpy(page->data.data() + offset + 4 + keyLen, value.c_str(), valueLen);
-                    page->isDirty=true;
-                    return true;
+                    auto page=getPageUnlocked(it->second);
+                    if(page) eraseRecord(*page, entry.first, hashKey(entry.first));
                 }
+                it->second=entry.second;
+            }
+            else
+            {
+                keyToPage.emplace(std::move(entry.first), entry.second);
             }
         }
-        
-        return false;
+        keys.clear();
+        for(PageId pageId=first; pageId<end; pageId++) allocatedPages.insert(pageId);
+        nextPageId=std::max(nextPageId, end);
+        //one rebuild sized for the new total beats growing it key by key
+        rebuildKeyFilter();
+        if(!flushAllUnlocked()) return false;
+        dbFile.flush();
+        {
+            ScopedSync sync(IoFile::DATA);
+            if(fdatasync(fd) != 0)
+            {
+                logError("failed to sync data file: " + std::string(strerror(errno)));
+                return false;
+            }
+        }
+        if(!setPendingLoad(fd, 0)) return false;
+        pendingLoadStart=0;
+        pendingLoadEnd=0;
+        log("bulk load published pages " + std::to_string(first) + "-" + std::to_string(end - 1));
+        return true;
     }
-    std::vector<Record> StorageManager::scanRecords()
+
+    bool StorageManager::redoBulkLoad(std::string_view descriptor)
     {
-        std::vector<Record> records;
+        uint32_t range[2];
+        if(descriptor.size() != sizeof(range))
+        {
+            logError("malformed bulk load record");
+            return false;
+        }
+        memcpy(range, descriptor.data(), sizeof(range));
         std::lock_guard<std::mutex> lock(cacheMutex);
-        
-        for(PageId pageId : allocatedPages)
+        //a load published before the crash is already part of the file
+        if(pendingLoadStart == 0 || range[0] != pendingLoadStart) return true;
+        if(range[1] > pendingLoadEnd)
         {
-            auto page=getPageUnlocked(pageId);
-            if(!page) continue;
-            
-        size_t offset=0;
-            while(offset < PAGE_SIZE - RECORD_HEADER_SIZE)
+            logError("bulk loaded pages " + std::to_string(pendingLoadEnd) + "-" + std::to_string(range[1] - 1) + " are missing");
+            return false;
+        }
+        int fd=::open(dbPath.c_str(), O_RDWR | O_CLOEXEC);
+        if(fd < 0)
+        {
+            logError("failed to open " + dbPath + " for bulk load redo");
+            return false;
+        }
+        std::vector<std::pair<std::string, PageId>> keys;
+        PageBuffer buffer;
+        bool ok=true;
+        for(PageId pageId=range[0]; ok && pageId<range[1]; pageId++)
+        {
+            ok=readPageFromDisk(pageId, buffer.data());
+            forEachInPage(options.pageFormat, buffer.data(), [&](std::string_view key, std::string_view)
+            {
+                keys.emplace_back(std::string(key), pageId);
+            });
+        }
+        //pages past the load were allocated after it and are live already
+        for(PageId pageId=range[1]; ok && pageId<pendingLoadEnd; pageId++) allocatedPages.insert(pageId);
+        if(ok) ok=publishLoad(fd, range[0], range[1], keys);
+        else logError("failed to read bulk loaded pages");
+        ::close(fd);
+        return ok;
+    }
+
+    bool StorageManager::discardPendingLoad()
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        if(pendingLoadStart == 0) return true;
+        int fd=::open(dbPath.c_str(), O_RDWR | O_CLOEXEC);
+        if(fd < 0)
+        {
+            logError("failed to open " + dbPath + " to drop a bulk load");
+            return false;
+        }
+        log("dropping uncommitted bulk load of pages " + std::to_string(pendingLoadStart) + "-" +
+            std::to_string(pendingLoadEnd - 1));
+        bool ok=true;
+        noteWritten(pendingLoadStart, pendingLoadEnd);
+        if(nextPageId == pendingLoadEnd)
+        {
+            ok=ftruncate(fd, static_cast<off_t>(HEADER_SIZE + static_cast<uint64_t>(pendingLoadStart) * PAGE_SIZE)) == 0;
+            nextPageId=pendingLoadStart;
+        }
+        else
+        {
+            //redo allocated pages after the load; keep the range as zeroed free pages
+            std::vector<uint8_t> zeros(PAGE_SIZE, 0);
+            for(PageId pageId=pendingLoadStart; ok && pageId<pendingLoadEnd; pageId++)
+            {
+                ok=pwrite(fd, zeros.data(), PAGE_SIZE, static_cast<off_t>(HEADER_SIZE + static_cast<uint64_t>(pageId) * PAGE_SIZE)) == PAGE_SIZE;
+                freePages.push_back(pageId);
+            }
+        }
+        ok=ok && fdatasync(fd) == 0 && setPendingLoad(fd, 0);
+        if(!ok) logError("failed to drop uncommitted bulk load");
+        pendingLoadStart=0;
+        pendingLoadEnd=0;
+        ::close(fd);
+        return ok;
+    }
+
+    //caller holds cacheMutex; copies the pages in [first, end) that the
+    //backup has not taken yet, one copyFileBytes per run of them
+    void StorageManager::copyForBackup(PageId first, PageId end)
+    {
+        BackupCopy& copy=*activeBackup;
+        PageId pageId=first;
+        while(pageId < end && !copy.failed)
+        {
+            if(copy.copied[pageId])
+            {
+                pageId++;
+                continue;
+            }
+            PageId runEnd=pageId;
+            while(runEnd < end && !copy.copied[runEnd]) copy.copied[runEnd++]=true;
+            uint64_t offset=HEADER_SIZE + static_cast<uint64_t>(pageId) * PAGE_SIZE;
+            uint64_t bytes=static_cast<uint64_t>(runEnd - pageId) * PAGE_SIZE;
+            if(!copyFileBytes(copy.srcFd, offset, copy.dstFd, offset, bytes))
+            {
+                logError("hot backup failed to copy pages: " + std::string(strerror(errno)));
+                copy.failed=true;
+            }
+            Statistics::global().recordRead(IoFile::DATA, bytes);
+            pageId=runEnd;
+        }
+    }
+
+    //the image is the file at the moment the backup starts: a sweep copies
+    //it BACKUP_CHUNK_PAGES at a time, and writePageToDisk copies a page the
+    //sweep has not reached before overwriting it. pages appended later are
+    //not part of it. bulk loads write past the end and open-time recovery
+    //does not run concurrently, so every in-place write goes through
+    //writePageToDisk. an incremental image starts with the unchanged pages
+    //marked as copied, so neither the sweep nor a write-back touches them
+    bool StorageManager::backupData(const std::string& destPath, const BackupOptions& backup, BackupStats& stats)
+    {
+        if(!dbOpen) return false;
+        if(options.compression == PageCompression::LZ)
+        {
+            logError("hot backup does not support compressed data files");
+            return false;
+        }
+        int srcFd=::open(dbPath.c_str(), O_RDONLY | O_CLOEXEC);
+        int dstFd=::open(destPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if(srcFd < 0 || dstFd < 0)
+        {
+            logError("hot backup cannot open " + std::string(srcFd < 0 ? dbPath : destPath));
+            if(srcFd >= 0) ::close(srcFd);
+            if(dstFd >= 0) ::close(dstFd);
+            return false;
+        }
+        stats=BackupStats();
+        std::vector<std::pair<PageId, PageId>> runs;
+        PageId pages=0;
+        bool ok=true;
+        //what the change map said before this backup, put back if it fails
+        std::vector<bool> previousChanges;
+        uint64_t previousBase=0;
+        {
+            std::lock_guard<std::mutex> lock(cacheMutex);
+            if(activeBackup)
+            {
+                logError("a hot backup is already running");
+                ok=false;
+            }
+            else if(backup.incremental && (changeBase == 0 || changeBase != backup.base))
+            {
+                logError("incremental backup needs the pages changed since backup " + std::to_string(backup.base) +
+                         ", which this database does not track; take a full backup");
+                ok=false;
+            }
+            struct stat st;
+            if(ok && fstat(srcFd, &st) != 0) ok=false;
+            if(ok)
+            {
+                if(static_cast<uint64_t>(st.st_size) > HEADER_SIZE) pages=static_cast<PageId>((st.st_size - HEADER_SIZE) / PAGE_SIZE);
+                ok=copyFileBytes(srcFd, 0, dstFd, 0, HEADER_SIZE);
+            }
+            if(ok)
             {
-            uint16_t keyLen, valueLen;
-            memcpy(&keyLen, page->data.data() + offset, 2);
-            memcpy(&valueLen, page->data.data() + offset + 2, 2);
-                if(keyLen == 0)
+                activeBackup=std::make_unique<BackupCopy>();
+                activeBackup->srcFd=srcFd;
+                activeBackup->dstFd=dstFd;
+                activeBackup->pages=pages;
+                activeBackup->copied.assign(pages, false);
+                if(backup.incremental)
                 {
-                    if(valueLen > 0 && valueLen < MAX_VALUE_SIZE && offset + 4 + valueLen < PAGE_SIZE)
+                    for(PageId pageId=0; pageId<pages; pageId++)
                     {
-                        offset += 4 + valueLen;
-                        continue;
+                        bool changed=pageId >= changedPages.size() || changedPages[pageId];
+                        activeBackup->copied[pageId]=!changed;
+                        if(!changed) continue;
+                        if(!runs.empty() && runs.back().second == pageId) runs.back().second++;
+                        else runs.emplace_back(pageId, pageId + 1);
                     }
-                    size_t searchOffset=offset + 4;
-                    bool foundNext=false;
-                    while(searchOffset < PAGE_SIZE - RECORD_HEADER_SIZE)
-                    {
-                        if(searchOffset + 4 > PAGE_SIZE) break;
-                        
-                        uint16_t testKeyLen, testValueLen;
-                        memcpy(&testKeyLen, page->data.data() + searchOffset, 2);
-                        memcpy(&testValueLen, page->data.data() + searchOffset + 2, 2);
-                        if(testKeyLen > 0 && testKeyLen <= MAX_KEY_SIZE && 
-                           testValueLen > 0 && testValueLen <= MAX_VALUE_SIZE &&
-                           searchOffset + 4 + testKeyLen + testValueLen <= PAGE_SIZE)
-                        {
-                            offset=searchOffset;
-                            foundNext=true;
-                            break;
-                        }
-                        if(testKeyLen == 0 && testValueLen > 0 && testValueLen < MAX_VALUE_SIZE && 
-                           searchOffset + 4 + testValueLen < PAGE_SIZE)
-                        {
-                            searchOffset += 4 + testValueLen;
-                            continue;
-                        }
-                        searchOffset += 4;
-                    }
-                    if(!foundNext) break;
-                    continue;
                 }
-                if(keyLen > MAX_KEY_SIZE || valueLen > MAX_VALUE_SIZE)
+                else
                 {
-                    break;
+                    if(pages > 0) runs.emplace_back(0, pages);
                 }
-                if(offset + 4 > PAGE_SIZE || 
-                   offset + 4 + keyLen > PAGE_SIZE ||
-                   offset + 4 + keyLen + valueLen > PAGE_SIZE)
+                //from here on the map counts the writes since this backup
+                previousChanges.swap(changedPages);
+                previousBase=changeBase;
+                changedPages.assign(pages, false);
+                changeBase=backup.id;
+            }
+        }
+        for(const auto& run : runs)
+        {
+            for(PageId chunk=run.first; ok && chunk<run.second; chunk += BACKUP_CHUNK_PAGES)
+            {
+                std::lock_guard<std::mutex> lock(cacheMutex);
+                copyForBackup(chunk, std::min<PageId>(run.second, chunk + BACKUP_CHUNK_PAGES));
+                ok=!activeBackup->failed;
+            }
+        }
+        {
+            std::lock_guard<std::mutex> lock(cacheMutex);
+            if(activeBackup && activeBackup->srcFd == srcFd)
+            {
+                ok=ok && !activeBackup->failed;
+                stats.preserved=activeBackup->preserved;
+                activeBackup.reset();
+                if(!ok)
                 {
-                    break;
+                    //nothing can name a failed backup as its base: keep the old
+                    //base and every page written since it
+                    previousChanges.resize(std::min(previousChanges.size(), changedPages.size()));
+                    for(size_t pageId=0; pageId<previousChanges.size(); pageId++)
+                    {
+                        if(changedPages[pageId]) previousChanges[pageId]=true;
+                    }
+                    changedPages.swap(previousChanges);
+                    changeBase=previousBase;
                 }
-            std::string key(reinterpret_cast<const char*>(page->data.data() + offset + 4), keyLen);
-            std::string value(reinterpret_cast<const char*>(page->data.data() + offset + 4 + keyLen), valueLen);
-            records.emplace_back(key, value);
-                
-            offset += 4 + keyLen + valueLen;
             }
         }
-        
-        return records;
+        stats.pages=pages;
+        stats.extents.emplace_back(0, HEADER_SIZE);
+        for(const auto& run : runs)
+        {
+            stats.extents.emplace_back(HEADER_SIZE + static_cast<uint64_t>(run.first) * PAGE_SIZE,
+                                       static_cast<uint64_t>(run.second - run.first) * PAGE_SIZE);
+        }
+        for(const auto& extent : stats.extents) stats.bytes += extent.second;
+        //an incremental image is sparse: unchanged pages stay holes
+        if(ok && ftruncate(dstFd, static_cast<off_t>(HEADER_SIZE + static_cast<uint64_t>(pages) * PAGE_SIZE)) != 0) ok=false;
+        if(ok && fdatasync(dstFd) != 0)
+        {
+            logError("failed to sync backup " + destPath + ": " + std::string(strerror(errno)));
+            ok=false;
+        }
+        ::close(srcFd);
+        ::close(dstFd);
+        return ok;
     }
 }
@@ -0,0 +1,158 @@
+#include"threadpool.hpp"
+
+namespace stonedb
+{
+    //the pool and deque a worker thread serves, so its submissions stay local
+    static thread_local ThreadPool* currentPool=nullptr;
+    static thread_local size_t currentQueue=0;
+
+    ThreadPool::ThreadPool(size_t workerCount)
+        : queued(0), nextQueue(0), stopping(false)
+    {
+        if(workerCount == 0) workerCount=std::max(1U, std::thread::hardware_concurrency());
+        for(size_t i=0; i<workerCount; i++) queues.push_back(std::make_unique<WorkQueue>());
+        for(size_t i=0; i<workerCount; i++) workers.emplace_back(&ThreadPool::workerLoop, this, i);
+    }
+
+    ThreadPool::~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            stopping=true;
+        }
+        sleepCv.notify_all();
+        for(auto& worker : workers) worker.join();
+    }
+
+    ThreadPool& ThreadPool::shared()
+    {
+        static ThreadPool pool;
+        return pool;
+    }
+
+    size_t ThreadPool::currentWorker() const
+    {
+        return currentPool == this ? currentQueue : workers.size();
+    }
+
+    void ThreadPool::submit(std::function<void()> task)
+    {
+        size_t index=currentPool == this ? currentQueue : nextQueue.fetch_add(1) % queues.size();
+        {
+            std::lock_guard<std::mutex> lock(queues[index]->mutex);
+            queues[index]->tasks.push_back(std::move(task));
+        }
+        queued++;
+        //taking the lock orders the count against a worker about to sleep
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+        }
+        sleepCv.notify_one();
+    }
+
+    //newest from the home deque, else the oldest from the first other
+    //deque that has one
+    bool ThreadPool::takeTask(size_t home, std::function<void()>& task)
+    {
+        if(queued.load() == 0) return false;
+        {
+            WorkQueue& own=*queues[home];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if(!own.tasks.empty())
+            {
+                task=std::move(own.tasks.back());
+                own.tasks.pop_back();
+                queued--;
+                return true;
+            }
+        }
+        for(size_t i=1; i<queues.size(); i++)
+        {
+            WorkQueue& victim=*queues[(home + i) % queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if(!victim.tasks.empty())
+            {
+                task=std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+                queued--;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void ThreadPool::workerLoop(size_t index)
+    {
+        currentPool=this;
+        currentQueue=index;
+        std::function<void()> task;
+        while(true)
+        {
+            if(takeTask(index, task))
+            {
+                task();
+                task=nullptr;
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            sleepCv.wait(lock, [&] { return stopping || queued.load() > 0; });
+            if(stopping && queued.load() == 0) return;
+        }
+    }
+
+    void ThreadPool::parallelFor(size_t count, size_t grain, const std::function<void(size_t, size_t)>& fn)
+    {
+        if(count == 0) return;
+        if(grain == 0) grain=1;
+        if(count <= grain)
+        {
+            fn(0, count);
+            return;
+        }
+        TaskGroup group(*this);
+        for(size_t begin=grain; begin<count; begin+=grain)
+        {
+            size_t end=std::min(count, begin + grain);
+            group.run([&fn, begin, end] { fn(begin, end); });
+        }
+        //the first range runs here instead of waiting in a deque
+        fn(0, grain);
+        group.wait();
+    }
+
+    //runs the group's next queued task, if the caller or another stub has
+    //not taken it already
+    bool TaskGroup::runNext(State& state)
+    {
+        std::function<void()> task;
+        {
+            std::lock_guard<std::mutex> lock(state.mutex);
+            if(state.tasks.empty()) return false;
+            task=std::move(state.tasks.front());
+            state.tasks.pop_front();
+        }
+        task();
+        std::lock_guard<std::mutex> lock(state.mutex);
+        if(--state.pending == 0) state.doneCv.notify_all();
+        return true;
+    }
+
+    void TaskGroup::run(std::function<void()> task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            state->tasks.push_back(std::move(task));
+            state->pending++;
+        }
+        //the stub keeps the state alive past the group
+        pool.submit([shared=state] { runNext(*shared); });
+    }
+
+    void TaskGroup::wait()
+    {
+        while(runNext(*state)) {}
+        //whatever is left is running on other threads
+        std::unique_lock<std::mutex> lock(state->mutex);
+        state->doneCv.wait(lock, [&] { return state->pending == 0; });
+    }
+}
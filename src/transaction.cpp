@@ -1,8 +1,9 @@
 #include"transaction.hpp"
+#include"statistics.hpp"
 
 namespace stonedb
 {
-    TransactionManager::TransactionManager(std::shared_ptr<StorageManager> storage,
+    TransactionManager::TransactionManager(std::shared_ptr<StorageEngine> storage,
                                          std::shared_ptr<WALManager> wal,
                                          std::shared_ptr<LockManager> lockMgr)
         : storage(storage), wal(wal), lockMgr(lockMgr), nextTxnId(1)
@@ -22,51 +23,63 @@ namespace stonedb
         }
         
         activeTxns.emplace(txnId, Transaction(txnId));
+        Statistics::global().incrementTransactions();
         if(!wal->logBeginTxn(txnId))
         {
             logError("failed to log transaction begin");
             return INVALID_TXN_ID;
         }
         
-        log("started transaction " + std::to_string(txnId));
+        STONEDB_DEBUG("started transaction " + std::to_string(txnId));
         return txnId;
     }
     
     bool TransactionManager::commitTransaction(TransactionId txnId)
     {
-        std::lock_guard<std::mutex> lock(txnMutex);
-        
-        auto it=activeTxns.find(txnId);
-        if(it == activeTxns.end())
+        ScopedLatency timer(LatencyOp::COMMIT);
         {
-            logError("transaction " + std::to_string(txnId) + " not found");
-            return false;
+            std::lock_guard<std::mutex> lock(txnMutex);
+            
+            auto it=activeTxns.find(txnId);
+            if(it == activeTxns.end())
+            {
+                logError("transaction " + std::to_string(txnId) + " not found");
+                return false;
+            }
+            
+            Transaction& txn=it->second;
+            if(txn.state != TransactionState::ACTIVE)
+            {
+                logError("transaction " + std::to_string(txnId) + " not active");
+                return false;
+            }
+            txn.state=TransactionState::COMMITTING;
         }
         
-        Transaction& txn=it->second;
-        if(txn.state != TransactionState::ACTIVE)
+        //the durable part runs without txnMutex, so concurrent committers
+        //share the log's syncs; the txn's record locks keep them apart
+        bool ok=wal->logCommitTxn(txnId);
+        if(!ok)
         {
-            logError("transaction " + std::to_string(txnId) + " not active");
-            return false;
+            logError("failed to log transaction commit");
         }
-        
-
-        if(!wal->logCommitTxn(txnId))
+        else if(!storage->flushAll())
         {
-            logError("failed to log transaction commit");
-            return false;
+            logError("failed to flush storage");
+            ok=false;
         }
         
-        
-        if(!storage->flushAll())
+        std::lock_guard<std::mutex> lock(txnMutex);
+        auto it=activeTxns.find(txnId);
+        if(!ok)
         {
-            logError("failed to flush storage");
+            //still active: the caller may retry or abort
+            if(it != activeTxns.end()) it->second.state=TransactionState::ACTIVE;
             return false;
         }
         releaseLocks(txnId);
-        txn.state=TransactionState::COMMITTED;
-        activeTxns.erase(it);
-        log("committed transaction " + std::to_string(txnId));
+        if(it != activeTxns.end()) activeTxns.erase(it);
+        STONEDB_DEBUG("committed transaction " + std::to_string(txnId));
         return true;
     }
     bool TransactionManager::abortTransaction(TransactionId txnId)
@@ -94,11 +107,13 @@ namespace stonedb
         txn.state=TransactionState::ABORTED;
         activeTxns.erase(it);
         
-        log("aborted transaction " + std::to_string(txnId));
+        STONEDB_DEBUG("aborted transaction " + std::to_string(txnId));
         return true;
     }
     bool TransactionManager::putRecord(TransactionId txnId, const std::string& key, const std::string& value)
     {
+        ScopedLatency timer(LatencyOp::PUT);
+        Statistics::global().incrementPutOps();
         {
             std::lock_guard<std::mutex> lock(txnMutex);
             
@@ -130,6 +145,7 @@ namespace stonedb
             logError("failed to put record");
             return false;
         }
+        Statistics::global().recordLogicalWrite(key.size() + value.size());
         {
             std::lock_guard<std::mutex> lock(txnMutex);
             auto it=activeTxns.find(txnId);
@@ -137,11 +153,13 @@ namespace stonedb
                 it->second.writeSet.insert(key);
             }
         }
-        log("txn " + std::to_string(txnId) + " put " + key + " = " + value);
+        STONEDB_TRACE("txn " + std::to_string(txnId) + " put " + key + " = " + value);
         return true;
     }
     bool TransactionManager::getRecord(TransactionId txnId, const std::string& key, std::string& value)
     {
+        ScopedLatency timer(LatencyOp::GET);
+        Statistics::global().incrementGetOps();
         {
             std::lock_guard<std::mutex> lock(txnMutex);
             
@@ -175,11 +193,11 @@ namespace stonedb
                     it->second.readSet.insert(key);
                 }
             }
-            log("txn " + std::to_string(txnId) + " get " + key + " = " + value);
+            STONEDB_TRACE("txn " + std::to_string(txnId) + " get " + key + " = " + value);
         }
         else
         {
-            log("txn " + std::to_string(txnId) + " get " + key + " (not found)");
+            STONEDB_TRACE("txn " + std::to_string(txnId) + " get " + key + " (not found)");
         }
         
         return found;
@@ -187,6 +205,8 @@ namespace stonedb
     
     bool TransactionManager::deleteRecord(TransactionId txnId, const std::string& key)
     {
+        ScopedLatency timer(LatencyOp::DELETE);
+        Statistics::global().incrementDeleteOps();
         {
             std::lock_guard<std::mutex> lock(txnMutex);
             
@@ -233,8 +253,9 @@ namespace stonedb
                 releaseLocks(txnId);
                 return false;
             }
+            Statistics::global().recordLogicalWrite(key.size());
             it->second.writeSet.insert(key);
-            log("txn " + std::to_string(txnId) + " delete " + key);
+            STONEDB_TRACE("txn " + std::to_string(txnId) + " delete " + key);
             return true;
         }
     }
@@ -1,11 +1,349 @@
 #include "wal.hpp"
-#include "storage.hpp"
+#include "engine.hpp"
+#include "statistics.hpp"
+#include<algorithm>
 #include<chrono>
+#include<cstdio>
+#include<deque>
 #include<cstring>
+#include<cerrno>
+#include<filesystem>
+#include<fcntl.h>
+#include<unistd.h>
+#include<sys/uio.h>
 
 namespace stonedb
 {
-    WALManager::WALManager() : walOpen(false) {}
+    static constexpr uint64_t WAL_MAGIC=0x32304c4157424453ULL;   //"SDBWAL02"
+    static constexpr uint32_t WAL_VERSION=2;
+    static constexpr size_t FRAME_HEADER_SIZE=8;
+    //five varints of at most 10 bytes plus the key and value
+    static constexpr size_t MAX_PAYLOAD_SIZE=50 + MAX_KEY_SIZE + MAX_VALUE_SIZE;
+    //how long published records may sit in the ring before the writer picks them up
+    static constexpr auto WRITER_INTERVAL=std::chrono::milliseconds(5);
+    //in-order publish spins this long on a predecessor before yielding
+    static constexpr int PUBLISH_SPINS=64;
+
+    //writes v at p, returns the end of the varint
+    static uint8_t* putVarint(uint8_t* p, uint64_t v)
+    {
+        while(v >= 0x80)
+        {
+            *p++=static_cast<uint8_t>(v) | 0x80;
+            v >>= 7;
+        }
+        *p++=static_cast<uint8_t>(v);
+        return p;
+    }
+
+    static bool getVarint(const uint8_t*& p, const uint8_t* end, uint64_t& v)
+    {
+        v=0;
+        for(int shift=0; shift<64 && p<end; shift+=7)
+        {
+            uint8_t b=*p++;
+            v |= static_cast<uint64_t>(b & 0x7f) << shift;
+            if(!(b & 0x80)) return true;
+        }
+        return false;
+    }
+
+    static uint32_t frameChecksum(uint32_t payloadLen, const uint8_t* payload)
+    {
+        return crc32c(payload, payloadLen, crc32c(&payloadLen, sizeof(payloadLen)));
+    }
+
+    //writes every iovec, resuming after short writes
+    static bool writeAll(int fd, iovec* parts, int count)
+    {
+        while(count > 0)
+        {
+            ssize_t written=::writev(fd, parts, count);
+            if(written < 0)
+            {
+                if(errno == EINTR) continue;
+                return false;
+            }
+            Statistics::global().recordWrite(IoFile::WAL, static_cast<uint64_t>(written));
+            size_t left=static_cast<size_t>(written);
+            while(count > 0 && left >= parts->iov_len)
+            {
+                left -= parts->iov_len;
+                parts++;
+                count--;
+            }
+            if(count > 0)
+            {
+                parts->iov_base=static_cast<uint8_t*>(parts->iov_base) + left;
+                parts->iov_len -= left;
+            }
+        }
+        return true;
+    }
+
+    static uint64_t nowMillis()
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    static_assert((4 << 20) >= FRAME_HEADER_SIZE + MAX_PAYLOAD_SIZE, "the log ring must hold the largest record");
+
+    //decodes a payload whose checksum matched; without withData the key and
+    //value are only bounds-checked, not copied
+    static bool decodePayload(const uint8_t* payload, size_t size, LogEntry& entry, bool withData)
+    {
+        const uint8_t* p=payload;
+        const uint8_t* end=payload + size;
+        uint64_t type, txnId;
+        if(!getVarint(p, end, type) || !getVarint(p, end, txnId)) return false;
+        if(type > static_cast<uint64_t>(LogType::PREPARE_TXN)) return false;
+        entry.type=static_cast<LogType>(type);
+        entry.txnId=txnId;
+        entry.timestamp=0;
+        entry.key.clear();
+        entry.value.clear();
+        if(entry.type == LogType::COMMIT_TXN)
+        {
+            if(!getVarint(p, end, entry.timestamp)) return false;
+        }
+        else if(entry.type == LogType::PUT_RECORD || entry.type == LogType::DELETE_RECORD)
+        {
+            uint64_t keyLen;
+            if(!getVarint(p, end, keyLen) || keyLen > MAX_KEY_SIZE || keyLen > static_cast<uint64_t>(end - p)) return false;
+            if(withData) entry.key.assign(reinterpret_cast<const char*>(p), keyLen);
+            p += keyLen;
+            if(entry.type == LogType::PUT_RECORD)
+            {
+                uint64_t valueLen;
+                if(!getVarint(p, end, valueLen) || valueLen > MAX_VALUE_SIZE || valueLen > static_cast<uint64_t>(end - p))
+                {
+                    return false;
+                }
+                if(withData) entry.value.assign(reinterpret_cast<const char*>(p), valueLen);
+                p += valueLen;
+            }
+        }
+        else if(entry.type == LogType::BULK_LOAD)
+        {
+            uint64_t valueLen;
+            if(!getVarint(p, end, valueLen) || valueLen > static_cast<uint64_t>(end - p)) return false;
+            if(withData) entry.value.assign(reinterpret_cast<const char*>(p), valueLen);
+            p += valueLen;
+        }
+        else if(entry.type == LogType::PREPARE_TXN)
+        {
+            //the coordinator reference is short and always decoded
+            uint64_t valueLen;
+            if(!getVarint(p, end, valueLen) || valueLen > static_cast<uint64_t>(end - p)) return false;
+            entry.value.assign(reinterpret_cast<const char*>(p), valueLen);
+            p += valueLen;
+        }
+        return p == end;
+    }
+
+    //LogReader: sequential scan of the records after the header through one
+    //large read buffer that always holds at least a whole record; entries are
+    //decoded into the caller's LogEntry so its strings are reused
+    class LogReader
+    {
+    private:
+        int fd;
+        std::unique_ptr<uint8_t[]> buffer;
+        size_t begin;
+        size_t end;
+        bool eof;
+        Lsn lsn;
+
+        static constexpr size_t READ_BUFFER_SIZE=4 << 20;
+
+        //makes sure need bytes are buffered; false at end of file
+        bool fill(size_t need)
+        {
+            if(end - begin >= need) return true;
+            if(begin > 0)
+            {
+                memmove(buffer.get(), buffer.get() + begin, end - begin);
+                end -= begin;
+                begin=0;
+            }
+            while(end < need && !eof)
+            {
+                ssize_t got=::read(fd, buffer.get() + end, READ_BUFFER_SIZE - end);
+                if(got < 0 && errno == EINTR) continue;
+                if(got <= 0) eof=true;
+                else end += static_cast<size_t>(got);
+                if(got >= 0) Statistics::global().recordRead(IoFile::WAL, static_cast<uint64_t>(got));
+            }
+            return end >= need;
+        }
+    public:
+        static_assert(READ_BUFFER_SIZE >= FRAME_HEADER_SIZE + MAX_PAYLOAD_SIZE, "a record must fit the read buffer");
+
+        LogReader(const std::string& path, size_t headerSize, Lsn base)
+            : fd(::open(path.c_str(), O_RDONLY | O_CLOEXEC)), begin(0), end(0), eof(false), lsn(base)
+        {
+            if(fd < 0) return;
+            buffer.reset(new uint8_t[READ_BUFFER_SIZE]);
+            posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+            if(lseek(fd, static_cast<off_t>(headerSize), SEEK_SET) < 0) eof=true;
+        }
+        ~LogReader()
+        {
+            if(fd >= 0) ::close(fd);
+        }
+        bool isOpen() const { return fd >= 0; }
+        //LSN of the next record, the end of the intact log once next() failed
+        Lsn position() const { return lsn; }
+        //false at the end of the log or at the first record that is short,
+        //fails its checksum (when verify) or does not decode
+        bool next(LogEntry& entry, bool withData, bool verify)
+        {
+            if(!fill(FRAME_HEADER_SIZE)) return false;
+            uint32_t frame[2];
+            memcpy(frame, buffer.get() + begin, sizeof(frame));
+            uint32_t payloadLen=frame[1];
+            if(payloadLen == 0 || payloadLen > MAX_PAYLOAD_SIZE) return false;
+            if(!fill(FRAME_HEADER_SIZE + payloadLen)) return false;
+            const uint8_t* payload=buffer.get() + begin + FRAME_HEADER_SIZE;
+            if(verify && frame[0] != frameChecksum(payloadLen, payload)) return false;
+            if(!decodePayload(payload, payloadLen, entry, withData)) return false;
+            entry.lsn=lsn;
+            begin += FRAME_HEADER_SIZE + payloadLen;
+            lsn += FRAME_HEADER_SIZE + payloadLen;
+            return true;
+        }
+    };
+
+    //ChainReader: LogReader over consecutive log files; it moves on to the
+    //next file only where that one starts at the LSN the current one ends
+    class ChainReader
+    {
+    private:
+        const std::vector<LogSegment>& segments;
+        size_t headerSize;
+        size_t current;
+        std::unique_ptr<LogReader> reader;
+        bool failed;
+    public:
+        ChainReader(const std::vector<LogSegment>& segs, size_t header)
+            : segments(segs), headerSize(header), current(0), failed(false)
+        {
+            if(segments.empty()) return;
+            reader=std::make_unique<LogReader>(segments[0].path, headerSize, segments[0].base);
+            failed=!reader->isOpen();
+        }
+        bool isOpen() const { return !failed; }
+        const std::string& path() const { return segments[current].path; }
+        Lsn position() const { return reader ? reader->position() : 0; }
+        bool next(LogEntry& entry, bool withData, bool verify)
+        {
+            while(reader && !failed)
+            {
+                if(reader->next(entry, withData, verify)) return true;
+                if(current + 1 >= segments.size() || segments[current + 1].base != reader->position()) return false;
+                current++;
+                reader=std::make_unique<LogReader>(segments[current].path, headerSize, segments[current].base);
+                failed=!reader->isOpen();
+            }
+            return false;
+        }
+    };
+
+    //TxnSpans: which run of a transaction id a record belongs to. ids
+    //restart at 1 every time the engine starts, so a log chain spanning
+    //several runs holds the same id more than once; an outcome belongs to
+    //the span from the record that opened it, named by that record's lsn,
+    //to its COMMIT or ABORT. both replay passes feed it the same records
+    struct TxnSpans
+    {
+        std::unordered_map<TransactionId, Lsn> open;
+
+        //the span entry belongs to, 0 for a self-committing BULK_LOAD. a
+        //COMMIT or ABORT closes its span; a BEGIN for an id that is still
+        //open starts a new span and hands back the old one in abandoned,
+        //which never finished
+        Lsn track(const LogEntry& entry, Lsn& abandoned)
+        {
+            abandoned=0;
+            if(entry.type == LogType::BULK_LOAD) return 0;
+            auto it=open.find(entry.txnId);
+            if(entry.type == LogType::COMMIT_TXN || entry.type == LogType::ABORT_TXN)
+            {
+                if(it == open.end()) return 0;
+                Lsn span=it->second;
+                open.erase(it);
+                return span;
+            }
+            if(it == open.end())
+            {
+                open.emplace(entry.txnId, entry.lsn);
+                return entry.lsn;
+            }
+            if(entry.type == LogType::BEGIN_TXN)
+            {
+                abandoned=it->second;
+                it->second=entry.lsn;
+            }
+            return it->second;
+        }
+    };
+
+    //RedoQueue: batches of committed records for one redo worker; all records
+    //of a key go to the same queue, so each key is applied in log order
+    struct RedoQueue
+    {
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::deque<std::vector<LogEntry>> batches;
+        bool done=false;
+    };
+    static constexpr size_t REDO_BATCH=256;
+    //batches queued per worker before the reader waits, bounds replay memory
+    static constexpr size_t REDO_QUEUE_DEPTH=8;
+
+    static void pushRedoBatch(RedoQueue& queue, std::vector<LogEntry>& batch)
+    {
+        std::unique_lock<std::mutex> lock(queue.mutex);
+        queue.cv.wait(lock, [&] { return queue.batches.size() < REDO_QUEUE_DEPTH; });
+        queue.batches.push_back(std::move(batch));
+        batch.clear();
+        queue.cv.notify_all();
+    }
+
+    //applies batches until the queue is closed; after a failure anywhere it
+    //keeps draining so the reader never blocks
+    static void redoWorker(RedoQueue& queue, const std::function<bool(const LogEntry&)>& apply,
+                           std::atomic<bool>& failed, std::atomic<size_t>& replayed)
+    {
+        while(true)
+        {
+            std::vector<LogEntry> batch;
+            {
+                std::unique_lock<std::mutex> lock(queue.mutex);
+                queue.cv.wait(lock, [&] { return !queue.batches.empty() || queue.done; });
+                if(queue.batches.empty()) return;
+                batch=std::move(queue.batches.front());
+                queue.batches.pop_front();
+            }
+            queue.cv.notify_all();
+            for(const auto& entry : batch)
+            {
+                if(failed.load()) break;
+                if(!apply(entry))
+                {
+                    logError("wal replay stopped: applying lsn " + std::to_string(entry.lsn) + " failed");
+                    failed=true;
+                    break;
+                }
+                replayed++;
+            }
+        }
+    }
+
+    WALManager::WALManager()
+        : backups(0), walFd(-1), walOpen(false), baseLsn(0), reservedLsn(0), publishedLsn(0), writtenLsn(0), durableLsn(0),
+          spaceWaiters(0), writeFailed(false), stopWriter(false), writeRequested(false), syncTarget(0) {}
     WALManager::~WALManager()
     {
         if(walOpen)
@@ -14,160 +352,374 @@ namespace stonedb
             close();
         }
     }
+    bool WALManager::createLogFile(const std::string& path, Lsn base)
+    {
+        uint8_t header[WAL_HEADER_SIZE]={0};
+        uint32_t version=WAL_VERSION;
+        memcpy(header, &WAL_MAGIC, 8);
+        memcpy(header + 8, &version, 4);
+        memcpy(header + 16, &base, 8);
+        uint32_t crc=crc32c(header, WAL_HEADER_SIZE - 4);
+        memcpy(header + WAL_HEADER_SIZE - 4, &crc, 4);
+        std::string tmpPath=path + ".tmp";
+        int fd=::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if(fd < 0)
+        {
+            logError("failed to create wal file: " + path);
+            return false;
+        }
+        bool ok=::write(fd, header, WAL_HEADER_SIZE) == static_cast<ssize_t>(WAL_HEADER_SIZE) && fdatasync(fd) == 0;
+        ::close(fd);
+        Statistics::global().recordWrite(IoFile::WAL, WAL_HEADER_SIZE);
+        Statistics::global().recordFlush(IoFile::WAL);
+        //a rename, so a log archived under another name keeps its contents
+        if(!ok || std::rename(tmpPath.c_str(), path.c_str()) != 0)
+        {
+            logError("failed to write wal header: " + path);
+            std::remove(tmpPath.c_str());
+            return false;
+        }
+        return true;
+    }
+    //writes an empty log whose first record will get LSN base
+    bool WALManager::createLog(Lsn base)
+    {
+        if(!createLogFile(walPath, base)) return false;
+        baseLsn=base;
+        resetOffsets(base);
+        return true;
+    }
+    //the log ends at end and all of it is on disk
+    void WALManager::resetOffsets(Lsn end)
+    {
+        reservedLsn=end;
+        publishedLsn=end;
+        writtenLsn=end;
+        durableLsn=end;
+        syncTarget=end;
+    }
     bool WALManager::open(const std::string& path)
     {
         walPath=path;
-        walFile.open(path, std::ios::in | std::ios::out | std::ios::binary | std::ios::app);
-        if(!walFile.is_open())
+        std::error_code ec;
+        uintmax_t fileSize=std::filesystem::file_size(path, ec);
+        if(ec || fileSize == 0)
+        {
+            if(!createLog(0)) return false;
+        }
+        else
         {
-            walFile.open(path, std::ios::out | std::ios::binary);
-            if(!walFile.is_open())
+            std::ifstream in(path, std::ios::binary);
+            uint8_t header[WAL_HEADER_SIZE]={0};
+            in.read(reinterpret_cast<char*>(header), WAL_HEADER_SIZE);
+            Statistics::global().recordRead(IoFile::WAL, in.gcount());
+            uint64_t magic;
+            uint32_t version, crc;
+            memcpy(&magic, header, 8);
+            memcpy(&version, header + 8, 4);
+            memcpy(&crc, header + WAL_HEADER_SIZE - 4, 4);
+            bool zeroHeader=std::all_of(header, header + WAL_HEADER_SIZE, [](uint8_t b) { return b == 0; });
+            if(zeroHeader && fileSize == WAL_HEADER_SIZE)
             {
-                logError("failed to create wal file: " + path);
-                return false;
+                //an empty log from before the v2 format has nothing to lose
+                in.close();
+                if(!createLog(0)) return false;
+                log("upgraded empty wal to format v2: " + path);
             }
-            char header[WAL_HEADER_SIZE] = {0};
-            walFile.write(header, WAL_HEADER_SIZE);
-            walFile.flush();
-            walFile.close();
-            
-            //fix bug #16: explicitly ensure closed before retry
-            if(walFile.is_open())
+            else if(in.gcount() != WAL_HEADER_SIZE || magic != WAL_MAGIC)
             {
-                walFile.close();
+                logError("wal " + path + " is not in the v2 log format (written by an older StoneDB?); "
+                         "recover it with that version or move it aside");
+                return false;
             }
-            
-            walFile.open(path, std::ios::in | std::ios::out | std::ios::binary | std::ios::app);
-            if(!walFile.is_open())
+            else if(version != WAL_VERSION || crc != crc32c(header, WAL_HEADER_SIZE - 4))
             {
-                logError("failed to reopen wal file");
+                logError("wal " + path + " has an unsupported version or a corrupt header");
                 return false;
             }
+            else
+            {
+                memcpy(&baseLsn, header + 16, 8);
+                in.close();
+                //find the end of the last intact record and cut anything after it
+                LogReader reader(path, WAL_HEADER_SIZE, baseLsn);
+                LogEntry entry(LogType::BEGIN_TXN, 0);
+                while(reader.next(entry, false, true)) {}
+                uint64_t validEnd=WAL_HEADER_SIZE + (reader.position() - baseLsn);
+                if(validEnd < fileSize)
+                {
+                    log("truncating wal after lsn " + std::to_string(baseLsn + validEnd - WAL_HEADER_SIZE) +
+                        ": dropped " + std::to_string(fileSize - validEnd) + " torn or corrupt bytes");
+                    std::filesystem::resize_file(path, validEnd, ec);
+                    if(ec)
+                    {
+                        logError("failed to truncate torn wal tail: " + ec.message());
+                        return false;
+                    }
+                }
+                resetOffsets(baseLsn + validEnd - WAL_HEADER_SIZE);
+            }
+        }
+        walFd=::open(path.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+        if(walFd < 0)
+        {
+            logError("failed to open wal file: " + path);
+            return false;
         }
+        if(!logBuffer) logBuffer.reset(new uint8_t[LOG_BUFFER_SIZE]);
+        writeFailed=false;
+        startWriter();
         walOpen = true;
         log("opened wal: " + path);
         return true;
     }
     void WALManager::close()
     {
-        if(walOpen) 
+        if(walOpen)
         {
             flush();
-            walFile.close();
-            committedTxns.clear();
-            activeTxns.clear();
+            stopWriterThread();
+            ::close(walFd);
+            walFd=-1;
             walOpen = false;
             log("closed wal");
         }
     }
-    void WALManager::serializeEntry(const LogEntry& entry, std::vector<uint8_t>& data)
-    {
-        size_t keySize = entry.key.size();
-        size_t valueSize = entry.value.size();
-        size_t totalSize = sizeof(LogType) + sizeof(TransactionId) + sizeof(uint64_t) + sizeof(uint16_t) + keySize + sizeof(uint16_t) + valueSize;
-        data.resize(totalSize);
-        size_t offset = 0;
-        memcpy(data.data() + offset, &entry.type, sizeof(LogType));
-        offset+=sizeof(LogType);
-        memcpy(data.data() + offset, &entry.txnId, sizeof(TransactionId));
-        offset+=sizeof(TransactionId);
-        memcpy(data.data() + offset, &entry.timestamp, sizeof(uint64_t));
-        offset+=sizeof(uint64_t);
-        uint16_t keyLen = keySize;
-        memcpy(data.data() + offset, &keyLen, sizeof(uint16_t));
-        offset+=sizeof(uint16_t);
-        memcpy(data.data() + offset, entry.key.c_str(), keySize);
-        offset+=keySize;
-        uint16_t valueLen=valueSize;
-        memcpy(data.data()+ offset, &valueLen, sizeof(uint16_t));
-        offset += sizeof(uint16_t);
-        memcpy(data.data()+offset, entry.value.c_str(), valueSize);
-    }
-    bool WALManager::deserializeEntry(const std::vector<uint8_t>& data, LogEntry& entry)
-    {
-        size_t offset = 0;
-        if(offset + sizeof(LogType) > data.size()) return false;
-        memcpy(&entry.type, data.data() + offset, sizeof(LogType));
-        offset += sizeof(LogType);
-        if(offset +sizeof(TransactionId) > data.size()) return false;
-        memcpy(&entry.txnId, data.data() + offset, sizeof(TransactionId));
-        offset += sizeof(TransactionId);
-
-        if(offset + sizeof(uint64_t) > data.size()) return false;
-        memcpy(&entry.timestamp, data.data() + offset, sizeof(uint64_t));
-        offset += sizeof(uint64_t);
-
-        if(offset + sizeof(uint16_t) > data.size()) return false;
-        uint16_t keyLen;
-        memcpy(&keyLen, data.data() + offset, sizeof(uint16_t));
-        offset += sizeof(uint16_t);
-
-        if(offset + keyLen > data.size()) return false;
-        entry.key.assign(reinterpret_cast<const char*>(data.data() + offset), keyLen);
-        offset+=keyLen;
-        if(offset + sizeof(uint16_t) > data.size()) return false;
-        uint16_t valueLen;
-        memcpy(&valueLen, data.data() + offset, sizeof(uint16_t));
-        offset += sizeof(uint16_t);
-        if(offset + valueLen > data.size()) return false;
-        entry.value.assign(reinterpret_cast<const char*>(data.data() + offset), valueLen);
+    //frames a record straight into the log buffer: [u32 crc32c][u32 payloadLen][payload]
+    //key and value are only written for the types that carry them
+    bool WALManager::appendRecord(LogType type, TransactionId txnId, uint64_t timestamp,
+                                  std::string_view key, std::string_view value)
+    {
+        if(!walOpen) return false;
+        bool hasKey=type == LogType::PUT_RECORD || type == LogType::DELETE_RECORD;
+        bool hasValue=type == LogType::PUT_RECORD || type == LogType::BULK_LOAD || type == LogType::PREPARE_TXN;
+        if(!hasKey) key={};
+        if(!hasValue) value={};
+        //the varints ahead of the key, and the value length that sits between key and value
+        uint8_t head[FRAME_HEADER_SIZE + 30];
+        uint8_t valueHead[10];
+        uint8_t* p=putVarint(head + FRAME_HEADER_SIZE, static_cast<uint64_t>(type));
+        p=putVarint(p, txnId);
+        if(type == LogType::COMMIT_TXN) p=putVarint(p, timestamp);
+        if(hasKey) p=putVarint(p, key.size());
+        size_t headSize=static_cast<size_t>(p - head);
+        size_t valueHeadSize=hasValue ? static_cast<size_t>(putVarint(valueHead, value.size()) - valueHead) : 0;
+        size_t recordSize=headSize + key.size() + valueHeadSize + value.size();
 
-        return true;
+        uint32_t payloadLen=static_cast<uint32_t>(recordSize - FRAME_HEADER_SIZE);
+        uint32_t crc=crc32c(&payloadLen, sizeof(payloadLen));
+        crc=crc32c(head + FRAME_HEADER_SIZE, headSize - FRAME_HEADER_SIZE, crc);
+        crc=crc32c(key.data(), key.size(), crc);
+        crc=crc32c(valueHead, valueHeadSize, crc);
+        crc=crc32c(value.data(), value.size(), crc);
+        memcpy(head, &crc, 4);
+        memcpy(head + 4, &payloadLen, 4);
+
+        //reserve our range of the ring; its start is the record's LSN
+        Lsn start=reservedLsn.fetch_add(recordSize);
+        Lsn end=start + recordSize;
+        //no space only once a write failed: the range is still published,
+        //unfilled, so loggers behind it are not stuck waiting on it; the
+        //writer writes nothing more after a failure
+        bool space=end - writtenLsn.load(std::memory_order_acquire) <= LOG_BUFFER_SIZE || waitForSpace(end);
+        if(space)
+        {
+            copyToRing(start, head, headSize);
+            copyToRing(start + headSize, key.data(), key.size());
+            copyToRing(start + headSize + key.size(), valueHead, valueHeadSize);
+            copyToRing(end - value.size(), value.data(), value.size());
+        }
+
+        //publish in LSN order so the writer only ever sees a contiguous prefix
+        for(int spins=0; publishedLsn.load(std::memory_order_acquire) != start; spins++)
+        {
+            if(writeFailed.load()) return false;
+            if(spins >= PUBLISH_SPINS) std::this_thread::yield();
+        }
+        publishedLsn.store(end, std::memory_order_release);
+        if(!space) return false;
+
+        //wake the writer once half the ring is waiting, or for loggers out of space
+        Lsn written=writtenLsn.load(std::memory_order_acquire);
+        if((end - written >= LOG_BUFFER_SIZE / 2 && start - written < LOG_BUFFER_SIZE / 2) || spaceWaiters.load() > 0)
+        {
+            requestWrite();
+        }
+        return !writeFailed.load();
     }
-    bool WALManager::writeLogEntry(const LogEntry& entry)
+    //copies into the ring at the position of LSN at, wrapping around its end
+    void WALManager::copyToRing(Lsn at, const void* data, size_t size)
     {
-        if(!walOpen) return false;
-        walFile.clear();
-        std::vector<uint8_t> data;
-        serializeEntry(entry, data);
-        walFile.write(reinterpret_cast<const char*>(data.data()), data.size());
-        if(walFile.fail()) return false;
+        if(size == 0) return;
+        size_t pos=at % LOG_BUFFER_SIZE;
+        size_t first=std::min(size, LOG_BUFFER_SIZE - pos);
+        memcpy(logBuffer.get() + pos, data, first);
+        if(first < size) memcpy(logBuffer.get(), static_cast<const uint8_t*>(data) + first, size - first);
+    }
+    //blocks until the writer has freed the ring up to end
+    bool WALManager::waitForSpace(Lsn end)
+    {
+        std::unique_lock<std::mutex> lock(writerMutex);
+        spaceWaiters++;
+        writeRequested=true;
+        writerCv.notify_one();
+        doneCv.wait(lock, [&]
+        {
+            return end - writtenLsn.load() <= LOG_BUFFER_SIZE || writeFailed.load();
+        });
+        spaceWaiters--;
+        return !writeFailed.load();
+    }
+    void WALManager::requestWrite()
+    {
+        std::lock_guard<std::mutex> lock(writerMutex);
+        writeRequested=true;
+        writerCv.notify_one();
+    }
+    void WALManager::startWriter()
+    {
+        stopWriter=false;
+        writeRequested=false;
+        writer=std::thread(&WALManager::writerLoop, this);
+    }
+    //the writer writes out what is published before it exits
+    void WALManager::stopWriterThread()
+    {
+        if(!writer.joinable()) return;
+        {
+            std::lock_guard<std::mutex> lock(writerMutex);
+            stopWriter=true;
+            writerCv.notify_one();
+        }
+        writer.join();
+    }
+    void WALManager::writerLoop()
+    {
+        std::unique_lock<std::mutex> lock(writerMutex);
+        while(true)
+        {
+            writerCv.wait_for(lock, WRITER_INTERVAL, [&]
+            {
+                return stopWriter || writeRequested || syncTarget > durableLsn.load() ||
+                       (spaceWaiters.load() > 0 && publishedLsn.load() > writtenLsn.load());
+            });
+            writeRequested=false;
+            bool stopping=stopWriter;
+            Lsn target=syncTarget;
+            lock.unlock();
+
+            if(!writeFailed.load())
+            {
+                Lsn from=writtenLsn.load();
+                Lsn to=publishedLsn.load(std::memory_order_acquire);
+                bool ok=to == from || writeRing(from, to);
+                if(ok) writtenLsn.store(to, std::memory_order_release);
+                //flush() only asks for what was already published, so to covers target
+                if(ok && target > durableLsn.load())
+                {
+                    {
+                        ScopedLatency timer(LatencyOp::WAL_SYNC);
+                        ScopedSync sync(IoFile::WAL);
+                        ok=fdatasync(walFd) == 0;
+                    }
+                    if(!ok) logError("WAL sync failed: " + std::string(strerror(errno)));
+                    else durableLsn.store(to, std::memory_order_release);
+                }
+                if(!ok) writeFailed=true;
+            }
+
+            lock.lock();
+            doneCv.notify_all();
+            if(stopping) return;
+        }
+    }
+    //writes the ring bytes for LSNs [from, to): one write, two pieces if it wraps
+    bool WALManager::writeRing(Lsn from, Lsn to)
+    {
+        size_t pos=from % LOG_BUFFER_SIZE;
+        size_t size=to - from;
+        size_t first=std::min(size, LOG_BUFFER_SIZE - pos);
+        iovec parts[2]={{logBuffer.get() + pos, first}, {logBuffer.get(), size - first}};
+        if(!writeAll(walFd, parts, first < size ? 2 : 1))
+        {
+            logError("WAL write failed: " + std::string(strerror(errno)));
+            return false;
+        }
         return true;
     }
     bool WALManager::logBeginTxn(TransactionId txnId)
     {
-        LogEntry entry(LogType::BEGIN_TXN, txnId);
-        entry.timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(
-            std::chrono::system_clock::now().time_since_epoch()).count();
-        if(!writeLogEntry(entry)) return false;
-        activeTxns.insert(txnId);
-        return true;
+        return appendRecord(LogType::BEGIN_TXN, txnId, 0, {}, {});
     }
     bool WALManager::logCommitTxn(TransactionId txnId)
     {
-        LogEntry entry(LogType::COMMIT_TXN, txnId);
-        entry.timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(
-            std::chrono::system_clock::now().time_since_epoch()).count();
-        if(!writeLogEntry(entry)) return false;
-        activeTxns.erase(txnId);
-        committedTxns.insert(txnId);
-        return flush();
+        return appendRecord(LogType::COMMIT_TXN, txnId, nowMillis(), {}, {}) && flush();
     }
     bool WALManager::logAbortTxn(TransactionId txnId)
     {
-        LogEntry entry(LogType::ABORT_TXN, txnId);
-        entry.timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(
-            std::chrono::system_clock::now().time_since_epoch()).count();
-        if(!writeLogEntry(entry)) return false;
-        activeTxns.erase(txnId);
-        return true;
+        return appendRecord(LogType::ABORT_TXN, txnId, 0, {}, {});
     }
-    bool WALManager::logPutRecord(TransactionId txnId, const std::string& key, const std::string& value)
+    bool WALManager::logPutRecord(TransactionId txnId, std::string_view key, std::string_view value)
     {
-        LogEntry entry(LogType::PUT_RECORD, txnId);
-        entry.key = key;
-        entry.value = value;
-        entry.timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(
-            std::chrono::system_clock::now().time_since_epoch()).count();
-        return writeLogEntry(entry);
+        if(key.size() > MAX_KEY_SIZE || value.size() > MAX_VALUE_SIZE)
+        {
+            logError("wal record too large for key " + std::string(key));
+            return false;
+        }
+        return appendRecord(LogType::PUT_RECORD, txnId, 0, key, value);
     }
-    bool WALManager::logDeleteRecord(TransactionId txnId, const std::string& key)
+    bool WALManager::logDeleteRecord(TransactionId txnId, std::string_view key)
     {
-        LogEntry entry(LogType::DELETE_RECORD, txnId);
-        entry.key = key;
-        entry.timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(
-            std::chrono::system_clock::now().time_since_epoch()).count();
-        return writeLogEntry(entry);
+        if(key.size() > MAX_KEY_SIZE)
+        {
+            logError("wal record too large for key " + std::string(key));
+            return false;
+        }
+        return appendRecord(LogType::DELETE_RECORD, txnId, 0, key, {});
+    }
+    bool WALManager::logBulkLoad(std::string_view descriptor)
+    {
+        if(descriptor.size() > MAX_VALUE_SIZE)
+        {
+            logError("bulk load descriptor too large");
+            return false;
+        }
+        return appendRecord(LogType::BULK_LOAD, INVALID_TXN_ID, 0, {}, descriptor) && flush();
+    }
+    bool WALManager::logPrepareTxn(TransactionId txnId, std::string_view coordinator)
+    {
+        if(coordinator.size() > MAX_KEY_SIZE)
+        {
+            logError("coordinator reference too large");
+            return false;
+        }
+        return appendRecord(LogType::PREPARE_TXN, txnId, 0, {}, coordinator) && flush();
+    }
+    bool WALManager::preparedTransactions(std::vector<LogEntry>& inDoubt, std::unordered_set<TransactionId>& committed)
+    {
+        if(!walOpen || !flush()) return false;
+        std::vector<LogSegment> segments{{walPath, baseLsn}};
+        ChainReader reader(segments, WAL_HEADER_SIZE);
+        if(!reader.isOpen())
+        {
+            logError("failed to read wal: " + reader.path());
+            return false;
+        }
+        std::unordered_map<TransactionId, LogEntry> prepared;
+        LogEntry entry(LogType::BEGIN_TXN, 0);
+        while(reader.next(entry, false, true))
+        {
+            if(entry.type == LogType::PREPARE_TXN)
+            {
+                prepared.insert_or_assign(entry.txnId, entry);
+            }
+            else if(entry.type == LogType::COMMIT_TXN || entry.type == LogType::ABORT_TXN)
+            {
+                if(prepared.erase(entry.txnId) && entry.type == LogType::COMMIT_TXN) committed.insert(entry.txnId);
+            }
+        }
+        for(auto& pending : prepared) inDoubt.push_back(std::move(pending.second));
+        return true;
     }
     bool WALManager::flush()
     {
@@ -176,140 +728,365 @@ namespace stonedb
             logError("WAL not open");
             return false;
         }
-        walFile.clear();
-        walFile.flush();
-        if(walFile.fail())
+        //our own records are published, so everything up to here covers them
+        Lsn target=publishedLsn.load(std::memory_order_acquire);
+        std::unique_lock<std::mutex> lock(writerMutex);
+        if(target > syncTarget)
         {
-            logError("WAL flush failed");
-            return false;
+            syncTarget=target;
+            writerCv.notify_one();
         }
-        walFile.sync();
-        if(walFile.fail())
+        doneCv.wait(lock, [&] { return durableLsn.load() >= target || writeFailed.load(); });
+        if(writeFailed.load())
         {
-            logError("WAL sync failed");
+            logError("WAL flush failed");
             return false;
         }
         return true;
     }
-    std::vector<LogEntry> WALManager::replayLog()
+    bool WALManager::replayLog(const std::function<bool(const LogEntry&)>& apply, size_t redoThreads)
     {
-        std::vector<LogEntry> entries;
-        if(!walOpen) return entries;
-        walFile.seekg(WAL_HEADER_SIZE);
-        if(walFile.fail()) return entries;
-        while(walFile.good())
+        if(!walOpen || !flush()) return false;
+        Lsn validEnd=endLsn();
+        std::vector<LogSegment> segments{{walPath, baseLsn}};
+        bool ok=replaySegments(segments, RecoveryTarget(), apply, redoThreads, validEnd);
+        if(validEnd != endLsn())
         {
-            char header[sizeof(LogType) + sizeof(TransactionId) + sizeof(uint64_t) + 2*sizeof(uint16_t)];
-            walFile.read(header, sizeof(header));
-            if(walFile.gcount()!=sizeof(header)) break;
-
-            uint16_t keyLen, valueLen;
-            memcpy(&keyLen, header + sizeof(LogType) + sizeof(TransactionId) + sizeof(uint64_t), sizeof(uint16_t));
-            memcpy(&valueLen, header + sizeof(LogType) + sizeof(TransactionId) + sizeof(uint64_t) + sizeof(uint16_t), sizeof(uint16_t));
+            logError("wal replay stopped at corrupt record at lsn " + std::to_string(validEnd));
+        }
+        return ok;
+    }
+    //two passes over the chain: the first verifies checksums, finds where
+    //target cuts the log and which transactions commit before that; the
+    //second streams their records to apply
+    bool WALManager::replaySegments(const std::vector<LogSegment>& segments, const RecoveryTarget& target,
+                                    const std::function<bool(const LogEntry&)>& apply, size_t redoThreads, Lsn& validEnd)
+    {
+        LogEntry entry(LogType::BEGIN_TXN, 0);
 
-            //fix bug #11: validate sizes before allocating to prevent DoS
-            if(keyLen > MAX_KEY_SIZE || valueLen > MAX_VALUE_SIZE)
+        //pass 1: checksums and transaction outcomes, without copying data
+        TxnSpans spans;
+        std::unordered_set<Lsn> uncommitted;       //spans by opening lsn
+        Lsn abandoned=0;
+        bool cut=false;
+        {
+            ChainReader reader(segments, WAL_HEADER_SIZE);
+            if(!reader.isOpen())
             {
-                logError("invalid keyLen or valueLen in WAL entry - possible corruption");
-                break;
+                logError("failed to read wal: " + reader.path());
+                return false;
             }
-            
-            //validate reasonable limits to prevent huge allocations
-            const size_t MAX_WAL_KEY_SIZE=1024*1024;
-            const size_t MAX_WAL_VALUE_SIZE=10*1024*1024;
-            if(keyLen > MAX_WAL_KEY_SIZE || valueLen > MAX_WAL_VALUE_SIZE)
+            while(reader.next(entry, false, true))
             {
-                logError("WAL entry size exceeds maximum - possible corruption");
-                break;
+                if(entry.lsn >= target.lsn ||
+                   (entry.type == LogType::COMMIT_TXN && entry.timestamp > target.timestamp))
+                {
+                    cut=true;
+                    break;
+                }
+                Lsn span=spans.track(entry, abandoned);
+                if(abandoned != 0) uncommitted.insert(abandoned);
+                if(entry.type == LogType::ABORT_TXN && span != 0) uncommitted.insert(span);
             }
-
-            std::vector<char> keyData(keyLen);
-            std::vector<char> valueData(valueLen);
-            walFile.read(keyData.data(), keyLen);
-            walFile.read(valueData.data(), valueLen);
-            if(walFile.gcount() != keyLen + valueLen) break;
-
-            LogEntry entry(LogType::BEGIN_TXN, 0);
-            memcpy(&entry.type, header, sizeof(LogType));
-            memcpy(&entry.txnId, header + sizeof(LogType), sizeof(TransactionId));
-            memcpy(&entry.timestamp, header + sizeof(LogType) + sizeof(TransactionId), sizeof(uint64_t));
-            entry.key.assign(keyData.data(), keyLen);
-            entry.value.assign(valueData.data(), valueLen);
-
-            entries.push_back(entry);
+            validEnd=cut ? entry.lsn : reader.position();
         }
+        //transactions still open at the end never committed
+        for(const auto& open : spans.open) uncommitted.insert(open.second);
+        spans.open.clear();
 
-        std::vector<LogEntry> committedEntries;
-        std::unordered_set<TransactionId> committed;
-
-        for(const auto& entry : entries)
+        //pass 2: stream the committed changes, already verified up to validEnd
+        ChainReader reader(segments, WAL_HEADER_SIZE);
+        auto committed=[&]()
         {
-            if(entry.type == LogType::COMMIT_TXN) committed.insert(entry.txnId);
+            while(reader.position() < validEnd && reader.next(entry, true, false))
+            {
+                Lsn span=spans.track(entry, abandoned);
+                if(entry.type == LogType::BULK_LOAD) return true;
+                if(entry.type != LogType::PUT_RECORD && entry.type != LogType::DELETE_RECORD) continue;
+                if(!uncommitted.count(span)) return true;
+            }
+            return false;
+        };
+        std::atomic<size_t> replayed{0};
+        std::atomic<bool> failed{false};
+        if(redoThreads <= 1)
+        {
+            while(committed())
+            {
+                if(!apply(entry))
+                {
+                    logError("wal replay stopped: applying lsn " + std::to_string(entry.lsn) + " failed");
+                    return false;
+                }
+                replayed++;
+            }
         }
-
-        for(const auto& entry : entries)
+        else
         {
-            if(committed.count(entry.txnId) && (entry.type == LogType::PUT_RECORD || entry.type == LogType::DELETE_RECORD))
+            std::vector<RedoQueue> queues(redoThreads);
+            std::vector<std::vector<LogEntry>> pending(redoThreads);
+            std::vector<std::thread> workers;
+            auto startWorkers=[&]()
+            {
+                for(size_t i=0; i<redoThreads; i++)
+                {
+                    queues[i].done=false;
+                    workers.emplace_back(redoWorker, std::ref(queues[i]), std::cref(apply), std::ref(failed), std::ref(replayed));
+                }
+            };
+            //hands out what is batched and waits until the workers applied it all
+            auto drainWorkers=[&]()
+            {
+                for(size_t i=0; i<redoThreads; i++)
+                {
+                    if(!pending[i].empty()) pushRedoBatch(queues[i], pending[i]);
+                    std::lock_guard<std::mutex> lock(queues[i].mutex);
+                    queues[i].done=true;
+                    queues[i].cv.notify_all();
+                }
+                for(auto& worker : workers) worker.join();
+                workers.clear();
+            };
+            startWorkers();
+            while(!failed.load() && committed())
             {
-                committedEntries.push_back(entry);
+                if(entry.type == LogType::BULK_LOAD)
+                {
+                    //bulk loads are rare; restarting the workers is cheaper than a finer barrier
+                    drainWorkers();
+                    if(failed.load()) break;
+                    if(!apply(entry))
+                    {
+                        logError("wal replay stopped: applying lsn " + std::to_string(entry.lsn) + " failed");
+                        failed=true;
+                        break;
+                    }
+                    replayed++;
+                    startWorkers();
+                    continue;
+                }
+                size_t worker=hashKey(entry.key) % redoThreads;
+                pending[worker].push_back(std::move(entry));
+                if(pending[worker].size() >= REDO_BATCH) pushRedoBatch(queues[worker], pending[worker]);
             }
+            drainWorkers();
+            if(failed.load()) return false;
         }
-        log("replayed " + std::to_string(committedEntries.size()) + " committed operations");
-        return committedEntries;
+        log("replayed " + std::to_string(replayed.load()) + " committed operations");
+        return true;
     }
-    
-    bool WALManager::checkpoint(std::shared_ptr<class StorageManager> storage)
+    std::vector<LogEntry> WALManager::replayLog()
+    {
+        std::vector<LogEntry> entries;
+        replayLog([&](const LogEntry& entry)
+        {
+            entries.push_back(entry);
+            return true;
+        });
+        return entries;
+    }
+
+    bool WALManager::checkpoint(std::shared_ptr<StorageEngine> storage)
     {
         if(!walOpen) return false;
-        
-        //flush all storage pages
-        if(storage)
+
+        //flush all storage pages and persist the key filter
+        if(storage && !storage->checkpoint())
         {
-            storage->flushAll();
+            return false;
         }
-        
+
         //flush WAL
         if(!flush())
         {
             return false;
         }
-        
+
         log("checkpoint completed");
         return true;
     }
-    
+
     bool WALManager::truncateLog()
     {
         //fix bug #20: truncate WAL after checkpoint
         if(!walOpen) return false;
-        
-        walFile.flush();
-        walFile.close();
-        
-        //truncate file to header size (remove all log entries)
-        walFile.open(walPath, std::ios::out | std::ios::binary | std::ios::trunc);
-        if(!walFile.is_open())
+        std::lock_guard<std::mutex> lock(truncateMutex);
+        if(backups > 0)
+        {
+            logError("WAL not truncated: a backup is copying it");
+            return false;
+        }
+
+        stopWriterThread();
+        if(!archiveDir.empty() && !archiveLog())
+        {
+            startWriter();
+            return false;
+        }
+        ::close(walFd);
+        walFd=-1;
+
+        //drop all log entries; the new header carries the LSN forward
+        if(!createLog(endLsn()))
         {
             logError("failed to truncate WAL file");
+            walOpen=false;
             return false;
         }
-        
-        char header[WAL_HEADER_SIZE]={0};
-        walFile.write(header, WAL_HEADER_SIZE);
-        walFile.flush();
-        walFile.close();
-        
+
         //reopen in append mode
-        walFile.open(walPath, std::ios::in | std::ios::out | std::ios::binary | std::ios::app);
-        if(!walFile.is_open())
+        walFd=::open(walPath.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+        if(walFd < 0)
         {
             logError("failed to reopen WAL after truncation");
+            walOpen=false;
             return false;
         }
-        
-        committedTxns.clear();
-        activeTxns.clear();
+        startWriter();
         log("WAL truncated");
         return true;
     }
+
+    Lsn WALManager::beginBackup()
+    {
+        std::lock_guard<std::mutex> lock(truncateMutex);
+        backups++;
+        return endLsn();
+    }
+
+    void WALManager::endBackup()
+    {
+        std::lock_guard<std::mutex> lock(truncateMutex);
+        backups--;
+    }
+
+    bool WALManager::copyLog(const std::string& destPath, Lsn& end)
+    {
+        if(!flush()) return false;
+        //walPath and baseLsn only change under truncateMutex
+        std::lock_guard<std::mutex> lock(truncateMutex);
+        //the writer only hands whole published records to the file
+        end=durableLsn.load();
+        int srcFd=::open(walPath.c_str(), O_RDONLY | O_CLOEXEC);
+        int dstFd=::open(destPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        bool ok=srcFd >= 0 && dstFd >= 0;
+        uint64_t bytes=WAL_HEADER_SIZE + (end - baseLsn);
+        ok=ok && copyFileBytes(srcFd, 0, dstFd, 0, bytes) && fdatasync(dstFd) == 0;
+        if(ok) Statistics::global().recordRead(IoFile::WAL, bytes);
+        else logError("failed to copy wal to " + destPath + ": " + std::string(strerror(errno)));
+        if(srcFd >= 0) ::close(srcFd);
+        if(dstFd >= 0) ::close(dstFd);
+        return ok;
+    }
+
+    bool WALManager::setArchiveDir(const std::string& dir)
+    {
+        std::error_code ec;
+        std::filesystem::create_directories(dir, ec);
+        if(ec)
+        {
+            logError("cannot create wal archive " + dir + ": " + ec.message());
+            return false;
+        }
+        archiveDir=dir;
+        return true;
+    }
+
+    std::string WALManager::segmentName(Lsn base)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "%020llu.wal", static_cast<unsigned long long>(base));
+        return name;
+    }
+
+    //the writer is stopped, so the file holds every record; it is linked
+    //into the archive (copied if that is another file system) before
+    //createLog renames a fresh log over walPath
+    bool WALManager::archiveLog()
+    {
+        if(endLsn() == baseLsn) return true;
+        if(fdatasync(walFd) != 0)
+        {
+            logError("failed to sync wal before archiving: " + std::string(strerror(errno)));
+            return false;
+        }
+        std::string dest=(std::filesystem::path(archiveDir) / segmentName(baseLsn)).string();
+        std::string tmpPath=dest + ".tmp";
+        std::remove(tmpPath.c_str());
+        bool ok=::link(walPath.c_str(), tmpPath.c_str()) == 0;
+        if(!ok)
+        {
+            uint64_t bytes=WAL_HEADER_SIZE + (endLsn() - baseLsn);
+            int srcFd=::open(walPath.c_str(), O_RDONLY | O_CLOEXEC);
+            int dstFd=::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            ok=srcFd >= 0 && dstFd >= 0 && copyFileBytes(srcFd, 0, dstFd, 0, bytes) && fdatasync(dstFd) == 0;
+            if(ok) Statistics::global().recordRead(IoFile::WAL, bytes);
+            if(srcFd >= 0) ::close(srcFd);
+            if(dstFd >= 0) ::close(dstFd);
+        }
+        if(ok) ok=std::rename(tmpPath.c_str(), dest.c_str()) == 0;
+        if(!ok)
+        {
+            logError("failed to archive wal to " + dest + ": " + std::string(strerror(errno)));
+            std::remove(tmpPath.c_str());
+            return false;
+        }
+        log("archived wal lsn " + std::to_string(baseLsn) + "-" + std::to_string(endLsn()) + " to " + dest);
+        return true;
+    }
+
+    bool WALManager::readLogBounds(const std::string& path, Lsn& base, Lsn& end)
+    {
+        std::ifstream in(path, std::ios::binary);
+        uint8_t header[WAL_HEADER_SIZE]={0};
+        in.read(reinterpret_cast<char*>(header), WAL_HEADER_SIZE);
+        Statistics::global().recordRead(IoFile::WAL, in.gcount());
+        uint64_t magic;
+        uint32_t version, crc;
+        memcpy(&magic, header, 8);
+        memcpy(&version, header + 8, 4);
+        memcpy(&crc, header + WAL_HEADER_SIZE - 4, 4);
+        if(in.gcount() != WAL_HEADER_SIZE || magic != WAL_MAGIC || version != WAL_VERSION ||
+           crc != crc32c(header, WAL_HEADER_SIZE - 4))
+        {
+            return false;
+        }
+        memcpy(&base, header + 16, 8);
+        std::error_code ec;
+        end=base + (std::filesystem::file_size(path, ec) - WAL_HEADER_SIZE);
+        return !ec;
+    }
+
+    bool WALManager::replayChain(const std::vector<std::string>& paths, Lsn start, const RecoveryTarget& target,
+                                 const std::function<bool(const LogEntry&)>& apply, Lsn& end)
+    {
+        //by base, the longest file first among equal bases
+        std::vector<std::pair<LogSegment, Lsn>> found;
+        for(const auto& path : paths)
+        {
+            Lsn base, fileEnd;
+            if(!readLogBounds(path, base, fileEnd))
+            {
+                logError("skipping " + path + ": not a v2 wal file");
+                continue;
+            }
+            if(base >= start) found.push_back({{path, base}, fileEnd});
+        }
+        std::sort(found.begin(), found.end(), [](const auto& a, const auto& b)
+        {
+            return a.first.base != b.first.base ? a.first.base < b.first.base : a.second > b.second;
+        });
+        std::vector<LogSegment> segments;
+        for(const auto& file : found)
+        {
+            if(segments.empty() || segments.back().base != file.first.base) segments.push_back(file.first);
+        }
+        end=start;
+        if(segments.empty() || segments.front().base != start)
+        {
+            logError("no wal file starts at lsn " + std::to_string(start));
+            return false;
+        }
+        return replaySegments(segments, target, apply, 1, end);
+    }
 }
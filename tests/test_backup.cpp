@@ -0,0 +1,151 @@
+#include"backup.hpp"
+#include"storage.hpp"
+#include"lsm.hpp"
+#include"lockmgr.hpp"
+#include"transaction.hpp"
+#include<atomic>
+#include<cassert>
+#include<cstdio>
+#include<filesystem>
+#include<iostream>
+#include<thread>
+
+static const char* DB_PATH="test_backup.sdb";
+static const char* WAL_PATH="test_backup.wal";
+static const char* RESTORED_DB="test_backup_restored.sdb";
+static const char* RESTORED_WAL="test_backup_restored.wal";
+static const char* BACKUP_DIR="test_backup.dir";
+
+static void cleanup()
+{
+    for(const char* path : {DB_PATH, WAL_PATH, RESTORED_DB, RESTORED_WAL})
+    {
+        std::remove(path);
+        std::remove((std::string(path) + ".bloom").c_str());
+    }
+    std::filesystem::remove_all(BACKUP_DIR);
+    std::filesystem::remove_all("test_backup_lsm");
+}
+
+static bool autocommitPut(stonedb::TransactionManager& txnMgr, const std::string& key, const std::string& value)
+{
+    auto txnId=txnMgr.beginTransaction();
+    if(!txnMgr.putRecord(txnId, key, value))
+    {
+        txnMgr.abortTransaction(txnId);
+        return false;
+    }
+    return txnMgr.commitTransaction(txnId);
+}
+
+//a backup taken while a writer commits holds every transaction committed
+//before it started and a gap-free prefix of the writer's later ones
+static void testHotBackup(stonedb::StorageLayout layout)
+{
+    cleanup();
+    stonedb::StorageOptions opts;
+    opts.layout=layout;
+    opts.cacheFrames=64;       //small, so commits and evictions write pages back mid-backup
+    const int baseKeys=20000;
+    int beforeBackup=0;
+    int afterBackup=0;
+    {
+        auto storage=std::make_shared<stonedb::StorageManager>();
+        auto wal=std::make_shared<stonedb::WALManager>();
+        assert(storage->open(DB_PATH, opts));
+        assert(wal->open(WAL_PATH));
+        stonedb::TransactionManager txnMgr(storage, wal, std::make_shared<stonedb::LockManager>());
+        auto loadTxn=txnMgr.beginTransaction();
+        for(int i=0; i<baseKeys; i++) assert(txnMgr.putRecord(loadTxn, "base" + std::to_string(i), std::string(200, 'a' + i % 26)));
+        assert(txnMgr.commitTransaction(loadTxn));
+
+        std::atomic<int> committed{0};
+        std::atomic<bool> stop{false};
+        std::thread writer([&]()
+        {
+            for(int i=0; !stop.load(); i++)
+            {
+                //grow new keys and rewrite old ones, so pages fill, split and move records
+                assert(autocommitPut(txnMgr, "w" + std::to_string(i), std::string(300, 'w')));
+                assert(autocommitPut(txnMgr, "base" + std::to_string(i % baseKeys), "updated" + std::to_string(i)));
+                committed.store(i + 1);
+            }
+        });
+        while(committed.load() < 50) std::this_thread::yield();
+        stonedb::BackupInfo info;
+        beforeBackup=committed.load();
+        assert(stonedb::hotBackup(*storage, *wal, BACKUP_DIR, info));
+        afterBackup=committed.load();
+        stop=true;
+        writer.join();
+        std::cout << "  " << info.pages << " pages, " << info.preserved << " preserved, " << info.walBytes
+                  << " log bytes, writer " << beforeBackup << " -> " << afterBackup << std::endl;
+        assert(info.pages > 0 && stonedb::isBackupDirectory(BACKUP_DIR));
+        //a finished backup directory is not overwritten
+        assert(!stonedb::hotBackup(*storage, *wal, BACKUP_DIR, info));
+        storage->close();
+        wal->close();
+    }
+
+    stonedb::BackupInfo restored;
+    assert(stonedb::restoreBackup(BACKUP_DIR, RESTORED_DB, RESTORED_WAL, restored));
+    auto storage=std::make_shared<stonedb::StorageManager>();
+    stonedb::WALManager wal;
+    assert(storage->open(RESTORED_DB, opts));
+    assert(wal.open(RESTORED_WAL));
+    assert(storage->recover(wal));
+    std::string value;
+    int present=0;
+    while(storage->getRecord("w" + std::to_string(present), value)) present++;
+    assert(present >= beforeBackup && present <= afterBackup + 1);
+    assert(!storage->getRecord("w" + std::to_string(present + 1), value));
+    for(int i=0; i<baseKeys; i++)
+    {
+        assert(storage->getRecord("base" + std::to_string(i), value));
+        //the last update the writer committed inside the restored prefix
+        int last=-1;
+        for(int j=i; j<present; j += baseKeys) last=j;
+        if(last >= beforeBackup) continue;
+        if(last < 0) assert(value == std::string(200, 'a' + i % 26));
+        else assert(value == "updated" + std::to_string(last));
+    }
+    assert(static_cast<int>(storage->scanRecords().size()) == baseKeys + present);
+    storage->close();
+    wal.close();
+}
+
+static void testErrors()
+{
+    cleanup();
+    stonedb::BackupInfo info;
+    assert(!stonedb::isBackupDirectory(BACKUP_DIR));
+    assert(!stonedb::restoreBackup(BACKUP_DIR, RESTORED_DB, RESTORED_WAL, info));
+    assert(!std::filesystem::exists(RESTORED_DB));
+
+    //engines without a page image refuse
+    stonedb::LSMStorage lsm;
+    stonedb::WALManager wal;
+    assert(lsm.open("test_backup_lsm"));
+    assert(wal.open(WAL_PATH));
+    assert(!stonedb::hotBackup(lsm, wal, BACKUP_DIR, info));
+    assert(!stonedb::isBackupDirectory(BACKUP_DIR));
+    //a running backup keeps the log whole; a failed one lets go of it
+    wal.beginBackup();
+    assert(!wal.truncateLog());
+    wal.endBackup();
+    assert(wal.truncateLog());
+    lsm.close();
+    wal.close();
+}
+
+int main()
+{
+    std::cout << "Testing hot backup..." << std::endl;
+    stonedb::setLogLevel(stonedb::LogLevel::ERROR);
+    testHotBackup(stonedb::StorageLayout::HEAP);
+    testHotBackup(stonedb::StorageLayout::HASH);
+    testErrors();
+    cleanup();
+    std::cout << "Hot backup tests passed!" << std::endl;
+    return 0;
+}
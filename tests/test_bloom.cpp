@@ -0,0 +1,83 @@
+#include"bloom.hpp"
+#include"storage.hpp"
+#include<cassert>
+#include<iostream>
+
+int main()
+{
+    std::cout << "Testing bloom filter..." << std::endl;
+
+    const size_t numKeys=100000;
+    stonedb::BloomFilter filter(numKeys);
+    for(size_t i=0; i<numKeys; i++)
+    {
+        filter.insert(stonedb::hashKey("present:" + std::to_string(i)));
+    }
+
+    //no false negatives
+    for(size_t i=0; i<numKeys; i++)
+    {
+        assert(filter.mayContain(stonedb::hashKey("present:" + std::to_string(i))));
+    }
+
+    //false positive rate at 10 bits/key should be around 1%
+    size_t falsePositives=0;
+    for(size_t i=0; i<numKeys; i++)
+    {
+        if(filter.mayContain(stonedb::hashKey("absent:" + std::to_string(i)))) falsePositives++;
+    }
+    double rate=static_cast<double>(falsePositives) / numKeys;
+    std::cout << "False positive rate: " << rate * 100.0 << "%" << std::endl;
+    assert(rate < 0.03);
+
+    //serialize round trip
+    std::vector<uint8_t> bytes;
+    filter.serialize(bytes);
+    stonedb::BloomFilter copy;
+    assert(copy.deserialize(bytes.data(), bytes.size()));
+    assert(copy.count() == filter.count());
+    for(size_t i=0; i<1000; i++)
+    {
+        uint64_t hash=stonedb::hashKey("absent:" + std::to_string(i));
+        assert(copy.mayContain(hash) == filter.mayContain(hash));
+    }
+    bytes[0] ^= 0xff;
+    assert(!copy.deserialize(bytes.data(), bytes.size()));
+
+    //storage consults the filter for misses and persists it at checkpoint
+    std::remove("bloom_test.sdb");
+    std::remove("bloom_test.sdb.bloom");
+    {
+        stonedb::StorageManager storage;
+        assert(storage.open("bloom_test.sdb"));
+        for(int i=0; i<3000; i++)
+        {
+            assert(storage.putRecord("key" + std::to_string(i), "value" + std::to_string(i)));
+        }
+        std::string value;
+        assert(!storage.getRecord("missing", value));
+        assert(!storage.deleteRecord("missing"));
+        assert(storage.deleteRecord("key7"));
+        assert(!storage.getRecord("key7", value));
+        assert(storage.checkpoint());
+        storage.close();
+    }
+    {
+        stonedb::StorageManager storage;
+        assert(storage.open("bloom_test.sdb"));
+        std::string value;
+        for(int i=0; i<3000; i++)
+        {
+            if(i == 7) continue;
+            assert(storage.getRecord("key" + std::to_string(i), value));
+            assert(value == "value" + std::to_string(i));
+        }
+        assert(!storage.getRecord("key7", value));
+        storage.close();
+    }
+    std::remove("bloom_test.sdb");
+    std::remove("bloom_test.sdb.bloom");
+
+    stonedb::log("bloom filter tests passed");
+    return 0;
+}
@@ -0,0 +1,115 @@
+#include"bufferpool.hpp"
+#include"storage.hpp"
+#include<cassert>
+#include<cstdlib>
+#include<iostream>
+#include<new>
+
+//count heap allocations so we can check the miss path stays allocation free
+//per thread, so the logger's drain thread neither races nor skews the count.
+//every plain, array and nothrow form is replaced, so whatever the runtime
+//allocates through one form it frees through a matching one
+static thread_local size_t allocationCount=0;
+
+static void* countedAlloc(size_t size) noexcept
+{
+    allocationCount++;
+    return std::malloc(size == 0 ? 1 : size);
+}
+
+void* operator new(size_t size)
+{
+    if(void* p=countedAlloc(size)) return p;
+    throw std::bad_alloc();
+}
+void* operator new[](size_t size)
+{
+    if(void* p=countedAlloc(size)) return p;
+    throw std::bad_alloc();
+}
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return countedAlloc(size); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return countedAlloc(size); }
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+void operator delete[](void* p, size_t) noexcept { std::free(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { std::free(p); }
+
+int main()
+{
+    std::cout << "Testing buffer pool..." << std::endl;
+
+    stonedb::BufferPool pool(8);
+    assert(pool.isValid());
+    assert(pool.capacity() == 8);
+    assert(pool.residentCount() == 0);
+
+    //frames must be page aligned and contiguous
+    auto first=pool.install(1);
+    auto second=pool.install(2);
+    assert(reinterpret_cast<uintptr_t>(first->data.data()) % stonedb::PAGE_SIZE == 0);
+    assert(reinterpret_cast<uintptr_t>(second->data.data()) % stonedb::PAGE_SIZE == 0);
+    assert(second->data.data() - first->data.data() == static_cast<ptrdiff_t>(stonedb::PAGE_SIZE));
+
+    first->data[0]=42;
+    assert(pool.find(1)->data[0] == 42);
+    assert(!pool.find(3));
+
+    //fill, then churn through many more pages than frames
+    for(stonedb::PageId id=3; id<=8; id++)
+    {
+        assert(pool.install(id));
+    }
+    assert(pool.isFull());
+
+    size_t before=allocationCount;
+    for(stonedb::PageId id=100; id<10100; id++)
+    {
+        auto victim=pool.pickVictim();
+        assert(victim);
+        pool.evict(victim->pageId);
+        auto page=pool.install(id);
+        assert(page && page->pageId == id);
+        assert(pool.find(id));
+    }
+    assert(allocationCount == before);
+    std::cout << "Miss path allocations: " << (allocationCount - before) << std::endl;
+
+    //clean pages are evicted ahead of dirty ones
+    pool.clear();
+    for(stonedb::PageId id=1; id<=8; id++)
+    {
+        auto page=pool.install(id);
+        page->isDirty=(id != 5);
+    }
+    auto victim=pool.pickVictim();
+    assert(victim && victim->pageId == 5);
+
+    //storage with a tiny pool must write dirty victims back, not drop them
+    std::remove("bufferpool_test.sdb");
+    std::remove("bufferpool_test.sdb.bloom");
+    {
+        stonedb::StorageManager storage;
+        stonedb::StorageOptions options;
+        options.cacheFrames=2;
+        assert(storage.open("bufferpool_test.sdb", options));
+        for(int i=0; i<300; i++)
+        {
+            assert(storage.putRecord("key" + std::to_string(i), "value_padding_padding_padding_" + std::to_string(i)));
+        }
+        for(int i=0; i<300; i++)
+        {
+            std::string value;
+            assert(storage.getRecord("key" + std::to_string(i), value));
+            assert(value == "value_padding_padding_padding_" + std::to_string(i));
+        }
+        storage.close();
+    }
+    std::remove("bufferpool_test.sdb");
+    std::remove("bufferpool_test.sdb.bloom");
+
+    stonedb::log("buffer pool tests passed");
+    return 0;
+}
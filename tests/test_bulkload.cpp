@@ -0,0 +1,255 @@
+#include"bulkload.hpp"
+#include"storage.hpp"
+#include"lsm.hpp"
+#include"lockmgr.hpp"
+#include<cassert>
+#include<cstdio>
+#include<cstdint>
+#include<filesystem>
+#include<fstream>
+#include<iostream>
+#include<fcntl.h>
+#include<unistd.h>
+
+static const char* DB_PATH="test_bulkload.sdb";
+static const char* WAL_PATH="test_bulkload.wal";
+static const char* INPUT_PATH="test_bulkload.input";
+
+static void cleanup()
+{
+    std::remove(DB_PATH);
+    std::remove(WAL_PATH);
+    std::remove(INPUT_PATH);
+    std::remove((std::string(DB_PATH) + ".bloom").c_str());
+    std::filesystem::remove_all("test_bulkload_lsm");
+}
+
+static void writeInput(const std::string& content)
+{
+    std::ofstream out(INPUT_PATH, std::ios::binary | std::ios::trunc);
+    out << content;
+}
+
+static std::string binaryRecord(const std::string& key, const std::string& value)
+{
+    uint32_t lengths[2]={static_cast<uint32_t>(key.size()), static_cast<uint32_t>(value.size())};
+    return std::string(reinterpret_cast<const char*>(lengths), sizeof(lengths)) + key + value;
+}
+
+static std::string keyFor(int i)
+{
+    char key[32];
+    snprintf(key, sizeof(key), "key%06d", i);
+    return key;
+}
+
+//Store: a page store with its log and transaction manager, reopened on demand
+struct Store
+{
+    std::shared_ptr<stonedb::StorageEngine> storage;
+    std::shared_ptr<stonedb::WALManager> wal;
+    std::unique_ptr<stonedb::TransactionManager> txnMgr;
+
+    explicit Store(std::shared_ptr<stonedb::StorageEngine> engine, const std::string& path, bool recover=true)
+        : storage(engine), wal(std::make_shared<stonedb::WALManager>())
+    {
+        assert(storage->open(path));
+        assert(wal->open(WAL_PATH));
+        if(recover) assert(storage->recover(*wal));
+        txnMgr=std::make_unique<stonedb::TransactionManager>(storage, wal, std::make_shared<stonedb::LockManager>());
+    }
+
+    ~Store()
+    {
+        txnMgr.reset();
+        storage->close();
+        wal->close();
+    }
+
+    bool load(stonedb::LoadFormat format, stonedb::BulkLoadResult& result, size_t memoryBytes=256 << 20)
+    {
+        stonedb::BulkLoadOptions options;
+        options.format=format;
+        options.memoryBytes=memoryBytes;
+        options.tempPrefix="test_bulkload_run";
+        return stonedb::bulkLoad(INPUT_PATH, options, *storage, *wal, *txnMgr, result);
+    }
+
+    std::string get(const std::string& key)
+    {
+        std::string value;
+        return storage->getRecord(key, value) ? value : "<missing>";
+    }
+};
+
+static void testFormats()
+{
+    cleanup();
+    Store store(std::make_shared<stonedb::StorageManager>(), DB_PATH);
+    stonedb::BulkLoadResult result;
+
+    writeInput("b,two\r\n\"a,comma\",\"say \"\"hi\"\"\"\n\"multi\",\"line one\nline two\"\nc,x,y\n");
+    assert(store.load(stonedb::LoadFormat::CSV, result));
+    assert(result.packed && result.stats.records == 4 && result.stats.pages == 1);
+    assert(store.get("a,comma") == "say \"hi\"");
+    assert(store.get("b") == "two");
+    assert(store.get("multi") == "line one\nline two");
+    assert(store.get("c") == "x,y");
+
+    writeInput("t1\tvalue\twith tab\nb\tnew b\n");
+    assert(store.load(stonedb::LoadFormat::TSV, result));
+    assert(store.get("t1") == "value\twith tab");
+    //an existing key is replaced, not duplicated
+    assert(store.get("b") == "new b");
+    auto records=store.storage->scanRecords();
+    assert(records.size() == 5);
+
+    writeInput(binaryRecord("bin", std::string("\0\1\2", 3)) + binaryRecord("bin", "last"));
+    assert(store.load(stonedb::LoadFormat::BINARY, result));
+    assert(result.duplicates == 1);
+    assert(store.get("bin") == "last");
+
+    //malformed input loads nothing
+    writeInput("good,1\nno separator\n");
+    assert(!store.load(stonedb::LoadFormat::CSV, result));
+    assert(store.get("good") == "<missing>");
+    writeInput(binaryRecord("ok", "1").substr(0, 9));
+    assert(!store.load(stonedb::LoadFormat::BINARY, result));
+}
+
+//a small sort budget forces spilled runs; later duplicates win across runs
+static void testExternalSort()
+{
+    cleanup();
+    const int count=20000;
+    std::string input;
+    for(int i=count - 1; i>=0; i--) input += keyFor(i) + ",first" + std::to_string(i) + "\n";
+    for(int i=0; i<count; i+=7) input += keyFor(i) + ",second" + std::to_string(i) + "\n";
+    writeInput(input);
+    stonedb::BulkLoadResult result;
+    uint32_t firstPage=0;
+    {
+        Store store(std::make_shared<stonedb::StorageManager>(), DB_PATH);
+        assert(store.storage->putRecord("key000003", "old"));
+        assert(store.load(stonedb::LoadFormat::CSV, result, 64 << 10));
+        assert(result.runs > 1);
+        assert(result.stats.records == count);
+        assert(result.duplicates == (count + 6) / 7);
+        firstPage=result.stats.firstPage;
+        assert(store.get("key000003") == "first3");
+        assert(store.get("key000007") == "second7");
+        std::cout << "  " << result.stats.records << " records in " << result.stats.pages << " pages, "
+                  << result.runs << " runs" << std::endl;
+    }
+    assert(!std::filesystem::exists("test_bulkload_run.0.run"));
+    //the loaded pages survive a reopen without the log
+    std::remove(WAL_PATH);
+    {
+        Store store(std::make_shared<stonedb::StorageManager>(), DB_PATH);
+        assert(store.get("key000000") == "second0");
+        assert(store.get("key019998") == "first19998");
+        assert(store.get("key000003") == "first3");
+        assert(store.storage->scanRecords().size() == count);
+    }
+
+    //a load whose record is logged but not published is published on recovery
+    int fd=open(DB_PATH, O_RDWR);
+    assert(fd >= 0);
+    assert(pwrite(fd, &firstPage, sizeof(firstPage), 16) == sizeof(firstPage));
+    close(fd);
+    {
+        stonedb::WALManager wal;
+        assert(wal.open(WAL_PATH));
+        uint32_t descriptor[2]={firstPage, firstPage + static_cast<uint32_t>(result.stats.pages)};
+        assert(wal.logBulkLoad(std::string_view(reinterpret_cast<const char*>(descriptor), sizeof(descriptor))));
+        wal.close();
+    }
+    {
+        Store store(std::make_shared<stonedb::StorageManager>(), DB_PATH, false);
+        assert(store.get("key000100") == "<missing>");
+        assert(store.storage->recover(*store.wal));
+        assert(store.get("key000100") == "first100");
+        assert(store.storage->scanRecords().size() == count);
+    }
+
+    //without its log record the load is dropped and its pages with it
+    fd=open(DB_PATH, O_RDWR);
+    assert(pwrite(fd, &firstPage, sizeof(firstPage), 16) == sizeof(firstPage));
+    close(fd);
+    std::remove(WAL_PATH);
+    {
+        Store store(std::make_shared<stonedb::StorageManager>(), DB_PATH);
+        assert(store.get("key000100") == "<missing>");
+        assert(store.storage->scanRecords().empty());
+        assert(store.storage->putRecord("after", "drop"));
+    }
+    assert(std::filesystem::file_size(DB_PATH) < 64 + static_cast<uintmax_t>(firstPage + 2) * stonedb::PAGE_SIZE);
+    {
+        Store store(std::make_shared<stonedb::StorageManager>(), DB_PATH);
+        assert(store.get("after") == "drop");
+    }
+}
+
+//ShortIterator: sorted records that stop early with a read error
+class ShortIterator : public stonedb::KVIterator
+{
+private:
+    int index=0;
+    std::string current;
+
+public:
+    ShortIterator() : current(keyFor(0)) {}
+    bool valid() const override { return index < 100; }
+    void next() override { current=keyFor(++index); }
+    std::string_view key() const override { return current; }
+    std::string_view value() const override { return "short"; }
+    bool isTombstone() const override { return false; }
+    bool failed() const override { return index >= 100; }
+};
+
+//a stream that fails part way is discarded, not published as the load
+static void testShortInput()
+{
+    cleanup();
+    {
+        Store store(std::make_shared<stonedb::StorageManager>(), DB_PATH);
+        assert(store.storage->putRecord("kept", "1"));
+        ShortIterator input;
+        stonedb::BulkLoadStats stats;
+        assert(!store.storage->bulkLoad(input, *store.wal, stats));
+        assert(store.get(keyFor(0)) == "<missing>");
+        writeInput("after,load\n");
+        stonedb::BulkLoadResult result;
+        assert(store.load(stonedb::LoadFormat::CSV, result));
+    }
+    Store store(std::make_shared<stonedb::StorageManager>(), DB_PATH);
+    assert(store.get(keyFor(0)) == "<missing>");
+    assert(store.get("after") == "load");
+    assert(store.storage->scanRecords().size() == 2);
+}
+
+//engines without the packed path fall back to one transaction
+static void testFallback()
+{
+    cleanup();
+    writeInput("k2,v2\nk1,v1\nk2,v2b\n");
+    Store store(std::make_shared<stonedb::LSMStorage>(), "test_bulkload_lsm");
+    stonedb::BulkLoadResult result;
+    assert(store.load(stonedb::LoadFormat::CSV, result));
+    assert(!result.packed && result.stats.records == 2 && result.duplicates == 1);
+    assert(store.get("k1") == "v1");
+    assert(store.get("k2") == "v2b");
+}
+
+int main()
+{
+    std::cout << "Testing bulk load..." << std::endl;
+    stonedb::setLogLevel(stonedb::LogLevel::ERROR);
+    testFormats();
+    testExternalSort();
+    testShortInput();
+    testFallback();
+    cleanup();
+    std::cout << "Bulk load tests passed!" << std::endl;
+    return 0;
+}
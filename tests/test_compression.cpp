@@ -0,0 +1,171 @@
+#include"storage.hpp"
+#include"compress.hpp"
+#include<cassert>
+#include<chrono>
+#include<cstring>
+#include<iostream>
+#include<random>
+
+static std::string jsonValue(int i)
+{
+    return "{\"id\":" + std::to_string(i) + ",\"name\":\"user" + std::to_string(i) +
+           "\",\"email\":\"user" + std::to_string(i) + "@example.com\",\"active\":true,\"roles\":[\"reader\",\"writer\"]}";
+}
+
+static void removeDb(const std::string& path)
+{
+    std::remove(path.c_str());
+    std::remove((path + ".bloom").c_str());
+    std::remove((path + ".pagemap").c_str());
+}
+
+static void roundTrip(const uint8_t* data, size_t size)
+{
+    std::vector<uint8_t> packed(size + size / 8 + 64);
+    size_t packedSize=stonedb::lzCompress(data, size, packed.data(), packed.size());
+    assert(packedSize > 0);
+    std::vector<uint8_t> out(size);
+    assert(stonedb::lzDecompress(packed.data(), packedSize, out.data(), size));
+    assert(size == 0 || memcmp(out.data(), data, size) == 0);
+    //a wrong output size or a truncated stream is rejected
+    std::vector<uint8_t> longer(size + 1);
+    assert(!stonedb::lzDecompress(packed.data(), packedSize, longer.data(), longer.size()));
+    if(packedSize > 1) assert(!stonedb::lzDecompress(packed.data(), packedSize - 1, out.data(), size));
+}
+
+static void testCodec()
+{
+    uint8_t page[stonedb::PAGE_SIZE]={0};
+    roundTrip(page, sizeof(page));
+    roundTrip(page, 0);
+    roundTrip(page, 7);
+
+    std::string text;
+    for(int i=0; text.size() < stonedb::PAGE_SIZE; i++) text += jsonValue(i);
+    roundTrip(reinterpret_cast<const uint8_t*>(text.data()), stonedb::PAGE_SIZE);
+    uint8_t packed[stonedb::PAGE_SIZE];
+    size_t size=stonedb::lzCompress(reinterpret_cast<const uint8_t*>(text.data()), stonedb::PAGE_SIZE, packed, sizeof(packed));
+    assert(size > 0 && size < stonedb::PAGE_SIZE / 2);
+
+    std::mt19937 rng(7);
+    for(auto& b : page) b=static_cast<uint8_t>(rng());
+    roundTrip(page, sizeof(page));
+    //incompressible input does not fit a smaller buffer
+    assert(stonedb::lzCompress(page, sizeof(page), packed, stonedb::PAGE_SIZE - 256) == 0);
+}
+
+static void testStorage(stonedb::StorageLayout layout, const std::string& path)
+{
+    removeDb(path);
+    stonedb::StorageOptions opts;
+    opts.layout=layout;
+    opts.compression=stonedb::PageCompression::LZ;
+    opts.cacheFrames=8;
+    const int numKeys=3000;
+    {
+        stonedb::StorageManager storage;
+        assert(storage.open(path, opts));
+        assert(storage.compression() == stonedb::PageCompression::LZ);
+        for(int i=0; i<numKeys; i++)
+        {
+            assert(storage.putRecord("key" + std::to_string(i), jsonValue(i)));
+        }
+        assert(storage.flushAll());
+        //rewriting with random bytes makes pages outgrow their extents
+        std::mt19937 rng(11);
+        for(int i=0; i<numKeys; i+=4)
+        {
+            std::string noise(60, '\0');
+            for(auto& c : noise) c=static_cast<char>('a' + rng() % 26);
+            assert(storage.putRecord("key" + std::to_string(i), noise));
+        }
+        for(int i=1; i<numKeys; i+=4)
+        {
+            assert(storage.deleteRecord("key" + std::to_string(i)));
+        }
+        storage.close();
+    }
+    //the file's compression setting wins on reopen
+    stonedb::StorageManager storage;
+    assert(storage.open(path, stonedb::StorageOptions()));
+    assert(storage.compression() == stonedb::PageCompression::LZ);
+    std::string value;
+    for(int i=0; i<numKeys; i++)
+    {
+        bool found=storage.getRecord("key" + std::to_string(i), value);
+        if(i % 4 == 1)
+        {
+            assert(!found);
+        }
+        else
+        {
+            assert(found);
+            if(i % 4 == 0) assert(value.size() == 60);
+            else assert(value == jsonValue(i));
+        }
+    }
+    assert(storage.scanRecords().size() == static_cast<size_t>(numKeys - numKeys / 4));
+    storage.close();
+    removeDb(path);
+}
+
+//random GETs over a data set about four times the cache size
+static void benchmark(stonedb::PageCompression compression, const char* name)
+{
+    std::string path=std::string("compression_bench_") + name + ".sdb";
+    removeDb(path);
+    const int numKeys=20000;
+    stonedb::StorageOptions opts;
+    opts.layout=stonedb::StorageLayout::HASH;
+    opts.compression=compression;
+    {
+        stonedb::StorageManager storage;
+        assert(storage.open(path, opts));
+        for(int i=0; i<numKeys; i++)
+        {
+            assert(storage.putRecord("key" + std::to_string(i), jsonValue(i)));
+        }
+        storage.close();
+    }
+    opts.cacheFrames=256;
+    stonedb::StorageManager storage;
+    assert(storage.open(path, opts));
+    std::mt19937 rng(42);
+    std::string value;
+    for(int i=0; i<numKeys; i++)
+    {
+        assert(storage.getRecord("key" + std::to_string(rng() % numKeys), value));
+    }
+    stonedb::PageCacheStats warm=storage.cacheStats();
+    const int gets=100000;
+    auto start=std::chrono::high_resolution_clock::now();
+    for(int i=0; i<gets; i++)
+    {
+        assert(storage.getRecord("key" + std::to_string(rng() % numKeys), value));
+    }
+    auto end=std::chrono::high_resolution_clock::now();
+    stonedb::PageCacheStats stats=storage.cacheStats();
+    uint64_t frameHits=stats.frameHits - warm.frameHits;
+    uint64_t compressedHits=stats.compressedHits - warm.compressedHits;
+    uint64_t diskReads=stats.diskReads - warm.diskReads;
+    double hitRatio=100.0 * (frameHits + compressedHits) / (frameHits + compressedHits + diskReads);
+    double bytesPerGet=static_cast<double>(stats.bytesRead - warm.bytesRead) / gets;
+    auto us=std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+    std::cout << name << ": hit ratio " << hitRatio << "% (" << compressedHits << " from the compressed tier), "
+              << bytesPerGet << " bytes read/get, " << (gets * 1e6 / std::max<int64_t>(us, 1)) << " gets/sec" << std::endl;
+    storage.close();
+    removeDb(path);
+}
+
+int main()
+{
+    std::cout << "Testing page compression..." << std::endl;
+    testCodec();
+    testStorage(stonedb::StorageLayout::HEAP, "compression_heap.sdb");
+    testStorage(stonedb::StorageLayout::HASH, "compression_hash.sdb");
+    std::cout << "Page compression tests passed!" << std::endl;
+
+    benchmark(stonedb::PageCompression::NONE, "uncompressed");
+    benchmark(stonedb::PageCompression::LZ, "lz");
+    return 0;
+}
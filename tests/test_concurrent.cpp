@@ -2,6 +2,7 @@
 #include"storage.hpp"
 #include"wal.hpp"
 #include"lockmgr.hpp"
+#include"statistics.hpp"
 #include<iostream>
 #include<thread>
 #include<vector>
@@ -31,6 +32,7 @@ int main()
     
     // test concurrent writes
     std::cout << "Testing concurrent writes..." << std::endl;
+    uint64_t syncsBefore=stonedb::Statistics::global().io(stonedb::IoFile::WAL).syncs;
     for(int i=0; i<numThreads; ++i) {
         threads.emplace_back([&, i]() {
             bool success=true;
@@ -68,6 +70,14 @@ int main()
         }
     }
     
+    // committers wait for the log outside txnMutex, so they can share syncs
+    uint64_t syncs=stonedb::Statistics::global().io(stonedb::IoFile::WAL).syncs - syncsBefore;
+    std::cout << numThreads * operationsPerThread << " commits, " << syncs << " log syncs" << std::endl;
+    if(syncs > static_cast<uint64_t>(numThreads * operationsPerThread)) {
+        std::cout << "more log syncs than commits" << std::endl;
+        return 1;
+    }
+    
     if(allSuccess) {
         std::cout << "All concurrent write threads succeeded" << std::endl;
     } else {
@@ -198,6 +208,7 @@ int main()
     
     // remove test files
     std::remove("concurrent_test.sdb");
+    std::remove("concurrent_test.sdb.bloom");
     std::remove("concurrent_test.wal");
     
     std::cout << "Concurrent transaction tests passed" << std::endl;
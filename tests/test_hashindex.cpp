@@ -0,0 +1,200 @@
+#include"storage.hpp"
+#include"statistics.hpp"
+#include<cassert>
+#include<chrono>
+#include<iostream>
+#include<map>
+#include<vector>
+
+static std::string keyFor(int i)
+{
+    return "user:" + std::to_string(i * 7919);
+}
+
+//loads numKeys records, reopens with a small cache and times cold point lookups
+static void benchmarkLayout(stonedb::StorageLayout layout, const char* name, int numKeys)
+{
+    std::string path=std::string("hashindex_bench_") + name + ".sdb";
+    std::remove(path.c_str());
+    std::remove((path + ".bloom").c_str());
+    stonedb::StorageOptions opts;
+    opts.layout=layout;
+    {
+        stonedb::StorageManager storage;
+        assert(storage.open(path, opts));
+        for(int i=0; i<numKeys; i++)
+        {
+            assert(storage.putRecord(keyFor(i), "value-" + std::to_string(i) + std::string(40, 'x')));
+        }
+        storage.close();
+    }
+
+    opts.cacheFrames=16;
+    stonedb::StorageManager storage;
+    auto start=std::chrono::high_resolution_clock::now();
+    assert(storage.open(path, opts));
+    auto opened=std::chrono::high_resolution_clock::now();
+    uint64_t readsBefore=storage.pageReads();
+    std::string value;
+    for(int i=0; i<numKeys; i++)
+    {
+        assert(storage.getRecord(keyFor((i * 104729) % numKeys), value));
+    }
+    auto end=std::chrono::high_resolution_clock::now();
+    double readsPerGet=static_cast<double>(storage.pageReads() - readsBefore) / numKeys;
+    auto openMs=std::chrono::duration_cast<std::chrono::milliseconds>(opened - start).count();
+    auto getUs=std::chrono::duration_cast<std::chrono::microseconds>(end - opened).count();
+    std::cout << name << ": open " << openMs << "ms, " << numKeys << " gets " << getUs / 1000 << "ms ("
+              << (numKeys * 1e6 / std::max<int64_t>(getUs, 1)) << " ops/sec), "
+              << readsPerGet << " page reads/get" << std::endl;
+    if(layout == stonedb::StorageLayout::HASH)
+    {
+        assert(readsPerGet <= 1.0);
+    }
+    storage.close();
+    std::remove(path.c_str());
+    std::remove((path + ".bloom").c_str());
+}
+
+//inserting or deleting a key changes only its bucket and the key count on
+//page 0, not the directory, so a flush writes just those pages
+static void testFlushWrites()
+{
+    std::remove("hashindex_flush.sdb");
+    std::remove("hashindex_flush.sdb.bloom");
+    stonedb::StorageOptions opts;
+    opts.layout=stonedb::StorageLayout::HASH;
+    stonedb::StorageManager storage;
+    assert(storage.open("hashindex_flush.sdb", opts));
+    for(int i=0; i<30000; i++) assert(storage.putRecord(keyFor(i), std::string(200, 'd')));
+    assert(storage.flushAll());
+    uint64_t before=stonedb::Statistics::global().io(stonedb::IoFile::DATA).writes;
+    assert(storage.putRecord("new key", "v"));
+    assert(storage.deleteRecord(keyFor(7)));
+    assert(storage.flushAll());
+    uint64_t writes=stonedb::Statistics::global().io(stonedb::IoFile::DATA).writes - before;
+    assert(writes <= 3);
+    storage.close();
+    assert(storage.open("hashindex_flush.sdb", opts));
+    std::string value;
+    assert(storage.getRecord("new key", value) && value == "v");
+    assert(!storage.getRecord(keyFor(7), value));
+    assert(storage.scanRecords().size() == 30000);
+    storage.close();
+    std::remove("hashindex_flush.sdb");
+    std::remove("hashindex_flush.sdb.bloom");
+}
+
+//an update that cannot find room, even after splitting to the maximum
+//depth, fails and leaves the committed value in place
+static void testFailedUpdate()
+{
+    //three keys whose hashes share the low 18 bits always land in one bucket
+    std::map<uint64_t, std::vector<std::string>> byBits;
+    std::vector<std::string> keys;
+    for(int i=0; keys.empty(); i++)
+    {
+        std::string key="same:" + std::to_string(i);
+        auto& group=byBits[stonedb::hashKey(key) & ((1 << 18) - 1)];
+        group.push_back(key);
+        if(group.size() == 3) keys=group;
+    }
+    std::remove("hashindex_update.sdb");
+    std::remove("hashindex_update.sdb.bloom");
+    stonedb::StorageOptions opts;
+    opts.layout=stonedb::StorageLayout::HASH;
+    stonedb::StorageManager storage;
+    assert(storage.open("hashindex_update.sdb", opts));
+    for(const auto& key : keys) assert(storage.putRecord(key, std::string(1300, 'o')));
+    assert(!storage.putRecord(keys[1], std::string(2000, 'n')));
+    std::string value;
+    for(const auto& key : keys) assert(storage.getRecord(key, value) && value == std::string(1300, 'o'));
+    assert(storage.flushAll());
+    storage.close();
+    assert(storage.open("hashindex_update.sdb", opts));
+    assert(storage.getRecord(keys[1], value) && value == std::string(1300, 'o'));
+    assert(storage.scanRecords().size() == 3);
+    storage.close();
+    std::remove("hashindex_update.sdb");
+    std::remove("hashindex_update.sdb.bloom");
+}
+
+int main()
+{
+    std::cout << "Testing extendible hash layout..." << std::endl;
+
+    std::remove("hashindex_test.sdb");
+    std::remove("hashindex_test.sdb.bloom");
+    stonedb::StorageOptions opts;
+    opts.layout=stonedb::StorageLayout::HASH;
+    opts.cacheFrames=4;
+    const int numKeys=5000;
+    {
+        stonedb::StorageManager storage;
+        assert(storage.open("hashindex_test.sdb", opts));
+        assert(storage.layout() == stonedb::StorageLayout::HASH);
+        for(int i=0; i<numKeys; i++)
+        {
+            assert(storage.putRecord(keyFor(i), "v" + std::to_string(i)));
+        }
+        //growing values force relocation inside a bucket or a split
+        for(int i=0; i<numKeys; i+=3)
+        {
+            assert(storage.putRecord(keyFor(i), std::string(100, 'g') + std::to_string(i)));
+        }
+        for(int i=1; i<numKeys; i+=3)
+        {
+            assert(storage.deleteRecord(keyFor(i)));
+        }
+        assert(!storage.deleteRecord("missing"));
+        assert(!storage.putRecord(std::string(10, 'k'), std::string(5000, 'v')));
+        storage.close();
+    }
+
+    //default options on reopen: the layout comes from the file header
+    {
+        stonedb::StorageManager storage;
+        assert(storage.open("hashindex_test.sdb"));
+        assert(storage.layout() == stonedb::StorageLayout::HASH);
+        std::string value;
+        for(int i=0; i<numKeys; i++)
+        {
+            bool found=storage.getRecord(keyFor(i), value);
+            if(i % 3 == 1)
+            {
+                assert(!found);
+            }
+            else if(i % 3 == 0)
+            {
+                assert(found && value == std::string(100, 'g') + std::to_string(i));
+            }
+            else
+            {
+                assert(found && value == "v" + std::to_string(i));
+            }
+        }
+        assert(storage.scanRecords().size() == static_cast<size_t>(numKeys - (numKeys + 1) / 3));
+        storage.close();
+    }
+
+    //a stale bloom filter is rebuilt from the buckets
+    std::remove("hashindex_test.sdb.bloom");
+    {
+        stonedb::StorageManager storage;
+        assert(storage.open("hashindex_test.sdb", opts));
+        std::string value;
+        assert(storage.getRecord(keyFor(2), value) && value == "v2");
+        assert(!storage.getRecord(keyFor(1), value));
+        storage.close();
+    }
+    std::remove("hashindex_test.sdb");
+    std::remove("hashindex_test.sdb.bloom");
+
+    testFlushWrites();
+    testFailedUpdate();
+    benchmarkLayout(stonedb::StorageLayout::HEAP, "heap", 20000);
+    benchmarkLayout(stonedb::StorageLayout::HASH, "hash", 20000);
+
+    std::cout << "Hash layout tests passed!" << std::endl;
+    return 0;
+}
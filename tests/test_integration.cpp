@@ -96,6 +96,7 @@ int main()
     
     // remove test files
     std::remove("integration_test.sdb");
+    std::remove("integration_test.sdb.bloom");
     std::remove("integration_test.wal");
     
     std::cout << "Integration test passed" << std::endl;
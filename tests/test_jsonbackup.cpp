@@ -0,0 +1,163 @@
+#include"jsonbackup.hpp"
+#include"storage.hpp"
+#include"lsm.hpp"
+#include"lockmgr.hpp"
+#include<cassert>
+#include<chrono>
+#include<cstdio>
+#include<filesystem>
+#include<iostream>
+#include<map>
+#include<sstream>
+
+//Store: an engine with its log and transaction manager
+struct Store
+{
+    std::string path;
+    std::shared_ptr<stonedb::StorageEngine> storage;
+    std::shared_ptr<stonedb::WALManager> wal;
+    std::unique_ptr<stonedb::TransactionManager> txnMgr;
+
+    Store(std::shared_ptr<stonedb::StorageEngine> engine, const std::string& p)
+        : path(p), storage(engine), wal(std::make_shared<stonedb::WALManager>())
+    {
+        std::filesystem::remove_all(path);
+        std::remove((path + ".wal").c_str());
+        assert(storage->open(path));
+        assert(wal->open(path + ".wal"));
+        txnMgr=std::make_unique<stonedb::TransactionManager>(storage, wal, std::make_shared<stonedb::LockManager>());
+    }
+
+    ~Store()
+    {
+        txnMgr.reset();
+        storage->close();
+        wal->close();
+        std::filesystem::remove_all(path);
+        std::remove((path + ".wal").c_str());
+        std::remove((path + ".bloom").c_str());
+    }
+
+    std::map<std::string, std::string> contents()
+    {
+        std::map<std::string, std::string> out;
+        for(const auto& record : storage->scanRecords()) out[record.key]=record.value;
+        return out;
+    }
+};
+
+static std::map<std::string, std::string> trickyRecords()
+{
+    std::map<std::string, std::string> records;
+    std::string control;
+    for(int c=0; c<0x20; c++) control.push_back(static_cast<char>(c));
+    records["control"]=control;
+    records["quotes \"and\" \\backslashes\\"]="\"\"\"\\\\\\/";
+    records["high"]="caf\xc3\xa9 \xff\xfe raw bytes";
+    records["empty"]="";
+    records["multi\nline key"]="line one\nline two\r\n";
+    records["big"]=std::string(3000, '"');
+    for(int i=0; i<2500; i++) records["bulk" + std::to_string(i)]="value " + std::to_string(i);
+    return records;
+}
+
+//every record survives export and import unchanged, on both engines
+static void testRoundTrip(stonedb::EngineType type, const std::string& path)
+{
+    auto records=trickyRecords();
+    std::stringstream document;
+    {
+        Store source(stonedb::createStorageEngine(type), path);
+        auto txnId=source.txnMgr->beginTransaction();
+        for(const auto& entry : records) assert(source.txnMgr->putRecord(txnId, entry.first, entry.second));
+        assert(source.txnMgr->commitTransaction(txnId));
+        uint64_t written=0;
+        assert(stonedb::writeJsonBackup(*source.storage, document, written));
+        assert(written == records.size());
+    }
+    Store target(stonedb::createStorageEngine(type), path);
+    uint64_t read=0;
+    assert(stonedb::readJsonBackup(document, *target.txnMgr, 1000, read));
+    assert(read == records.size());
+    assert(target.contents() == records);
+}
+
+//the multi-line layout older releases wrote, plus escapes they never produced
+static void testCompatibility()
+{
+    Store target(std::make_shared<stonedb::StorageManager>(), "test_jsonbackup_compat.sdb");
+    std::istringstream legacy(
+        "{\n"
+        "  \"stonedb_backup\": true,\n"
+        "  \"version\": \"1.0.0\",\n"
+        "  \"exported_by\": {\"tool\": [1, 2.5e3, null, false, \"x\"]},\n"
+        "  \"records\": [\n"
+        "    {\n"
+        "      \"key\": \"name\",\n"
+        "      \"value\": \"say \\\"hi\\\"\\n\"\n"
+        "    },\n"
+        "    {\"value\": \"\\u00e9\\u20ac\\ud83d\\ude00\\u0001\", \"comment\": \"ignored\", \"key\": \"unicode\"}\n"
+        "  ]\n"
+        "}\n");
+    uint64_t read=0;
+    assert(stonedb::readJsonBackup(legacy, *target.txnMgr, 1, read));
+    assert(read == 2);
+    auto contents=target.contents();
+    assert(contents["name"] == "say \"hi\"\n");
+    assert(contents["unicode"] == "\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80\x01");
+
+    std::istringstream empty("{\"records\": []}");
+    assert(stonedb::readJsonBackup(empty, *target.txnMgr, 10, read) && read == 0);
+}
+
+//malformed documents fail; batches committed before the error stay
+static void testErrors()
+{
+    Store target(std::make_shared<stonedb::StorageManager>(), "test_jsonbackup_errors.sdb");
+    uint64_t read=0;
+    for(const char* bad : {"", "[]", "{\"version\": \"1\"}", "{\"records\": [{\"key\": \"k\"}]}",
+                           "{\"records\": [{\"key\": \"k\", \"value\": \"v\"}", "{\"records\": []} trailing",
+                           "{\"records\": [{\"key\": \"k\", \"value\": \"bad \\q escape\"}]}"})
+    {
+        std::istringstream in(bad);
+        assert(!stonedb::readJsonBackup(in, *target.txnMgr, 10, read));
+    }
+    assert(target.contents().empty());
+
+    std::istringstream partial("{\"records\": [{\"key\": \"a\", \"value\": \"1\"}, {\"key\": \"b\", \"value\": \"2\"}, "
+                               "{\"key\": \"c\", \"value\": \"3\"}, {\"key\": \"d\" \"value\": \"4\"}]}");
+    assert(!stonedb::readJsonBackup(partial, *target.txnMgr, 2, read));
+    assert(read == 2);
+    auto contents=target.contents();
+    assert(contents.size() == 2 && contents.count("a") && contents.count("b"));
+}
+
+//escaping is linear: 1 MB values made only of characters that need escaping
+static void benchmark()
+{
+    Store source(std::make_shared<stonedb::LSMStorage>(), "test_jsonbackup_bench");
+    auto txnId=source.txnMgr->beginTransaction();
+    std::string value(stonedb::MAX_VALUE_SIZE, '"');
+    for(int i=0; i<20; i++) assert(source.txnMgr->putRecord(txnId, "k" + std::to_string(i), value));
+    assert(source.txnMgr->commitTransaction(txnId));
+    std::stringstream document;
+    uint64_t written=0;
+    auto start=std::chrono::steady_clock::now();
+    assert(stonedb::writeJsonBackup(*source.storage, document, written) && written == 20);
+    double seconds=std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "  exported " << document.str().size() / 1024 << " KB of escaped quotes in "
+              << seconds * 1000 << " ms" << std::endl;
+}
+
+int main()
+{
+    std::cout << "Testing JSON backup..." << std::endl;
+    stonedb::setLogLevel(stonedb::LogLevel::ERROR);
+    testRoundTrip(stonedb::EngineType::PAGE, "test_jsonbackup.sdb");
+    testRoundTrip(stonedb::EngineType::LSM, "test_jsonbackup_lsm");
+    testCompatibility();
+    testErrors();
+    benchmark();
+    std::cout << "JSON backup tests passed!" << std::endl;
+    return 0;
+}
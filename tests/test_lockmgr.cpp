@@ -1,5 +1,7 @@
 #include"lockmgr.hpp"
 #include<cassert>
+#include<chrono>
+#include<thread>
 
 int main()
 {
@@ -20,6 +22,24 @@ int main()
     // release all locks
     assert(lockMgr.releaseAllLocks(txn1));
     
+    // a shared holder upgrades to exclusive without waiting on itself
+    assert(lockMgr.acquireLock(txn1, "key2", stonedb::LockType::SHARED));
+    assert(lockMgr.acquireLock(txn1, "key2", stonedb::LockType::EXCLUSIVE));
+    assert(lockMgr.releaseAllLocks(txn1));
+
+    // two shared holders upgrading at once: the second one closes the cycle and fails
+    stonedb::TransactionId txn2=2;
+    assert(lockMgr.acquireLock(txn1, "key3", stonedb::LockType::SHARED));
+    assert(lockMgr.acquireLock(txn2, "key3", stonedb::LockType::SHARED));
+    bool upgraded=false;
+    std::thread waiter([&]() { upgraded=lockMgr.acquireLock(txn1, "key3", stonedb::LockType::EXCLUSIVE); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    assert(!lockMgr.acquireLock(txn2, "key3", stonedb::LockType::EXCLUSIVE));
+    assert(lockMgr.releaseAllLocks(txn2));
+    waiter.join();
+    assert(upgraded);
+    assert(lockMgr.releaseAllLocks(txn1));
+    
     stonedb::log("lock manager tests passed");
     return 0;
 }
@@ -0,0 +1,151 @@
+#include"common.hpp"
+#include<cassert>
+#include<chrono>
+#include<ctime>
+#include<fcntl.h>
+#include<fstream>
+#include<iomanip>
+#include<iostream>
+#include<thread>
+#include<unistd.h>
+#include<vector>
+
+static int evaluations=0;
+static std::string countedMessage()
+{
+    evaluations++;
+    return "counted";
+}
+
+//runs body with stdout going to path (or /dev/null), flushing the logger first
+template<typename F>
+static void withStdout(const char* path, F body)
+{
+    stonedb::flushLog();
+    std::cout.flush();
+    fflush(stdout);
+    int saved=dup(STDOUT_FILENO);
+    int fd=::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    dup2(fd, STDOUT_FILENO);
+    ::close(fd);
+    body();
+    stonedb::flushLog();
+    std::cout.flush();
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    ::close(saved);
+}
+
+static void testLevels()
+{
+    stonedb::setLogLevel(stonedb::LogLevel::INFO);
+    //compiled out: the message expression is never evaluated
+#if STONEDB_MIN_LOG_LEVEL > 0
+    STONEDB_TRACE(countedMessage());
+    stonedb::setLogLevel(stonedb::LogLevel::TRACE);
+    STONEDB_TRACE(countedMessage());
+    assert(evaluations == 0);
+#endif
+    //disabled at runtime: not evaluated either
+    stonedb::setLogLevel(stonedb::LogLevel::INFO);
+    STONEDB_DEBUG(countedMessage());
+    assert(evaluations == 0);
+    stonedb::setLogLevel(stonedb::LogLevel::DEBUG);
+    withStdout("logger_levels.txt", [] { STONEDB_DEBUG(countedMessage()); });
+    assert(evaluations == 1);
+    std::ifstream in("logger_levels.txt");
+    std::string line;
+    assert(std::getline(in, line) && line.find("DEBUG counted") != std::string::npos);
+    stonedb::setLogLevel(stonedb::LogLevel::INFO);
+
+    stonedb::LogLevel level;
+    assert(stonedb::parseLogLevel("trace", level) && level == stonedb::LogLevel::TRACE);
+    assert(!stonedb::parseLogLevel("loud", level));
+    std::remove("logger_levels.txt");
+}
+
+//lines from several threads all arrive, each thread's in order
+static void testThreads()
+{
+    const int numThreads=4;
+    const int perThread=1000;
+    withStdout("logger_threads.txt", []
+    {
+        std::vector<std::thread> threads;
+        for(int t=0; t<numThreads; t++)
+        {
+            threads.emplace_back([t]()
+            {
+                for(int i=0; i<perThread; i++)
+                {
+                    stonedb::log("worker " + std::to_string(t) + " line " + std::to_string(i));
+                }
+            });
+        }
+        for(auto& thread : threads) thread.join();
+        stonedb::log(std::string(1000, 'x'));
+    });
+    std::ifstream in("logger_threads.txt");
+    std::string line;
+    std::vector<int> next(numThreads, 0);
+    size_t longest=0;
+    while(std::getline(in, line))
+    {
+        size_t at=line.find("worker ");
+        if(at == std::string::npos)
+        {
+            longest=std::max(longest, line.size());
+            continue;
+        }
+        int t=std::stoi(line.substr(at + 7));
+        int i=std::stoi(line.substr(line.find(" line ") + 6));
+        assert(i == next[t]);
+        next[t]++;
+    }
+    for(int t=0; t<numThreads; t++) assert(next[t] == perThread);
+    assert(stonedb::droppedLogMessages() == 0);
+    //long lines are cut to fit a ring slot
+    assert(longest > 200 && longest < 1000);
+    std::remove("logger_threads.txt");
+}
+
+//the synchronous logger this replaced
+static void oldLog(const std::string& msg)
+{
+    auto now=std::chrono::system_clock::now();
+    auto time_t=std::chrono::system_clock::to_time_t(now);
+    std::cout << "[" << std::put_time(std::localtime(&time_t), "%H:%M:%S") << "] " << msg << std::endl;
+}
+
+static void benchmark()
+{
+    const int calls=200000;
+    double oldNs=0, asyncNs=0, disabledNs=0;
+    uint64_t droppedBefore=stonedb::droppedLogMessages();
+    withStdout("/dev/null", [&]
+    {
+        auto start=std::chrono::high_resolution_clock::now();
+        for(int i=0; i<calls; i++) oldLog("txn 42 put key" + std::to_string(i) + " = value");
+        auto mid=std::chrono::high_resolution_clock::now();
+        for(int i=0; i<calls; i++) stonedb::log("txn 42 put key" + std::to_string(i) + " = value");
+        auto end=std::chrono::high_resolution_clock::now();
+        for(int i=0; i<calls; i++) STONEDB_DEBUG("txn 42 put key" + std::to_string(i) + " = value");
+        auto last=std::chrono::high_resolution_clock::now();
+        oldNs=std::chrono::duration<double, std::nano>(mid - start).count() / calls;
+        asyncNs=std::chrono::duration<double, std::nano>(end - mid).count() / calls;
+        disabledNs=std::chrono::duration<double, std::nano>(last - end).count() / calls;
+    });
+    std::cout << "per line: synchronous cout " << oldNs << " ns, async ring " << asyncNs
+              << " ns, disabled level " << disabledNs << " ns ("
+              << stonedb::droppedLogMessages() - droppedBefore << " dropped under flood)" << std::endl;
+}
+
+int main()
+{
+    std::cout << "Testing logger..." << std::endl;
+    testLevels();
+    testThreads();
+    benchmark();
+    std::cout << "Logger tests passed!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,165 @@
+#include"lsm.hpp"
+#include"memtable.hpp"
+#include"wal.hpp"
+#include<cassert>
+#include<filesystem>
+#include<iostream>
+
+static std::string keyFor(int i)
+{
+    char key[16];
+    snprintf(key, sizeof(key), "key%06d", i);
+    return key;
+}
+
+int main()
+{
+    std::cout << "Testing LSM storage..." << std::endl;
+
+    //memtable: overwrite keeps one entry, tombstones shadow, iteration is sorted
+    {
+        stonedb::MemTable table;
+        table.put("b", "1");
+        table.put("a", "2");
+        table.put("b", "3");
+        table.remove("c");
+        std::string value;
+        assert(table.get("b", value) == stonedb::LookupResult::FOUND && value == "3");
+        assert(table.get("c", value) == stonedb::LookupResult::DELETED);
+        assert(table.get("d", value) == stonedb::LookupResult::NOT_FOUND);
+        assert(table.size() == 3);
+        auto it=table.newIterator();
+        assert(it->valid() && it->key() == "a");
+        it->next();
+        assert(it->valid() && it->key() == "b" && it->value() == "3");
+        it->next();
+        assert(it->valid() && it->key() == "c" && it->isTombstone());
+        it->next();
+        assert(!it->valid());
+    }
+
+    //small limits so the test goes through flushes and several levels
+    stonedb::StorageOptions opts;
+    opts.memtableBytes=64*1024;
+    opts.l0CompactionTrigger=2;
+    opts.levelBaseBytes=128*1024;
+    opts.tableTargetBytes=32*1024;
+
+    const int numKeys=20000;
+    std::filesystem::remove_all("lsm_test.db");
+    {
+        stonedb::LSMStorage storage;
+        assert(storage.open("lsm_test.db", opts));
+        std::string payload(100, 'v');
+        for(int i=0; i<numKeys; i++)
+        {
+            assert(storage.putRecord(keyFor(i), payload + std::to_string(i)));
+        }
+        //overwrite and delete keys that already reached the tables
+        for(int i=0; i<numKeys; i+=10)
+        {
+            assert(storage.putRecord(keyFor(i), "updated" + std::to_string(i)));
+        }
+        for(int i=5; i<numKeys; i+=10)
+        {
+            assert(storage.deleteRecord(keyFor(i)));
+        }
+        assert(!storage.deleteRecord("missing"));
+        storage.waitForBackgroundWork();
+
+        auto counts=storage.levelTableCounts();
+        size_t deeper=0;
+        for(size_t level=1; level<counts.size(); level++) deeper += counts[level];
+        std::cout << "Tables: L0=" << counts[0] << " L1+=" << deeper << std::endl;
+        assert(counts[0] < opts.l0CompactionTrigger);
+        assert(deeper > 0);
+
+        std::string value;
+        for(int i=0; i<numKeys; i++)
+        {
+            bool found=storage.getRecord(keyFor(i), value);
+            if(i % 10 == 5)
+            {
+                assert(!found);
+            }
+            else if(i % 10 == 0)
+            {
+                assert(found && value == "updated" + std::to_string(i));
+            }
+            else
+            {
+                assert(found && value == payload + std::to_string(i));
+            }
+        }
+        storage.close();
+    }
+
+    //reopen from the manifest; scan is sorted and skips deleted keys
+    {
+        stonedb::LSMStorage storage;
+        assert(storage.open("lsm_test.db", opts));
+        auto records=storage.scanRecords();
+        assert(records.size() == static_cast<size_t>(numKeys - numKeys/10));
+        for(size_t i=1; i<records.size(); i++)
+        {
+            assert(records[i-1].key < records[i].key);
+        }
+        std::string value;
+        assert(storage.getRecord(keyFor(10), value) && value == "updated10");
+        assert(!storage.getRecord(keyFor(15), value));
+        storage.close();
+    }
+
+    //memtable contents survive a crash through WAL redo
+    std::filesystem::remove_all("lsm_recover.db");
+    std::remove("lsm_recover.wal");
+    {
+        stonedb::WALManager wal;
+        assert(wal.open("lsm_recover.wal"));
+        assert(wal.logBeginTxn(1));
+        assert(wal.logPutRecord(1, "alpha", "1"));
+        assert(wal.logPutRecord(1, "beta", "2"));
+        assert(wal.logCommitTxn(1));
+        assert(wal.logBeginTxn(2));
+        assert(wal.logDeleteRecord(2, "alpha"));
+        assert(wal.logCommitTxn(2));
+        assert(wal.logBeginTxn(3));
+        assert(wal.logPutRecord(3, "gamma", "uncommitted"));
+        assert(wal.flush());
+        wal.close();
+
+        auto storage=stonedb::createStorageEngine(stonedb::EngineType::LSM);
+        assert(storage->open("lsm_recover.db", opts));
+        stonedb::WALManager replay;
+        assert(replay.open("lsm_recover.wal"));
+        assert(storage->recover(replay));
+        std::string value;
+        assert(!storage->getRecord("alpha", value));
+        assert(storage->getRecord("beta", value) && value == "2");
+        assert(!storage->getRecord("gamma", value));
+        assert(replay.checkpoint(storage) && replay.truncateLog());
+        replay.close();
+        storage->close();
+
+        assert(storage->open("lsm_recover.db", opts));
+        assert(storage->getRecord("beta", value) && value == "2");
+        storage->close();
+    }
+
+    //a page store file is not an LSM directory
+    std::remove("lsm_page.sdb");
+    {
+        std::ofstream file("lsm_page.sdb");
+    }
+    {
+        stonedb::LSMStorage storage;
+        assert(!storage.open("lsm_page.sdb", opts));
+    }
+
+    std::filesystem::remove_all("lsm_test.db");
+    std::filesystem::remove_all("lsm_recover.db");
+    std::remove("lsm_recover.wal");
+    std::remove("lsm_page.sdb");
+    std::cout << "LSM tests passed!" << std::endl;
+    return 0;
+}
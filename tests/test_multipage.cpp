@@ -8,6 +8,7 @@ int main()
     
     // clean up old test file
     std::remove("multipage_test.sdb");
+    std::remove("multipage_test.sdb.bloom");
     
     stonedb::StorageManager storage;
     assert(storage.open("multipage_test.sdb"));
@@ -91,6 +92,7 @@ int main()
     
     // cleanup
     std::remove("multipage_test.sdb");
+    std::remove("multipage_test.sdb.bloom");
     
     std::cout << "Multi-page storage tests passed" << std::endl;
     return 0;
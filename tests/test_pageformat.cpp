@@ -0,0 +1,187 @@
+#include"storage.hpp"
+#include"pageformat.hpp"
+#include<cassert>
+#include<chrono>
+#include<iostream>
+#include<map>
+
+using stonedb::PageFormat;
+
+static std::string tenantKey(int i)
+{
+    return "tenant:12345:user:" + std::to_string(100000 + i);
+}
+
+static size_t countRecords(PageFormat format, const uint8_t* data)
+{
+    size_t count=0;
+    stonedb::forEachInPage(format, data, [&](std::string_view, std::string_view) { count++; });
+    return count;
+}
+
+static bool pagePut(PageFormat format, uint8_t* data, const std::string& key, const std::string& value)
+{
+    bool modified;
+    return stonedb::putInPage(format, data, key, value, stonedb::hashKey(key), modified);
+}
+
+static void testPageOperations(PageFormat format)
+{
+    uint8_t page[stonedb::PAGE_SIZE]={0};
+    std::map<std::string, std::string> expected;
+    std::string_view found;
+    assert(!stonedb::findInPage(format, page, "missing", stonedb::hashKey("missing"), found));
+    assert(countRecords(format, page) == 0);
+
+    for(int i=0; i<40; i++)
+    {
+        assert(pagePut(format, page, tenantKey(i), "v" + std::to_string(i)));
+        expected[tenantKey(i)]="v" + std::to_string(i);
+    }
+    //a key outside the shared prefix shrinks it without losing anything
+    assert(pagePut(format, page, "other", "o"));
+    expected["other"]="o";
+    //shrink in place, then grow past the old size
+    assert(pagePut(format, page, tenantKey(3), "s"));
+    expected[tenantKey(3)]="s";
+    assert(pagePut(format, page, tenantKey(4), std::string(60, 'g')));
+    expected[tenantKey(4)]=std::string(60, 'g');
+    assert(stonedb::eraseFromPage(format, page, tenantKey(5), stonedb::hashKey(tenantKey(5))));
+    assert(!stonedb::eraseFromPage(format, page, tenantKey(5), stonedb::hashKey(tenantKey(5))));
+    expected.erase(tenantKey(5));
+
+    for(const auto& pair : expected)
+    {
+        assert(stonedb::findInPage(format, page, pair.first, stonedb::hashKey(pair.first), found));
+        assert(found == pair.second);
+    }
+    assert(!stonedb::findInPage(format, page, tenantKey(5), stonedb::hashKey(tenantKey(5)), found));
+    std::map<std::string, std::string> seen;
+    stonedb::forEachInPage(format, page, [&](std::string_view key, std::string_view value)
+    {
+        seen[std::string(key)]=std::string(value);
+    });
+    assert(seen == expected);
+}
+
+//fills one page with erase/re-put churn so dead space has to be reclaimed
+static void testSlottedReclaim()
+{
+    const PageFormat format=PageFormat::SLOTTED;
+    uint8_t page[stonedb::PAGE_SIZE]={0};
+    int stored=0;
+    while(pagePut(format, page, tenantKey(stored), std::string(20, 'a'))) stored++;
+    assert(countRecords(format, page) == static_cast<size_t>(stored));
+    for(int round=0; round<20; round++)
+    {
+        for(int i=round % 2; i<stored; i+=2)
+        {
+            assert(stonedb::eraseFromPage(format, page, tenantKey(i), stonedb::hashKey(tenantKey(i))));
+        }
+        for(int i=round % 2; i<stored; i+=2)
+        {
+            assert(pagePut(format, page, tenantKey(i), std::string(20, 'a' + round)));
+        }
+    }
+    assert(countRecords(format, page) == static_cast<size_t>(stored));
+    std::string_view found;
+    assert(stonedb::findInPage(format, page, tenantKey(0), stonedb::hashKey(tenantKey(0)), found));
+    assert(found == std::string(20, 'a' + 18));
+}
+
+static void testStorage(stonedb::StorageLayout layout, const char* path)
+{
+    std::remove(path);
+    std::remove((std::string(path) + ".bloom").c_str());
+    stonedb::StorageOptions opts;
+    opts.layout=layout;
+    opts.pageFormat=PageFormat::SLOTTED;
+    opts.cacheFrames=8;
+    const int numKeys=3000;
+    {
+        stonedb::StorageManager storage;
+        assert(storage.open(path, opts));
+        assert(storage.pageFormat() == PageFormat::SLOTTED);
+        for(int i=0; i<numKeys; i++)
+        {
+            assert(storage.putRecord(tenantKey(i), "v" + std::to_string(i)));
+        }
+        for(int i=0; i<numKeys; i+=3)
+        {
+            assert(storage.putRecord(tenantKey(i), std::string(80, 'g')));
+        }
+        for(int i=1; i<numKeys; i+=3)
+        {
+            assert(storage.deleteRecord(tenantKey(i)));
+        }
+        storage.close();
+    }
+    //the file's format wins over the options on reopen
+    stonedb::StorageManager storage;
+    assert(storage.open(path, stonedb::StorageOptions()));
+    assert(storage.pageFormat() == PageFormat::SLOTTED);
+    std::string value;
+    for(int i=0; i<numKeys; i++)
+    {
+        bool found=storage.getRecord(tenantKey(i), value);
+        if(i % 3 == 1)
+        {
+            assert(!found);
+        }
+        else
+        {
+            assert(found);
+            assert(value == (i % 3 == 0 ? std::string(80, 'g') : "v" + std::to_string(i)));
+        }
+    }
+    assert(storage.scanRecords().size() == static_cast<size_t>(numKeys - numKeys / 3));
+    storage.close();
+    std::remove(path);
+    std::remove((std::string(path) + ".bloom").c_str());
+}
+
+//records per page and in-page lookup cost for long shared-prefix keys
+static void benchmarkFormat(PageFormat format, const char* name)
+{
+    uint8_t page[stonedb::PAGE_SIZE]={0};
+    int stored=0;
+    while(pagePut(format, page, tenantKey(stored), "12345678")) stored++;
+
+    std::vector<std::string> keys;
+    std::vector<uint64_t> hashes;
+    for(int i=0; i<stored; i++)
+    {
+        keys.push_back(tenantKey(i));
+        hashes.push_back(stonedb::hashKey(keys.back()));
+    }
+    const int rounds=2000;
+    size_t hits=0;
+    std::string_view found;
+    auto start=std::chrono::high_resolution_clock::now();
+    for(int r=0; r<rounds; r++)
+    {
+        for(int i=0; i<stored; i++)
+        {
+            hits += stonedb::findInPage(format, page, keys[i], hashes[i], found);
+        }
+    }
+    auto end=std::chrono::high_resolution_clock::now();
+    assert(hits == static_cast<size_t>(stored) * rounds);
+    double ns=std::chrono::duration<double, std::nano>(end - start).count() / (static_cast<double>(stored) * rounds);
+    std::cout << name << ": " << stored << " records/page, " << ns << " ns/lookup" << std::endl;
+}
+
+int main()
+{
+    std::cout << "Testing page formats..." << std::endl;
+    testPageOperations(PageFormat::RECORDS);
+    testPageOperations(PageFormat::SLOTTED);
+    testSlottedReclaim();
+    testStorage(stonedb::StorageLayout::HEAP, "pageformat_heap.sdb");
+    testStorage(stonedb::StorageLayout::HASH, "pageformat_hash.sdb");
+    std::cout << "Page format tests passed!" << std::endl;
+
+    benchmarkFormat(PageFormat::RECORDS, "records");
+    benchmarkFormat(PageFormat::SLOTTED, "slotted");
+    return 0;
+}
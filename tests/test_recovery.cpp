@@ -3,10 +3,82 @@
 #include"wal.hpp"
 #include"lockmgr.hpp"
 #include<cassert>
+#include<chrono>
 #include<fstream>
+#include<unordered_map>
+
+//redo of a large log on 1..N threads must end in the same state
+static void benchmarkRedo()
+{
+    const int numKeys=20000;
+    const int numTxns=4000;
+    const int txnSize=50;
+    std::remove("recovery_bench.wal");
+    std::unordered_map<std::string, std::string> expected;
+    {
+        stonedb::WALManager wal;
+        assert(wal.open("recovery_bench.wal"));
+        uint64_t seed=12345;
+        for(int t=1; t<=numTxns; t++)
+        {
+            assert(wal.logBeginTxn(t));
+            for(int i=0; i<txnSize; i++)
+            {
+                seed=seed * 6364136223846793005ULL + 1442695040888963407ULL;
+                std::string key="key" + std::to_string((seed >> 33) % numKeys);
+                if((seed >> 20) % 10 == 0)
+                {
+                    assert(wal.logDeleteRecord(t, key));
+                    if(t % 7) expected.erase(key);
+                }
+                else
+                {
+                    std::string value="value" + std::to_string(t) + "_" + std::to_string(i);
+                    assert(wal.logPutRecord(t, key, value));
+                    if(t % 7) expected[key]=value;
+                }
+            }
+            //every seventh transaction aborts
+            if(t % 7) assert(wal.logCommitTxn(t));
+            else assert(wal.logAbortTxn(t));
+        }
+        wal.close();
+    }
+
+    for(size_t threads : {1, 2, 4})
+    {
+        std::remove("recovery_bench.sdb");
+        std::remove("recovery_bench.sdb.bloom");
+        stonedb::StorageOptions opts;
+        opts.layout=stonedb::StorageLayout::HASH;
+        stonedb::StorageManager storage;
+        stonedb::WALManager wal;
+        assert(storage.open("recovery_bench.sdb", opts));
+        assert(wal.open("recovery_bench.wal"));
+        auto start=std::chrono::high_resolution_clock::now();
+        assert(storage.recover(wal, threads));
+        auto end=std::chrono::high_resolution_clock::now();
+        auto ms=std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+        std::cout << "redo of " << numTxns * txnSize << " records on " << threads << " thread(s): " << ms << " ms" << std::endl;
+
+        assert(storage.scanRecords().size() == expected.size());
+        std::string value;
+        for(const auto& kv : expected)
+        {
+            assert(storage.getRecord(kv.first, value) && value == kv.second);
+        }
+        wal.close();
+        storage.close();
+    }
+    std::remove("recovery_bench.sdb");
+    std::remove("recovery_bench.sdb.bloom");
+    std::remove("recovery_bench.wal");
+}
 
 int main()
 {
+    benchmarkRedo();
+
     // test crash recovery scenario
     std::cout << "Testing crash recovery..." << std::endl;
     
@@ -69,6 +141,7 @@ int main()
     
     // remove test files
     std::remove("recovery_test.sdb");
+    std::remove("recovery_test.sdb.bloom");
     std::remove("recovery_test.wal");
     
     std::cout << "Recovery tests passed" << std::endl;
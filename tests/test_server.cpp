@@ -0,0 +1,209 @@
+#include"server.hpp"
+#include"storage.hpp"
+#include"wal.hpp"
+#include"lockmgr.hpp"
+#include<cassert>
+#include<chrono>
+#include<cstdio>
+#include<cstring>
+#include<iostream>
+#include<sys/socket.h>
+#include<sys/un.h>
+#include<thread>
+#include<unistd.h>
+#include<vector>
+
+using stonedb::Opcode;
+using stonedb::Status;
+
+static const char* SOCKET_PATH="test_server.sock";
+
+//frames survive a round trip and partial input asks for more
+static void testCodec()
+{
+    std::string frame;
+    stonedb::encodeRequest(frame, Opcode::PUT, 7, "key", "value");
+    stonedb::Request request;
+    size_t consumed=0;
+    auto data=reinterpret_cast<const uint8_t*>(frame.data());
+    for(size_t size=0; size<frame.size(); size++)
+    {
+        assert(stonedb::decodeRequest(data, size, consumed, request) == stonedb::DecodeResult::NEED_MORE);
+    }
+    assert(stonedb::decodeRequest(data, frame.size(), consumed, request) == stonedb::DecodeResult::OK);
+    assert(consumed == frame.size());
+    assert(request.op == Opcode::PUT && request.id == 7 && request.key == "key" && request.value == "value");
+
+    //a key longer than the body and an unknown opcode are both malformed
+    std::string bad=frame;
+    bad[9]=static_cast<char>(200);
+    assert(stonedb::decodeRequest(reinterpret_cast<const uint8_t*>(bad.data()), bad.size(), consumed, request) == stonedb::DecodeResult::BAD);
+    bad=frame;
+    bad[4]=42;
+    assert(stonedb::decodeRequest(reinterpret_cast<const uint8_t*>(bad.data()), bad.size(), consumed, request) == stonedb::DecodeResult::BAD);
+
+    std::string reply;
+    stonedb::encodeResponse(reply, Status::NOT_FOUND, 9, "");
+    stonedb::Response response;
+    assert(stonedb::decodeResponse(reinterpret_cast<const uint8_t*>(reply.data()), reply.size(), consumed, response) == stonedb::DecodeResult::OK);
+    assert(response.status == Status::NOT_FOUND && response.id == 9 && response.value.empty());
+}
+
+static void testServer(stonedb::TransactionManager& txnMgr)
+{
+    stonedb::ServerOptions options;
+    options.workers=4;
+    options.maxBatch=8;
+    stonedb::Server server(txnMgr, options);
+    assert(server.start(SOCKET_PATH));
+    //a second server must not take over a live socket
+    stonedb::Server other(txnMgr, options);
+    assert(!other.start(SOCKET_PATH));
+
+    //single requests
+    stonedb::StoneClient client;
+    assert(client.connect(SOCKET_PATH));
+    stonedb::Response response;
+    assert(client.call(Opcode::PING, "", "", response) && response.status == Status::OK);
+    assert(client.call(Opcode::PUT, "alpha", "one", response) && response.status == Status::OK);
+    assert(client.call(Opcode::GET, "alpha", "", response) && response.status == Status::OK && response.value == "one");
+    assert(client.call(Opcode::GET, "missing", "", response) && response.status == Status::NOT_FOUND);
+    assert(client.call(Opcode::PUT, "", "x", response) && response.status == Status::BAD_REQUEST);
+    assert(client.call(Opcode::DEL, "alpha", "", response) && response.status == Status::OK);
+    assert(client.call(Opcode::GET, "alpha", "", response) && response.status == Status::NOT_FOUND);
+    assert(client.call(Opcode::STATS, "", "", response) && response.status == Status::OK);
+    assert(response.value.find("\"put_operations\"") != std::string::npos);
+
+    //pipelined requests on one connection run in order: every get sees the put before it
+    const int pipelined=1000;
+    std::vector<uint32_t> ids;
+    for(int i=0; i<pipelined; i++)
+    {
+        std::string key="p" + std::to_string(i % 10);
+        ids.push_back(client.send(Opcode::PUT, key, std::to_string(i)));
+        ids.push_back(client.send(Opcode::GET, key));
+    }
+    assert(client.flush());
+    for(int i=0; i<pipelined; i++)
+    {
+        assert(client.receive(response) && response.id == ids[2 * i] && response.status == Status::OK);
+        assert(client.receive(response) && response.id == ids[2 * i + 1] && response.status == Status::OK);
+        assert(response.value == std::to_string(i));
+    }
+
+    //concurrent connections, each writing its own keys
+    const int numClients=8;
+    const int perClient=500;
+    std::vector<std::thread> threads;
+    for(int c=0; c<numClients; c++)
+    {
+        threads.emplace_back([c]()
+        {
+            stonedb::StoneClient local;
+            assert(local.connect(SOCKET_PATH));
+            for(int i=0; i<perClient; i++) local.send(Opcode::PUT, "c" + std::to_string(c) + "_" + std::to_string(i), std::to_string(i));
+            assert(local.flush());
+            stonedb::Response reply;
+            for(int i=0; i<perClient; i++) assert(local.receive(reply) && reply.status == Status::OK);
+        });
+    }
+    for(auto& thread : threads) thread.join();
+    for(int c=0; c<numClients; c++)
+    {
+        assert(client.call(Opcode::GET, "c" + std::to_string(c) + "_" + std::to_string(perClient - 1), "", response));
+        assert(response.status == Status::OK && response.value == std::to_string(perClient - 1));
+    }
+
+    //a half-closed connection still gets the answers to what it sent
+    {
+        std::string frames;
+        stonedb::encodeRequest(frames, Opcode::PUT, 1, "half", "closed");
+        stonedb::encodeRequest(frames, Opcode::GET, 2, "half", "");
+        int fd=socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un addr{};
+        addr.sun_family=AF_UNIX;
+        strcpy(addr.sun_path, SOCKET_PATH);
+        assert(connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0);
+        assert(write(fd, frames.data(), frames.size()) == static_cast<ssize_t>(frames.size()));
+        shutdown(fd, SHUT_WR);
+        std::string received;
+        char buf[256];
+        ssize_t n;
+        while((n=read(fd, buf, sizeof(buf))) > 0) received.append(buf, n);
+        close(fd);
+        size_t consumed=0;
+        auto data=reinterpret_cast<const uint8_t*>(received.data());
+        assert(stonedb::decodeResponse(data, received.size(), consumed, response) == stonedb::DecodeResult::OK);
+        assert(response.id == 1 && response.status == Status::OK);
+        assert(stonedb::decodeResponse(data + consumed, received.size() - consumed, consumed, response) == stonedb::DecodeResult::OK);
+        assert(response.id == 2 && response.value == "closed");
+    }
+
+    //garbage closes that connection only
+    {
+        int fd=socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un addr{};
+        addr.sun_family=AF_UNIX;
+        strcpy(addr.sun_path, SOCKET_PATH);
+        assert(connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0);
+        const char garbage[16]={'\xff', '\xff', '\xff', '\xff'};
+        assert(write(fd, garbage, sizeof(garbage)) == sizeof(garbage));
+        char buf[16];
+        assert(read(fd, buf, sizeof(buf)) == 0);
+        close(fd);
+    }
+    assert(client.call(Opcode::PING, "", "", response) && response.status == Status::OK);
+
+    server.stop();
+    assert(access(SOCKET_PATH, F_OK) != 0);
+    assert(!client.call(Opcode::PING, "", "", response));
+}
+
+//pipelining against one request per round trip
+static void benchmark(stonedb::TransactionManager& txnMgr)
+{
+    stonedb::Server server(txnMgr);
+    assert(server.start(SOCKET_PATH));
+    stonedb::StoneClient client;
+    assert(client.connect(SOCKET_PATH));
+    stonedb::Response response;
+    const int requests=20000;
+    for(size_t pipeline : {1, 16, 128})
+    {
+        auto start=std::chrono::steady_clock::now();
+        for(int done=0; done<requests; done += pipeline)
+        {
+            for(size_t i=0; i<pipeline; i++) client.send(Opcode::GET, "bench");
+            assert(client.flush());
+            for(size_t i=0; i<pipeline; i++) assert(client.receive(response));
+        }
+        double seconds=std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "pipeline " << pipeline << ": " << static_cast<uint64_t>(requests / seconds) << " gets/sec" << std::endl;
+    }
+    server.stop();
+}
+
+int main()
+{
+    std::cout << "Testing server..." << std::endl;
+    stonedb::setLogLevel(stonedb::LogLevel::ERROR);
+    std::remove("test_server.sdb");
+    std::remove("test_server.wal");
+    auto storage=std::make_shared<stonedb::StorageManager>();
+    auto wal=std::make_shared<stonedb::WALManager>();
+    auto lockMgr=std::make_shared<stonedb::LockManager>();
+    assert(storage->open("test_server.sdb"));
+    assert(wal->open("test_server.wal"));
+    {
+        stonedb::TransactionManager txnMgr(storage, wal, lockMgr);
+        testCodec();
+        testServer(txnMgr);
+        benchmark(txnMgr);
+    }
+    storage->close();
+    wal->close();
+    std::remove("test_server.sdb");
+    std::remove("test_server.wal");
+    std::cout << "Server tests passed!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,258 @@
+#include"shard.hpp"
+#include<atomic>
+#include<cassert>
+#include<chrono>
+#include<csignal>
+#include<filesystem>
+#include<iostream>
+#include<map>
+#include<thread>
+#include<sys/resource.h>
+
+static const char* DIR="test_shard.db";
+
+static std::map<std::string, std::string> contents(stonedb::ShardedEngine& engine)
+{
+    std::map<std::string, std::string> out;
+    assert(engine.forEachRecord([&](std::string_view key, std::string_view value)
+    {
+        assert(out.emplace(std::string(key), std::string(value)).second);
+        return true;
+    }));
+    return out;
+}
+
+//same placement as ShardedEngine::shardOf
+static size_t shardOf(const std::string& key, size_t shards)
+{
+    return static_cast<size_t>(((stonedb::hashKey(key) >> 32) * shards) >> 32);
+}
+
+static std::string keyOnShard(size_t shard, size_t shards, const std::string& prefix)
+{
+    for(int i=0;; i++)
+    {
+        std::string key=prefix + std::to_string(i);
+        if(shardOf(key, shards) == shard) return key;
+    }
+}
+
+//single-key operations and batches route to the owning shard and survive a reopen
+static void testBasics(stonedb::EngineType type)
+{
+    std::filesystem::remove_all(DIR);
+    stonedb::ShardOptions opts;
+    opts.shards=4;
+    opts.engine=type;
+    std::map<std::string, std::string> expected;
+    {
+        stonedb::ShardedEngine engine;
+        assert(engine.open(DIR, opts) && engine.shardCount() == 4);
+        for(int i=0; i<500; i++)
+        {
+            std::string key="key" + std::to_string(i);
+            expected[key]="value" + std::to_string(i);
+            assert(engine.putRecord(key, expected[key]));
+        }
+        std::string value;
+        assert(engine.getRecord("key42", value) && value == "value42");
+        assert(engine.deleteRecord("key42") && !engine.getRecord("key42", value));
+        assert(!engine.deleteRecord("key42"));
+        expected.erase("key42");
+
+        //a batch over every shard commits as a whole
+        std::vector<stonedb::ShardWrite> batch;
+        for(int i=0; i<20; i++) batch.push_back({"batch" + std::to_string(i), "b", false});
+        batch.push_back({"key7", "", true});
+        batch.push_back({"missing", "", true});
+        assert(engine.commit(batch));
+        for(int i=0; i<20; i++) expected["batch" + std::to_string(i)]="b";
+        expected.erase("key7");
+
+        //one bad write rejects the batch before anything is logged
+        batch.push_back({"big", std::string(stonedb::MAX_VALUE_SIZE + 1, 'x'), false});
+        batch[0].value="changed";
+        assert(!engine.commit(batch));
+        assert(contents(engine) == expected);
+    }
+    stonedb::ShardedEngine engine;
+    //placement depends on the shard count, so it is fixed
+    opts.shards=3;
+    assert(!engine.open(DIR, opts));
+    opts.shards=0;
+    assert(engine.open(DIR, opts) && engine.shardCount() == 4);
+    assert(contents(engine) == expected);
+    engine.close();
+    std::filesystem::remove_all(DIR);
+}
+
+//a crash between the votes and the last COMMIT: open() asks the
+//coordinator's log how each prepared transaction ended
+static void testInDoubt()
+{
+    std::filesystem::remove_all(DIR);
+    stonedb::ShardOptions opts;
+    opts.shards=2;
+    {
+        stonedb::ShardedEngine engine;
+        assert(engine.open(DIR, opts));
+    }
+    std::string committedKey=keyOnShard(1, 2, "decided");
+    std::string abortedKey=keyOnShard(1, 2, "undecided");
+    std::string coordinatorKey=keyOnShard(0, 2, "coordinator");
+    {
+        //the coordinator (shard 0) decided transaction 1001 but not 1003
+        stonedb::WALManager wal;
+        assert(wal.open(std::string(DIR) + "/shard-000.wal"));
+        assert(wal.logBeginTxn(1001) && wal.logPutRecord(1001, coordinatorKey, "c") && wal.logPrepareTxn(1001, "0"));
+        assert(wal.logCommitTxn(1001));
+        assert(wal.logBeginTxn(1003) && wal.logPrepareTxn(1003, "0"));
+        wal.close();
+    }
+    {
+        //shard 1 voted for both and heard of neither decision
+        stonedb::WALManager wal;
+        assert(wal.open(std::string(DIR) + "/shard-001.wal"));
+        assert(wal.logBeginTxn(1001) && wal.logPutRecord(1001, committedKey, "yes") && wal.logPrepareTxn(1001, "0"));
+        assert(wal.logBeginTxn(1003) && wal.logPutRecord(1003, abortedKey, "no") && wal.logPrepareTxn(1003, "0"));
+        std::vector<stonedb::LogEntry> inDoubt;
+        std::unordered_set<stonedb::TransactionId> committed;
+        assert(wal.preparedTransactions(inDoubt, committed) && inDoubt.size() == 2 && committed.empty());
+        wal.close();
+    }
+    stonedb::ShardedEngine engine;
+    assert(engine.open(DIR, opts));
+    std::string value;
+    assert(engine.getRecord(committedKey, value) && value == "yes");
+    assert(engine.getRecord(coordinatorKey, value) && value == "c");
+    assert(!engine.getRecord(abortedKey, value));
+    engine.close();
+    std::filesystem::remove_all(DIR);
+}
+
+//a participant that cannot log the COMMIT it was sent stays prepared;
+//checkpoint() must not truncate the coordinator's decision under it
+static void testUndeliveredCommit()
+{
+    std::filesystem::remove_all(DIR);
+    stonedb::ShardOptions opts;
+    opts.shards=2;
+    std::string coordinatorKey=keyOnShard(0, 2, "first");
+    std::string participantKey=keyOnShard(1, 2, "second");
+    std::string coordinatorWal=std::string(DIR) + "/shard-000.wal";
+    std::string participantWal=std::string(DIR) + "/shard-001.wal";
+    rlimit saved;
+    assert(getrlimit(RLIMIT_FSIZE, &saved) == 0);
+    std::signal(SIGXFSZ, SIG_IGN);
+    {
+        stonedb::ShardedEngine engine;
+        assert(engine.open(DIR, opts));
+        //rewrites of one key grow the participant's log well past the
+        //coordinator's and every data file
+        for(int i=0; i<300; i++) assert(engine.putRecord(participantKey, std::string(2000, 'p')));
+        //the same batch twice logs the same bytes: cut the second one's
+        //COMMIT on the participant short by one byte
+        std::vector<stonedb::ShardWrite> batch{{coordinatorKey, "c", false}, {participantKey, "d", false}};
+        uintmax_t before=std::filesystem::file_size(participantWal);
+        assert(engine.commit(batch));
+        uintmax_t after=std::filesystem::file_size(participantWal);
+        assert(std::filesystem::file_size(coordinatorWal) + 4096 < after);
+        rlimit limited=saved;
+        limited.rlim_cur=after + (after - before) - 1;
+        assert(setrlimit(RLIMIT_FSIZE, &limited) == 0);
+        batch[0].value="committed";
+        batch[1].value="committed";
+        assert(engine.commit(batch));
+        std::string value;
+        assert(engine.getRecord(coordinatorKey, value) && value == "committed");
+        assert(engine.getRecord(participantKey, value) && value == "d");
+        assert(!engine.checkpoint());
+        assert(setrlimit(RLIMIT_FSIZE, &saved) == 0);
+        engine.close();
+    }
+    std::signal(SIGXFSZ, SIG_DFL);
+    stonedb::ShardedEngine engine;
+    assert(engine.open(DIR, opts));
+    std::string value;
+    assert(engine.getRecord(participantKey, value) && value == "committed");
+    engine.close();
+    std::filesystem::remove_all(DIR);
+}
+
+//client threads writing through one shard against several
+static double throughput(size_t shards, size_t threads, int opsPerThread)
+{
+    std::filesystem::remove_all(DIR);
+    stonedb::ShardOptions opts;
+    opts.shards=shards;
+    stonedb::ShardedEngine engine;
+    assert(engine.open(DIR, opts));
+    auto start=std::chrono::steady_clock::now();
+    std::vector<std::thread> clients;
+    for(size_t t=0; t<threads; t++)
+    {
+        clients.emplace_back([&, t]
+        {
+            for(int i=0; i<opsPerThread; i++)
+            {
+                assert(engine.putRecord("t" + std::to_string(t) + "k" + std::to_string(i), std::string(100, 'v')));
+            }
+        });
+    }
+    for(auto& client : clients) client.join();
+    double seconds=std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    assert(contents(engine).size() == threads * opsPerThread);
+    engine.close();
+    std::filesystem::remove_all(DIR);
+    return threads * opsPerThread / seconds;
+}
+
+//cross-shard batches from many threads stay atomic: each batch writes the
+//same value under keys on different shards
+static void testConcurrentCommits()
+{
+    std::filesystem::remove_all(DIR);
+    stonedb::ShardOptions opts;
+    opts.shards=4;
+    stonedb::ShardedEngine engine;
+    assert(engine.open(DIR, opts));
+    std::atomic<int> committed{0};
+    std::vector<std::thread> clients;
+    for(int t=0; t<4; t++)
+    {
+        clients.emplace_back([&, t]
+        {
+            for(int i=0; i<50; i++)
+            {
+                std::vector<stonedb::ShardWrite> batch;
+                for(int k=0; k<8; k++) batch.push_back({"shared" + std::to_string(k), std::to_string(t * 1000 + i), false});
+                //a batch colliding with another one's prepared keys is refused
+                if(engine.commit(batch)) committed++;
+            }
+        });
+    }
+    for(auto& client : clients) client.join();
+    assert(committed > 0);
+    auto records=contents(engine);
+    assert(records.size() == 8);
+    for(const auto& record : records) assert(record.second == records.begin()->second);
+    engine.close();
+    std::filesystem::remove_all(DIR);
+}
+
+int main()
+{
+    std::cout << "Testing sharded engine..." << std::endl;
+    stonedb::setLogLevel(stonedb::LogLevel::ERROR);
+    testBasics(stonedb::EngineType::PAGE);
+    testBasics(stonedb::EngineType::LSM);
+    testInDoubt();
+    testUndeliveredCommit();
+    testConcurrentCommits();
+    double one=throughput(1, 4, 250);
+    double four=throughput(4, 4, 250);
+    std::cout << "  4 clients: " << static_cast<int>(one) << " puts/sec on 1 shard, " << static_cast<int>(four)
+              << " on 4 shards (" << std::max(1U, std::thread::hardware_concurrency()) << " cpus)" << std::endl;
+    std::cout << "Sharded engine tests passed!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,139 @@
+#include"storage.hpp"
+#include<atomic>
+#include<cassert>
+#include<chrono>
+#include<cstdio>
+#include<iostream>
+#include<map>
+#include<thread>
+
+static const char* DB_PATH="test_snapshot.sdb";
+
+static void cleanup()
+{
+    std::remove(DB_PATH);
+    std::remove((std::string(DB_PATH) + ".bloom").c_str());
+    std::remove((std::string(DB_PATH) + ".changes").c_str());
+}
+
+static std::map<std::string, std::string> readSnapshot(stonedb::StorageManager& storage,
+                                                       const stonedb::PageSnapshot& snapshot)
+{
+    std::map<std::string, std::string> out;
+    assert(storage.forEachRecord(snapshot, [&](std::string_view key, std::string_view value)
+    {
+        //every record is seen once
+        assert(out.emplace(std::string(key), std::string(value)).second);
+        return true;
+    }));
+    return out;
+}
+
+static std::map<std::string, std::string> contents(stonedb::StorageManager& storage)
+{
+    std::map<std::string, std::string> out;
+    for(const auto& record : storage.scanRecords()) out[record.key]=record.value;
+    return out;
+}
+
+//a snapshot keeps reading the records it was taken with through overwrites,
+//deletes, inserts that fill new pages and, in the hash layout, bucket splits
+static void testPointInTime(stonedb::StorageLayout layout, stonedb::PageFormat format)
+{
+    cleanup();
+    stonedb::StorageOptions opts;
+    opts.layout=layout;
+    opts.pageFormat=format;
+    opts.cacheFrames=32;
+    stonedb::StorageManager storage;
+    assert(storage.open(DB_PATH, opts));
+    std::map<std::string, std::string> before;
+    for(int i=0; i<2000; i++)
+    {
+        std::string key="key" + std::to_string(i);
+        before[key]=std::string(50, 'a');
+        assert(storage.putRecord(key, before[key]));
+    }
+
+    auto snapshot=storage.createSnapshot();
+    assert(snapshot && storage.snapshotImages() == 0);
+    for(int i=0; i<2000; i+=2) assert(storage.putRecord("key" + std::to_string(i), std::string(80, 'b')));
+    for(int i=1; i<2000; i+=4) assert(storage.deleteRecord("key" + std::to_string(i)));
+    for(int i=0; i<3000; i++) assert(storage.putRecord("new" + std::to_string(i), "fresh"));
+    assert(storage.snapshotImages() > 0);
+
+    auto after=contents(storage);
+    assert(after.size() == 2000 - 500 + 3000 && after["key0"] == std::string(80, 'b'));
+    assert(readSnapshot(storage, *snapshot) == before);
+
+    //a second snapshot sees the second state, and both share the images
+    //changed after both were taken
+    auto second=storage.createSnapshot();
+    for(int i=0; i<3000; i++) assert(storage.deleteRecord("new" + std::to_string(i)));
+    assert(readSnapshot(storage, *snapshot) == before);
+    assert(readSnapshot(storage, *second) == after);
+
+    storage.releaseSnapshot(snapshot);
+    storage.releaseSnapshot(second);
+    assert(storage.snapshotImages() == 0);
+    assert(contents(storage).size() == 1500);
+    storage.close();
+}
+
+//writers keep going while a slow reader walks a snapshot
+static void testWritersProceed()
+{
+    cleanup();
+    stonedb::StorageManager storage;
+    assert(storage.open(DB_PATH));
+    for(int i=0; i<1000; i++) assert(storage.putRecord("key" + std::to_string(i), "old"));
+
+    auto snapshot=storage.createSnapshot();
+    std::atomic<bool> started(false);
+    std::atomic<int> writes(0);
+    std::thread writer([&]
+    {
+        while(!started) std::this_thread::yield();
+        for(int i=0; i<1000; i++)
+        {
+            assert(storage.putRecord("key" + std::to_string(i), "new"));
+            writes++;
+        }
+    });
+    size_t seen=0;
+    int writesDuringScan=0;
+    assert(storage.forEachRecord(*snapshot, [&](std::string_view, std::string_view value)
+    {
+        assert(value == "old");
+        if(seen++ == 0)
+        {
+            started=true;
+            //the reader sits on its first record until the writer has finished
+            auto deadline=std::chrono::steady_clock::now() + std::chrono::seconds(30);
+            while(writes < 1000 && std::chrono::steady_clock::now() < deadline) std::this_thread::yield();
+            writesDuringScan=writes;
+        }
+        return true;
+    }));
+    writer.join();
+    assert(seen == 1000 && writesDuringScan == 1000);
+    storage.releaseSnapshot(snapshot);
+
+    std::string value;
+    assert(storage.getRecord("key999", value) && value == "new");
+    storage.close();
+    cleanup();
+}
+
+int main()
+{
+    std::cout << "Testing snapshots..." << std::endl;
+    stonedb::setLogLevel(stonedb::LogLevel::ERROR);
+    testPointInTime(stonedb::StorageLayout::HEAP, stonedb::PageFormat::RECORDS);
+    testPointInTime(stonedb::StorageLayout::HEAP, stonedb::PageFormat::SLOTTED);
+    testPointInTime(stonedb::StorageLayout::HASH, stonedb::PageFormat::SLOTTED);
+    testWritersProceed();
+    cleanup();
+    std::cout << "Snapshot tests passed!" << std::endl;
+    return 0;
+}
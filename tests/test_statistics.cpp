@@ -0,0 +1,246 @@
+#include"statistics.hpp"
+#include"transaction.hpp"
+#include"storage.hpp"
+#include"wal.hpp"
+#include"lockmgr.hpp"
+#include<cassert>
+#include<chrono>
+#include<cstdio>
+#include<iostream>
+#include<random>
+#include<thread>
+#include<vector>
+
+using stonedb::LatencyHistogram;
+using stonedb::LatencyOp;
+
+//every value lands in a bucket whose bounds hold it, at most 1/16 wide
+static void testBuckets()
+{
+    std::mt19937_64 rng(7);
+    for(int i=0; i<100000; i++)
+    {
+        uint64_t v=rng() >> (rng() % 64);
+        size_t bucket=LatencyHistogram::bucketFor(v);
+        assert(bucket < LatencyHistogram::BUCKETS);
+        if(v >= (uint64_t(1) << LatencyHistogram::MAX_EXPONENT)) continue;
+        uint64_t upper=LatencyHistogram::bucketUpperBound(bucket);
+        uint64_t lower=bucket == 0 ? 0 : LatencyHistogram::bucketUpperBound(bucket - 1) + 1;
+        assert(lower <= v && v <= upper);
+        assert(upper - lower <= v / LatencyHistogram::SUB_BUCKETS);
+    }
+    for(uint64_t v=0; v<16; v++) assert(LatencyHistogram::bucketUpperBound(LatencyHistogram::bucketFor(v)) == v);
+}
+
+//percentiles of a known distribution come back within bucket precision
+static void testPercentiles()
+{
+    stonedb::Statistics stats;
+    for(uint64_t v=1; v<=100000; v++) stats.recordLatency(LatencyOp::GET, v * 10);
+    stonedb::HistogramSnapshot h=stats.latency(LatencyOp::GET);
+    assert(h.count == 100000);
+    assert(h.max == 1000000);
+    auto near=[](uint64_t got, uint64_t want) { return got >= want && got <= want + want / 16; };
+    assert(near(h.percentile(50), 500000));
+    assert(near(h.percentile(99), 990000));
+    assert(near(h.percentile(99.9), 999000));
+    assert(h.percentile(100) == 1000000);
+    assert(h.mean() > 500000 && h.mean() < 500010);
+    assert(stats.latency(LatencyOp::PUT).count == 0);
+    assert(stats.latency(LatencyOp::PUT).percentile(99) == 0);
+    stats.reset();
+    assert(stats.latency(LatencyOp::GET).count == 0);
+}
+
+//shards from many threads add up exactly
+static void testShardedCounters()
+{
+    stonedb::Statistics stats;
+    const int numThreads=8;
+    const int perThread=100000;
+    std::vector<std::thread> threads;
+    for(int t=0; t<numThreads; t++)
+    {
+        threads.emplace_back([&stats]()
+        {
+            for(int i=0; i<perThread; i++)
+            {
+                stats.incrementPutOps();
+                stats.recordLatency(LatencyOp::PUT, i);
+            }
+        });
+    }
+    for(auto& thread : threads) thread.join();
+    assert(stats.getPutOps() == uint64_t(numThreads) * perThread);
+    assert(stats.latency(LatencyOp::PUT).count == uint64_t(numThreads) * perThread);
+    assert(stats.latency(LatencyOp::PUT).max == perThread - 1);
+    assert(stats.getGetOps() == 0);
+}
+
+//the engine records into the global instance
+static void testInstrumentation()
+{
+    std::remove("test_stats.sdb");
+    std::remove("test_stats.wal");
+    stonedb::Statistics& stats=stonedb::Statistics::global();
+    stats.reset();
+    {
+        auto storage=std::make_shared<stonedb::StorageManager>();
+        auto wal=std::make_shared<stonedb::WALManager>();
+        auto lockMgr=std::make_shared<stonedb::LockManager>();
+        assert(storage->open("test_stats.sdb"));
+        assert(wal->open("test_stats.wal"));
+        stonedb::TransactionManager txnMgr(storage, wal, lockMgr);
+
+        auto txnId=txnMgr.beginTransaction();
+        assert(txnMgr.putRecord(txnId, "a", "1"));
+        assert(txnMgr.putRecord(txnId, "b", "2"));
+        std::string value;
+        assert(txnMgr.getRecord(txnId, "a", value));
+        assert(txnMgr.deleteRecord(txnId, "b"));
+        assert(txnMgr.commitTransaction(txnId));
+
+        //a second writer blocks on the first one's exclusive lock
+        auto holder=txnMgr.beginTransaction();
+        assert(txnMgr.putRecord(holder, "a", "3"));
+        std::thread waiter([&txnMgr]()
+        {
+            auto txn=txnMgr.beginTransaction();
+            assert(txnMgr.putRecord(txn, "a", "4"));
+            assert(txnMgr.commitTransaction(txn));
+        });
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        assert(txnMgr.commitTransaction(holder));
+        waiter.join();
+
+        storage->close();
+        wal->close();
+    }
+    assert(stats.getTransactionCount() == 3);
+    assert(stats.getPutOps() == 4);
+    assert(stats.getGetOps() == 1);
+    assert(stats.getDeleteOps() == 1);
+    assert(stats.latency(LatencyOp::PUT).count == 4);
+    assert(stats.latency(LatencyOp::GET).count == 1);
+    assert(stats.latency(LatencyOp::DELETE).count == 1);
+    assert(stats.latency(LatencyOp::COMMIT).count == 3);
+    assert(stats.latency(LatencyOp::WAL_SYNC).count > 0);
+    assert(stats.latency(LatencyOp::PAGE_WRITE).count > 0);
+    assert(stats.getCacheHits() + stats.getCacheMisses() > 0);
+    assert(stats.getLockWaits() == 1);
+    stonedb::HistogramSnapshot wait=stats.latency(LatencyOp::LOCK_WAIT);
+    assert(wait.count == 1 && wait.max >= 40000000);
+
+    std::string json=stats.toJson();
+    for(const char* key : {"\"transactions\":3", "\"put_operations\":4", "\"lock_waits\":1", "\"commit\":{\"count\":3",
+                           "\"wal_sync\":", "\"page_read\":", "\"p50\":", "\"p99\":", "\"p999\":", "\"max\":"})
+    {
+        assert(json.find(key) != std::string::npos);
+    }
+    assert(json.front() == '{' && json.back() == '}');
+    std::remove("test_stats.sdb");
+    std::remove("test_stats.wal");
+}
+
+//bytes, calls and syncs per file, and write amplification against client bytes
+static void testIoAccounting()
+{
+    stonedb::Statistics local;
+    local.recordWrite(stonedb::IoFile::DATA, 4096);
+    local.recordWrite(stonedb::IoFile::DATA, 4096);
+    local.recordFlush(stonedb::IoFile::DATA);
+    local.recordRead(stonedb::IoFile::WAL, 100);
+    local.recordSync(stonedb::IoFile::WAL, 2000);
+    stonedb::IoSnapshot data=local.io(stonedb::IoFile::DATA);
+    assert(data.writes == 2 && data.bytesWritten == 8192 && data.flushes == 1 && data.syncs == 0);
+    stonedb::IoSnapshot wal=local.io(stonedb::IoFile::WAL);
+    assert(wal.reads == 1 && wal.bytesRead == 100 && wal.syncs == 1 && wal.syncLatency.max == 2000);
+    assert(local.writeAmplification() == 0.0);
+    local.recordLogicalWrite(1024);
+    assert(local.writeAmplification() == 8.0);
+    local.reset();
+    assert(local.io(stonedb::IoFile::DATA).bytesWritten == 0 && local.getLogicalBytes() == 0);
+
+    std::remove("test_stats_io.sdb");
+    std::remove("test_stats_io.wal");
+    stonedb::Statistics& stats=stonedb::Statistics::global();
+    stats.reset();
+    const int records=100;
+    const std::string value(100, 'v');
+    {
+        auto storage=std::make_shared<stonedb::StorageManager>();
+        auto wal=std::make_shared<stonedb::WALManager>();
+        auto lockMgr=std::make_shared<stonedb::LockManager>();
+        assert(storage->open("test_stats_io.sdb"));
+        assert(wal->open("test_stats_io.wal"));
+        stonedb::TransactionManager txnMgr(storage, wal, lockMgr);
+        auto txnId=txnMgr.beginTransaction();
+        for(int i=0; i<records; i++) assert(txnMgr.putRecord(txnId, "key" + std::to_string(1000 + i), value));
+        assert(txnMgr.commitTransaction(txnId));
+        storage->close();
+        wal->close();
+    }
+    uint64_t logical=records * (7 + value.size());
+    assert(stats.getLogicalBytes() == logical);
+    stonedb::IoSnapshot walIo=stats.io(stonedb::IoFile::WAL);
+    stonedb::IoSnapshot dataIo=stats.io(stonedb::IoFile::DATA);
+    //every record is framed in the log, so the WAL alone writes more than the client did
+    assert(walIo.bytesWritten > logical);
+    assert(walIo.syncs >= 1 && walIo.syncLatency.count == walIo.syncs);
+    assert(dataIo.writes > 0 && dataIo.bytesWritten >= stonedb::PAGE_SIZE);
+    assert(dataIo.flushes > 0);
+    assert(stats.writeAmplification() > 1.0);
+    std::string json=stats.toJson();
+    for(const char* key : {"\"io\":{\"data\":{", "\"wal\":{\"reads\":", "\"bytes_written\":", "\"syncs\":",
+                           "\"sync_p99_ns\":", "\"logical_bytes_written\":" , "\"write_amplification\":"})
+    {
+        assert(json.find(key) != std::string::npos);
+    }
+    std::cout << "one commit of " << records << " x " << value.size() << "-byte values: wal " << walIo.bytesWritten
+              << " bytes in " << walIo.writes << " writes, " << walIo.syncs << " syncs; data " << dataIo.bytesWritten
+              << " bytes in " << dataIo.writes << " writes; write amplification " << stats.writeAmplification() << std::endl;
+    std::remove("test_stats_io.sdb");
+    std::remove("test_stats_io.wal");
+}
+
+//cost of one timed operation, and sharded counters against one shared atomic
+static void benchmark()
+{
+    const int calls=1000000;
+    stonedb::Statistics& stats=stonedb::Statistics::global();
+    auto start=std::chrono::steady_clock::now();
+    for(int i=0; i<calls; i++)
+    {
+        stonedb::ScopedLatency timer(LatencyOp::GET);
+    }
+    auto end=std::chrono::steady_clock::now();
+    double timedNs=std::chrono::duration<double, std::nano>(end - start).count() / calls;
+
+    const int numThreads=4;
+    std::atomic<uint64_t> shared{0};
+    auto run=[&](auto body)
+    {
+        auto begin=std::chrono::steady_clock::now();
+        std::vector<std::thread> threads;
+        for(int t=0; t<numThreads; t++) threads.emplace_back([&]() { for(int i=0; i<calls; i++) body(); });
+        for(auto& thread : threads) thread.join();
+        return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count() / calls;
+    };
+    double sharedNs=run([&]() { shared.fetch_add(1, std::memory_order_relaxed); });
+    double shardedNs=run([&]() { stats.incrementGetOps(); });
+    std::cout << "ScopedLatency: " << timedNs << " ns per timed operation; " << numThreads
+              << " threads counting: shared atomic " << sharedNs << " ns, sharded " << shardedNs << " ns per round" << std::endl;
+}
+
+int main()
+{
+    std::cout << "Testing statistics..." << std::endl;
+    testBuckets();
+    testPercentiles();
+    testShardedCounters();
+    testInstrumentation();
+    testIoAccounting();
+    benchmark();
+    std::cout << "Statistics tests passed!" << std::endl;
+    return 0;
+}
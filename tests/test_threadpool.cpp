@@ -0,0 +1,195 @@
+#include"threadpool.hpp"
+#include"storage.hpp"
+#include<atomic>
+#include<cassert>
+#include<chrono>
+#include<filesystem>
+#include<iostream>
+#include<map>
+#include<set>
+
+static const char* DB_PATH="test_threadpool.sdb";
+
+//every index is visited exactly once, whatever the grain
+static void testParallelFor()
+{
+    stonedb::ThreadPool pool(4);
+    assert(pool.workerCount() == 4);
+    for(size_t grain : {1, 7, 64, 1000, 5000})
+    {
+        std::vector<std::atomic<int>> hits(3000);
+        pool.parallelFor(hits.size(), grain, [&](size_t begin, size_t end)
+        {
+            assert(begin < end && end <= hits.size() && end - begin <= grain);
+            for(size_t i=begin; i<end; i++) hits[i]++;
+        });
+        for(const auto& hit : hits) assert(hit == 1);
+    }
+    pool.parallelFor(0, 8, [](size_t, size_t) { assert(false); });
+}
+
+//tasks that split themselves further finish on a small pool
+static void testNested()
+{
+    stonedb::ThreadPool pool(2);
+    std::atomic<uint64_t> sum(0);
+    pool.parallelFor(16, 1, [&](size_t outer, size_t)
+    {
+        pool.parallelFor(100, 10, [&](size_t begin, size_t end)
+        {
+            for(size_t i=begin; i<end; i++) sum += outer * 100 + i;
+        });
+    });
+    assert(sum == 1600 * 1599 / 2);
+}
+
+//tasks queued by one worker land on its deque; idle workers steal them
+static void testStealing()
+{
+    stonedb::ThreadPool pool(4);
+    std::mutex idsMutex;
+    std::set<std::thread::id> ids;
+    std::atomic<bool> done(false);
+    pool.submit([&]
+    {
+        stonedb::TaskGroup group(pool);
+        for(int i=0; i<16; i++)
+        {
+            group.run([&]
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+                std::lock_guard<std::mutex> lock(idsMutex);
+                ids.insert(std::this_thread::get_id());
+            });
+        }
+        group.wait();
+        done=true;
+    });
+    while(!done) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    assert(ids.size() > 1);
+}
+
+//a waiter holding a lock only runs its own group's tasks, never one that
+//needs the lock
+static void testWaitUnderLock()
+{
+    stonedb::ThreadPool pool(1);
+    std::mutex mutex;
+    std::atomic<int> locked(0);
+    std::unique_lock<std::mutex> hold(mutex);
+    //the only worker may be blocked in one of these
+    stonedb::TaskGroup others(pool);
+    for(int i=0; i<4; i++)
+    {
+        others.run([&]
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            locked++;
+        });
+    }
+    std::atomic<int> ranges(0);
+    pool.parallelFor(8, 1, [&](size_t, size_t) { ranges++; });
+    assert(ranges == 8);
+    hold.unlock();
+    others.wait();
+    assert(locked == 4);
+}
+
+//the destructor runs what is still queued
+static void testShutdown()
+{
+    std::atomic<int> ran(0);
+    {
+        stonedb::ThreadPool pool(3);
+        for(int i=0; i<200; i++) pool.submit([&] { ran++; });
+    }
+    assert(ran == 200);
+}
+
+static void removeFiles()
+{
+    for(const char* suffix : {"", ".pagemap", ".bloom", ".changes"})
+    {
+        std::filesystem::remove(std::string(DB_PATH) + suffix);
+    }
+}
+
+static std::map<std::string, std::string> contents(stonedb::StorageManager& storage)
+{
+    std::map<std::string, std::string> out;
+    for(const auto& record : storage.scanRecords()) assert(out.emplace(record.key, record.value).second);
+    return out;
+}
+
+//flushes of many dirty pages, the startup parse and scans split into page
+//ranges give the same store as the single-threaded paths
+static void testStorage(stonedb::StorageLayout layout, stonedb::PageCompression compression)
+{
+    removeFiles();
+    stonedb::StorageOptions opts;
+    opts.layout=layout;
+    opts.compression=compression;
+    opts.cacheFrames=2000;
+    opts.workerThreads=4;
+    std::map<std::string, std::string> expected;
+    {
+        stonedb::StorageManager storage;
+        assert(storage.open(DB_PATH, opts));
+        for(int i=0; i<3000; i++)
+        {
+            std::string key="key" + std::to_string(i);
+            expected[key]=std::string(200, static_cast<char>('a' + i % 26));
+            assert(storage.putRecord(key, expected[key]));
+        }
+        //rewritten keys move between pages; the later copy must win on reopen
+        for(int i=0; i<3000; i+=7)
+        {
+            std::string key="key" + std::to_string(i);
+            expected[key]=std::string(900, 'z');
+            assert(storage.putRecord(key, expected[key]));
+        }
+        for(int i=1; i<3000; i+=11)
+        {
+            std::string key="key" + std::to_string(i);
+            expected.erase(key);
+            assert(storage.deleteRecord(key));
+        }
+        assert(storage.flushAll());
+        assert(contents(storage) == expected);
+        storage.close();
+    }
+    for(size_t threads : {1, 4, 0})
+    {
+        opts.workerThreads=threads;
+        //without a saved filter open() rebuilds it from every page
+        std::filesystem::remove(std::string(DB_PATH) + ".bloom");
+        stonedb::StorageManager storage;
+        assert(storage.open(DB_PATH, opts));
+        assert(contents(storage) == expected);
+        for(const auto& entry : expected)
+        {
+            std::string value;
+            assert(storage.getRecord(entry.first, value) && value == entry.second);
+        }
+        std::string value;
+        assert(!storage.getRecord("key1", value));
+        storage.close();
+    }
+    removeFiles();
+}
+
+int main()
+{
+    std::cout << "Testing thread pool..." << std::endl;
+    stonedb::setLogLevel(stonedb::LogLevel::ERROR);
+    testParallelFor();
+    testNested();
+    testStealing();
+    testWaitUnderLock();
+    testShutdown();
+    testStorage(stonedb::StorageLayout::HEAP, stonedb::PageCompression::NONE);
+    testStorage(stonedb::StorageLayout::HEAP, stonedb::PageCompression::LZ);
+    testStorage(stonedb::StorageLayout::HASH, stonedb::PageCompression::NONE);
+    std::cout << "Thread pool tests passed!" << std::endl;
+    return 0;
+}
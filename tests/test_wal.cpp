@@ -1,34 +1,234 @@
 #include"wal.hpp"
 #include<cassert>
+#include<cstring>
+#include<filesystem>
 #include<iostream>
 
+static uintmax_t fileSize(const char* path)
+{
+    return std::filesystem::file_size(path);
+}
+
+static void appendBytes(const char* path, const std::string& bytes)
+{
+    std::ofstream out(path, std::ios::binary | std::ios::app);
+    out.write(bytes.data(), bytes.size());
+}
+
+//record framing, checksums and LSNs
+static void testFormat()
+{
+    //standard CRC-32C check value
+    assert(stonedb::crc32c("123456789", 9) == 0xe3069283U);
+    assert(stonedb::crc32c("", 0) == 0);
+
+    std::remove("wal_format.wal");
+    {
+        stonedb::WALManager wal;
+        assert(wal.open("wal_format.wal"));
+        assert(wal.endLsn() == 0);
+        assert(wal.logBeginTxn(1));
+        stonedb::Lsn afterBegin=wal.endLsn();
+        assert(afterBegin > 0);
+        assert(wal.logPutRecord(1, "key1", "value1"));
+        //frame header, four one-byte varints, key and value
+        assert(wal.endLsn() - afterBegin == 8 + 4 + 4 + 6);
+        assert(wal.logCommitTxn(1));
+        assert(wal.logBeginTxn(2));
+        assert(wal.logDeleteRecord(2, "key1"));
+        assert(wal.logCommitTxn(2));
+        assert(wal.logBeginTxn(3));
+        assert(wal.logPutRecord(3, "key3", std::string(100000, 'v')));
+        assert(wal.logCommitTxn(3));
+
+        auto entries=wal.replayLog();
+        assert(entries.size() == 3);
+        assert(entries[0].type == stonedb::LogType::PUT_RECORD && entries[0].key == "key1" && entries[0].value == "value1");
+        assert(entries[1].type == stonedb::LogType::DELETE_RECORD && entries[1].key == "key1");
+        assert(entries[2].value.size() == 100000);
+        assert(entries[0].lsn == afterBegin);
+        assert(entries[0].lsn < entries[1].lsn && entries[1].lsn < entries[2].lsn);
+        assert(fileSize("wal_format.wal") == 32 + wal.endLsn());
+
+        //truncation keeps LSNs growing
+        stonedb::Lsn end=wal.endLsn();
+        assert(wal.truncateLog());
+        assert(wal.endLsn() == end);
+        assert(wal.logBeginTxn(4));
+        assert(wal.logPutRecord(4, "key4", "value4"));
+        assert(wal.logCommitTxn(4));
+        entries=wal.replayLog();
+        assert(entries.size() == 1 && entries[0].lsn > end);
+        wal.close();
+    }
+    std::remove("wal_format.wal");
+}
+
+//a torn tail is cut on open, a corrupt record ends replay
+static void testCorruption()
+{
+    std::remove("wal_torn.wal");
+    stonedb::Lsn intactEnd;
+    {
+        stonedb::WALManager wal;
+        assert(wal.open("wal_torn.wal"));
+        assert(wal.logBeginTxn(1));
+        assert(wal.logPutRecord(1, "a", "1"));
+        assert(wal.logCommitTxn(1));
+        intactEnd=wal.endLsn();
+        wal.close();
+    }
+    //half a record, as left by a crash mid-write
+    appendBytes("wal_torn.wal", std::string("\x12\x34\x56\x78\x40\x00\x00\x00partial", 15));
+    {
+        stonedb::WALManager wal;
+        assert(wal.open("wal_torn.wal"));
+        assert(wal.endLsn() == intactEnd);
+        assert(fileSize("wal_torn.wal") == 32 + intactEnd);
+        assert(wal.replayLog().size() == 1);
+        assert(wal.logBeginTxn(2));
+        assert(wal.logPutRecord(2, "b", "2"));
+        assert(wal.logCommitTxn(2));
+        assert(wal.replayLog().size() == 2);
+        wal.close();
+    }
+    //flip a byte inside the second transaction's put
+    {
+        std::fstream file("wal_torn.wal", std::ios::in | std::ios::out | std::ios::binary);
+        file.seekp(32 + intactEnd + 14);
+        file.put('X');
+    }
+    {
+        stonedb::WALManager wal;
+        assert(wal.open("wal_torn.wal"));
+        assert(wal.endLsn() < 32 + intactEnd + 14);
+        auto entries=wal.replayLog();
+        assert(entries.size() == 1 && entries[0].key == "a");
+        wal.close();
+    }
+    std::remove("wal_torn.wal");
+}
+
+//streaming replay over interleaved transactions
+static void testStreaming()
+{
+    std::remove("wal_stream.wal");
+    stonedb::WALManager wal;
+    assert(wal.open("wal_stream.wal"));
+    assert(wal.logBeginTxn(1));
+    assert(wal.logBeginTxn(2));
+    assert(wal.logPutRecord(1, "a", "1"));
+    assert(wal.logPutRecord(2, "b", "2"));
+    assert(wal.logBeginTxn(3));
+    assert(wal.logPutRecord(3, "c", "3"));
+    assert(wal.logAbortTxn(3));
+    assert(wal.logDeleteRecord(2, "a"));
+    assert(wal.logCommitTxn(2));
+    assert(wal.logBeginTxn(4));
+    assert(wal.logPutRecord(4, "d", "4"));
+    assert(wal.logCommitTxn(1));
+
+    //aborted and still-open transactions are skipped, the rest come in log order
+    std::vector<std::string> seen;
+    stonedb::Lsn last=0;
+    assert(wal.replayLog([&](const stonedb::LogEntry& entry)
+    {
+        assert(seen.empty() || entry.lsn > last);
+        last=entry.lsn;
+        seen.push_back(entry.key + (entry.type == stonedb::LogType::DELETE_RECORD ? "-" : "=" + entry.value));
+        return true;
+    }));
+    assert((seen == std::vector<std::string>{"a=1", "b=2", "a-"}));
+
+    //a failing apply stops the replay
+    int calls=0;
+    assert(!wal.replayLog([&](const stonedb::LogEntry&) { return ++calls < 2; }));
+    assert(calls == 2);
+    wal.close();
+    assert(!wal.replayLog([](const stonedb::LogEntry&) { return true; }));
+    std::remove("wal_stream.wal");
+}
+
+//an id reused after a restart: each BEGIN starts its own outcome, so a
+//later abort or an unfinished run does not drop earlier committed work
+static void testReusedIds()
+{
+    std::remove("wal_reuse.wal");
+    stonedb::WALManager wal;
+    assert(wal.open("wal_reuse.wal"));
+    assert(wal.logBeginTxn(1) && wal.logPutRecord(1, "a", "1") && wal.logCommitTxn(1));
+    assert(wal.logBeginTxn(1) && wal.logPutRecord(1, "b", "2") && wal.logAbortTxn(1));
+    assert(wal.logBeginTxn(2) && wal.logPutRecord(2, "c", "3"));
+    //a crash left 2 open; the next run reuses it
+    assert(wal.logBeginTxn(2) && wal.logPutRecord(2, "d", "4") && wal.logCommitTxn(2));
+    assert(wal.logBeginTxn(1) && wal.logPutRecord(1, "e", "5"));
+    std::vector<std::string> seen;
+    assert(wal.replayLog([&](const stonedb::LogEntry& entry)
+    {
+        seen.push_back(entry.key + "=" + entry.value);
+        return true;
+    }));
+    assert((seen == std::vector<std::string>{"a=1", "d=4"}));
+    wal.close();
+    std::remove("wal_reuse.wal");
+}
+
+//logs written before the v2 format
+static void testLegacy()
+{
+    std::remove("wal_legacy.wal");
+    appendBytes("wal_legacy.wal", std::string(32, '\0'));
+    {
+        stonedb::WALManager wal;
+        assert(wal.open("wal_legacy.wal"));
+        assert(wal.logBeginTxn(1));
+        wal.close();
+    }
+    std::remove("wal_legacy.wal");
+    appendBytes("wal_legacy.wal", std::string(32, '\0') + std::string(24, '\1'));
+    {
+        stonedb::WALManager wal;
+        assert(!wal.open("wal_legacy.wal"));
+        assert(!wal.isOpen());
+    }
+    assert(fileSize("wal_legacy.wal") == 56);
+    std::remove("wal_legacy.wal");
+}
+
 int main()
 {
+    std::remove("test.wal");
     stonedb::WALManager wal;
-    
+
     // test basic operations
     assert(wal.open("test.wal"));
     assert(wal.isOpen());
-    
+
     // test transaction logging
     stonedb::TransactionId txn1=1;
     assert(wal.logBeginTxn(txn1));
     assert(wal.logPutRecord(txn1, "key1", "value1"));
     assert(wal.logPutRecord(txn1, "key2", "value2"));
     assert(wal.logCommitTxn(txn1));
-    
+
     // test abort
     stonedb::TransactionId txn2=2;
     assert(wal.logBeginTxn(txn2));
     assert(wal.logPutRecord(txn2, "key3", "value3"));
     assert(wal.logAbortTxn(txn2));
-    
+
     // test replay
     auto entries=wal.replayLog();
     std::cout << "Found " << entries.size() << " committed operations" << std::endl;
-    
-    // for now, just check that we can replay without crashing
+    assert(entries.size() == 2);
+
     wal.close();
+
+    testFormat();
+    testCorruption();
+    testStreaming();
+    testReusedIds();
+    testLegacy();
     stonedb::log("wal tests passed");
     return 0;
 }